@@ -19,8 +19,8 @@ class material;
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
-    double t;
+    const material* mat_ptr;  // Owned by the hittable that was hit
+    real t;
     bool front_face;
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -32,7 +32,7 @@ struct hit_record {
 
 class hittable {
     public:
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
 };
 
 #endif
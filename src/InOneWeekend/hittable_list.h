@@ -27,14 +27,14 @@ class hittable_list: public hittable  {
         void clear() { objects.clear(); }
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
 
     public:
         std::vector<shared_ptr<hittable>> objects;
 };
 
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     hit_record temp_rec;
     auto hit_anything = false;
     auto closest_so_far = t_max;
@@ -11,14 +11,20 @@
 
 #include "rtweekend.h"
 
+#include "adaptive_sampler.h"
 #include "camera.h"
 #include "color.h"
+#include "framebuffer.h"
 #include "hittable_list.h"
+#include "image_output.h"
 #include "material.h"
+#include "options.h"
+#include "progressive.h"
+#include "renderer.h"
 #include "sphere.h"
 
 #include <iostream>
-#include <omp.h>
+#include <string>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "external/stb_image_write.h"
@@ -30,7 +36,9 @@ color ray_color(const ray& r, const hittable& world, int depth) {
 	// If we've exceeded the ray bounce limit, no more light is gathered.
 	if (depth <= 0)
 		return color(0, 0, 0);
+	start_bounce(depth);
 
+	RTW_STAT(stat_path_rays);
 	if (world.hit(r, 0.001, infinity, rec)) {
 		ray scattered;
 		color attenuation;
@@ -45,6 +53,38 @@ color ray_color(const ray& r, const hittable& world, int depth) {
 }
 
 
+color ray_color_iterative(ray r, const hittable& world, int max_depth, int rr_depth) {
+	// Same estimate as ray_color, but walks the path in a loop, carrying the product of the
+	// attenuations so far, and plays Russian roulette from bounce rr_depth on.
+	color throughput(1, 1, 1);
+
+	for (int depth = 0; depth < max_depth; ++depth) {
+		hit_record rec;
+		start_bounce(depth);
+
+		RTW_STAT(stat_path_rays);
+		if (!world.hit(r, 0.001, infinity, rec)) {
+			vec3 unit_direction = unit_vector(r.direction());
+			auto t = 0.5 * (unit_direction.y() + 1.0);
+			return throughput * ((1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0));
+		}
+
+		ray scattered;
+		color attenuation;
+		if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+			break;
+
+		throughput = throughput * attenuation;
+		r = scattered;
+
+		if (depth + 1 >= rr_depth && !russian_roulette(throughput))
+			break;
+	}
+
+	return color(0, 0, 0);
+}
+
+
 hittable_list random_scene() {
 	hittable_list world;
 
@@ -93,21 +133,40 @@ hittable_list random_scene() {
 	return world;
 }
 
-int main(int argc, char** argv) {
-	const auto aspect_ratio = 16.0 / 9.0;
-	const int image_width = 1366;
-	const int image_height = static_cast<int>(image_width / aspect_ratio);
-	const int n = 4;
-	const int samples_per_pixel = 100;
-	const int max_depth = 50;
-	const int buffer_size = image_height * image_width * n;
-	unsigned char* buffer = new unsigned char[buffer_size];
-	omp_lock_t m_lock;
-	omp_init_lock(&m_lock);
+int main(int argc, char* argv[]) {
+	render_options options;
+	options.image_width = 1366;
+	options.samples_per_pixel = 100;
+	options.max_depth = 50;
+	options.scenes = { "random_scene" };
+	options.scene = "random_scene";
+	options.output = "test.png";
+	if (!options.parse(argc, argv))
+		return 1;
+
+	const auto aspect_ratio = options.image_height > 0
+		? double(options.image_width) / options.image_height : 16.0 / 9.0;
+	const int image_width = options.image_width;
+	const int image_height = options.image_height > 0
+		? options.image_height : static_cast<int>(image_width / aspect_ratio);
+	const int samples_per_pixel = options.samples_per_pixel;
+	const int max_depth = options.max_depth;
+	const bool iterative = options.integrator == "iterative";
+	const int rr_depth = options.rr_depth;
+	const bool adaptive = options.adaptive;
+	const bool progressive = options.progressive;
+	const int node = options.node;
+	const int node_count = options.node_count;
+
+	if (options.threads > 0)
+		omp_set_num_threads(options.threads);
+	active_sample_sequence() = options.sequence();
 
 	// std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
 
+	RTW_STAT_TIMER(scene_timer, stat_scene_build);
 	auto world = random_scene();
+	RTW_STAT_STOP(scene_timer);
 
 	point3 lookfrom(13, 2, 3);
 	point3 lookat(0, 0, 0);
@@ -117,28 +176,73 @@ int main(int argc, char** argv) {
 
 	camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
 
-	for (int j = 0; j < image_height; j++) {
-		std::cerr << "\rLines: " <<  j << ':' << image_height << std::flush;
-#pragma omp parallel for
-		for (int i = 0; i < image_width; i++) {
-			color pixel_color;
-			for (int s = 0; s < samples_per_pixel; ++s) {
-				auto u = (i + random_double()) / (image_width - 1);
-				auto v = (j + random_double()) / (image_height - 1);
-				ray r = cam.get_ray(u, v);		
-				pixel_color += ray_color(r, world, max_depth);
-			}
-			omp_set_lock(&m_lock);
-			buffer[n * image_width * j + i * n + 0] = convert(pixel_color.x(), samples_per_pixel);
-			buffer[n * image_width * j + i * n + 1] = convert(pixel_color.y(), samples_per_pixel);
-			buffer[n * image_width * j + i * n + 2] = convert(pixel_color.z(), samples_per_pixel);
-			buffer[n * image_width * j + i * n + 3] = 255;
-			omp_unset_lock(&m_lock);
+	const auto share = node_samples(node, node_count, samples_per_pixel);
+	adaptive_sampler sampler(adaptive ? 32 : share.count, share.count, options.threshold);
+	framebuffer image(image_width, image_height);
+
+	auto sample = [&](int i, int j, int s) -> color {
+		start_sample(i, j, image_width, s);
+		real du, dv;
+		sample_2d(du, dv);
+		auto u = (i + du) / (image_width - 1);
+		auto v = (j + dv) / (image_height - 1);
+		ray r = cam.get_ray(u, v);
+		return iterative
+			? ray_color_iterative(r, world, max_depth, rr_depth)
+			: ray_color(r, world, max_depth);
+	};
+
+	auto write_image = [&](const framebuffer& fb) {
+		RTW_STAT_TIMER(timer, stat_encode);
+		if (!make_image_output(options.output, image_width, image_height)->finish(fb))
+			std::cerr << "\nCould not write " << options.output << '\n';
+	};
+
+	// Unless the render is progressive, tiles stream into the image as they finish, so only
+	// completing the file waits for the frame. A share of a distributed render is saved as raw
+	// sums and counts for rtw_merge instead.
+	std::unique_ptr<image_output> output;
+	if (node_count == 1 && !progressive)
+		output = make_image_output(options.output, image_width, image_height);
+
+	auto write_output = [&](const framebuffer& fb) {
+		RTW_STAT_TIMER(timer, stat_encode);
+		if (output) {
+			if (!output->finish(fb))
+				std::cerr << "\nCould not write " << options.output << '\n';
+		} else if (!fb.write_checkpoint(options.output_with(".node" + std::to_string(node) + ".fb"))) {
+			std::cerr << "\nCould not write the sample buffer\n";
 		}
+	};
+
+	tile_renderer renderer(image_width, image_height, options.tile_size);
+	RTW_STAT_TIMER(render_timer, stat_render);
+	if (progressive && node_count == 1) {
+		// Rerunning after an interruption resumes from the checkpoint.
+		progressive_renderer passes(renderer, samples_per_pixel);
+		passes.checkpoint_every(
+			options.checkpoint_seconds, 0, options.output_with(".ckpt"), write_image);
+		passes.render(image, sample);
+		RTW_STAT_STOP(render_timer);
+	} else {
+		renderer.render([&](const tile& t) {
+			sampler.sample_tile(t, sample, image, share.first);
+			if (output)
+				output->write_tile(image, t);
+		});
+		RTW_STAT_STOP(render_timer);
+		write_output(image);
+	}
+
+	if (adaptive && !progressive && node_count == 1) {
+		RTW_STAT_TIMER(timer, stat_encode);
+		auto heatmap = image.sample_heatmap_rgba8(share.count);
+		stbi_write_png(options.output_with("_samples.png").c_str(),
+			image_width, image_height, 4, heatmap.data(), image_width * 4);
+		std::cerr << "\nAverage samples per pixel: "
+			<< double(image.total_samples()) / (image_width * image_height);
 	}
 
-	stbi_write_png("test.png", image_width, image_height, n, buffer, image_width * n);
-	delete[] buffer;
-	omp_destroy_lock(&m_lock);
+	RTW_STAT_REPORT(std::cerr);
 	std::cerr << "\nDone.\n";
 }
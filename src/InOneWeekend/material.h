@@ -17,7 +17,7 @@
 struct hit_record;
 
 
-double schlick(double cosine, double ref_idx) {
+real schlick(real cosine, real ref_idx) {
     auto r0 = (1-ref_idx) / (1+ref_idx);
     r0 = r0*r0;
     return r0 + (1-r0)*pow((1 - cosine),5);
@@ -34,25 +34,25 @@ class material  {
 
 class dielectric : public material {
     public:
-        dielectric(double ri) : ref_idx(ri) {}
+        dielectric(real ri) : ref_idx(ri) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const {
             attenuation = color(1.0, 1.0, 1.0);
-            double etai_over_etat = (rec.front_face) ? (1.0 / ref_idx) : (ref_idx);
+            real etai_over_etat = (rec.front_face) ? (1.0 / ref_idx) : (ref_idx);
 
             vec3 unit_direction = unit_vector(r_in.direction());
-            double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+            real cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+            real sin_theta = sqrt(1.0 - cos_theta*cos_theta);
             if (etai_over_etat * sin_theta > 1.0 ) {
                 vec3 reflected = reflect(unit_direction, rec.normal);
                 scattered = ray(rec.p, reflected);
                 return true;
             }
 
-            double reflect_prob = schlick(cos_theta, etai_over_etat);
-            if (random_double() < reflect_prob)
+            real reflect_prob = schlick(cos_theta, etai_over_etat);
+            if (sample_1d() < reflect_prob)
             {
                 vec3 reflected = reflect(unit_direction, rec.normal);
                 scattered = ray(rec.p, reflected);
@@ -65,7 +65,7 @@ class dielectric : public material {
         }
 
     public:
-        double ref_idx;
+        real ref_idx;
 };
 
 
@@ -76,7 +76,7 @@ class lambertian : public material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const  {
-            vec3 scatter_direction = rec.normal + random_unit_vector();
+            vec3 scatter_direction = rec.normal + sample_unit_vector();
             scattered = ray(rec.p, scatter_direction);
             attenuation = albedo;
             return true;
@@ -89,20 +89,20 @@ class lambertian : public material {
 
 class metal : public material {
     public:
-        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+        metal(const color& a, real f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const  {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+            scattered = ray(rec.p, reflected + fuzz*sample_in_unit_sphere());
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
 
     public:
         color albedo;
-        double fuzz;
+        real fuzz;
 };
 
 
@@ -20,19 +20,20 @@ class sphere: public hittable  {
     public:
         sphere() {}
 
-        sphere(point3 cen, double r, shared_ptr<material> m)
+        sphere(point3 cen, real r, shared_ptr<material> m)
             : center(cen), radius(r), mat_ptr(m) {};
 
-        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
 
     public:
         point3 center;
-        double radius;
+        real radius;
         shared_ptr<material> mat_ptr;
 };
 
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    RTW_STAT(stat_primitive_tests);
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -48,7 +49,7 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
             rec.p = r.at(rec.t);
             vec3 outward_normal = (rec.p - center) / radius;
             rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.mat_ptr = mat_ptr.get();
             return true;
         }
 
@@ -58,7 +59,7 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
             rec.p = r.at(rec.t);
             vec3 outward_normal = (rec.p - center) / radius;
             rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.mat_ptr = mat_ptr.get();
             return true;
         }
     }
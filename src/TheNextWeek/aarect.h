@@ -21,12 +21,14 @@ class xy_rect: public hittable {
         xy_rect() {}
 
         xy_rect(
-            double _x0, double _x1, double _y0, double _y1, double _k, shared_ptr<material> mat
+            real _x0, real _x1, real _y0, real _y1, real _k, shared_ptr<material> mat
         ) : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
-        virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+        virtual bool hit(const ray& r, real t0, real t1, hit_record& rec) const;
+        virtual void surface(const ray& r, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t0, real t1) const;
 
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
             // The bounding box must have non-zero width in each dimension, so pad the Z
             // dimension a small amount.
             output_box = aabb(point3(x0,y0, k-0.0001), point3(x1, y1, k+0.0001));
@@ -35,7 +37,7 @@ class xy_rect: public hittable {
 
     public:
         shared_ptr<material> mp;
-        double x0, x1, y0, y1, k;
+        real x0, x1, y0, y1, k;
 };
 
 class xz_rect: public hittable {
@@ -43,12 +45,14 @@ class xz_rect: public hittable {
         xz_rect() {}
 
         xz_rect(
-            double _x0, double _x1, double _z0, double _z1, double _k, shared_ptr<material> mat
+            real _x0, real _x1, real _z0, real _z1, real _k, shared_ptr<material> mat
         ) : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
-        virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+        virtual bool hit(const ray& r, real t0, real t1, hit_record& rec) const;
+        virtual void surface(const ray& r, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t0, real t1) const;
 
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
             // The bounding box must have non-zero width in each dimension, so pad the Y
             // dimension a small amount.
             output_box = aabb(point3(x0,k-0.0001,z0), point3(x1, k+0.0001, z1));
@@ -57,7 +61,7 @@ class xz_rect: public hittable {
 
     public:
         shared_ptr<material> mp;
-        double x0, x1, z0, z1, k;
+        real x0, x1, z0, z1, k;
 };
 
 class yz_rect: public hittable {
@@ -65,12 +69,14 @@ class yz_rect: public hittable {
         yz_rect() {}
 
         yz_rect(
-            double _y0, double _y1, double _z0, double _z1, double _k, shared_ptr<material> mat
+            real _y0, real _y1, real _z0, real _z1, real _k, shared_ptr<material> mat
         ) : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
-        virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+        virtual bool hit(const ray& r, real t0, real t1, hit_record& rec) const;
+        virtual void surface(const ray& r, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t0, real t1) const;
 
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
             // The bounding box must have non-zero width in each dimension, so pad the X
             // dimension a small amount.
             output_box = aabb(point3(k-0.0001, y0, z0), point3(k+0.0001, y1, z1));
@@ -79,10 +85,11 @@ class yz_rect: public hittable {
 
     public:
         shared_ptr<material> mp;
-        double y0, y1, z0, z1, k;
+        real y0, y1, z0, z1, k;
 };
 
-bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+bool xy_rect::hit(const ray& r, real t0, real t1, hit_record& rec) const {
+    RTW_STAT(stat_primitive_tests);
     auto t = (k-r.origin().z()) / r.direction().z();
     if (t < t0 || t > t1)
         return false;
@@ -92,18 +99,28 @@ bool xy_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
 
+    rec.t = t;
+    rec.object = this;
+    rec.pending = true;
+
+    return true;
+}
+
+void xy_rect::surface(const ray& r, hit_record& rec) const {
+    auto x = r.origin().x() + rec.t*r.direction().x();
+    auto y = r.origin().y() + rec.t*r.direction().y();
+
     rec.u = (x-x0)/(x1-x0);
     rec.v = (y-y0)/(y1-y0);
-    rec.t = t;
+    rec.set_footprint(r, sqrt((x1-x0)*(y1-y0)));
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
 }
 
-bool xz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+bool xz_rect::hit(const ray& r, real t0, real t1, hit_record& rec) const {
+    RTW_STAT(stat_primitive_tests);
     auto t = (k-r.origin().y()) / r.direction().y();
     if (t < t0 || t > t1)
         return false;
@@ -113,18 +130,28 @@ bool xz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     if (x < x0 || x > x1 || z < z0 || z > z1)
         return false;
 
+    rec.t = t;
+    rec.object = this;
+    rec.pending = true;
+
+    return true;
+}
+
+void xz_rect::surface(const ray& r, hit_record& rec) const {
+    auto x = r.origin().x() + rec.t*r.direction().x();
+    auto z = r.origin().z() + rec.t*r.direction().z();
+
     rec.u = (x-x0)/(x1-x0);
     rec.v = (z-z0)/(z1-z0);
-    rec.t = t;
+    rec.set_footprint(r, sqrt((x1-x0)*(z1-z0)));
     auto outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
-
-    return true;
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
 }
 
-bool yz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
+bool yz_rect::hit(const ray& r, real t0, real t1, hit_record& rec) const {
+    RTW_STAT(stat_primitive_tests);
     auto t = (k-r.origin().x()) / r.direction().x();
     if (t < t0 || t > t1)
         return false;
@@ -134,15 +161,57 @@ bool yz_rect::hit(const ray& r, double t0, double t1, hit_record& rec) const {
     if (y < y0 || y > y1 || z < z0 || z > z1)
         return false;
 
+    rec.t = t;
+    rec.object = this;
+    rec.pending = true;
+
+    return true;
+}
+
+void yz_rect::surface(const ray& r, hit_record& rec) const {
+    auto y = r.origin().y() + rec.t*r.direction().y();
+    auto z = r.origin().z() + rec.t*r.direction().z();
+
     rec.u = (y-y0)/(y1-y0);
     rec.v = (z-z0)/(z1-z0);
-    rec.t = t;
+    rec.set_footprint(r, sqrt((y1-y0)*(z1-z0)));
     auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
-    rec.p = r.at(t);
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
+}
 
-    return true;
+bool xy_rect::occluded(const ray& r, real t0, real t1) const {
+    RTW_STAT(stat_primitive_tests);
+    auto t = (k-r.origin().z()) / r.direction().z();
+    if (t < t0 || t > t1)
+        return false;
+
+    auto x = r.origin().x() + t*r.direction().x();
+    auto y = r.origin().y() + t*r.direction().y();
+    return !(x < x0 || x > x1 || y < y0 || y > y1);
+}
+
+bool xz_rect::occluded(const ray& r, real t0, real t1) const {
+    RTW_STAT(stat_primitive_tests);
+    auto t = (k-r.origin().y()) / r.direction().y();
+    if (t < t0 || t > t1)
+        return false;
+
+    auto x = r.origin().x() + t*r.direction().x();
+    auto z = r.origin().z() + t*r.direction().z();
+    return !(x < x0 || x > x1 || z < z0 || z > z1);
+}
+
+bool yz_rect::occluded(const ray& r, real t0, real t1) const {
+    RTW_STAT(stat_primitive_tests);
+    auto t = (k-r.origin().x()) / r.direction().x();
+    if (t < t0 || t > t1)
+        return false;
+
+    auto y = r.origin().y() + t*r.direction().y();
+    auto z = r.origin().z() + t*r.direction().z();
+    return !(y < y0 || y > y1 || z < z0 || z > z1);
 }
 
 #endif
@@ -13,7 +13,11 @@
 
 #include "rtweekend.h"
 
+#include "bvh_builder.h"
+#include "bvh_wide.h"
 #include "hittable.h"
+#include "hittable_list.h"
+#include "shared_array.h"
 
 #include <algorithm>
 
@@ -22,16 +26,17 @@ class bvh_node : public hittable  {
     public:
         bvh_node();
 
-        bvh_node(hittable_list& list, double time0, double time1)
+        bvh_node(hittable_list& list, real time0, real time1)
             : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
         {}
 
         bvh_node(
             std::vector<shared_ptr<hittable>>& objects,
-            size_t start, size_t end, double time0, double time1);
+            size_t start, size_t end, real time0, real time1);
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const;
 
     public:
         shared_ptr<hittable> left;
@@ -66,8 +71,9 @@ bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b)
 
 bvh_node::bvh_node(
     std::vector<shared_ptr<hittable>>& objects,
-    size_t start, size_t end, double time0, double time1
+    size_t start, size_t end, real time0, real time1
 ) {
+    RTW_STAT_TIMER(timer, stat_bvh_build);
     int axis = random_int(0,2);
     auto comparator = (axis == 0) ? box_x_compare
                     : (axis == 1) ? box_y_compare
@@ -104,7 +110,8 @@ bvh_node::bvh_node(
 }
 
 
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    RTW_STAT(stat_bvh_nodes);
     if (!box.hit(r, t_min, t_max))
         return false;
 
@@ -115,10 +122,551 @@ bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
 }
 
 
-bool bvh_node::bounding_box(double t0, double t1, aabb& output_box) const {
+bool bvh_node::occluded(const ray& r, real t_min, real t_max) const {
+    RTW_STAT(stat_bvh_nodes);
+    if (!box.hit(r, t_min, t_max))
+        return false;
+
+    return left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max);
+}
+
+
+bool bvh_node::bounding_box(real t0, real t1, aabb& output_box) const {
     output_box = box;
     return true;
 }
 
 
+void accumulate_bvh_stats(const hittable& h, real root_area, int depth, bvh_stats& stats) {
+    // Walks a bvh_node tree with the same cost model as compute_bvh_stats(), treating every
+    // child that is not itself a bvh_node as a single-primitive leaf.
+    aabb box;
+    h.bounding_box(0, 1, box);
+    auto probability = root_area > 0 ? box.area() / root_area : 1.0;
+
+    stats.nodes++;
+    stats.max_depth = std::max(stats.max_depth, depth);
+
+    auto node = dynamic_cast<const bvh_node*>(&h);
+    if (!node) {
+        stats.leaves++;
+        stats.sah_cost += probability * bvh_intersection_cost;
+        return;
+    }
+
+    stats.sah_cost += probability * bvh_traversal_cost;
+    accumulate_bvh_stats(*node->left, root_area, depth + 1, stats);
+    if (node->right != node->left)
+        accumulate_bvh_stats(*node->right, root_area, depth + 1, stats);
+}
+
+
+bvh_stats compute_bvh_stats(const bvh_node& root) {
+    bvh_stats stats;
+    accumulate_bvh_stats(root, root.box.area(), 1, stats);
+    return stats;
+}
+
+
+class flat_bvh : public hittable {
+    // A BVH flattened into one array of compact nodes in depth-first order, traversed with a
+    // small explicit stack instead of a virtual call per node. Leaves still hold ordinary
+    // hittables, so any primitive (or another acceleration structure) can sit underneath.
+    public:
+        flat_bvh() {}
+
+        flat_bvh(
+            hittable_list& list, real time0, real time1,
+            const bvh_build_options& options = bvh_build_options())
+            : flat_bvh(list.objects, time0, time1, options)
+        {}
+
+        flat_bvh(
+            const std::vector<shared_ptr<hittable>>& objects, real time0, real time1,
+            const bvh_build_options& options = bvh_build_options());
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const;
+
+        virtual void hit_packet(
+            const ray* rays, int count, real t_min, real* t_max, hit_record* recs, bool* hits
+        ) const;
+
+        bvh_stats stats() const;
+
+    public:
+        std::vector<flat_bvh_node> nodes;
+        std::vector<shared_ptr<hittable>> primitives;  // In leaf order
+};
+
+
+flat_bvh::flat_bvh(
+    const std::vector<shared_ptr<hittable>>& objects, real time0, real time1,
+    const bvh_build_options& options
+) {
+    RTW_STAT_TIMER(timer, stat_bvh_build);
+
+    // Query every primitive's bounds exactly once; the builder works only from these.
+    const auto size = static_cast<int>(objects.size());
+    std::vector<aabb> boxes(size);
+    bool missing_box = false;
+
+    #pragma omp parallel for if(options.parallel) reduction(||:missing_box)
+    for (int i = 0; i < size; i++) {
+        if (!objects[i]->bounding_box(time0, time1, boxes[i]))
+            missing_box = true;
+    }
+
+    if (missing_box)
+        std::cerr << "No bounding box in flat_bvh constructor.\n";
+
+    std::vector<uint32_t> order;
+    bvh_builder(boxes, options).build(nodes, order);
+
+    primitives.reserve(order.size());
+    for (auto index : order)
+        primitives.push_back(objects[index]);
+}
+
+
+bool flat_bvh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    uint32_t stack[64];
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const auto& node = nodes[current];
+        RTW_STAT(stat_bvh_nodes);
+
+        if (node.hit(r, t_min, t_max)) {
+            if (node.is_leaf()) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    if (primitives[i]->hit(r, t_min, t_max, rec)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                }
+            } else {
+                // Descend into the child nearer to the ray origin first.
+                if (r.sign(node.axis)) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+
+bool flat_bvh::occluded(const ray& r, real t_min, real t_max) const {
+    // Same walk as hit(), but done at the first primitive that blocks the ray. Without a
+    // closest hit to shrink t_max, the order children are visited in doesn't matter.
+    if (nodes.empty())
+        return false;
+
+    uint32_t stack[64];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+        RTW_STAT(stat_bvh_nodes);
+
+        if (node.hit(r, t_min, t_max)) {
+            if (!node.is_leaf()) {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                if (primitives[i]->occluded(r, t_min, t_max))
+                    return true;
+            }
+        }
+
+        if (stack_size == 0)
+            return false;
+        current = stack[--stack_size];
+    }
+}
+
+
+// Rays traversed together by hit_packet; one bit per ray in a 32-bit activity mask.
+const int bvh_packet_size = 32;
+
+inline uint32_t packet_mask(int count) {
+    return count >= 32 ? 0xffffffffu : (1u << count) - 1;
+}
+
+
+void flat_bvh::hit_packet(
+    const ray* rays, int count, real t_min, real* t_max, hit_record* recs, bool* hits
+) const {
+    // Walks the tree once per packet. Each stack entry carries the rays still inside that
+    // subtree, so a node is fetched once for all of them and dropped when none remain.
+    if (nodes.empty())
+        return;
+
+    struct entry {
+        uint32_t index;
+        uint32_t active;  // Bit i set: ray i may still hit something below this node
+    };
+
+    hit_record temp_rec;
+
+    for (int base = 0; base < count; base += bvh_packet_size) {
+        const auto r = rays + base;
+        const auto t = t_max + base;
+        const int n = std::min(bvh_packet_size, count - base);
+
+        entry stack[128];
+        int stack_size = 0;
+        stack[stack_size++] = entry{0, packet_mask(n)};
+
+        while (stack_size > 0) {
+            const auto current = stack[--stack_size];
+            const auto& node = nodes[current.index];
+            RTW_STAT_ADD(stat_bvh_nodes, stat_popcount(current.active));
+
+            uint32_t active = 0;
+            for (int i = 0; i < n; i++) {
+                if ((current.active >> i & 1) && node.hit(r[i], t_min, t[i]))
+                    active |= 1u << i;
+            }
+
+            if (!active)
+                continue;
+
+            if (node.is_leaf()) {
+                for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+                    for (int i = 0; i < n; i++) {
+                        if ((active >> i & 1) && primitives[p]->hit(r[i], t_min, t[i], temp_rec)) {
+                            recs[base + i] = temp_rec;
+                            t[i] = temp_rec.t;
+                            hits[base + i] = true;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // Visit first the child nearer to the origin of the first active ray.
+            int lead = 0;
+            while (!(active >> lead & 1))
+                lead++;
+
+            if (r[lead].sign(node.axis)) {
+                stack[stack_size++] = entry{current.index + 1, active};
+                stack[stack_size++] = entry{node.offset, active};
+            } else {
+                stack[stack_size++] = entry{node.offset, active};
+                stack[stack_size++] = entry{current.index + 1, active};
+            }
+        }
+    }
+}
+
+
+bvh_stats flat_bvh::stats() const {
+    return compute_bvh_stats(nodes);
+}
+
+
+bool flat_bvh::bounding_box(real t0, real t1, aabb& output_box) const {
+    if (nodes.empty())
+        return false;
+
+    const auto& root = nodes[0];
+    output_box = aabb(
+        point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+        point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
+    return true;
+}
+
+
+template <int W>
+class wide_bvh : public hittable {
+    // A W-wide BVH, collapsed from the binary SAH tree, that tests all children of a node with
+    // one SIMD slab test (SSE for W=4, AVX for W=8) and visits hit children nearest first.
+    public:
+        wide_bvh() {}
+
+        wide_bvh(
+            hittable_list& list, real time0, real time1,
+            const bvh_build_options& options = bvh_build_options())
+            : wide_bvh(list.objects, time0, time1, options)
+        {}
+
+        wide_bvh(
+            const std::vector<shared_ptr<hittable>>& objects, real time0, real time1,
+            const bvh_build_options& options = bvh_build_options()
+        ) {
+            RTW_STAT_TIMER(timer, stat_bvh_build);
+            flat_bvh binary(objects, time0, time1, options);
+            std::vector<wide_bvh_node<W>> collapsed;
+            wide_bvh_collapser<W>(binary.nodes).collapse(collapsed);
+            nodes = shared_array<wide_bvh_node<W>>(std::move(collapsed));
+            primitives.swap(binary.primitives);
+            binary.bounding_box(time0, time1, box);
+        }
+
+        // A BVH built earlier, such as one read back from a scene cache: nodes over primitives
+        // that are already in leaf order. The nodes are used where they are, which may be a
+        // mapped file.
+        wide_bvh(
+            shared_array<wide_bvh_node<W>> nodes, std::vector<shared_ptr<hittable>> primitives,
+            const aabb& box)
+            : nodes(std::move(nodes)), primitives(std::move(primitives)), box(box)
+        {}
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
+            output_box = box;
+            return !nodes.empty();
+        }
+
+        virtual void hit_packet(
+            const ray* rays, int count, real t_min, real* t_max, hit_record* recs, bool* hits
+        ) const;
+
+    public:
+        shared_array<wide_bvh_node<W>> nodes;
+        std::vector<shared_ptr<hittable>> primitives;  // In leaf order
+        aabb box;
+};
+
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+
+template <int W>
+bool wide_bvh<W>::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    const wide_ray wr(r);
+
+    struct entry {
+        uint32_t index;  // Node index, or the first primitive of a leaf
+        uint32_t count;  // Leaf primitive count, or 0 for a node
+        float t_near;
+    };
+
+    entry stack[64 * W];
+    int stack_size = 0;
+    stack[stack_size++] = entry{0, 0, -std::numeric_limits<float>::infinity()};
+
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+        const auto current = stack[--stack_size];
+        if (current.t_near > t_max)
+            continue;
+
+        if (current.count > 0) {
+            for (auto i = current.index; i < current.index + current.count; i++) {
+                if (primitives[i]->hit(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            continue;
+        }
+
+        const auto& node = nodes[current.index];
+        RTW_STAT(stat_bvh_nodes);
+        float t_near[W];
+        auto mask = slab_test<W>(
+            node, wr, static_cast<float>(t_min), static_cast<float>(t_max), t_near);
+
+        // Gather the children that were hit, sorted farthest first, so that the nearest one
+        // ends up on top of the stack.
+        entry hits[W];
+        int hit_count = 0;
+        for (int c = 0; c < W; c++) {
+            if (!(mask & (1 << c)))
+                continue;
+
+            entry e{node.child[c], node.count[c], t_near[c]};
+            int k = hit_count++;
+            while (k > 0 && hits[k-1].t_near < e.t_near) {
+                hits[k] = hits[k-1];
+                k--;
+            }
+            hits[k] = e;
+        }
+
+        for (int k = 0; k < hit_count; k++)
+            stack[stack_size++] = hits[k];
+    }
+
+    return hit_anything;
+}
+
+
+template <int W>
+bool wide_bvh<W>::occluded(const ray& r, real t_min, real t_max) const {
+    // Same walk as hit(), but done at the first primitive that blocks the ray, so the children
+    // that were hit are pushed as they are, without sorting.
+    if (nodes.empty())
+        return false;
+
+    const wide_ray wr(r);
+
+    struct entry {
+        uint32_t index;  // Node index, or the first primitive of a leaf
+        uint32_t count;  // Leaf primitive count, or 0 for a node
+    };
+
+    entry stack[64 * W];
+    int stack_size = 0;
+    stack[stack_size++] = entry{0, 0};
+
+    while (stack_size > 0) {
+        const auto current = stack[--stack_size];
+
+        if (current.count > 0) {
+            for (auto i = current.index; i < current.index + current.count; i++) {
+                if (primitives[i]->occluded(r, t_min, t_max))
+                    return true;
+            }
+            continue;
+        }
+
+        const auto& node = nodes[current.index];
+        RTW_STAT(stat_bvh_nodes);
+        float t_near[W];
+        auto mask = slab_test<W>(
+            node, wr, static_cast<float>(t_min), static_cast<float>(t_max), t_near);
+
+        for (int c = 0; c < W; c++) {
+            if (mask & (1 << c))
+                stack[stack_size++] = entry{node.child[c], node.count[c]};
+        }
+    }
+
+    return false;
+}
+
+
+template <int W>
+void wide_bvh<W>::hit_packet(
+    const ray* rays, int count, real t_min, real* t_max, hit_record* recs, bool* hits
+) const {
+    // Packet version of hit(): every node is fetched once for all rays of a packet that are
+    // still inside it, and each child inherits only the rays whose slab test it passed.
+    if (nodes.empty())
+        return;
+
+    struct entry {
+        uint32_t index;   // Node index, or the first primitive of a leaf
+        uint32_t count;   // Leaf primitive count, or 0 for a node
+        uint32_t active;  // Bit i set: ray i entered this child
+    };
+
+    wide_ray wide_rays[bvh_packet_size];
+    hit_record temp_rec;
+
+    for (int base = 0; base < count; base += bvh_packet_size) {
+        const auto r = rays + base;
+        const auto t = t_max + base;
+        const int n = std::min(bvh_packet_size, count - base);
+
+        for (int i = 0; i < n; i++)
+            wide_rays[i] = wide_ray(r[i]);
+
+        entry stack[64 * W];
+        int stack_size = 0;
+        stack[stack_size++] = entry{0, 0, packet_mask(n)};
+
+        while (stack_size > 0) {
+            const auto current = stack[--stack_size];
+
+            if (current.count > 0) {
+                for (auto p = current.index; p < current.index + current.count; p++) {
+                    for (int i = 0; i < n; i++) {
+                        if (!(current.active >> i & 1))
+                            continue;
+                        if (primitives[p]->hit(r[i], t_min, t[i], temp_rec)) {
+                            recs[base + i] = temp_rec;
+                            t[i] = temp_rec.t;
+                            hits[base + i] = true;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            const auto& node = nodes[current.index];
+            RTW_STAT_ADD(stat_bvh_nodes, stat_popcount(current.active));
+            uint32_t child_active[W] = {};
+            float lead_t_near[W];
+            bool have_lead[W] = {};
+
+            for (int i = 0; i < n; i++) {
+                if (!(current.active >> i & 1))
+                    continue;
+
+                float t_near[W];
+                auto mask = slab_test<W>(
+                    node, wide_rays[i], static_cast<float>(t_min), static_cast<float>(t[i]),
+                    t_near);
+
+                for (int c = 0; c < W; c++) {
+                    if (!(mask & (1 << c)))
+                        continue;
+                    child_active[c] |= 1u << i;
+                    if (!have_lead[c]) {
+                        have_lead[c] = true;
+                        lead_t_near[c] = t_near[c];
+                    }
+                }
+            }
+
+            // Push the entered children farthest first, by the distance at which the first
+            // ray to enter each one did so.
+            entry entered[W];
+            float entered_t[W];
+            int entered_count = 0;
+            for (int c = 0; c < W; c++) {
+                if (!child_active[c])
+                    continue;
+
+                entry e{node.child[c], node.count[c], child_active[c]};
+                int k = entered_count++;
+                while (k > 0 && entered_t[k-1] < lead_t_near[c]) {
+                    entered[k] = entered[k-1];
+                    entered_t[k] = entered_t[k-1];
+                    k--;
+                }
+                entered[k] = e;
+                entered_t[k] = lead_t_near[c];
+            }
+
+            for (int k = 0; k < entered_count; k++)
+                stack[stack_size++] = entered[k];
+        }
+    }
+}
+
+
 #endif
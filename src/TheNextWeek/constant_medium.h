@@ -17,60 +17,58 @@
 #include "material.h"
 #include "texture.h"
 
+#include <vector>
+
 
 class constant_medium : public hittable  {
     public:
-        constant_medium(shared_ptr<hittable> b, double d, shared_ptr<texture> a)
+        constant_medium(shared_ptr<hittable> b, real d, shared_ptr<texture> a)
             : boundary(b), neg_inv_density(-1/d)
         {
             phase_function = make_shared<isotropic>(a);
         }
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
 
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
             return boundary->bounding_box(t0, t1, output_box);
         }
 
     public:
         shared_ptr<hittable> boundary;
         shared_ptr<material> phase_function;
-        double neg_inv_density;
+        real neg_inv_density;
 };
 
 
-bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool constant_medium::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     // Print occasional samples when debugging. To enable, set enableDebug true.
     const bool enableDebug = false;
     const bool debugging = enableDebug && random_double() < 0.00001;
 
-    hit_record rec1, rec2;
-
-    if (!boundary->hit(r, -infinity, infinity, rec1))
-        return false;
-
-    if (!boundary->hit(r, rec1.t+0.0001, infinity, rec2))
+    real t0, t1;
+    if (!boundary->interval(r, t0, t1))
         return false;
 
-    if (debugging) std::cerr << "\nt0=" << rec1.t << ", t1=" << rec2.t << '\n';
+    if (debugging) std::cerr << "\nt0=" << t0 << ", t1=" << t1 << '\n';
 
-    if (rec1.t < t_min) rec1.t = t_min;
-    if (rec2.t > t_max) rec2.t = t_max;
+    if (t0 < t_min) t0 = t_min;
+    if (t1 > t_max) t1 = t_max;
 
-    if (rec1.t >= rec2.t)
+    if (t0 >= t1)
         return false;
 
-    if (rec1.t < 0)
-        rec1.t = 0;
+    if (t0 < 0)
+        t0 = 0;
 
     const auto ray_length = r.direction().length();
-    const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
+    const auto distance_inside_boundary = (t1 - t0) * ray_length;
     const auto hit_distance = neg_inv_density * log(random_double());
 
     if (hit_distance > distance_inside_boundary)
         return false;
 
-    rec.t = rec1.t + hit_distance / ray_length;
+    rec.t = t0 + hit_distance / ray_length;
     rec.p = r.at(rec.t);
 
     if (debugging) {
@@ -81,9 +79,167 @@ bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record&
 
     rec.normal = vec3(1,0,0);  // arbitrary
     rec.front_face = true;     // also arbitrary
-    rec.mat_ptr = phase_function;
+    rec.footprint = 0;
+    rec.mat_ptr = phase_function.get();
+    rec.object = this;
+    rec.pending = false;
 
     return true;
 }
 
+
+class heterogeneous_medium : public hittable  {
+    // A medium whose density at each point is density times the mean of a texture's channels
+    // there, such as a noise_texture's. Free paths are found by delta tracking: tentative
+    // collisions come at the rate of a majorant, and each is real with the probability of the
+    // density over the majorant. Majorants are kept per cell of a coarse grid over the
+    // boundary's box, so a ray takes few steps through thin regions and none through empty
+    // ones. A cell's majorant is the largest density sampled through it, with a margin; where
+    // the density rises past that between the samples, the medium is as dense as the majorant.
+    public:
+        heterogeneous_medium(
+            shared_ptr<hittable> b, real d, shared_ptr<texture> density_texture,
+            shared_ptr<texture> a, int resolution = 16);
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
+
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
+            return boundary->bounding_box(t0, t1, output_box);
+        }
+
+    public:
+        shared_ptr<hittable> boundary;
+        shared_ptr<material> phase_function;
+        shared_ptr<texture> density_texture;
+        real density;
+        int resolution;              // Grid cells along each axis, or 0 with no bounding box
+        aabb grid_box;
+        std::vector<real> majorants;  // One per cell, x fastest
+
+    private:
+        real density_at(const point3& p) const {
+            const auto c = density_texture->lookup(0, 0, p, 0);
+            return density * (c.x() + c.y() + c.z()) / 3;
+        }
+
+        real& majorant(int x, int y, int z) {
+            return majorants[(size_t(z)*resolution + y)*resolution + x];
+        }
+};
+
+
+heterogeneous_medium::heterogeneous_medium(
+    shared_ptr<hittable> b, real d, shared_ptr<texture> density_texture,
+    shared_ptr<texture> a, int resolution
+) : boundary(b), density_texture(density_texture), density(d), resolution(resolution)
+{
+    phase_function = make_shared<isotropic>(a);
+    if (!boundary->bounding_box(0, 1, grid_box)) {
+        this->resolution = 0;
+        return;
+    }
+
+    // Each cell is sampled on a 5x5x5 lattice, its corners and faces included.
+    const int samples = 5;
+    const auto lo = grid_box.min();
+    const auto cell = (grid_box.max() - lo) / resolution;
+    majorants.assign(size_t(resolution)*resolution*resolution, 0);
+
+    #pragma omp parallel for
+    for (int z = 0; z < resolution; z++) {
+        for (int y = 0; y < resolution; y++) {
+            for (int x = 0; x < resolution; x++) {
+                real most = 0;
+                for (int k = 0; k < samples; k++) {
+                    for (int j = 0; j < samples; j++) {
+                        for (int i = 0; i < samples; i++) {
+                            const vec3 offset(x + i / (samples - 1.0), y + j / (samples - 1.0),
+                                              z + k / (samples - 1.0));
+                            most = fmax(most, density_at(lo + offset * cell));
+                        }
+                    }
+                }
+                majorant(x, y, z) = 1.25 * most;
+            }
+        }
+    }
+}
+
+
+bool heterogeneous_medium::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    real t0, t1;
+    if (resolution == 0 || !boundary->interval(r, t0, t1))
+        return false;
+
+    if (t0 < t_min) t0 = t_min;
+    if (t1 > t_max) t1 = t_max;
+    if (t0 < 0) t0 = 0;
+    if (t0 >= t1)
+        return false;
+
+    // Walk the cells the segment crosses in order. next is where r leaves the current cell
+    // across each axis, and delta how far apart in t that axis's cell faces are.
+    const auto lo = grid_box.min();
+    const auto cell = (grid_box.max() - lo) / resolution;
+    const auto entry = r.at(t0);
+    int index[3], step[3];
+    real next[3], delta[3];
+    for (int a = 0; a < 3; a++) {
+        const auto i = cell[a] > 0 ? static_cast<int>((entry[a] - lo[a]) / cell[a]) : 0;
+        index[a] = i < 0 ? 0 : i >= resolution ? resolution - 1 : i;
+
+        const auto d = r.direction()[a];
+        step[a] = d > 0 ? 1 : d < 0 ? -1 : 0;
+        if (step[a] == 0) {
+            next[a] = delta[a] = infinity;
+        } else {
+            const auto face = lo[a] + (index[a] + (step[a] > 0)) * cell[a];
+            next[a] = (face - r.origin()[a]) / d;
+            delta[a] = cell[a] / fabs(d);
+        }
+    }
+
+    const auto ray_length = r.direction().length();
+    auto t = t0;
+    while (true) {
+        const int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2)
+                                        : (next[1] < next[2] ? 1 : 2);
+        const auto cell_exit = fmin(next[a], t1);
+        const auto cell_majorant =
+            majorants[(size_t(index[2])*resolution + index[1])*resolution + index[0]];
+
+        if (cell_majorant > 0) {
+            const auto rate = cell_majorant * ray_length;  // Tentative collisions per unit t
+            while (true) {
+                t -= log(random_double()) / rate;
+                if (t >= cell_exit)
+                    break;
+                RTW_STAT(stat_medium_lookups);
+                if (random_double() * cell_majorant < density_at(r.at(t))) {
+                    rec.t = t;
+                    rec.p = r.at(t);
+                    rec.normal = vec3(1,0,0);  // arbitrary
+                    rec.front_face = true;     // also arbitrary
+                    rec.u = rec.v = 0;
+                    rec.footprint = 0;
+                    rec.mat_ptr = phase_function.get();
+                    rec.object = this;
+                    rec.pending = false;
+                    return true;
+                }
+            }
+        }
+
+        // Free paths are memoryless, so tracking starts afresh at the next cell's face.
+        if (next[a] >= t1)
+            return false;
+        t = cell_exit;
+        index[a] += step[a];
+        if (index[a] < 0 || index[a] >= resolution)
+            return false;
+        next[a] += delta[a];
+    }
+}
+
+
 #endif
@@ -26,15 +26,23 @@ class hittable_list: public hittable  {
         void clear() { objects.clear(); }
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const;
+
+        virtual void hit_packet(
+            const ray* rays, int count, real t_min, real* t_max, hit_record* recs, bool* hits
+        ) const {
+            for (const auto& object : objects)
+                object->hit_packet(rays, count, t_min, t_max, recs, hits);
+        }
 
     public:
         std::vector<shared_ptr<hittable>> objects;
 };
 
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     hit_record temp_rec;
     auto hit_anything = false;
     auto closest_so_far = t_max;
@@ -51,7 +59,16 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
 }
 
 
-bool hittable_list::bounding_box(double t0, double t1, aabb& output_box) const {
+bool hittable_list::occluded(const ray& r, real t_min, real t_max) const {
+    for (const auto& object : objects) {
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    }
+    return false;
+}
+
+
+bool hittable_list::bounding_box(real t0, real t1, aabb& output_box) const {
     if (objects.empty()) return false;
 
     aabb temp_box;
@@ -11,365 +11,97 @@
 
 #include "rtweekend.h"
 
-#include "box.h"
-#include "bvh.h"
+#include "adaptive_sampler.h"
 #include "camera.h"
 #include "color.h"
-#include "constant_medium.h"
+#include "framebuffer.h"
 #include "hittable_list.h"
-#include "material.h"
-#include "moving_sphere.h"
-#include "sphere.h"
-#include "texture.h"
+#include "image_output.h"
+#include "options.h"
+#include "preview.h"
+#include "progressive.h"
+#include "ray_color.h"
+#include "renderer.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "wavefront.h"
 
 #include <iostream>
-#include <omp.h>
+#include <string>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "external/stb_image_write.h"
 
 
-color ray_color(const ray& r, const color& background, const hittable& world, int depth) {
-	hit_record rec;
-
-	// If we've exceeded the ray bounce limit, no more light is gathered.
-	if (depth <= 0)
-		return color(0, 0, 0);
-
-	// If the ray hits nothing, return the background color.
-	if (!world.hit(r, 0.001, infinity, rec))
-		return background;
-
-	ray scattered;
-	color attenuation;
-	color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-	if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-		return emitted;
-
-	return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
-}
-
-
-hittable_list random_scene() {
+int main(int argc, char* argv[]) {
+	render_options options;
+	options.image_width = 300;
+	options.samples_per_pixel = 500;
+	options.max_depth = 30;
+	options.integrators = { "iterative", "recursive", "wavefront" };
+	options.scenes = {
+		"random_scene", "two_spheres", "two_perlin_spheres", "earth", "simple_light",
+		"cornell_box", "cornell_balls", "cornell_smoke", "cornell_final", "final_scene",
+		"cornell_mesh", "instances", "cornell_cloud", "random_motion"
+	};
+	options.takes_model = true;
+	options.takes_textures = true;
+	options.takes_scene_file = true;
+	options.takes_preview = true;
+	options.scene = "cornell_smoke";
+	options.output = "test.png";
+	if (!options.parse(argc, argv))
+		return 1;
+
+	const auto aspect_ratio = options.image_height > 0
+		? double(options.image_width) / options.image_height : 1.0 / 1.0;
+	const int image_width = options.image_width;
+	const int image_height = options.image_height > 0
+		? options.image_height : static_cast<int>(image_width / aspect_ratio);
+
+	texture_cache::global().set_budget(static_cast<size_t>(options.texture_budget * (1 << 20)));
 	hittable_list world;
 
-	auto checker = make_shared<checker_texture>(
-		make_shared<solid_color>(0.2, 0.3, 0.1),
-		make_shared<solid_color>(0.9, 0.9, 0.9)
-		);
-
-	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
-
-	for (int a = -11; a < 11; a++) {
-		for (int b = -11; b < 11; b++) {
-			auto choose_mat = random_double();
-			point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-			if ((center - vec3(4, 0.2, 0)).length() > 0.9) {
-				shared_ptr<material> sphere_material;
-
-				if (choose_mat < 0.8) {
-					// diffuse
-					auto albedo = color::random() * color::random();
-					sphere_material = make_shared<lambertian>(make_shared<solid_color>(albedo));
-					auto center2 = center + vec3(0, random_double(0, .5), 0);
-					world.add(make_shared<moving_sphere>(
-						center, center2, 0.0, 1.0, 0.2, sphere_material));
-				}
-				else if (choose_mat < 0.95) {
-					// metal
-					auto albedo = color::random(0.5, 1);
-					auto fuzz = random_double(0, 0.5);
-					sphere_material = make_shared<metal>(albedo, fuzz);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
-				else {
-					// glass
-					sphere_material = make_shared<dielectric>(1.5);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
-			}
-		}
-	}
-
-	auto material1 = make_shared<dielectric>(1.5);
-	world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-	auto material2 = make_shared<lambertian>(make_shared<solid_color>(color(0.4, 0.2, 0.1)));
-	world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-	auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-	world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-	return hittable_list(make_shared<bvh_node>(world, 0.0, 1.0));
-}
-
-
-hittable_list two_spheres() {
-	hittable_list objects;
-
-	auto checker = make_shared<checker_texture>(
-		make_shared<solid_color>(0.2, 0.3, 0.1),
-		make_shared<solid_color>(0.9, 0.9, 0.9)
-		);
-
-	objects.add(make_shared<sphere>(point3(0, -10, 0), 10, make_shared<lambertian>(checker)));
-	objects.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
-
-	return objects;
-}
-
-
-hittable_list two_perlin_spheres() {
-	hittable_list objects;
-
-	auto pertext = make_shared<noise_texture>(4);
-	objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-	objects.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-	return objects;
-}
-
-
-hittable_list earth() {
-	auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-	auto earth_surface = make_shared<lambertian>(earth_texture);
-	auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
-
-	return hittable_list(globe);
-}
-
-
-hittable_list simple_light() {
-	hittable_list objects;
-
-	auto pertext = make_shared<noise_texture>(4);
-	objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-	objects.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-	auto difflight = make_shared<diffuse_light>(make_shared<solid_color>(4, 4, 4));
-	objects.add(make_shared<sphere>(point3(0, 7, 0), 2, difflight));
-	objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, difflight));
-
-	return objects;
-}
-
-
-hittable_list cornell_box() {
-	hittable_list objects;
-
-	auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
-	auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
-	auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
-	auto light = make_shared<diffuse_light>(make_shared<solid_color>(15, 15, 15));
-
-	objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
-	objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-	objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
-	objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
-	objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-	objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
-
-	shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-	box1 = make_shared<rotate_y>(box1, 15);
-	box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-	objects.add(box1);
-
-	shared_ptr<hittable> box2 = make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-	box2 = make_shared<rotate_y>(box2, -18);
-	box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-	objects.add(box2);
-
-	return objects;
-}
-
-
-hittable_list cornell_balls() {
-	hittable_list objects;
-
-	auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
-	auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
-	auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
-	auto light = make_shared<diffuse_light>(make_shared<solid_color>(5, 5, 5));
-
-	objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
-	objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-	objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
-	objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
-	objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-	objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
-
-	auto boundary = make_shared<sphere>(point3(160, 100, 145), 100, make_shared<dielectric>(1.5));
-	objects.add(boundary);
-	objects.add(make_shared<constant_medium>(boundary, 0.1, make_shared<solid_color>(1, 1, 1)));
-
-	shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-	box1 = make_shared<rotate_y>(box1, 15);
-	box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-	objects.add(box1);
-
-	return objects;
-}
-
-
-hittable_list cornell_smoke() {
-	hittable_list objects;
-
-	auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
-	auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
-	auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
-	auto light = make_shared<diffuse_light>(make_shared<solid_color>(7, 7, 7));
-
-	objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
-	objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-	objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
-	objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
-	objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-	objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
-
-	shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-	box1 = make_shared<rotate_y>(box1, 15);
-	box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-
-	shared_ptr<hittable> box2 = make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-	box2 = make_shared<rotate_y>(box2, -18);
-	box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-
-	objects.add(make_shared<constant_medium>(box1, 0.01, make_shared<solid_color>(0, 0, 0)));
-	objects.add(make_shared<constant_medium>(box2, 0.01, make_shared<solid_color>(1, 1, 1)));
-
-	return objects;
-}
-
-
-hittable_list cornell_final() {
-	hittable_list objects;
-
-	auto pertext = make_shared<noise_texture>(0.1);
-
-	auto mat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-
-	auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
-	auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
-	auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
-	auto light = make_shared<diffuse_light>(make_shared<solid_color>(7, 7, 7));
-
-	objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
-	objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-	objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
-	objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
-	objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-	objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
-
-	shared_ptr<hittable> boundary2 =
-		make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), make_shared<dielectric>(1.5));
-	boundary2 = make_shared<rotate_y>(boundary2, -18);
-	boundary2 = make_shared<translate>(boundary2, vec3(130, 0, 65));
-
-	auto tex = make_shared<solid_color>(0.9, 0.9, 0.9);
-
-	objects.add(boundary2);
-	objects.add(make_shared<constant_medium>(boundary2, 0.2, tex));
-
-	return objects;
-}
-
-
-hittable_list final_scene() {
-	hittable_list boxes1;
-	auto ground = make_shared<lambertian>(make_shared<solid_color>(0.48, 0.83, 0.53));
-
-	const int boxes_per_side = 20;
-	for (int i = 0; i < boxes_per_side; i++) {
-		for (int j = 0; j < boxes_per_side; j++) {
-			auto w = 100.0;
-			auto x0 = -1000.0 + i * w;
-			auto z0 = -1000.0 + j * w;
-			auto y0 = 0.0;
-			auto x1 = x0 + w;
-			auto y1 = random_double(1, 101);
-			auto z1 = z0 + w;
-
-			boxes1.add(make_shared<box>(point3(x0, y0, z0), point3(x1, y1, z1), ground));
-		}
-	}
-
-	hittable_list objects;
-
-	objects.add(make_shared<bvh_node>(boxes1, 0, 1));
-
-	auto light = make_shared<diffuse_light>(make_shared<solid_color>(7, 7, 7));
-	objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
-
-	auto center1 = point3(400, 400, 200);
-	auto center2 = center1 + vec3(30, 0, 0);
-	auto moving_sphere_material =
-		make_shared<lambertian>(make_shared<solid_color>(0.7, 0.3, 0.1));
-	objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
-
-	objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-	objects.add(make_shared<sphere>(
-		point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 10.0)
-		));
-
-	auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
-	objects.add(boundary);
-	objects.add(make_shared<constant_medium>(
-		boundary, 0.2, make_shared<solid_color>(0.2, 0.4, 0.9)
-		));
-	boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-	objects.add(make_shared<constant_medium>(boundary, .0001, make_shared<solid_color>(1, 1, 1)));
-
-	auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-	objects.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
-	auto pertext = make_shared<noise_texture>(0.1);
-	objects.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
-
-	hittable_list boxes2;
-	auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
-	int ns = 1000;
-	for (int j = 0; j < ns; j++) {
-		boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
-	}
-
-	objects.add(make_shared<translate>(
-		make_shared<rotate_y>(
-			make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-		vec3(-100, 270, 395)
-		)
-	);
-
-	return objects;
-}
-
-
-int main() {
-	const auto aspect_ratio = 1.0 / 1.0;
-	const int image_width = 300;
-	const int image_height = static_cast<int>(image_width / aspect_ratio);
-
-	hittable_list world;
-
-	int samples_per_pixel = 500;
-	int max_depth = 30;
-
-	const int n = 4;
-	const int buffer_size = image_height * image_width * n;
-	unsigned char* buffer = new unsigned char[buffer_size];
-
-	omp_lock_t m_lock;
-	omp_init_lock(&m_lock);
+	const int samples_per_pixel = options.samples_per_pixel;
+	const int max_depth = options.max_depth;
+	enum { recursive, iterative, wavefront };
+	const int integrator = options.integrator == "recursive" ? recursive
+	                     : options.integrator == "wavefront" ? wavefront : iterative;
+	const int rr_depth = options.rr_depth;
+	const bool adaptive = options.adaptive;
+	const bool progressive = options.progressive;
+	const int node = options.node;
+	const int node_count = options.node_count;
+
+	if (options.threads > 0)
+		omp_set_num_threads(options.threads);
+	active_sample_sequence() = options.sequence();
 
 	point3 lookfrom;
 	point3 lookat;
 	vec3 vup(0, 1, 0);
-	auto vfov = 40.0;
-	auto aperture = 0.0;
-	auto dist_to_focus = 10.0;
+	real vfov = 40.0;
+	real aperture = 0.0;
+	real dist_to_focus = 10.0;
 	color background(0, 0, 0);
 
-	switch (8) {
+	RTW_STAT_TIMER(scene_timer, stat_scene_build);
+	scene_description description;
+	switch (options.scene_file.empty() ? options.scene_index() + 1 : 0) {
+	case 0: {
+		if (!load_scene_file(options.scene_file, options.scene_cache, description, world))
+			return 1;
+		const auto& view = description.view;
+		lookfrom = point3(view.lookfrom[0], view.lookfrom[1], view.lookfrom[2]);
+		lookat = point3(view.lookat[0], view.lookat[1], view.lookat[2]);
+		vup = vec3(view.vup[0], view.vup[1], view.vup[2]);
+		vfov = view.vfov;
+		aperture = view.aperture;
+		dist_to_focus = view.focus;
+		background = color(view.background[0], view.background[1], view.background[2]);
+		break;
+	}
+
 	case 1:
 		world = random_scene();
 		lookfrom = point3(13, 2, 3);
@@ -444,34 +176,150 @@ int main() {
 		lookat = point3(278, 278, 0);
 		vfov = 40.0;
 		break;
+
+	case 11:
+		world = cornell_mesh(options.model);
+		lookfrom = point3(278, 278, -800);
+		lookat = point3(278, 278, 0);
+		vfov = 40.0;
+		break;
+
+	case 12:
+		world = instances();
+		lookfrom = point3(13, 2, 3);
+		lookat = point3(0, 0, 0);
+		vfov = 20.0;
+		background = color(0.70, 0.80, 1.00);
+		break;
+
+	case 13:
+		world = cornell_cloud();
+		lookfrom = point3(278, 278, -800);
+		lookat = point3(278, 278, 0);
+		vfov = 40.0;
+		break;
+
+	case 14:
+		world = random_motion();
+		lookfrom = point3(13, 2, 3);
+		lookat = point3(0, 0, 0);
+		vfov = 20.0;
+		background = color(0.70, 0.80, 1.00);
+		break;
 	}
+	RTW_STAT_STOP(scene_timer);
 
 	// std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
 
 	camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
-
-	for (int j = image_height - 1; j >= 0; --j) {
-		std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-#pragma omp parallel for		
-		for (int i = 0; i < image_width; ++i) {
-			color pixel_color;
-			for (int s = 0; s < samples_per_pixel; ++s) {
-				auto u = (i + random_double()) / (image_width - 1);
-				auto v = (j + random_double()) / (image_height - 1);
-				ray r = cam.get_ray(u, v);			
-				pixel_color += ray_color(r, background, world, max_depth);			
-			}
-			omp_set_lock(&m_lock);
-			buffer[n * image_width * j + i * n + 0] = convert(pixel_color.x(), samples_per_pixel);
-			buffer[n * image_width * j + i * n + 1] = convert(pixel_color.y(), samples_per_pixel);
-			buffer[n * image_width * j + i * n + 2] = convert(pixel_color.z(), samples_per_pixel);
-			buffer[n * image_width * j + i * n + 3] = 255;
-			omp_unset_lock(&m_lock);
+	cam.set_image_width(image_width);
+
+	const auto share = node_samples(node, node_count, samples_per_pixel);
+	adaptive_sampler sampler(adaptive ? 32 : share.count, share.count, options.threshold);
+	framebuffer image(image_width, image_height);
+
+	auto sample = [&](int i, int j, int s) -> color {
+		start_sample(i, j, image_width, s);
+		real du, dv;
+		sample_2d(du, dv);
+		auto u = (i + du) / (image_width - 1);
+		auto v = (j + dv) / (image_height - 1);
+		ray r = cam.get_ray(u, v);
+		return integrator == recursive
+			? ray_color(r, background, world, max_depth)
+			: ray_color_iterative(r, background, world, max_depth, rr_depth);
+	};
+
+	auto write_image = [&](const framebuffer& fb) {
+		RTW_STAT_TIMER(timer, stat_encode);
+		if (!make_image_output(options.output, image_width, image_height)->finish(fb))
+			std::cerr << "\nCould not write " << options.output << '\n';
+	};
+
+	// Unless the render is progressive or a preview, tiles stream into the image as they
+	// finish, so only completing the file waits for the frame. A share of a distributed render
+	// is saved as raw sums and counts for rtw_merge instead.
+	std::unique_ptr<image_output> output;
+	if (node_count == 1 && !progressive && !options.preview)
+		output = make_image_output(options.output, image_width, image_height);
+
+	auto write_output = [&](const framebuffer& fb) {
+		RTW_STAT_TIMER(timer, stat_encode);
+		if (output) {
+			if (!output->finish(fb))
+				std::cerr << "\nCould not write " << options.output << '\n';
+		} else if (!fb.write_checkpoint(options.output_with(".node" + std::to_string(node) + ".fb"))) {
+			std::cerr << "\nCould not write the sample buffer\n";
 		}
+	};
+
+	tile_renderer renderer(image_width, image_height, options.tile_size);
+	wavefront_integrator batched(world, background, max_depth, rr_depth);
+	RTW_STAT_TIMER(render_timer, stat_render);
+
+	if (options.preview) {
+		// The scene and its BVHs stay resident while camera commands arrive on the standard
+		// input; each restarts the image alone. Every pass replaces the output by renaming a
+		// finished file over it, so a viewer that reloads it never sees half an image.
+		camera_view view = { lookfrom, lookat, vup, vfov, aperture, dist_to_focus };
+		const auto partial = options.output_with(".partial")
+			+ options.output.substr(options.output_with("").size());
+		preview_renderer passes(renderer, samples_per_pixel);
+		passes.render(image, view, std::cin, [&](const camera_view& v) {
+			cam = v.make_camera(aspect_ratio, 0.0, 1.0);
+			cam.set_image_width(image_width);
+		}, sample, [&](const framebuffer& fb) {
+			RTW_STAT_TIMER(timer, stat_encode);
+			const bool written = make_image_output(partial, image_width, image_height)->finish(fb);
+			bool ok = written && std::rename(partial.c_str(), options.output.c_str()) == 0;
+#ifdef _WIN32
+			// Windows won't rename over an existing file, so there the old image goes first.
+			if (written && !ok) {
+				std::remove(options.output.c_str());
+				ok = std::rename(partial.c_str(), options.output.c_str()) == 0;
+			}
+#endif
+			if (!ok)
+				std::cerr << "\nCould not write " << options.output << '\n';
+		});
+		RTW_STAT_STOP(render_timer);
+	} else if (progressive && node_count == 1) {
+		// Rerunning after an interruption resumes from the checkpoint. Passes are traced one
+		// sample at a time, so the wavefront integrator falls back to the iterative one.
+		progressive_renderer passes(renderer, samples_per_pixel);
+		passes.checkpoint_every(
+			options.checkpoint_seconds, 0, options.output_with(".ckpt"), write_image);
+		passes.render(image, sample);
+		RTW_STAT_STOP(render_timer);
+	} else {
+		renderer.render([&](const tile& t) {
+			if (integrator == wavefront)
+				batched.render_tile(t, cam, image_width, image_height, share, image);
+			else
+				sampler.sample_tile(t, sample, image, share.first);
+			if (output)
+				output->write_tile(image, t);
+		});
+		RTW_STAT_STOP(render_timer);
+		write_output(image);
+	}
+
+	if (adaptive && !progressive && !options.preview && node_count == 1
+		&& integrator != wavefront) {
+		RTW_STAT_TIMER(timer, stat_encode);
+		auto heatmap = image.sample_heatmap_rgba8(share.count);
+		stbi_write_png(options.output_with("_samples.png").c_str(),
+			image_width, image_height, 4, heatmap.data(), image_width * 4);
+		std::cerr << "\nAverage samples per pixel: "
+			<< double(image.total_samples()) / (image_width * image_height);
+	}
+
+	const auto& textures = texture_cache::global();
+	if (textures.decodes() > 0) {
+		std::cerr << "\nTextures: " << textures.decodes() << " decoded, " << textures.evictions()
+			<< " evicted, " << textures.resident_bytes() / double(1 << 20) << " MB resident";
 	}
 
-	stbi_write_png("test.png", image_width, image_height, n, buffer, image_width * n);
-	delete[] buffer;
-	omp_destroy_lock(&m_lock);
+	RTW_STAT_REPORT(std::cerr);
 	std::cerr << "\nDone.\n";
 }
@@ -17,46 +17,69 @@
 #include "texture.h"
 
 
-double schlick(double cosine, double ref_idx) {
-    double r0 = (1-ref_idx) / (1+ref_idx);
+real schlick(real cosine, real ref_idx) {
+    real r0 = (1-ref_idx) / (1+ref_idx);
     r0 = r0*r0;
     return r0 + (1-r0)*pow((1 - cosine),5);
 }
 
 
+// The materials defined here, which shading dispatches on with a switch (see material_scatter
+// below), and the groups the wavefront integrator shades together. Materials defined elsewhere
+// are other, and reached through their virtual functions.
+enum class material_kind { lambertian, metal, dielectric, diffuse_light, isotropic, other };
+const int material_kind_count = 6;
+
+
 class material  {
     public:
-        virtual color emitted(double u, double v, const point3& p) const {
+        material() : tag(material_kind::other) {}
+
+        virtual color emitted(real u, real v, const point3& p) const {
             return color(0,0,0);
         }
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const = 0;
+
+        material_kind kind() const { return tag; }
+
+    private:
+        // Only the final classes below may claim a kind, since material_scatter casts to them.
+        friend class dielectric;
+        friend class diffuse_light;
+        friend class isotropic;
+        friend class lambertian;
+        friend class metal;
+
+        explicit material(material_kind k) : tag(k) {}
+
+        material_kind tag;
 };
 
 
-class dielectric : public material {
+class dielectric final : public material {
     public:
-        dielectric(double ri) : ref_idx(ri) {}
+        dielectric(real ri) : material(material_kind::dielectric), ref_idx(ri) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const {
             attenuation = color(1.0, 1.0, 1.0);
-            double etai_over_etat = (rec.front_face) ? (1.0 / ref_idx) : (ref_idx);
+            real etai_over_etat = (rec.front_face) ? (1.0 / ref_idx) : (ref_idx);
 
             vec3 unit_direction = unit_vector(r_in.direction());
-            double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+            real cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+            real sin_theta = sqrt(1.0 - cos_theta*cos_theta);
             if (etai_over_etat * sin_theta > 1.0 ) {
                 vec3 reflected = reflect(unit_direction, rec.normal);
                 scattered = ray(rec.p, reflected, r_in.time());
                 return true;
             }
 
-            double reflect_prob = schlick(cos_theta, etai_over_etat);
-            if (random_double() < reflect_prob)
+            real reflect_prob = schlick(cos_theta, etai_over_etat);
+            if (sample_1d() < reflect_prob)
             {
                 vec3 reflected = reflect(unit_direction, rec.normal);
                 scattered = ray(rec.p, reflected, r_in.time());
@@ -69,13 +92,14 @@ class dielectric : public material {
         }
 
     public:
-        double ref_idx;
+        real ref_idx;
 };
 
 
-class diffuse_light : public material {
+class diffuse_light final : public material {
     public:
-        diffuse_light(shared_ptr<texture> a) : emit(a) {}
+        diffuse_light(shared_ptr<texture> a)
+          : material(material_kind::diffuse_light), emit(a) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
@@ -83,8 +107,8 @@ class diffuse_light : public material {
             return false;
         }
 
-        virtual color emitted(double u, double v, const point3& p) const {
-            return emit->value(u, v, p);
+        virtual color emitted(real u, real v, const point3& p) const {
+            return emit->lookup(u, v, p, 0);
         }
 
     public:
@@ -92,15 +116,15 @@ class diffuse_light : public material {
 };
 
 
-class isotropic : public material {
+class isotropic final : public material {
     public:
-        isotropic(shared_ptr<texture> a) : albedo(a) {}
+        isotropic(shared_ptr<texture> a) : material(material_kind::isotropic), albedo(a) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const  {
-            scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            scattered = ray(rec.p, sample_unit_vector(), r_in.time());
+            attenuation = albedo->lookup(rec.u, rec.v, rec.p, rec.footprint);
             return true;
         }
 
@@ -109,16 +133,16 @@ class isotropic : public material {
 };
 
 
-class lambertian : public material {
+class lambertian final : public material {
     public:
-        lambertian(shared_ptr<texture> a) : albedo(a) {}
+        lambertian(shared_ptr<texture> a) : material(material_kind::lambertian), albedo(a) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const {
-            vec3 scatter_direction = rec.normal + random_unit_vector();
+            vec3 scatter_direction = rec.normal + sample_unit_vector();
             scattered = ray(rec.p, scatter_direction, r_in.time());
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            attenuation = albedo->lookup(rec.u, rec.v, rec.p, rec.footprint);
             return true;
         }
 
@@ -127,23 +151,62 @@ class lambertian : public material {
 };
 
 
-class metal : public material {
+class metal final : public material {
     public:
-        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+        metal(const color& a, real f)
+          : material(material_kind::metal), albedo(a), fuzz(f < 1 ? f : 1) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(), r_in.time());
+            scattered = ray(rec.p, reflected + fuzz*sample_in_unit_sphere(), r_in.time());
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
 
     public:
         color albedo;
-        double fuzz;
+        real fuzz;
 };
 
 
+// Shading switched on the material's kind. Each case calls its class's own function by name,
+// which the compiler can inline, so a bounce off one of the materials above makes no virtual
+// call; other materials go through the vtable.
+
+inline color material_emitted(const material& m, real u, real v, const point3& p) {
+    switch (m.kind()) {
+    case material_kind::diffuse_light:
+        return static_cast<const diffuse_light&>(m).diffuse_light::emitted(u, v, p);
+    case material_kind::other:
+        return m.emitted(u, v, p);
+    default:
+        return color(0,0,0);
+    }
+}
+
+inline bool material_scatter(
+    const material& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+) {
+    switch (m.kind()) {
+    case material_kind::lambertian:
+        return static_cast<const lambertian&>(m).lambertian::scatter(
+            r_in, rec, attenuation, scattered);
+    case material_kind::metal:
+        return static_cast<const metal&>(m).metal::scatter(r_in, rec, attenuation, scattered);
+    case material_kind::dielectric:
+        return static_cast<const dielectric&>(m).dielectric::scatter(
+            r_in, rec, attenuation, scattered);
+    case material_kind::diffuse_light:
+        return false;
+    case material_kind::isotropic:
+        return static_cast<const isotropic&>(m).isotropic::scatter(
+            r_in, rec, attenuation, scattered);
+    default:
+        return m.scatter(r_in, rec, attenuation, scattered);
+    }
+}
+
+
 #endif
@@ -20,29 +20,31 @@ class moving_sphere : public hittable {
     public:
         moving_sphere() {}
         moving_sphere(
-            point3 cen0, point3 cen1, double t0, double t1, double r, shared_ptr<material> m)
+            point3 cen0, point3 cen1, real t0, real t1, real r, shared_ptr<material> m)
             : center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), mat_ptr(m)
         {};
 
-        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual void surface(const ray& r, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const;
 
-        point3 center(double time) const;
+        point3 center(real time) const;
 
     public:
         point3 center0, center1;
-        double time0, time1;
-        double radius;
+        real time0, time1;
+        real radius;
         shared_ptr<material> mat_ptr;
 };
 
 
-point3 moving_sphere::center(double time) const{
+point3 moving_sphere::center(real time) const{
     return center0 + ((time - time0) / (time1 - time0))*(center1 - center0);
 }
 
 
-bool moving_sphere::bounding_box(double t0, double t1, aabb& output_box) const {
+bool moving_sphere::bounding_box(real t0, real t1, aabb& output_box) const {
     aabb box0(
         center(t0) - vec3(radius, radius, radius),
         center(t0) + vec3(radius, radius, radius));
@@ -55,7 +57,8 @@ bool moving_sphere::bounding_box(double t0, double t1, aabb& output_box) const {
 
 
 // replace "center" with "center(r.time())"
-bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool moving_sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    RTW_STAT(stat_primitive_tests);
     vec3 oc = r.origin() - center(r.time());
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -69,20 +72,16 @@ bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
         auto temp = (-half_b - root)/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.object = this;
+            rec.pending = true;
             return true;
         }
 
         temp = (-half_b + root)/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center(r.time())) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
+            rec.object = this;
+            rec.pending = true;
             return true;
         }
     }
@@ -90,4 +89,34 @@ bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
     return false;
 }
 
+
+void moving_sphere::surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center(r.time())) / radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.footprint = 0;
+    rec.mat_ptr = mat_ptr.get();
+}
+
+
+bool moving_sphere::occluded(const ray& r, real t_min, real t_max) const {
+    RTW_STAT(stat_primitive_tests);
+    vec3 oc = r.origin() - center(r.time());
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant <= 0)
+        return false;
+
+    auto root = sqrt(discriminant);
+    auto temp = (-half_b - root)/a;
+    if (temp < t_max && temp > t_min)
+        return true;
+
+    temp = (-half_b + root)/a;
+    return temp < t_max && temp > t_min;
+}
+
 #endif
@@ -0,0 +1,766 @@
+#ifndef PRIMITIVE_POOL_H
+#define PRIMITIVE_POOL_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh_builder.h"
+#include "bvh_wide.h"
+#include "hittable.h"
+#include "shared_array.h"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+
+namespace primitive_pool_detail {
+
+    template <typename T>
+    void reorder(std::vector<T>& values, const std::vector<uint32_t>& order) {
+        std::vector<T> ordered;
+        ordered.reserve(values.size());
+        for (auto i : order)
+            ordered.push_back(values[i]);
+        values.swap(ordered);
+    }
+
+}
+
+
+// The fields of many primitives of one kind, one array per field, with a material index for
+// each into a table kept elsewhere. Each kind intersects and shades exactly as its hittable
+// class does, given the index of a primitive.
+
+struct sphere_arrays {
+    std::vector<real> x, y, z;
+    std::vector<real> radius;
+    std::vector<uint32_t> material;
+
+    size_t size() const { return radius.size(); }
+
+    void add(const point3& center, real r, uint32_t m) {
+        x.push_back(center.x());
+        y.push_back(center.y());
+        z.push_back(center.z());
+        radius.push_back(r);
+        material.push_back(m);
+    }
+
+    void reorder(const std::vector<uint32_t>& order) {
+        using primitive_pool_detail::reorder;
+        reorder(x, order);
+        reorder(y, order);
+        reorder(z, order);
+        reorder(radius, order);
+        reorder(material, order);
+    }
+
+    aabb bounds(uint32_t i, real time0, real time1) const {
+        const point3 center(x[i], y[i], z[i]);
+        const vec3 extent(radius[i], radius[i], radius[i]);
+        return aabb(center - extent, center + extent);
+    }
+
+    bool intersect(uint32_t i, const ray& r, real t_min, real t_max, real& t) const {
+        RTW_STAT(stat_primitive_tests);
+        vec3 oc = r.origin() - point3(x[i], y[i], z[i]);
+        auto a = r.direction().length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius[i]*radius[i];
+
+        auto discriminant = half_b*half_b - a*c;
+        if (discriminant <= 0)
+            return false;
+
+        auto root = sqrt(discriminant);
+        t = (-half_b - root)/a;
+        if (t < t_max && t > t_min)
+            return true;
+        t = (-half_b + root)/a;
+        return t < t_max && t > t_min;
+    }
+
+    void surface(uint32_t i, const ray& r, hit_record& rec) const {
+        const point3 center(x[i], y[i], z[i]);
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center) / radius[i];
+        rec.set_face_normal(r, outward_normal);
+        get_sphere_uv((rec.p - center)/radius[i], rec.u, rec.v);
+        rec.set_footprint(r, sqrt(2.0) * pi * radius[i]);
+    }
+};
+
+
+struct moving_sphere_arrays {
+    std::vector<real> x0, y0, z0;  // Center at time0
+    std::vector<real> x1, y1, z1;  // Center at time1
+    std::vector<real> time0, time1;
+    std::vector<real> radius;
+    std::vector<uint32_t> material;
+
+    size_t size() const { return radius.size(); }
+
+    void add(const point3& center0, const point3& center1, real t0, real t1, real r, uint32_t m) {
+        x0.push_back(center0.x());
+        y0.push_back(center0.y());
+        z0.push_back(center0.z());
+        x1.push_back(center1.x());
+        y1.push_back(center1.y());
+        z1.push_back(center1.z());
+        time0.push_back(t0);
+        time1.push_back(t1);
+        radius.push_back(r);
+        material.push_back(m);
+    }
+
+    void reorder(const std::vector<uint32_t>& order) {
+        using primitive_pool_detail::reorder;
+        reorder(x0, order);
+        reorder(y0, order);
+        reorder(z0, order);
+        reorder(x1, order);
+        reorder(y1, order);
+        reorder(z1, order);
+        reorder(time0, order);
+        reorder(time1, order);
+        reorder(radius, order);
+        reorder(material, order);
+    }
+
+    point3 center(uint32_t i, real time) const {
+        const point3 center0(x0[i], y0[i], z0[i]);
+        const point3 center1(x1[i], y1[i], z1[i]);
+        return center0 + ((time - time0[i]) / (time1[i] - time0[i]))*(center1 - center0);
+    }
+
+    aabb bounds(uint32_t i, real t0, real t1) const {
+        const vec3 extent(radius[i], radius[i], radius[i]);
+        return surrounding_box(
+            aabb(center(i, t0) - extent, center(i, t0) + extent),
+            aabb(center(i, t1) - extent, center(i, t1) + extent));
+    }
+
+    bool intersect(uint32_t i, const ray& r, real t_min, real t_max, real& t) const {
+        RTW_STAT(stat_primitive_tests);
+        vec3 oc = r.origin() - center(i, r.time());
+        auto a = r.direction().length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius[i]*radius[i];
+
+        auto discriminant = half_b*half_b - a*c;
+        if (discriminant <= 0)
+            return false;
+
+        auto root = sqrt(discriminant);
+        t = (-half_b - root)/a;
+        if (t < t_max && t > t_min)
+            return true;
+        t = (-half_b + root)/a;
+        return t < t_max && t > t_min;
+    }
+
+    void surface(uint32_t i, const ray& r, hit_record& rec) const {
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center(i, r.time())) / radius[i];
+        rec.set_face_normal(r, outward_normal);
+        rec.footprint = 0;
+    }
+};
+
+
+template <int A, int B, int K>
+struct rect_arrays {
+    // Rectangles spanning a0 to a1 along axis A and b0 to b1 along axis B, at k on axis K.
+    std::vector<real> a0, a1, b0, b1, k;
+    std::vector<uint32_t> material;
+
+    size_t size() const { return k.size(); }
+
+    void add(real _a0, real _a1, real _b0, real _b1, real _k, uint32_t m) {
+        a0.push_back(_a0);
+        a1.push_back(_a1);
+        b0.push_back(_b0);
+        b1.push_back(_b1);
+        k.push_back(_k);
+        material.push_back(m);
+    }
+
+    void reorder(const std::vector<uint32_t>& order) {
+        using primitive_pool_detail::reorder;
+        reorder(a0, order);
+        reorder(a1, order);
+        reorder(b0, order);
+        reorder(b1, order);
+        reorder(k, order);
+        reorder(material, order);
+    }
+
+    aabb bounds(uint32_t i, real time0, real time1) const {
+        // Padded along K, as the rectangle classes are, for a box of non-zero width.
+        point3 lo, hi;
+        lo[A] = a0[i];
+        hi[A] = a1[i];
+        lo[B] = b0[i];
+        hi[B] = b1[i];
+        lo[K] = k[i]-0.0001;
+        hi[K] = k[i]+0.0001;
+        return aabb(lo, hi);
+    }
+
+    bool intersect(uint32_t i, const ray& r, real t0, real t1, real& t) const {
+        RTW_STAT(stat_primitive_tests);
+        t = (k[i]-r.origin()[K]) / r.direction()[K];
+        if (t < t0 || t > t1)
+            return false;
+
+        auto a = r.origin()[A] + t*r.direction()[A];
+        auto b = r.origin()[B] + t*r.direction()[B];
+        return !(a < a0[i] || a > a1[i] || b < b0[i] || b > b1[i]);
+    }
+
+    void surface(uint32_t i, const ray& r, hit_record& rec) const {
+        auto a = r.origin()[A] + rec.t*r.direction()[A];
+        auto b = r.origin()[B] + rec.t*r.direction()[B];
+
+        rec.u = (a-a0[i])/(a1[i]-a0[i]);
+        rec.v = (b-b0[i])/(b1[i]-b0[i]);
+        rec.set_footprint(r, sqrt((a1[i]-a0[i])*(b1[i]-b0[i])));
+        vec3 outward_normal(0, 0, 0);
+        outward_normal[K] = 1;
+        rec.set_face_normal(r, outward_normal);
+        rec.p = r.at(rec.t);
+    }
+};
+
+using xy_rect_arrays = rect_arrays<0, 1, 2>;
+using xz_rect_arrays = rect_arrays<0, 2, 1>;
+using yz_rect_arrays = rect_arrays<1, 2, 0>;
+
+
+
+
+namespace primitive_pool_detail {
+
+    // The nearest hit among count primitives of a, from local, numbered from index in a pool.
+    template <typename Arrays>
+    bool nearest(
+        const Arrays& a, uint32_t local, uint32_t count, uint32_t index, const ray& r,
+        real t_min, real& t_max, hit_record& rec
+    ) {
+        bool hit_anything = false;
+        real t;
+        for (uint32_t j = 0; j < count; j++) {
+            if (a.intersect(local + j, r, t_min, t_max, t)) {
+                hit_anything = true;
+                t_max = t;
+                rec.t = t;
+                rec.part = index + j;
+            }
+        }
+        return hit_anything;
+    }
+
+    template <typename Arrays>
+    bool any(
+        const Arrays& a, uint32_t local, uint32_t count, const ray& r, real t_min, real t_max
+    ) {
+        real t;
+        for (uint32_t j = 0; j < count; j++) {
+            if (a.intersect(local + j, r, t_min, t_max, t))
+                return true;
+        }
+        return false;
+    }
+
+    template <typename Arrays>
+    void shade(
+        const Arrays& a, uint32_t local, const ray& r,
+        const std::vector<shared_ptr<material>>& materials, hit_record& rec
+    ) {
+        a.surface(local, r, rec);
+        rec.mat_ptr = materials[a.material[local]].get();
+    }
+
+}
+
+
+enum pool_kind {
+    pool_spheres, pool_moving_spheres, pool_xy_rects, pool_xz_rects, pool_yz_rects,
+    pool_kind_count
+};
+
+
+class primitive_pool : public hittable {
+    // Spheres, moving spheres and axis-aligned rectangles as a single hittable, the way a
+    // triangle_mesh holds its triangles: each kind's fields in arrays, and a 4-wide BVH of the
+    // pool's own, walked as bvh4 walks its nodes. No leaf mixes kinds, and the primitives are
+    // numbered kind by kind, so every leaf is a range of one kind's arrays, tested with a plain
+    // loop with no virtual calls and no reference counting. Primitives are added with the
+    // arguments of their hittable's constructor, and then the pool is built once.
+    //
+    // With fast moving spheres, the tree is built over the boxes at the middle of the shutter
+    // interval and keeps each node's bounds at both of its ends. A ray tests the bounds
+    // interpolated to its own time, so nodes hold what is there at that moment instead of
+    // everything swept over the interval.
+    public:
+        primitive_pool() {
+            number();
+        }
+
+        void add_sphere(const point3& center, real radius, shared_ptr<material> m) {
+            added[pool_spheres].push_back(add_count++);
+            spheres.add(center, radius, material_id(m));
+        }
+
+        void add_moving_sphere(
+            const point3& center0, const point3& center1, real time0, real time1, real radius,
+            shared_ptr<material> m
+        ) {
+            added[pool_moving_spheres].push_back(add_count++);
+            moving_spheres.add(center0, center1, time0, time1, radius, material_id(m));
+        }
+
+        void add_xy_rect(real x0, real x1, real y0, real y1, real k, shared_ptr<material> m) {
+            added[pool_xy_rects].push_back(add_count++);
+            xy_rects.add(x0, x1, y0, y1, k, material_id(m));
+        }
+
+        void add_xz_rect(real x0, real x1, real z0, real z1, real k, shared_ptr<material> m) {
+            added[pool_xz_rects].push_back(add_count++);
+            xz_rects.add(x0, x1, z0, z1, k, material_id(m));
+        }
+
+        void add_yz_rect(real y0, real y1, real z0, real z1, real k, shared_ptr<material> m) {
+            added[pool_yz_rects].push_back(add_count++);
+            yz_rects.add(y0, y1, z0, z1, k, material_id(m));
+        }
+
+        size_t size() const { return first[pool_kind_count]; }
+
+        // Builds the BVH and puts the primitives in its order. Returns, for each primitive in
+        // that order, the index at which it was added.
+        std::vector<uint32_t> build(
+            real time0, real time1, const bvh_build_options& options = bvh_build_options());
+
+        // Takes a BVH built earlier, over primitives added in the order the other build()
+        // returned, with the same times.
+        void build(
+            shared_array<wide_bvh_node<4>> tree, const aabb& tree_box, real time0, real time1
+        ) {
+            number();
+            nodes = std::move(tree);
+            box = tree_box;
+            keys = key_count(time0, time1);
+            node_count = nodes.size() / keys;
+            key_time0 = time0;
+            key_time1 = time1;
+        }
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
+        virtual void surface(const ray& r, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
+            output_box = box;
+            return !nodes.empty();
+        }
+
+    public:
+        sphere_arrays spheres;
+        moving_sphere_arrays moving_spheres;
+        xy_rect_arrays xy_rects;
+        xz_rect_arrays xz_rects;
+        yz_rect_arrays yz_rects;
+        std::vector<shared_ptr<material>> materials;
+        shared_array<wide_bvh_node<4>> nodes;  // At the first key, then any second
+        aabb box;
+
+    private:
+        size_t keys = 1;        // Times at which the tree's bounds are kept
+        size_t node_count = 0;  // Nodes per key
+        real key_time0 = 0, key_time1 = 1;
+        uint32_t first[pool_kind_count + 1];  // Where each kind starts in the pool's numbering
+        uint32_t add_count = 0;
+        std::vector<uint32_t> added[pool_kind_count];  // Each kind's indices of adding
+        std::unordered_map<const material*, uint32_t> material_index;
+
+        // The index of m in materials, adding it if it is new.
+        uint32_t material_id(const shared_ptr<material>& m) {
+            auto found = material_index.insert(
+                std::make_pair(m.get(), static_cast<uint32_t>(materials.size())));
+            if (found.second)
+                materials.push_back(m);
+            return found.first->second;
+        }
+
+        void number() {
+            const size_t sizes[] = {
+                spheres.size(), moving_spheres.size(), xy_rects.size(), xz_rects.size(),
+                yz_rects.size()
+            };
+            first[0] = 0;
+            for (int k = 0; k < pool_kind_count; k++)
+                first[k + 1] = first[k] + static_cast<uint32_t>(sizes[k]);
+        }
+
+        int kind_of(uint32_t index) const {
+            int k = 0;
+            while (index >= first[k + 1])
+                k++;
+            return k;
+        }
+
+        aabb bounds(int k, uint32_t local, real time0, real time1) const {
+            switch (k) {
+            case pool_spheres:        return spheres.bounds(local, time0, time1);
+            case pool_moving_spheres: return moving_spheres.bounds(local, time0, time1);
+            case pool_xy_rects:       return xy_rects.bounds(local, time0, time1);
+            case pool_xz_rects:       return xz_rects.bounds(local, time0, time1);
+            default:                  return yz_rects.bounds(local, time0, time1);
+            }
+        }
+
+        // Two keys pay for their interpolation once most moving spheres sweep more than
+        // twice the area they cover at one moment over the interval.
+        size_t key_count(real time0, real time1) const {
+            const auto mid = (time0 + time1) / 2;
+            size_t fast = 0;
+            for (uint32_t i = 0; i < moving_spheres.size(); i++) {
+                const auto swept = moving_spheres.bounds(i, time0, time1).area();
+                fast += swept > 2 * moving_spheres.bounds(i, mid, mid).area();
+            }
+            return 2 * fast > moving_spheres.size() ? 2 : 1;
+        }
+
+        // How far r's time is from the first key to the second, held to the interval.
+        float key_fraction(const ray& r) const {
+            if (keys == 1 || key_time1 <= key_time0)
+                return 0;
+            auto s = (r.time() - key_time0) / (key_time1 - key_time0);
+            return static_cast<float>(s < 0 ? 0 : s > 1 ? 1 : s);
+        }
+
+        int slab_test(
+            uint32_t index, const wide_ray& wr, float s, real t_min, real t_max, float* t_near
+        ) const {
+            const auto tmin = static_cast<float>(t_min), tmax = static_cast<float>(t_max);
+            if (keys == 1)
+                return ::slab_test<4>(nodes[index], wr, tmin, tmax, t_near);
+            return ::slab_test<4>(
+                nodes[index], nodes[node_count + index], s, wr, tmin, tmax, t_near);
+        }
+
+        void fit(std::vector<wide_bvh_node<4>>& tree, real time) const;
+
+        bool leaf_hit(
+            uint32_t index, uint32_t count, const ray& r, real t_min, real& t_max,
+            hit_record& rec
+        ) const;
+
+        bool leaf_occluded(
+            uint32_t index, uint32_t count, const ray& r, real t_min, real t_max) const;
+};
+
+
+std::vector<uint32_t> primitive_pool::build(
+    real time0, real time1, const bvh_build_options& options
+) {
+    RTW_STAT_TIMER(timer, stat_bvh_build);
+    number();
+
+    // With two keys, primitives are split by where they are halfway through the interval,
+    // since what their nodes hold at other times now moves with them.
+    keys = key_count(time0, time1);
+    key_time0 = time0;
+    key_time1 = time1;
+    const auto mid = (time0 + time1) / 2;
+
+    const auto size = first[pool_kind_count];
+    std::vector<aabb> boxes(size);
+    std::vector<uint8_t> kinds(size);
+    for (int k = 0; k < pool_kind_count; k++) {
+        for (auto i = first[k]; i < first[k + 1]; i++) {
+            const auto swept = bounds(k, i - first[k], time0, time1);
+            boxes[i] = keys == 1 ? swept : bounds(k, i - first[k], mid, mid);
+            kinds[i] = static_cast<uint8_t>(k);
+            box = i == 0 ? swept : surrounding_box(box, swept);
+        }
+    }
+
+    std::vector<flat_bvh_node> binary;
+    std::vector<uint32_t> order;
+    bvh_builder(boxes, options, kinds).build(binary, order);
+
+    // Renumber the leaves kind by kind, each kind keeping the order of its leaves.
+    std::vector<uint32_t> numbered(size);
+    uint32_t next[pool_kind_count];
+    std::copy(first, first + pool_kind_count, next);
+    for (auto& node : binary) {
+        if (!node.is_leaf())
+            continue;
+        const auto k = kinds[order[node.offset]];
+        std::copy(order.begin() + node.offset, order.begin() + node.offset + node.count,
+                  numbered.begin() + next[k]);
+        node.offset = next[k];
+        next[k] += node.count;
+    }
+
+    std::vector<uint32_t> added_order(size);
+    for (int k = 0; k < pool_kind_count; k++) {
+        std::vector<uint32_t> local(numbered.begin() + first[k], numbered.begin() + first[k + 1]);
+        for (auto i = first[k]; i < first[k + 1]; i++) {
+            local[i - first[k]] -= first[k];
+            added_order[i] = added[k][local[i - first[k]]];
+        }
+        switch (k) {
+        case pool_spheres:        spheres.reorder(local); break;
+        case pool_moving_spheres: moving_spheres.reorder(local); break;
+        case pool_xy_rects:       xy_rects.reorder(local); break;
+        case pool_xz_rects:       xz_rects.reorder(local); break;
+        default:                  yz_rects.reorder(local); break;
+        }
+        added[k].clear();
+    }
+
+    std::vector<wide_bvh_node<4>> tree;
+    wide_bvh_collapser<4>(binary).collapse(tree);
+    node_count = tree.size();
+
+    if (keys == 2) {
+        // The second key follows the first, with the same topology and the bounds at time1.
+        // Both keys are padded by a few ulps for the rounding of their interpolation.
+        auto last = tree;
+        fit(tree, time0);
+        fit(last, time1);
+        for (size_t n = 0; n < node_count; n++) {
+            for (int a = 0; a < 3; a++) {
+                for (int c = 0; c < 4; c++) {
+                    auto& lo0 = tree[n].lo[a][c];
+                    auto& hi0 = tree[n].hi[a][c];
+                    auto& lo1 = last[n].lo[a][c];
+                    auto& hi1 = last[n].hi[a][c];
+                    const auto scale = std::max(std::max(std::fabs(lo0), std::fabs(lo1)),
+                                                std::max(std::fabs(hi0), std::fabs(hi1)));
+                    const auto pad = 3 * std::numeric_limits<float>::epsilon() * scale;
+                    lo0 -= pad;
+                    lo1 -= pad;
+                    hi0 += pad;
+                    hi1 += pad;
+                }
+            }
+        }
+        tree.insert(tree.end(), last.begin(), last.end());
+    }
+
+    nodes = shared_array<wide_bvh_node<4>>(std::move(tree));
+    return added_order;
+}
+
+
+void primitive_pool::fit(std::vector<wide_bvh_node<4>>& tree, real time) const {
+    // Sets every child's bounds to its primitives at the given time. Children come after
+    // their parents, so walking back from the last node fits each node before its parent.
+    for (auto n = tree.size(); n-- > 0;) {
+        auto& node = tree[n];
+        for (uint32_t c = 0; c < node.num_children; c++) {
+            point3 lo( infinity,  infinity,  infinity);
+            point3 hi(-infinity, -infinity, -infinity);
+
+            if (node.count[c] > 0) {
+                for (auto i = node.child[c]; i < node.child[c] + node.count[c]; i++) {
+                    const auto k = kind_of(i);
+                    const auto b = bounds(k, i - first[k], time, time);
+                    for (int a = 0; a < 3; a++) {
+                        lo[a] = fmin(lo[a], b.min()[a]);
+                        hi[a] = fmax(hi[a], b.max()[a]);
+                    }
+                }
+            } else {
+                const auto& child = tree[node.child[c]];
+                for (uint32_t g = 0; g < child.num_children; g++) {
+                    for (int a = 0; a < 3; a++) {
+                        lo[a] = fmin(lo[a], child.lo[a][g]);
+                        hi[a] = fmax(hi[a], child.hi[a][g]);
+                    }
+                }
+            }
+
+            // Rounded outward, as bvh_builder rounds its boxes.
+            for (int a = 0; a < 3; a++) {
+                auto lo_a = static_cast<float>(lo[a]);
+                auto hi_a = static_cast<float>(hi[a]);
+                if (lo_a > lo[a]) lo_a = std::nextafter(lo_a, -INFINITY);
+                if (hi_a < hi[a]) hi_a = std::nextafter(hi_a,  INFINITY);
+                node.lo[a][c] = lo_a;
+                node.hi[a][c] = hi_a;
+            }
+        }
+    }
+}
+
+
+bool primitive_pool::leaf_hit(
+    uint32_t index, uint32_t count, const ray& r, real t_min, real& t_max, hit_record& rec
+) const {
+    using primitive_pool_detail::nearest;
+    const auto k = kind_of(index);
+    const auto local = index - first[k];
+    switch (k) {
+    case pool_spheres:
+        return nearest(spheres, local, count, index, r, t_min, t_max, rec);
+    case pool_moving_spheres:
+        return nearest(moving_spheres, local, count, index, r, t_min, t_max, rec);
+    case pool_xy_rects:
+        return nearest(xy_rects, local, count, index, r, t_min, t_max, rec);
+    case pool_xz_rects:
+        return nearest(xz_rects, local, count, index, r, t_min, t_max, rec);
+    default:
+        return nearest(yz_rects, local, count, index, r, t_min, t_max, rec);
+    }
+}
+
+
+bool primitive_pool::leaf_occluded(
+    uint32_t index, uint32_t count, const ray& r, real t_min, real t_max
+) const {
+    using primitive_pool_detail::any;
+    const auto k = kind_of(index);
+    const auto local = index - first[k];
+    switch (k) {
+    case pool_spheres:        return any(spheres, local, count, r, t_min, t_max);
+    case pool_moving_spheres: return any(moving_spheres, local, count, r, t_min, t_max);
+    case pool_xy_rects:       return any(xy_rects, local, count, r, t_min, t_max);
+    case pool_xz_rects:       return any(xz_rects, local, count, r, t_min, t_max);
+    default:                  return any(yz_rects, local, count, r, t_min, t_max);
+    }
+}
+
+
+void primitive_pool::surface(const ray& r, hit_record& rec) const {
+    using primitive_pool_detail::shade;
+    const auto k = kind_of(rec.part);
+    const auto local = rec.part - first[k];
+    switch (k) {
+    case pool_spheres:        shade(spheres, local, r, materials, rec); break;
+    case pool_moving_spheres: shade(moving_spheres, local, r, materials, rec); break;
+    case pool_xy_rects:       shade(xy_rects, local, r, materials, rec); break;
+    case pool_xz_rects:       shade(xz_rects, local, r, materials, rec); break;
+    default:                  shade(yz_rects, local, r, materials, rec); break;
+    }
+}
+
+
+bool primitive_pool::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    // The walk of wide_bvh::hit, keeping only t and the primitive until surface().
+    if (nodes.empty())
+        return false;
+
+    const wide_ray wr(r);
+    const auto s = key_fraction(r);
+
+    struct entry {
+        uint32_t index;  // Node index, or the first primitive of a leaf
+        uint32_t count;  // Leaf primitive count, or 0 for a node
+        float t_near;
+    };
+
+    entry stack[64 * 4];
+    int stack_size = 0;
+    stack[stack_size++] = entry{0, 0, -std::numeric_limits<float>::infinity()};
+
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+        const auto current = stack[--stack_size];
+        if (current.t_near > t_max)
+            continue;
+
+        if (current.count > 0) {
+            if (leaf_hit(current.index, current.count, r, t_min, t_max, rec))
+                hit_anything = true;
+            continue;
+        }
+
+        const auto& node = nodes[current.index];
+        RTW_STAT(stat_bvh_nodes);
+        float t_near[4];
+        auto mask = slab_test(current.index, wr, s, t_min, t_max, t_near);
+
+        // Nearest child last, so that it ends up on top of the stack.
+        entry hits[4];
+        int hit_count = 0;
+        for (int c = 0; c < 4; c++) {
+            if (!(mask & (1 << c)))
+                continue;
+
+            entry e{node.child[c], node.count[c], t_near[c]};
+            int k = hit_count++;
+            while (k > 0 && hits[k-1].t_near < e.t_near) {
+                hits[k] = hits[k-1];
+                k--;
+            }
+            hits[k] = e;
+        }
+
+        for (int k = 0; k < hit_count; k++)
+            stack[stack_size++] = hits[k];
+    }
+
+    if (hit_anything) {
+        rec.object = this;
+        rec.pending = true;
+    }
+    return hit_anything;
+}
+
+
+bool primitive_pool::occluded(const ray& r, real t_min, real t_max) const {
+    if (nodes.empty())
+        return false;
+
+    const wide_ray wr(r);
+    const auto s = key_fraction(r);
+
+    struct entry {
+        uint32_t index;
+        uint32_t count;
+    };
+
+    entry stack[64 * 4];
+    int stack_size = 0;
+    stack[stack_size++] = entry{0, 0};
+
+    while (stack_size > 0) {
+        const auto current = stack[--stack_size];
+
+        if (current.count > 0) {
+            if (leaf_occluded(current.index, current.count, r, t_min, t_max))
+                return true;
+            continue;
+        }
+
+        const auto& node = nodes[current.index];
+        RTW_STAT(stat_bvh_nodes);
+        float t_near[4];
+        auto mask = slab_test(current.index, wr, s, t_min, t_max, t_near);
+
+        for (int c = 0; c < 4; c++) {
+            if (mask & (1 << c))
+                stack[stack_size++] = entry{node.child[c], node.count[c]};
+        }
+    }
+
+    return false;
+}
+
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef RAY_COLOR_H
+#define RAY_COLOR_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "hittable.h"
+#include "material.h"
+
+
+color ray_color(const ray& r, const color& background, const hittable& world, int depth) {
+    hit_record rec;
+
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    if (depth <= 0)
+        return color(0, 0, 0);
+    start_bounce(depth);
+
+    // If the ray hits nothing, return the background color.
+    RTW_STAT(stat_path_rays);
+    if (!world.hit(r, 0.001, infinity, rec))
+        return background;
+    rec.complete(r);
+
+    ray scattered;
+    color attenuation;
+    color emitted = material_emitted(*rec.mat_ptr, rec.u, rec.v, rec.p);
+
+    if (!material_scatter(*rec.mat_ptr, r, rec, attenuation, scattered))
+        return emitted;
+
+    return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
+}
+
+
+color ray_color_iterative(
+    ray r, const color& background, const hittable& world, int max_depth, int rr_depth
+) {
+    // Same estimate as ray_color, but walks the path in a loop, carrying the product of the
+    // attenuations so far, and plays Russian roulette from bounce rr_depth on.
+    color radiance(0, 0, 0);
+    color throughput(1, 1, 1);
+
+    for (int depth = 0; depth < max_depth; ++depth) {
+        hit_record rec;
+        start_bounce(depth);
+
+        RTW_STAT(stat_path_rays);
+        if (!world.hit(r, 0.001, infinity, rec)) {
+            radiance += throughput * background;
+            break;
+        }
+        rec.complete(r);
+
+        ray scattered;
+        color attenuation;
+        radiance += throughput * material_emitted(*rec.mat_ptr, rec.u, rec.v, rec.p);
+
+        if (!material_scatter(*rec.mat_ptr, r, rec, attenuation, scattered))
+            break;
+
+        throughput = throughput * attenuation;
+        r = scattered;
+
+        if (depth + 1 >= rr_depth && !russian_roulette(throughput))
+            break;
+    }
+
+    return radiance;
+}
+
+
+#endif
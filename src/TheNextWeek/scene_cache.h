@@ -0,0 +1,336 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// A built scene saved in binary next to its scene file, so that rendering the same file again
+// skips parsing, mesh loading and every BVH build. The cache is a header followed by the
+// arrays of a scene_description in native byte order, each starting on a 64-byte boundary,
+// and is matched to its scene file by a hash of the file's text and the sizes of the meshes
+// it reads. It guards against stale caches, not malicious ones.
+//
+// A cache is read by mapping it into memory, and the scene's arrays, the BVH nodes and mesh
+// triangles among them, are used where they lie in the mapping instead of being copied out, so
+// that loading costs little more than the validation pass, and render processes on one host
+// that load the same scene share one copy of its pages.
+
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "mapped_file.h"
+#include "scene_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+const uint32_t scene_cache_version = 4;
+
+struct scene_cache_section {
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+enum scene_cache_array {
+    cache_textures, cache_materials, cache_shapes, cache_children, cache_bvh_nodes,
+    cache_mesh_nodes, cache_vertices, cache_indices, cache_dependencies, cache_strings,
+    cache_array_count
+};
+
+struct scene_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // 0x01020304 as the writer stored it
+    uint64_t key;
+    uint32_t root;
+    uint32_t pad;
+    scene_view view;
+    scene_cache_section sections[cache_array_count];
+};
+
+
+// FNV-1a over the text of a scene file.
+inline uint64_t scene_key(const std::string& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+namespace scene_cache_detail {
+
+    inline const char* magic() { return "RTWSCN1"; }  // 8 bytes with the NUL
+
+    inline uint64_t align(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+
+    // A temporary name next to path that no other process writing the same cache will use.
+    inline std::string temporary_path(const std::string& path) {
+#if defined(_WIN32)
+        const auto pid = static_cast<unsigned long>(GetCurrentProcessId());
+#else
+        const auto pid = static_cast<unsigned long>(getpid());
+#endif
+        return path + "." + std::to_string(pid) + ".tmp";
+    }
+
+    template <typename T>
+    void describe(scene_cache_section& section, uint64_t& end, const T& array) {
+        section.offset = align(end);
+        section.bytes = sizeof(array[0]) * array.size();
+        end = section.offset + section.bytes;
+    }
+
+    template <typename T>
+    bool write(std::FILE* file, const scene_cache_section& section, const T& array) {
+        static const char zeros[64] = {};
+        auto padding = section.offset - static_cast<uint64_t>(std::ftell(file));
+        return std::fwrite(zeros, 1, padding, file) == padding
+            && std::fwrite(array.data(), 1, section.bytes, file) == section.bytes;
+    }
+
+    // Points array at its section of the mapped file, which it then keeps mapped.
+    template <typename T>
+    bool view(
+        const shared_ptr<const mapped_file>& file, const scene_cache_section& section,
+        shared_array<T>& array
+    ) {
+        const auto size = static_cast<uint64_t>(file->size());
+        if (section.offset > size || section.bytes > size - section.offset
+            || section.bytes % sizeof(T) != 0 || section.offset % alignof(T) != 0)
+            return false;
+        const auto* first = reinterpret_cast<const T*>(file->data() + section.offset);
+        array = shared_array<T>(first, section.bytes / sizeof(T), file);
+        return true;
+    }
+
+    inline uint64_t file_size(const std::string& path) {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        return in ? static_cast<uint64_t>(in.tellg()) : ~uint64_t(0);
+    }
+
+    inline bool within(uint32_t first, uint32_t count, size_t size) {
+        return first <= size && count <= size - first;
+    }
+
+    // Whether every index in scene refers to something that exists. Children always come
+    // before the shapes that hold them, which rules out cycles.
+    inline bool consistent(const scene_description& scene) {
+        if (!scene.strings.empty() && scene.strings[scene.strings.size() - 1] != '\0')
+            return false;
+
+        const auto texture_count = scene.textures.size();
+        for (size_t k = 0; k < texture_count; k++) {
+            const auto& t = scene.textures[k];
+            auto type = static_cast<scene_texture_type>(t.type);
+            if ((type == scene_texture_type::checker && (t.ref[0] >= k || t.ref[1] >= k))
+                || (type == scene_texture_type::image && t.ref[0] >= scene.strings.size()))
+                return false;
+        }
+
+        for (const auto& m : scene.materials) {
+            auto type = static_cast<scene_material_type>(m.type);
+            if ((type == scene_material_type::lambertian || type == scene_material_type::light)
+                && m.texture >= texture_count)
+                return false;
+        }
+
+        for (size_t k = 0; k < scene.shapes.size(); k++) {
+            const auto& s = scene.shapes[k];
+            if (s.type > static_cast<uint32_t>(scene_shape_type::mesh))
+                return false;
+
+            const auto type = static_cast<scene_shape_type>(s.type);
+            if (type == scene_shape_type::mesh) {
+                const auto vertex_floats = 3 * size_t(s.ref[1]);
+                if (!within(s.ref[0], uint32_t(vertex_floats), scene.vertices.size())
+                    || !within(s.ref[4], 3 * s.ref[5], scene.indices.size())
+                    || !within(s.ref[6], s.ref[7], scene.mesh_nodes.size())
+                    || (s.ref[2] != scene_none
+                        && !within(s.ref[2], uint32_t(vertex_floats), scene.vertices.size()))
+                    || (s.ref[3] != scene_none
+                        && !within(s.ref[3], 2 * s.ref[1], scene.vertices.size())))
+                    return false;
+            } else if (type < scene_shape_type::sphere) {
+                if (!within(s.ref[0], s.ref[1], scene.children.size()) || s.ref[1] == 0)
+                    return false;
+                for (uint32_t c = 0; c < s.ref[1]; c++) {
+                    if (scene.children[s.ref[0] + c] >= k)
+                        return false;
+                }
+                if (type == scene_shape_type::bvh
+                    && !within(s.ref[2], s.ref[3], scene.bvh_nodes.size()))
+                    return false;
+                if (type == scene_shape_type::medium
+                    && (s.material >= texture_count
+                        || (s.ref[2] != scene_none && s.ref[2] >= texture_count)))
+                    return false;
+            }
+
+            if (type >= scene_shape_type::sphere && s.material >= scene.materials.size())
+                return false;
+        }
+
+        return scene.root < scene.shapes.size()
+            && scene.shapes[scene.root].type == static_cast<uint32_t>(scene_shape_type::group);
+    }
+
+}
+
+
+// Saves a built scene. Like a framebuffer checkpoint, the cache is written under a temporary
+// name, one for each process, and renamed into place, so renders that miss the cache at once
+// each replace it with a whole file of their own.
+inline bool write_scene_cache(
+    const std::string& path, uint64_t key, const scene_description& scene
+) {
+    using namespace scene_cache_detail;
+
+    scene_cache_header header = {};
+    std::memcpy(header.magic, magic(), 8);
+    header.version = scene_cache_version;
+    header.byte_order = 0x01020304;
+    header.key = key;
+    header.root = scene.root;
+    header.view = scene.view;
+
+    auto* s = header.sections;
+    uint64_t end = sizeof header;
+    describe(s[cache_textures], end, scene.textures);
+    describe(s[cache_materials], end, scene.materials);
+    describe(s[cache_shapes], end, scene.shapes);
+    describe(s[cache_children], end, scene.children);
+    describe(s[cache_bvh_nodes], end, scene.bvh_nodes);
+    describe(s[cache_mesh_nodes], end, scene.mesh_nodes);
+    describe(s[cache_vertices], end, scene.vertices);
+    describe(s[cache_indices], end, scene.indices);
+    describe(s[cache_dependencies], end, scene.dependencies);
+    describe(s[cache_strings], end, scene.strings);
+
+    const auto temporary = temporary_path(path);
+    auto file = std::fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = std::fwrite(&header, sizeof header, 1, file) == 1
+           && write(file, s[cache_textures], scene.textures)
+           && write(file, s[cache_materials], scene.materials)
+           && write(file, s[cache_shapes], scene.shapes)
+           && write(file, s[cache_children], scene.children)
+           && write(file, s[cache_bvh_nodes], scene.bvh_nodes)
+           && write(file, s[cache_mesh_nodes], scene.mesh_nodes)
+           && write(file, s[cache_vertices], scene.vertices)
+           && write(file, s[cache_indices], scene.indices)
+           && write(file, s[cache_dependencies], scene.dependencies)
+           && write(file, s[cache_strings], scene.strings);
+    ok = std::fclose(file) == 0 && ok;
+
+    const bool written = ok;
+    ok = written && std::rename(temporary.c_str(), path.c_str()) == 0;
+#if defined(_WIN32)
+    // Windows won't rename over an existing file, so there the old cache goes first.
+    if (written && !ok) {
+        std::remove(path.c_str());
+        ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+#endif
+    if (!ok)
+        std::remove(temporary.c_str());
+    return ok;
+}
+
+
+// Replaces scene with the cache at path, mapped into memory. Returns false, leaving scene in an
+// unspecified state, if there is no cache, or it was made from other text (a different key),
+// with the other byte order or from meshes that have since changed, or if it doesn't hold
+// together.
+inline bool read_scene_cache(const std::string& path, uint64_t key, scene_description& scene) {
+    using namespace scene_cache_detail;
+
+    auto file = mapped_file::open(path);
+    if (!file || file->size() < sizeof(scene_cache_header))
+        return false;
+
+    scene_cache_header header;
+    std::memcpy(&header, file->data(), sizeof header);
+    bool ok = std::memcmp(header.magic, magic(), 8) == 0
+           && header.version == scene_cache_version
+           && header.byte_order == 0x01020304
+           && header.key == key;
+
+    const auto* s = header.sections;
+    ok = ok && view(file, s[cache_textures], scene.textures)
+            && view(file, s[cache_materials], scene.materials)
+            && view(file, s[cache_shapes], scene.shapes)
+            && view(file, s[cache_children], scene.children)
+            && view(file, s[cache_bvh_nodes], scene.bvh_nodes)
+            && view(file, s[cache_mesh_nodes], scene.mesh_nodes)
+            && view(file, s[cache_vertices], scene.vertices)
+            && view(file, s[cache_indices], scene.indices)
+            && view(file, s[cache_dependencies], scene.dependencies)
+            && view(file, s[cache_strings], scene.strings);
+
+    if (!ok)
+        return false;
+    scene.view = header.view;
+    scene.root = header.root;
+
+    if (!consistent(scene))
+        return false;
+    for (const auto& dependency : scene.dependencies) {
+        if (dependency.path >= scene.strings.size()
+            || file_size(scene.string(dependency.path)) != dependency.size)
+            return false;
+    }
+    return true;
+}
+
+
+// Loads the scene file at path into scene and world. With a cache, a scene whose cache still
+// matches is read from it, and any other is parsed, built and then cached.
+inline bool load_scene_file(
+    const std::string& path, bool use_cache, scene_description& scene, hittable_list& world
+) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Could not read scene file " << path << '\n';
+        return false;
+    }
+    const std::string text(
+        (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    const auto key = scene_key(text);
+    const auto cache_path = path + ".cache";
+    if (use_cache && read_scene_cache(cache_path, key, scene)) {
+        world = build_scene(scene);
+        return true;
+    }
+
+    scene = scene_description();
+    std::istringstream in(text);
+    if (!read_scene_file(path, in, scene))
+        return false;
+
+    world = build_scene(scene);
+    if (use_cache && !write_scene_cache(cache_path, key, scene))
+        std::cerr << "Could not write the scene cache " << cache_path << '\n';
+    return true;
+}
+
+
+#endif
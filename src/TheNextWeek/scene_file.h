@@ -0,0 +1,884 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Scenes described in text instead of C++. A scene file holds one statement per line, with
+// '#' starting a comment:
+//
+//     camera lookfrom 278 278 -800 lookat 278 278 0 vfov 40
+//     background 0 0 0
+//
+//     texture white solid .73 .73 .73
+//     material white lambertian white
+//     material light light lamp             # diffuse_light, emitting texture lamp
+//
+//     sphere 0 1 0  1  glass
+//     transform rotate_y 15 translate 265 0 295
+//         box 0 0 0  165 330 165  white
+//     end
+//
+// Textures are `solid R G B`, `checker EVEN ODD`, `noise SCALE` or `image PATH`. Materials are
+// `lambertian TEXTURE`, `metal R G B FUZZ`, `dielectric INDEX` or `light TEXTURE`. Primitives
+// are `sphere X Y Z RADIUS`, `moving_sphere X0 Y0 Z0 X1 Y1 Z1 T0 T1 RADIUS`, `xy_rect X0 X1 Y0
+// Y1 K`, `xz_rect X0 X1 Z0 Z1 K`, `yz_rect Y0 Y1 Z0 Z1 K`, `box X0 Y0 Z0 X1 Y1 Z1` and
+// `mesh PATH` (OBJ or PLY), each followed by its material. Paths are relative to the file.
+//
+// Blocks, closed by `end`, apply to what they hold: `group`, `bvh` (a BVH over its contents),
+// `flip`, `medium DENSITY TEXTURE [DENSITY_TEXTURE]` (a medium bounded by its contents, of
+// constant density or scaled by the mean of the second texture's channels), and
+// `transform` followed by any of `translate X Y Z`, `rotate_y DEGREES`, `rotate X Y Z DEGREES`
+// and `scale X Y Z`, applied in the order written. `define NAME` ... `end` builds its contents
+// without adding them to the scene, and `use NAME` adds them, as often as wanted, all sharing
+// one object. A `bvh` holding nothing but spheres, moving spheres and rectangles becomes a
+// primitive pool of them instead. The camera takes `lookfrom`, `lookat` and `vup` points,
+// `vfov` in degrees, `aperture` and `focus`; lights are surfaces with a light material.
+
+#include "rtweekend.h"
+
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "mesh_io.h"
+#include "moving_sphere.h"
+#include "primitive_pool.h"
+#include "shared_array.h"
+#include "sphere.h"
+#include "texture.h"
+#include "texture_cache.h"
+#include "triangle_mesh.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// A parsed scene is a set of flat records that refer to each other by index. Every record is
+// plain data of a fixed size, so a scene cache can store the arrays exactly as they are, and a
+// scene read back from one can use them where they lie in the mapped file.
+
+const uint32_t scene_none = 0xffffffffu;  // An index that refers to nothing
+
+enum class scene_texture_type : uint32_t { solid, checker, noise, image };
+
+struct scene_texture {
+    uint32_t type;
+    uint32_t ref[2];   // checker: the even and odd textures. image: the path, in strings.
+    uint32_t pad;
+    double param[3];   // solid: the color. noise: the scale.
+};
+
+enum class scene_material_type : uint32_t { lambertian, metal, dielectric, light };
+
+struct scene_material {
+    uint32_t type;
+    uint32_t texture;  // lambertian, light
+    double param[4];   // metal: albedo and fuzz. dielectric: refractive index.
+};
+
+enum class scene_shape_type : uint32_t {
+    group, bvh, flip, medium, translate, rotate_y, rotate, scale,
+    sphere, moving_sphere, xy_rect, xz_rect, yz_rect, box, mesh
+};
+
+struct scene_shape {
+    // Shapes that hold others (group through scale) list them in ref[0] and ref[1], as the
+    // first and the number of their entries in children. A bvh keeps its nodes in ref[2] and
+    // ref[3], the same way, once built, whether it is a bvh4 or a pool; a medium keeps its
+    // density texture, if any, in ref[2], and a mesh its arrays in ref[0] to ref[7]. The
+    // params are the primitive's constructor arguments, the transform's, the medium's
+    // density, or the bounds of a built bvh or mesh.
+    uint32_t type;
+    uint32_t material;  // A primitive's material, or a medium's texture
+    uint32_t ref[8];
+    double param[12];
+};
+
+struct scene_view {
+    double lookfrom[3];
+    double lookat[3];
+    double vup[3];
+    double vfov;
+    double aperture;
+    double focus;
+    double background[3];
+};
+
+struct scene_dependency {
+    // A file the scene read, with its size then, so a cache can tell whether it changed.
+    uint32_t path;  // In strings
+    uint32_t pad;
+    uint64_t size;
+};
+
+
+struct scene_description {
+    // The arrays are read-only; a built BVH or mesh shares them rather than copying them.
+    scene_view view = {
+        { 0, 0, 1 }, { 0, 0, 0 }, { 0, 1, 0 }, 40, 0, 10, { 0, 0, 0 }
+    };
+    shared_array<scene_texture> textures;
+    shared_array<scene_material> materials;
+    shared_array<scene_shape> shapes;
+    shared_array<uint32_t> children;             // Grouped by the shape that holds them
+    shared_array<wide_bvh_node<4>> bvh_nodes;
+    shared_array<flat_bvh_node> mesh_nodes;
+    shared_array<float> vertices;                // Mesh positions, normals and UVs
+    shared_array<uint32_t> indices;              // Mesh triangles
+    shared_array<scene_dependency> dependencies;
+    shared_array<char> strings;                  // Paths, each ending in a NUL
+    uint32_t root = 0;                           // The group of everything in the scene
+
+    const char* string(uint32_t offset) const { return strings.data() + offset; }
+};
+
+
+namespace scene_file_detail {
+
+    // A path relative to the directory of the file that names it, unless it is absolute.
+    inline std::string resolve(const std::string& file, const std::string& path) {
+        if (path.empty() || path[0] == '/' || path[0] == '\\' || path.find(':') != path.npos)
+            return path;
+        auto slash = file.find_last_of("/\\");
+        return slash == file.npos ? path : file.substr(0, slash + 1) + path;
+    }
+
+    inline scene_shape make_shape(scene_shape_type type) {
+        scene_shape shape = {};
+        shape.type = static_cast<uint32_t>(type);
+        shape.material = scene_none;
+        return shape;
+    }
+
+    // Whether a bvh shape holds only primitives a primitive_pool can hold.
+    inline bool poolable(const scene_description& scene, const scene_shape& s) {
+        for (uint32_t k = 0; k < s.ref[1]; k++) {
+            const auto type = scene.shapes[scene.children[s.ref[0] + k]].type;
+            if (type < static_cast<uint32_t>(scene_shape_type::sphere)
+                || type > static_cast<uint32_t>(scene_shape_type::yz_rect))
+                return false;
+        }
+        return s.ref[1] > 0;
+    }
+
+
+    class parser {
+        public:
+            parser(const std::string& path, scene_description& scene)
+              : path(path), scene(scene), number(0) {}
+
+            bool parse(std::istream& in) {
+                blocks.resize(1);
+                blocks[0].shape = make_shape(scene_shape_type::group);
+
+                std::string line;
+                for (number = 1; std::getline(in, line); ++number) {
+                    std::istringstream fields(line.substr(0, line.find('#')));
+                    std::string keyword, extra;
+                    if (!(fields >> keyword))
+                        continue;
+                    if (!statement(keyword, fields))
+                        return false;
+                    if (fields >> extra)
+                        return error("unexpected \"" + extra + "\"");
+                }
+
+                if (blocks.size() > 1) {
+                    number = blocks.back().line;
+                    return error("block has no end");
+                }
+                scene.root = add_container(blocks[0].shape, blocks[0].items);
+                scene.textures = std::move(textures);
+                scene.materials = std::move(materials);
+                scene.shapes = std::move(shapes);
+                scene.children = std::move(children);
+                scene.vertices = std::move(vertices);
+                scene.indices = std::move(indices);
+                scene.dependencies = std::move(dependencies);
+                scene.strings = std::move(strings);
+                return true;
+            }
+
+        private:
+            struct block {
+                scene_shape shape;               // What the block makes, but for its contents
+                std::vector<scene_shape> steps;  // transform: one shape per step, in order
+                std::string name;                // define
+                std::vector<uint32_t> items;
+                int line;
+            };
+
+            const std::string& path;
+            scene_description& scene;
+            int number;
+            std::vector<block> blocks;
+            std::map<std::string, uint32_t> texture_names, material_names, shape_names;
+
+            // The arrays of the scene as they grow, handed to it once the file is parsed.
+            std::vector<scene_texture> textures;
+            std::vector<scene_material> materials;
+            std::vector<scene_shape> shapes;
+            std::vector<uint32_t> children;
+            std::vector<float> vertices;
+            std::vector<uint32_t> indices;
+            std::vector<scene_dependency> dependencies;
+            std::vector<char> strings;
+
+            bool error(const std::string& message) const {
+                std::cerr << path << ':' << number << ": " << message << '\n';
+                return false;
+            }
+
+            bool numbers(std::istream& fields, double* out, int count) const {
+                for (int k = 0; k < count; k++) {
+                    if (!(fields >> out[k]))
+                        return error("expected a number");
+                }
+                return true;
+            }
+
+            bool word(std::istream& fields, std::string& out, const char* what) const {
+                if (!(fields >> out))
+                    return error(std::string("expected ") + what);
+                return true;
+            }
+
+            bool lookup(
+                std::istream& fields, const std::map<std::string, uint32_t>& names,
+                const char* what, uint32_t& out
+            ) const {
+                std::string name;
+                if (!word(fields, name, what))
+                    return false;
+                auto found = names.find(name);
+                if (found == names.end())
+                    return error(std::string("no ") + what + " named " + name);
+                out = found->second;
+                return true;
+            }
+
+            bool define(
+                std::map<std::string, uint32_t>& names, const std::string& name, uint32_t index
+            ) const {
+                if (!names.insert(std::make_pair(name, index)).second)
+                    return error(name + " is already defined");
+                return true;
+            }
+
+            uint32_t add_string(const std::string& s) {
+                auto offset = static_cast<uint32_t>(strings.size());
+                strings.insert(strings.end(), s.begin(), s.end());
+                strings.push_back('\0');
+                return offset;
+            }
+
+            uint32_t add_shape(const scene_shape& shape) {
+                shapes.push_back(shape);
+                return static_cast<uint32_t>(shapes.size() - 1);
+            }
+
+            uint32_t add_container(scene_shape shape, const std::vector<uint32_t>& items) {
+                shape.ref[0] = static_cast<uint32_t>(children.size());
+                shape.ref[1] = static_cast<uint32_t>(items.size());
+                children.insert(children.end(), items.begin(), items.end());
+                return add_shape(shape);
+            }
+
+            // The items as one shape: the item itself if there is only one, or else a group.
+            uint32_t content(const std::vector<uint32_t>& items) {
+                if (items.size() == 1)
+                    return items[0];
+                return add_container(make_shape(scene_shape_type::group), items);
+            }
+
+            bool statement(const std::string& keyword, std::istream& fields) {
+                auto& view = scene.view;
+                if (keyword == "camera") {
+                    std::string key;
+                    while (fields >> key) {
+                        bool ok = key == "lookfrom" ? numbers(fields, view.lookfrom, 3)
+                                : key == "lookat"   ? numbers(fields, view.lookat, 3)
+                                : key == "vup"      ? numbers(fields, view.vup, 3)
+                                : key == "vfov"     ? numbers(fields, &view.vfov, 1)
+                                : key == "aperture" ? numbers(fields, &view.aperture, 1)
+                                : key == "focus"    ? numbers(fields, &view.focus, 1)
+                                : error("unknown camera setting " + key);
+                        if (!ok)
+                            return false;
+                    }
+                    return true;
+                }
+
+                if (keyword == "background")
+                    return numbers(fields, view.background, 3);
+                if (keyword == "texture")
+                    return texture(fields);
+                if (keyword == "material")
+                    return material(fields);
+
+                if (keyword == "use") {
+                    uint32_t shape;
+                    if (!lookup(fields, shape_names, "definition", shape))
+                        return false;
+                    blocks.back().items.push_back(shape);
+                    return true;
+                }
+
+                if (keyword == "end")
+                    return end();
+
+                static const char* const block_keywords[] = {
+                    "group", "bvh", "flip", "medium", "define", "transform"
+                };
+                for (auto block_keyword : block_keywords) {
+                    if (keyword == block_keyword)
+                        return begin(keyword, fields);
+                }
+                return primitive(keyword, fields);
+            }
+
+            bool texture(std::istream& fields) {
+                std::string name, type;
+                if (!word(fields, name, "a texture name")
+                    || !word(fields, type, "a texture type"))
+                    return false;
+
+                scene_texture t = {};
+                bool ok;
+                if (type == "solid") {
+                    t.type = static_cast<uint32_t>(scene_texture_type::solid);
+                    ok = numbers(fields, t.param, 3);
+                } else if (type == "checker") {
+                    t.type = static_cast<uint32_t>(scene_texture_type::checker);
+                    ok = lookup(fields, texture_names, "texture", t.ref[0])
+                      && lookup(fields, texture_names, "texture", t.ref[1]);
+                } else if (type == "noise") {
+                    t.type = static_cast<uint32_t>(scene_texture_type::noise);
+                    ok = numbers(fields, t.param, 1);
+                } else if (type == "image") {
+                    std::string file;
+                    t.type = static_cast<uint32_t>(scene_texture_type::image);
+                    ok = word(fields, file, "an image path");
+                    t.ref[0] = add_string(resolve(path, file));
+                } else {
+                    return error("unknown texture type " + type);
+                }
+
+                textures.push_back(t);
+                return ok && define(texture_names, name, uint32_t(textures.size() - 1));
+            }
+
+            bool material(std::istream& fields) {
+                std::string name, type;
+                if (!word(fields, name, "a material name")
+                    || !word(fields, type, "a material type"))
+                    return false;
+
+                scene_material m = {};
+                m.texture = scene_none;
+                bool ok;
+                if (type == "lambertian" || type == "light") {
+                    m.type = static_cast<uint32_t>(type == "light"
+                        ? scene_material_type::light : scene_material_type::lambertian);
+                    ok = lookup(fields, texture_names, "texture", m.texture);
+                } else if (type == "metal") {
+                    m.type = static_cast<uint32_t>(scene_material_type::metal);
+                    ok = numbers(fields, m.param, 4);
+                } else if (type == "dielectric") {
+                    m.type = static_cast<uint32_t>(scene_material_type::dielectric);
+                    ok = numbers(fields, m.param, 1);
+                } else {
+                    return error("unknown material type " + type);
+                }
+
+                materials.push_back(m);
+                return ok && define(material_names, name, uint32_t(materials.size() - 1));
+            }
+
+            bool begin(const std::string& keyword, std::istream& fields) {
+                block b;
+                b.line = number;
+                if (keyword == "group") {
+                    b.shape = make_shape(scene_shape_type::group);
+                } else if (keyword == "bvh") {
+                    b.shape = make_shape(scene_shape_type::bvh);
+                } else if (keyword == "flip") {
+                    b.shape = make_shape(scene_shape_type::flip);
+                } else if (keyword == "medium") {
+                    b.shape = make_shape(scene_shape_type::medium);
+                    if (!numbers(fields, b.shape.param, 1)
+                        || !lookup(fields, texture_names, "texture", b.shape.material))
+                        return false;
+                    b.shape.ref[2] = scene_none;
+                    if (!(fields >> std::ws).eof()
+                        && !lookup(fields, texture_names, "texture", b.shape.ref[2]))
+                        return false;
+                } else if (keyword == "define") {
+                    b.shape = make_shape(scene_shape_type::group);
+                    if (!word(fields, b.name, "a name"))
+                        return false;
+                } else {
+                    b.shape = make_shape(scene_shape_type::group);
+                    if (!transform_steps(fields, b.steps))
+                        return false;
+                }
+
+                blocks.push_back(std::move(b));
+                return true;
+            }
+
+            bool transform_steps(std::istream& fields, std::vector<scene_shape>& steps) const {
+                std::string step;
+                while (fields >> step) {
+                    scene_shape shape;
+                    bool ok;
+                    if (step == "translate") {
+                        shape = make_shape(scene_shape_type::translate);
+                        ok = numbers(fields, shape.param, 3);
+                    } else if (step == "rotate_y") {
+                        shape = make_shape(scene_shape_type::rotate_y);
+                        ok = numbers(fields, shape.param, 1);
+                    } else if (step == "rotate") {
+                        shape = make_shape(scene_shape_type::rotate);
+                        ok = numbers(fields, shape.param, 4);
+                    } else if (step == "scale") {
+                        shape = make_shape(scene_shape_type::scale);
+                        ok = numbers(fields, shape.param, 3);
+                    } else {
+                        return error("unknown transform " + step);
+                    }
+                    if (!ok)
+                        return false;
+                    steps.push_back(shape);
+                }
+
+                if (steps.empty())
+                    return error("transform needs at least one step");
+                return true;
+            }
+
+            bool end() {
+                if (blocks.size() == 1)
+                    return error("end without a block");
+                if (blocks.back().items.empty())
+                    return error("empty block");
+
+                auto b = std::move(blocks.back());
+                blocks.pop_back();
+
+                uint32_t shape;
+                const auto type = static_cast<scene_shape_type>(b.shape.type);
+                if (!b.steps.empty()) {
+                    shape = content(b.items);
+                    for (const auto& step : b.steps)
+                        shape = add_container(step, std::vector<uint32_t>(1, shape));
+                } else if (type == scene_shape_type::group) {
+                    shape = content(b.items);
+                } else if (type == scene_shape_type::bvh) {
+                    shape = add_container(b.shape, b.items);
+                } else {
+                    shape = add_container(b.shape, std::vector<uint32_t>(1, content(b.items)));
+                }
+
+                if (!b.name.empty())
+                    return define(shape_names, b.name, shape);
+                blocks.back().items.push_back(shape);
+                return true;
+            }
+
+            bool primitive(const std::string& keyword, std::istream& fields) {
+                static const struct {
+                    const char* keyword;
+                    scene_shape_type type;
+                    int params;
+                } primitives[] = {
+                    { "sphere",        scene_shape_type::sphere,        4 },
+                    { "moving_sphere", scene_shape_type::moving_sphere, 9 },
+                    { "xy_rect",       scene_shape_type::xy_rect,       5 },
+                    { "xz_rect",       scene_shape_type::xz_rect,       5 },
+                    { "yz_rect",       scene_shape_type::yz_rect,       5 },
+                    { "box",           scene_shape_type::box,           6 },
+                };
+
+                scene_shape shape;
+                if (keyword == "mesh") {
+                    shape = make_shape(scene_shape_type::mesh);
+                    std::string file;
+                    if (!word(fields, file, "a mesh path") || !mesh(resolve(path, file), shape))
+                        return false;
+                } else {
+                    bool known = false;
+                    for (const auto& p : primitives) {
+                        if (keyword == p.keyword) {
+                            shape = make_shape(p.type);
+                            if (!numbers(fields, shape.param, p.params))
+                                return false;
+                            known = true;
+                        }
+                    }
+                    if (!known)
+                        return error("unknown statement " + keyword);
+                }
+
+                if (!lookup(fields, material_names, "material", shape.material))
+                    return false;
+                blocks.back().items.push_back(add_shape(shape));
+                return true;
+            }
+
+            bool mesh(const std::string& file, scene_shape& shape) {
+                mesh_data mesh;
+                if (!load_mesh(file, mesh))
+                    return error("could not load the mesh");
+
+                std::ifstream in(file, std::ios::binary | std::ios::ate);
+                scene_dependency dependency = {};
+                dependency.path = add_string(file);
+                dependency.size = static_cast<uint64_t>(in.tellg());
+                dependencies.push_back(dependency);
+
+                auto append = [&](const std::vector<float>& values) {
+                    auto offset = static_cast<uint32_t>(vertices.size());
+                    vertices.insert(vertices.end(), values.begin(), values.end());
+                    return offset;
+                };
+
+                shape.ref[0] = append(mesh.positions);
+                shape.ref[1] = static_cast<uint32_t>(mesh.vertex_count());
+                shape.ref[2] = mesh.normals.size() == mesh.positions.size()
+                             ? append(mesh.normals) : scene_none;
+                shape.ref[3] = mesh.uvs.size() / 2 == mesh.vertex_count()
+                             ? append(mesh.uvs) : scene_none;
+                shape.ref[4] = static_cast<uint32_t>(indices.size());
+                shape.ref[5] = static_cast<uint32_t>(mesh.triangle_count());
+                indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+                return true;
+            }
+    };
+
+
+    class builder {
+        // Makes hittables of a description. A shape used in several places is built once and
+        // shared. BVHs and meshes that have no nodes yet are built, and their nodes, with
+        // children and triangles in leaf order, are stored back into the description, so
+        // that from then on it rebuilds without any BVH construction. Those that have nodes
+        // use them, and their triangles, in place in the description's arrays.
+        public:
+            builder(scene_description& scene) : scene(scene), built(scene.shapes.size()) {}
+
+            hittable_list build() {
+                for (const auto& t : scene.textures)
+                    textures.push_back(texture(t));
+                for (const auto& m : scene.materials)
+                    materials.push_back(material(m));
+
+                hittable_list world;
+                const auto& root = scene.shapes[scene.root];
+                for (uint32_t k = 0; k < root.ref[1]; k++)
+                    world.add(shape(scene.children[root.ref[0] + k]));
+
+                if (edited) {
+                    scene.shapes = std::move(edits.shapes);
+                    scene.children = std::move(edits.children);
+                    scene.bvh_nodes = std::move(edits.bvh_nodes);
+                    scene.mesh_nodes = std::move(edits.mesh_nodes);
+                    scene.indices = std::move(edits.indices);
+                }
+                return world;
+            }
+
+        private:
+            // Copies of the arrays that building a BVH or mesh changes, made when one is first
+            // built. Shapes are still read from the description, whose arrays stay unchanged
+            // until the build is done.
+            struct arrays {
+                std::vector<scene_shape> shapes;
+                std::vector<uint32_t> children;
+                std::vector<wide_bvh_node<4>> bvh_nodes;
+                std::vector<flat_bvh_node> mesh_nodes;
+                std::vector<uint32_t> indices;
+            };
+
+            scene_description& scene;
+            std::vector<shared_ptr<::texture>> textures;
+            std::vector<shared_ptr<::material>> materials;
+            std::vector<shared_ptr<hittable>> built;
+            arrays edits;
+            bool edited = false;
+
+            arrays& edit() {
+                if (!edited) {
+                    edits.shapes = scene.shapes.to_vector();
+                    edits.children = scene.children.to_vector();
+                    edits.bvh_nodes = scene.bvh_nodes.to_vector();
+                    edits.mesh_nodes = scene.mesh_nodes.to_vector();
+                    edits.indices = scene.indices.to_vector();
+                    edited = true;
+                }
+                return edits;
+            }
+
+            shared_ptr<::texture> texture(const scene_texture& t) const {
+                const auto* p = t.param;
+                switch (static_cast<scene_texture_type>(t.type)) {
+                case scene_texture_type::checker:
+                    return make_shared<checker_texture>(textures[t.ref[0]], textures[t.ref[1]]);
+                case scene_texture_type::noise:
+                    return make_shared<noise_texture>(p[0]);
+                case scene_texture_type::image:
+                    return load_texture(scene.string(t.ref[0]));
+                default:
+                    return make_shared<solid_color>(p[0], p[1], p[2]);
+                }
+            }
+
+            shared_ptr<::material> material(const scene_material& m) const {
+                const auto* p = m.param;
+                switch (static_cast<scene_material_type>(m.type)) {
+                case scene_material_type::metal:
+                    return make_shared<metal>(color(p[0], p[1], p[2]), p[3]);
+                case scene_material_type::dielectric:
+                    return make_shared<dielectric>(p[0]);
+                case scene_material_type::light:
+                    return make_shared<diffuse_light>(textures[m.texture]);
+                default:
+                    return make_shared<lambertian>(textures[m.texture]);
+                }
+            }
+
+            shared_ptr<hittable> shape(uint32_t index) {
+                if (!built[index])
+                    built[index] = make(index);
+                return built[index];
+            }
+
+            shared_ptr<hittable> child(const scene_shape& s) {
+                return shape(scene.children[s.ref[0]]);
+            }
+
+            shared_ptr<hittable> make(uint32_t index) {
+                const auto& s = scene.shapes[index];
+                const auto* p = s.param;
+                const bool primitive = s.type >= static_cast<uint32_t>(scene_shape_type::sphere);
+                const auto m = primitive ? materials[s.material] : nullptr;
+
+                switch (static_cast<scene_shape_type>(s.type)) {
+                case scene_shape_type::group: {
+                    auto list = make_shared<hittable_list>();
+                    for (uint32_t k = 0; k < s.ref[1]; k++)
+                        list->add(shape(scene.children[s.ref[0] + k]));
+                    return list;
+                }
+                case scene_shape_type::bvh:
+                    return bvh(index);
+                case scene_shape_type::flip:
+                    return make_shared<flip_face>(child(s));
+                case scene_shape_type::medium:
+                    if (s.ref[2] != scene_none) {
+                        return make_shared<heterogeneous_medium>(
+                            child(s), p[0], textures[s.ref[2]], textures[s.material]);
+                    }
+                    return make_shared<constant_medium>(child(s), p[0], textures[s.material]);
+                case scene_shape_type::translate:
+                    return make_shared<translate>(child(s), vec3(p[0], p[1], p[2]));
+                case scene_shape_type::rotate_y:
+                    return make_shared<rotate_y>(child(s), p[0]);
+                case scene_shape_type::rotate:
+                    return make_shared<instance>(child(s),
+                        affine::rotation(vec3(p[0], p[1], p[2]), p[3]),
+                        affine::rotation(vec3(p[0], p[1], p[2]), -p[3]));
+                case scene_shape_type::scale:
+                    return make_shared<instance>(child(s),
+                        affine::scaling(vec3(p[0], p[1], p[2])),
+                        affine::scaling(vec3(1/p[0], 1/p[1], 1/p[2])));
+                case scene_shape_type::sphere:
+                    return make_shared<sphere>(point3(p[0], p[1], p[2]), p[3], m);
+                case scene_shape_type::moving_sphere:
+                    return make_shared<moving_sphere>(
+                        point3(p[0], p[1], p[2]), point3(p[3], p[4], p[5]), p[6], p[7], p[8], m);
+                case scene_shape_type::xy_rect:
+                    return make_shared<xy_rect>(p[0], p[1], p[2], p[3], p[4], m);
+                case scene_shape_type::xz_rect:
+                    return make_shared<xz_rect>(p[0], p[1], p[2], p[3], p[4], m);
+                case scene_shape_type::yz_rect:
+                    return make_shared<yz_rect>(p[0], p[1], p[2], p[3], p[4], m);
+                case scene_shape_type::box:
+                    return make_shared<box>(point3(p[0], p[1], p[2]), point3(p[3], p[4], p[5]), m);
+                case scene_shape_type::mesh:
+                    return mesh(index);
+                }
+                return nullptr;
+            }
+
+            static aabb bounds(const double* p) {
+                return aabb(point3(p[0], p[1], p[2]), point3(p[3], p[4], p[5]));
+            }
+
+            static void store_bounds(const aabb& box, double* p) {
+                for (int a = 0; a < 3; a++) {
+                    p[a] = box.min()[a];
+                    p[3 + a] = box.max()[a];
+                }
+            }
+
+            shared_ptr<hittable> bvh(uint32_t index) {
+                const auto& s = scene.shapes[index];
+                if (poolable(scene, s))
+                    return pool(index);
+
+                const auto* children = &scene.children[s.ref[0]];
+                std::vector<shared_ptr<hittable>> objects;
+                for (uint32_t k = 0; k < s.ref[1]; k++)
+                    objects.push_back(shape(children[k]));
+
+                if (s.ref[3] > 0) {
+                    return make_shared<bvh4>(
+                        scene.bvh_nodes.slice(s.ref[2], s.ref[3]), std::move(objects),
+                        bounds(s.param));
+                }
+
+                auto tree = make_shared<bvh4>(objects, 0, 1);
+                auto& out = edit();
+                auto& stored = out.shapes[index];
+
+                // A child built twice is one object, so each object maps back to one shape.
+                std::unordered_map<const hittable*, uint32_t> shape_of;
+                for (uint32_t k = 0; k < s.ref[1]; k++)
+                    shape_of[objects[k].get()] = children[k];
+                for (uint32_t k = 0; k < s.ref[1]; k++)
+                    out.children[s.ref[0] + k] = shape_of[tree->primitives[k].get()];
+
+                stored.ref[2] = static_cast<uint32_t>(out.bvh_nodes.size());
+                stored.ref[3] = static_cast<uint32_t>(tree->nodes.size());
+                out.bvh_nodes.insert(out.bvh_nodes.end(), tree->nodes.begin(), tree->nodes.end());
+                store_bounds(tree->box, stored.param);
+                return tree;
+            }
+
+            void add(primitive_pool& pool, const scene_shape& s) const {
+                const auto* p = s.param;
+                const auto m = materials[s.material];
+                switch (static_cast<scene_shape_type>(s.type)) {
+                case scene_shape_type::sphere:
+                    pool.add_sphere(point3(p[0], p[1], p[2]), p[3], m);
+                    break;
+                case scene_shape_type::moving_sphere:
+                    pool.add_moving_sphere(
+                        point3(p[0], p[1], p[2]), point3(p[3], p[4], p[5]), p[6], p[7], p[8], m);
+                    break;
+                case scene_shape_type::xy_rect:
+                    pool.add_xy_rect(p[0], p[1], p[2], p[3], p[4], m);
+                    break;
+                case scene_shape_type::xz_rect:
+                    pool.add_xz_rect(p[0], p[1], p[2], p[3], p[4], m);
+                    break;
+                default:
+                    pool.add_yz_rect(p[0], p[1], p[2], p[3], p[4], m);
+                    break;
+                }
+            }
+
+            // A bvh of spheres and rectangles, as a pool of them. Once built, its children are
+            // stored in the pool's order, so that adding them again needs no reordering.
+            shared_ptr<hittable> pool(uint32_t index) {
+                const auto& s = scene.shapes[index];
+                const auto* children = &scene.children[s.ref[0]];
+                auto primitives = make_shared<primitive_pool>();
+                for (uint32_t k = 0; k < s.ref[1]; k++)
+                    add(*primitives, scene.shapes[children[k]]);
+
+                if (s.ref[3] > 0) {
+                    primitives->build(
+                        scene.bvh_nodes.slice(s.ref[2], s.ref[3]), bounds(s.param), 0, 1);
+                    return primitives;
+                }
+
+                const auto order = primitives->build(0, 1);
+                auto& out = edit();
+                auto& stored = out.shapes[index];
+                for (uint32_t k = 0; k < s.ref[1]; k++)
+                    out.children[s.ref[0] + k] = children[order[k]];
+
+                stored.ref[2] = static_cast<uint32_t>(out.bvh_nodes.size());
+                stored.ref[3] = static_cast<uint32_t>(primitives->nodes.size());
+                out.bvh_nodes.insert(
+                    out.bvh_nodes.end(), primitives->nodes.begin(), primitives->nodes.end());
+                store_bounds(primitives->box, stored.param);
+                return primitives;
+            }
+
+            shared_ptr<hittable> mesh(uint32_t index) {
+                const auto& s = scene.shapes[index];
+                const auto vertex_count = size_t(s.ref[1]);
+                const auto index_count = 3*size_t(s.ref[5]);
+                const auto m = materials[s.material];
+
+                if (s.ref[7] > 0) {
+                    const auto& v = scene.vertices;
+                    return make_shared<triangle_mesh>(
+                        v.slice(s.ref[0], 3*vertex_count),
+                        s.ref[2] != scene_none ? v.slice(s.ref[2], 3*vertex_count)
+                                               : shared_array<float>(),
+                        s.ref[3] != scene_none ? v.slice(s.ref[3], 2*vertex_count)
+                                               : shared_array<float>(),
+                        scene.indices.slice(s.ref[4], index_count),
+                        scene.mesh_nodes.slice(s.ref[6], s.ref[7]), bounds(s.param), m);
+                }
+
+                const auto* vertices = scene.vertices.data();
+                mesh_data mesh;
+                mesh.positions.assign(vertices + s.ref[0], vertices + s.ref[0] + 3*vertex_count);
+                if (s.ref[2] != scene_none)
+                    mesh.normals.assign(vertices + s.ref[2], vertices + s.ref[2] + 3*vertex_count);
+                if (s.ref[3] != scene_none)
+                    mesh.uvs.assign(vertices + s.ref[3], vertices + s.ref[3] + 2*vertex_count);
+                const auto* first_index = scene.indices.data() + s.ref[4];
+                mesh.indices.assign(first_index, first_index + index_count);
+
+                auto built_mesh = make_shared<triangle_mesh>(std::move(mesh), m);
+                auto& out = edit();
+                auto& stored = out.shapes[index];
+                std::copy(built_mesh->indices.begin(), built_mesh->indices.end(),
+                          out.indices.begin() + s.ref[4]);
+                stored.ref[6] = static_cast<uint32_t>(out.mesh_nodes.size());
+                stored.ref[7] = static_cast<uint32_t>(built_mesh->nodes.size());
+                out.mesh_nodes.insert(
+                    out.mesh_nodes.end(), built_mesh->nodes.begin(), built_mesh->nodes.end());
+                store_bounds(built_mesh->box, stored.param);
+                return built_mesh;
+            }
+    };
+
+}
+
+
+// Parses a scene file into scene, printing where and why if it can't.
+inline bool read_scene_file(
+    const std::string& path, std::istream& in, scene_description& scene
+) {
+    return scene_file_detail::parser(path, scene).parse(in);
+}
+
+
+// The hittables of a scene. Builds the BVHs and meshes it has no nodes for, and stores those
+// nodes in the scene.
+inline hittable_list build_scene(scene_description& scene) {
+    return scene_file_detail::builder(scene).build();
+}
+
+
+#endif
@@ -0,0 +1,498 @@
+#ifndef SCENES_H
+#define SCENES_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "moving_sphere.h"
+#include "primitive_pool.h"
+#include "sphere.h"
+#include "texture.h"
+#include "texture_cache.h"
+#include "triangle_mesh.h"
+
+#include <string>
+
+
+hittable_list random_spheres(bool fast_motion) {
+    // All the spheres, moving or not, go into one pool with a BVH of its own. With fast
+    // motion, every small sphere moves, across several times its size.
+    auto spheres = make_shared<primitive_pool>();
+    auto add_small = [&](const point3& center, shared_ptr<material> m) {
+        if (!fast_motion) {
+            spheres->add_sphere(center, 0.2, m);
+            return;
+        }
+        auto center2 = center + vec3(random_double(-1, 1), random_double(0, 1),
+                                     random_double(-1, 1));
+        spheres->add_moving_sphere(center, center2, 0.0, 1.0, 0.2, m);
+    };
+
+    auto checker = make_shared<checker_texture>(
+        make_shared<solid_color>(0.2, 0.3, 0.1),
+        make_shared<solid_color>(0.9, 0.9, 0.9)
+        );
+
+    spheres->add_sphere(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - vec3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_shared<lambertian>(make_shared<solid_color>(albedo));
+                    if (fast_motion) {
+                        add_small(center, sphere_material);
+                    } else {
+                        auto center2 = center + vec3(0, random_double(0, .5), 0);
+                        spheres->add_moving_sphere(center, center2, 0.0, 1.0, 0.2,
+                                                   sphere_material);
+                    }
+                }
+                else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_shared<metal>(albedo, fuzz);
+                    add_small(center, sphere_material);
+                }
+                else {
+                    // glass
+                    sphere_material = make_shared<dielectric>(1.5);
+                    add_small(center, sphere_material);
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<dielectric>(1.5);
+    spheres->add_sphere(point3(0, 1, 0), 1.0, material1);
+
+    auto material2 = make_shared<lambertian>(make_shared<solid_color>(color(0.4, 0.2, 0.1)));
+    spheres->add_sphere(point3(-4, 1, 0), 1.0, material2);
+
+    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    spheres->add_sphere(point3(4, 1, 0), 1.0, material3);
+
+    spheres->build(0.0, 1.0);
+    return hittable_list(spheres);
+}
+
+
+hittable_list random_scene() {
+    return random_spheres(false);
+}
+
+
+hittable_list random_motion() {
+    // random_scene with all of its small spheres in fast motion, so that most of the shutter
+    // interval's sweep of any sphere is empty at any one time.
+    return random_spheres(true);
+}
+
+
+hittable_list two_spheres() {
+    hittable_list objects;
+
+    auto checker = make_shared<checker_texture>(
+        make_shared<solid_color>(0.2, 0.3, 0.1),
+        make_shared<solid_color>(0.9, 0.9, 0.9)
+        );
+
+    objects.add(make_shared<sphere>(point3(0, -10, 0), 10, make_shared<lambertian>(checker)));
+    objects.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
+
+    return objects;
+}
+
+
+hittable_list two_perlin_spheres() {
+    hittable_list objects;
+
+    auto pertext = make_shared<noise_texture>(4);
+    objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+    objects.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+
+    return objects;
+}
+
+
+hittable_list earth() {
+    auto earth_texture = load_texture("earthmap.jpg");
+    auto earth_surface = make_shared<lambertian>(earth_texture);
+    auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
+
+    return hittable_list(globe);
+}
+
+
+hittable_list simple_light() {
+    hittable_list objects;
+
+    auto pertext = make_shared<noise_texture>(4);
+    objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+    objects.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+
+    auto difflight = make_shared<diffuse_light>(make_shared<solid_color>(4, 4, 4));
+    objects.add(make_shared<sphere>(point3(0, 7, 0), 2, difflight));
+    objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, difflight));
+
+    return objects;
+}
+
+
+hittable_list cornell_box() {
+    hittable_list objects;
+
+    auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
+    auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
+    auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(make_shared<solid_color>(15, 15, 15));
+
+    objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    objects.add(box1);
+
+    shared_ptr<hittable> box2 = make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+    objects.add(box2);
+
+    return objects;
+}
+
+
+hittable_list cornell_balls() {
+    hittable_list objects;
+
+    auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
+    auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
+    auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(make_shared<solid_color>(5, 5, 5));
+
+    objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    auto boundary = make_shared<sphere>(point3(160, 100, 145), 100, make_shared<dielectric>(1.5));
+    objects.add(boundary);
+    objects.add(make_shared<constant_medium>(boundary, 0.1, make_shared<solid_color>(1, 1, 1)));
+
+    shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    objects.add(box1);
+
+    return objects;
+}
+
+
+hittable_list cornell_smoke() {
+    hittable_list objects;
+
+    auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
+    auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
+    auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(make_shared<solid_color>(7, 7, 7));
+
+    objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+
+    shared_ptr<hittable> box2 = make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+
+    objects.add(make_shared<constant_medium>(box1, 0.01, make_shared<solid_color>(0, 0, 0)));
+    objects.add(make_shared<constant_medium>(box2, 0.01, make_shared<solid_color>(1, 1, 1)));
+
+    return objects;
+}
+
+
+hittable_list cornell_cloud() {
+    // The Cornell box around a cloud whose density follows the marbled Perlin noise.
+    hittable_list objects;
+
+    auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
+    auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
+    auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(make_shared<solid_color>(7, 7, 7));
+
+    objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    auto boundary = make_shared<sphere>(point3(278, 220, 278), 160, nullptr);
+    objects.add(make_shared<heterogeneous_medium>(
+        boundary, 0.05, make_shared<noise_texture>(0.05), make_shared<solid_color>(1, 1, 1)));
+
+    return objects;
+}
+
+
+hittable_list cornell_final() {
+    hittable_list objects;
+
+    auto pertext = make_shared<noise_texture>(0.1);
+
+    auto mat = make_shared<lambertian>(load_texture("earthmap.jpg"));
+
+    auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
+    auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
+    auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(make_shared<solid_color>(7, 7, 7));
+
+    objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    shared_ptr<hittable> boundary2 =
+        make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), make_shared<dielectric>(1.5));
+    boundary2 = make_shared<rotate_y>(boundary2, -18);
+    boundary2 = make_shared<translate>(boundary2, vec3(130, 0, 65));
+
+    auto tex = make_shared<solid_color>(0.9, 0.9, 0.9);
+
+    objects.add(boundary2);
+    objects.add(make_shared<constant_medium>(boundary2, 0.2, tex));
+
+    return objects;
+}
+
+
+mesh_data torus_mesh(real major_radius, real minor_radius, int rings, int sides) {
+    // A torus around the y axis with smooth normals and (ring, side) texture coordinates.
+    mesh_data mesh;
+    for (int i = 0; i <= rings; i++) {
+        auto phi = 2*pi * i / rings;
+        for (int j = 0; j <= sides; j++) {
+            auto theta = 2*pi * j / sides;
+            vec3 normal(cos(phi)*cos(theta), sin(theta), sin(phi)*cos(theta));
+            for (int a = 0; a < 3; a++) {
+                auto center = a == 1 ? 0 : major_radius * (a == 0 ? cos(phi) : sin(phi));
+                mesh.positions.push_back(static_cast<float>(center + minor_radius*normal[a]));
+                mesh.normals.push_back(static_cast<float>(normal[a]));
+            }
+            mesh.uvs.push_back(static_cast<float>(real(i) / rings));
+            mesh.uvs.push_back(static_cast<float>(real(j) / sides));
+        }
+    }
+
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            uint32_t a = i*(sides + 1) + j, b = a + sides + 1;
+            uint32_t quad[6] = { a, a + 1, b + 1, a, b + 1, b };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+    return mesh;
+}
+
+
+void fit_mesh(mesh_data& mesh, const point3& base, real size) {
+    // Scales and moves the mesh so its largest extent is size and its bounding box sits
+    // centered on base.
+    point3 lo( infinity,  infinity,  infinity);
+    point3 hi(-infinity, -infinity, -infinity);
+    for (size_t k = 0; k < mesh.positions.size(); k++) {
+        lo[k % 3] = fmin(lo[k % 3], mesh.positions[k]);
+        hi[k % 3] = fmax(hi[k % 3], mesh.positions[k]);
+    }
+
+    auto extent = hi - lo;
+    auto scale = size / fmax(extent.x(), fmax(extent.y(), extent.z()));
+    auto offset = base - scale * point3(0.5*(lo.x() + hi.x()), lo.y(), 0.5*(lo.z() + hi.z()));
+    for (size_t k = 0; k < mesh.positions.size(); k++)
+        mesh.positions[k] = static_cast<float>(scale * mesh.positions[k] + offset[k % 3]);
+}
+
+
+hittable_list cornell_mesh(const std::string& path) {
+    // The Cornell box around a model read from an OBJ or PLY file, or around a torus if
+    // there is no file.
+    hittable_list objects;
+
+    auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
+    auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
+    auto green = make_shared<lambertian>(make_shared<solid_color>(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(make_shared<solid_color>(15, 15, 15));
+
+    objects.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+    objects.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
+
+    mesh_data mesh;
+    if (path.empty() || !load_mesh(path, mesh)) {
+        if (!path.empty())
+            std::cerr << "Rendering a torus instead.\n";
+        mesh = torus_mesh(2, 0.8, 192, 96);
+    }
+    fit_mesh(mesh, point3(278, 0, 278), 350);
+
+    auto surface = make_shared<metal>(color(0.8, 0.85, 0.88), 0.15);
+    objects.add(make_shared<triangle_mesh>(std::move(mesh), surface));
+
+    return objects;
+}
+
+
+hittable_list instances() {
+    // A field of 625 tori, each an instance of one of three meshes, so there are three mesh
+    // BVHs however many tori there are, and one more BVH over the instances.
+    hittable_list world;
+
+    auto checker = make_shared<checker_texture>(
+        make_shared<solid_color>(0.2, 0.3, 0.1),
+        make_shared<solid_color>(0.9, 0.9, 0.9)
+        );
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+
+    const auto shape = torus_mesh(1, 0.4, 96, 48);
+    shared_ptr<hittable> prototypes[] = {
+        make_shared<triangle_mesh>(shape,
+            make_shared<lambertian>(make_shared<solid_color>(0.7, 0.3, 0.2))),
+        make_shared<triangle_mesh>(shape, make_shared<metal>(color(0.8, 0.7, 0.4), 0.1)),
+        make_shared<triangle_mesh>(shape, make_shared<dielectric>(1.5)),
+    };
+
+    hittable_list placed;
+    for (int a = -12; a < 13; a++) {
+        for (int b = -12; b < 13; b++) {
+            auto prototype = prototypes[static_cast<int>(random_double(0, 3))];
+            aabb box;
+            prototype->bounding_box(0, 1, box);
+
+            auto size = random_double(0.15, 0.3);
+            auto shape_to_world =
+                affine::rotation(random_unit_vector(), random_double(0, 360))
+                * affine::scaling(vec3(size, size * random_double(0.6, 1.4), size));
+
+            // Rest the torus on the ground.
+            auto lift = -shape_to_world.box(box).min().y();
+            auto position = vec3(a + 0.9*random_double(), lift, b + 0.9*random_double());
+            placed.add(make_shared<instance>(
+                prototype, affine::translation(position) * shape_to_world));
+        }
+    }
+
+    world.add(make_shared<flat_bvh>(placed, 0, 1));
+    return world;
+}
+
+
+hittable_list final_scene() {
+    hittable_list boxes1;
+    auto ground = make_shared<lambertian>(make_shared<solid_color>(0.48, 0.83, 0.53));
+
+    const int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i * w;
+            auto z0 = -1000.0 + j * w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = random_double(1, 101);
+            auto z1 = z0 + w;
+
+            boxes1.add(make_shared<box>(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+        }
+    }
+
+    hittable_list objects;
+
+    objects.add(make_shared<bvh4>(boxes1, 0, 1));
+
+    auto light = make_shared<diffuse_light>(make_shared<solid_color>(7, 7, 7));
+    objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+
+    auto center1 = point3(400, 400, 200);
+    auto center2 = center1 + vec3(30, 0, 0);
+    auto moving_sphere_material =
+        make_shared<lambertian>(make_shared<solid_color>(0.7, 0.3, 0.1));
+    objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+
+    objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
+    objects.add(make_shared<sphere>(
+        point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 10.0)
+        ));
+
+    auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
+    objects.add(boundary);
+    objects.add(make_shared<constant_medium>(
+        boundary, 0.2, make_shared<solid_color>(0.2, 0.4, 0.9)
+        ));
+    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
+    objects.add(make_shared<constant_medium>(boundary, .0001, make_shared<solid_color>(1, 1, 1)));
+
+    auto emat = make_shared<lambertian>(load_texture("earthmap.jpg"));
+    objects.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
+    auto pertext = make_shared<noise_texture>(0.1);
+    objects.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
+
+    auto boxes2 = make_shared<primitive_pool>();
+    auto white = make_shared<lambertian>(make_shared<solid_color>(.73, .73, .73));
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        boxes2->add_sphere(point3::random(0, 165), 10, white);
+    }
+    boxes2->build(0.0, 1.0);
+
+    objects.add(make_shared<translate>(
+        make_shared<rotate_y>(boxes2, 15),
+        vec3(-100, 270, 395)
+        )
+    );
+
+    return objects;
+}
+
+
+#endif
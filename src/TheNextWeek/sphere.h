@@ -19,26 +19,30 @@
 class sphere: public hittable  {
     public:
         sphere() {}
-        sphere(point3 cen, double r, shared_ptr<material> m)
+        sphere(point3 cen, real r, shared_ptr<material> m)
             : center(cen), radius(r), mat_ptr(m) {};
-        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual void surface(const ray& r, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+        virtual bool interval(const ray& r, real& t_enter, real& t_exit) const;
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const;
 
     public:
         point3 center;
-        double radius;
+        real radius;
         shared_ptr<material> mat_ptr;
 };
 
 
-bool sphere::bounding_box(double t0, double t1, aabb& output_box) const {
+bool sphere::bounding_box(real t0, real t1, aabb& output_box) const {
     output_box = aabb(
         center - vec3(radius, radius, radius),
         center + vec3(radius, radius, radius));
     return true;
 }
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    RTW_STAT(stat_primitive_tests);
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -52,22 +56,16 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
         auto temp = (-half_b - root)/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            rec.object = this;
+            rec.pending = true;
             return true;
         }
 
         temp = (-half_b + root)/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            rec.object = this;
+            rec.pending = true;
             return true;
         }
     }
@@ -75,4 +73,56 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     return false;
 }
 
+
+void sphere::surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(r, outward_normal);
+    get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
+    // u runs around the equator, 2 pi r, and v from pole to pole, pi r; this is their mean.
+    rec.set_footprint(r, sqrt(2.0) * pi * radius);
+    rec.mat_ptr = mat_ptr.get();
+}
+
+
+bool sphere::occluded(const ray& r, real t_min, real t_max) const {
+    RTW_STAT(stat_primitive_tests);
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant <= 0)
+        return false;
+
+    auto root = sqrt(discriminant);
+    auto temp = (-half_b - root)/a;
+    if (temp < t_max && temp > t_min)
+        return true;
+
+    temp = (-half_b + root)/a;
+    return temp < t_max && temp > t_min;
+}
+
+
+bool sphere::interval(const ray& r, real& t_enter, real& t_exit) const {
+    // Both roots of the one quadratic, rejected where hit() would reject the second.
+    RTW_STAT(stat_primitive_tests);
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant <= 0)
+        return false;
+
+    auto root = sqrt(discriminant);
+    t_enter = (-half_b - root)/a;
+    t_exit = (-half_b + root)/a;
+    return t_exit > t_enter + 0.0001;
+}
+
+
 #endif
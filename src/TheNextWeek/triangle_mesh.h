@@ -0,0 +1,295 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh_builder.h"
+#include "hittable.h"
+#include "mesh_io.h"
+#include "shared_array.h"
+
+#include <vector>
+
+
+class triangle_mesh : public hittable {
+    // An indexed triangle mesh as a single hittable: shared single-precision vertex arrays, three
+    // indices per triangle, and a BVH of its own over the triangles. The index triples are kept
+    // in the BVH's leaf order, so a leaf is just a range of triangles, and a triangle costs its
+    // 12 bytes of indices plus its share of vertices and nodes instead of a heap object. The
+    // arrays are read-only once built, so a mesh can also use them in place in a mapped file.
+    public:
+        triangle_mesh() {}
+
+        triangle_mesh(
+            mesh_data mesh, shared_ptr<material> m,
+            const bvh_build_options& options = bvh_build_options());
+
+        // A mesh whose BVH was built earlier: its indices are already in leaf order, and nodes
+        // and box are what the other constructor made of them. Normals and uvs may be empty.
+        triangle_mesh(
+            shared_array<float> positions, shared_array<float> normals, shared_array<float> uvs,
+            shared_array<uint32_t> indices, shared_array<flat_bvh_node> nodes, const aabb& box,
+            shared_ptr<material> m)
+          : positions(std::move(positions)), normals(std::move(normals)), uvs(std::move(uvs)),
+            indices(std::move(indices)), nodes(std::move(nodes)), mat_ptr(m), box(box) {}
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
+        virtual void surface(const ray& r, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
+            output_box = box;
+            return !nodes.empty();
+        }
+
+        size_t triangle_count() const { return indices.size() / 3; }
+
+        // Memory held by the mesh and its BVH.
+        size_t bytes() const {
+            return sizeof(float) * (positions.size() + normals.size() + uvs.size())
+                 + sizeof(uint32_t) * indices.size() + sizeof(flat_bvh_node) * nodes.size();
+        }
+
+    public:
+        shared_array<float> positions;
+        shared_array<float> normals;     // Empty, or one per vertex
+        shared_array<float> uvs;         // Empty, or one per vertex
+        shared_array<uint32_t> indices;  // In leaf order
+        shared_array<flat_bvh_node> nodes;
+        shared_ptr<material> mat_ptr;
+        aabb box;
+
+    private:
+        point3 vertex(uint32_t i) const {
+            return point3(positions[3*i], positions[3*i + 1], positions[3*i + 2]);
+        }
+
+        bool intersect(uint32_t triangle, const ray& r, real t_min, real t_max,
+                       real& t, real& b1, real& b2) const;
+};
+
+
+triangle_mesh::triangle_mesh(
+    mesh_data mesh, shared_ptr<material> m, const bvh_build_options& options
+) : mat_ptr(m) {
+    RTW_STAT_TIMER(timer, stat_bvh_build);
+
+    const auto vertex_count = mesh.vertex_count();
+    if (mesh.normals.size() == mesh.positions.size())
+        normals = shared_array<float>(std::move(mesh.normals));
+    if (mesh.uvs.size() / 2 == vertex_count)
+        uvs = shared_array<float>(std::move(mesh.uvs));
+    positions = shared_array<float>(std::move(mesh.positions));
+
+    const auto size = static_cast<int>(mesh.triangle_count());
+    std::vector<aabb> boxes(size);
+    point3 lo( infinity,  infinity,  infinity);
+    point3 hi(-infinity, -infinity, -infinity);
+
+    #pragma omp parallel for if(options.parallel)
+    for (int k = 0; k < size; k++) {
+        const auto* corner = &mesh.indices[3*k];
+        auto a = vertex(corner[0]), b = vertex(corner[1]), c = vertex(corner[2]);
+        boxes[k] = aabb(
+            point3(fmin(a.x(), fmin(b.x(), c.x())), fmin(a.y(), fmin(b.y(), c.y())),
+                   fmin(a.z(), fmin(b.z(), c.z()))),
+            point3(fmax(a.x(), fmax(b.x(), c.x())), fmax(a.y(), fmax(b.y(), c.y())),
+                   fmax(a.z(), fmax(b.z(), c.z()))));
+    }
+
+    for (const auto& triangle_box : boxes) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = fmin(lo[a], triangle_box.min()[a]);
+            hi[a] = fmax(hi[a], triangle_box.max()[a]);
+        }
+    }
+    box = aabb(lo, hi);
+
+    std::vector<flat_bvh_node> tree;
+    std::vector<uint32_t> order;
+    bvh_builder(boxes, options).build(tree, order);
+    nodes = shared_array<flat_bvh_node>(std::move(tree));
+
+    std::vector<uint32_t> leaf_order;
+    leaf_order.reserve(mesh.indices.size());
+    for (auto triangle : order) {
+        leaf_order.insert(
+            leaf_order.end(), &mesh.indices[3*triangle], &mesh.indices[3*triangle + 3]);
+    }
+    indices = shared_array<uint32_t>(std::move(leaf_order));
+}
+
+
+bool triangle_mesh::intersect(
+    uint32_t triangle, const ray& r, real t_min, real t_max, real& t, real& b1, real& b2
+) const {
+    // Möller and Trumbore's test, which finds t and the barycentric coordinates of the hit
+    // from the edge vectors alone, with no plane equation stored per triangle.
+    RTW_STAT(stat_primitive_tests);
+    const auto* corner = &indices[3*triangle];
+    const auto p0 = vertex(corner[0]);
+    const auto edge1 = vertex(corner[1]) - p0;
+    const auto edge2 = vertex(corner[2]) - p0;
+
+    const auto pvec = cross(r.direction(), edge2);
+    const auto det = dot(edge1, pvec);
+    if (det == 0)
+        return false;
+    const auto inv_det = 1 / det;
+
+    const auto tvec = r.origin() - p0;
+    b1 = dot(tvec, pvec) * inv_det;
+    if (b1 < 0 || b1 > 1)
+        return false;
+
+    const auto qvec = cross(tvec, edge1);
+    b2 = dot(r.direction(), qvec) * inv_det;
+    if (b2 < 0 || b1 + b2 > 1)
+        return false;
+
+    t = dot(edge2, qvec) * inv_det;
+    return t > t_min && t < t_max;
+}
+
+
+bool triangle_mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    // The walk of flat_bvh::hit, with the triangles tested in place in each leaf. Only t, the
+    // triangle and its barycentric coordinates (in u and v) are kept until surface().
+    if (nodes.empty())
+        return false;
+
+    uint32_t stack[64];
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+    real t, b1, b2;
+
+    while (true) {
+        const auto& node = nodes[current];
+        RTW_STAT(stat_bvh_nodes);
+
+        if (node.hit(r, t_min, t_max)) {
+            if (node.is_leaf()) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    if (intersect(i, r, t_min, t_max, t, b1, b2)) {
+                        hit_anything = true;
+                        t_max = t;
+                        rec.t = t;
+                        rec.u = b1;
+                        rec.v = b2;
+                        rec.part = i;
+                    }
+                }
+            } else {
+                if (r.sign(node.axis)) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    if (hit_anything) {
+        rec.object = this;
+        rec.pending = true;
+    }
+    return hit_anything;
+}
+
+
+void triangle_mesh::surface(const ray& r, hit_record& rec) const {
+    const auto* corner = &indices[3*rec.part];
+    const auto b1 = rec.u;
+    const auto b2 = rec.v;
+    const auto b0 = 1 - b1 - b2;
+    const auto p0 = vertex(corner[0]);
+
+    const auto edge1 = vertex(corner[1]) - p0;
+    const auto edge2 = vertex(corner[2]) - p0;
+    const auto area_normal = cross(edge1, edge2);
+
+    rec.p = r.at(rec.t);
+    rec.set_face_normal(r, unit_vector(area_normal));
+
+    if (!normals.empty()) {
+        // Interpolated normals shade, turned to the side the ray hit; the front face is
+        // still the geometric one.
+        vec3 shading;
+        for (int a = 0; a < 3; a++) {
+            shading[a] = b0*normals[3*corner[0] + a] + b1*normals[3*corner[1] + a]
+                       + b2*normals[3*corner[2] + a];
+        }
+        if (shading.length_squared() > 0) {
+            shading = unit_vector(shading);
+            rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+        }
+    }
+
+    // A unit of u or v spans the square root of the ratio of the triangle's area in space to
+    // its area in u and v; without UVs, u and v are b1 and b2.
+    real uv_area = 1;
+    if (!uvs.empty()) {
+        rec.u = b0*uvs[2*corner[0]] + b1*uvs[2*corner[1]] + b2*uvs[2*corner[2]];
+        rec.v = b0*uvs[2*corner[0] + 1] + b1*uvs[2*corner[1] + 1] + b2*uvs[2*corner[2] + 1];
+
+        const auto* uv0 = &uvs[2*corner[0]];
+        const auto* uv1 = &uvs[2*corner[1]];
+        const auto* uv2 = &uvs[2*corner[2]];
+        uv_area = fabs((uv1[0] - uv0[0])*(uv2[1] - uv0[1]) - (uv1[1] - uv0[1])*(uv2[0] - uv0[0]));
+    }
+    rec.set_footprint(r, uv_area > 0 ? sqrt(area_normal.length() / uv_area) : 0);
+
+    rec.mat_ptr = mat_ptr.get();
+}
+
+
+bool triangle_mesh::occluded(const ray& r, real t_min, real t_max) const {
+    if (nodes.empty())
+        return false;
+
+    uint32_t stack[64];
+    int stack_size = 0;
+    uint32_t current = 0;
+    real t, b1, b2;
+
+    while (true) {
+        const auto& node = nodes[current];
+        RTW_STAT(stat_bvh_nodes);
+
+        if (node.hit(r, t_min, t_max)) {
+            if (!node.is_leaf()) {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                if (intersect(i, r, t_min, t_max, t, b1, b2))
+                    return true;
+            }
+        }
+
+        if (stack_size == 0)
+            return false;
+        current = stack[--stack_size];
+    }
+}
+
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "color.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "material.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+class wavefront_integrator {
+    // Computes the same estimate as ray_color_iterative, but breadth first: the camera paths
+    // of a tile are extended one bounce at a time, every bounce is intersected as a batch with
+    // hittable::hit_packet, and the hits are then shaded grouped by material kind.
+    public:
+        wavefront_integrator(
+            const hittable& world, const color& background, int max_depth, int rr_depth,
+            int batch_size = 4096)
+          : world(world), background(background), max_depth(max_depth), rr_depth(rr_depth),
+            batch_size(batch_size)
+        {}
+
+        void render_tile(
+            const tile& t, const camera& cam, int image_width, int image_height,
+            const sample_range& samples, framebuffer& image
+        ) const;
+
+    private:
+        struct path {
+            // The path's own random and sample streams, swapped in while it is shaded.
+            pcg32 rng;
+            sample_stream samples;
+            color throughput;
+            color radiance;
+            int pixel;         // Index of the pixel within the tile
+        };
+
+        const hittable& world;
+        color background;
+        int max_depth;
+        int rr_depth;
+        int batch_size;
+
+        void trace(std::vector<path>& paths, std::vector<ray>& rays, uint64_t seed) const;
+};
+
+
+void wavefront_integrator::render_tile(
+    const tile& t, const camera& cam, int image_width, int image_height,
+    const sample_range& samples, framebuffer& image
+) const {
+    const int tile_width = t.x1 - t.x0;
+    const int pixels = tile_width * (t.y1 - t.y0);
+    const int samples_per_batch = std::max(1, std::min(samples.count, batch_size / pixels));
+    const int end = samples.first + samples.count;
+
+    std::vector<color> sums(pixels);
+    std::vector<path> paths;
+    std::vector<ray> rays;
+    paths.reserve(static_cast<size_t>(pixels) * samples_per_batch);
+    rays.reserve(paths.capacity());
+
+    for (int first = samples.first; first < end; first += samples_per_batch) {
+        const int last = std::min(end, first + samples_per_batch);
+
+        // Generate the camera rays exactly as the per-sample loop does, one stream per sample.
+        paths.clear();
+        rays.clear();
+        for (int j = t.y0; j < t.y1; ++j) {
+            for (int i = t.x0; i < t.x1; ++i) {
+                for (int s = first; s < last; ++s) {
+                    start_sample(i, j, image_width, s);
+                    real du, dv;
+                    sample_2d(du, dv);
+                    auto u = (i + du) / (image_width - 1);
+                    auto v = (j + dv) / (image_height - 1);
+                    rays.push_back(cam.get_ray(u, v));
+
+                    path p;
+                    p.rng = thread_rng();
+                    p.samples = thread_samples();
+                    p.throughput = color(1, 1, 1);
+                    p.pixel = (j - t.y0) * tile_width + (i - t.x0);
+                    paths.push_back(p);
+                }
+            }
+        }
+
+        const auto seed = static_cast<uint64_t>(t.y0) * image_width + t.x0;
+        trace(paths, rays, mix64(seed) ^ static_cast<uint64_t>(first));
+
+        for (const auto& p : paths)
+            sums[p.pixel] += p.radiance;
+    }
+
+    for (int j = t.y0; j < t.y1; ++j) {
+        for (int i = t.x0; i < t.x1; ++i)
+            image.add(i, j, sums[(j - t.y0) * tile_width + (i - t.x0)], samples.count);
+    }
+}
+
+
+void wavefront_integrator::trace(
+    std::vector<path>& paths, std::vector<ray>& rays, uint64_t seed
+) const {
+    // rays[a] is the next ray of paths[active[a]]; both shrink as paths terminate.
+    std::vector<int> active(paths.size());
+    for (size_t a = 0; a < active.size(); a++)
+        active[a] = static_cast<int>(a);
+
+    std::vector<hit_record> recs;
+    std::vector<real> t_max;
+    std::unique_ptr<bool[]> hits(new bool[paths.size()]);
+    std::vector<int> order;
+    std::vector<int> next_active;
+    std::vector<ray> next_rays;
+    std::vector<real> sample_u, sample_v;
+    std::vector<vec3> directions;
+
+    for (int depth = 0; depth < max_depth && !active.empty(); ++depth) {
+        const auto count = static_cast<int>(active.size());
+
+        // Intersect. Hittables that draw random numbers while intersecting (constant_medium)
+        // use a stream fixed by the tile, batch and bounce, so renders stay reproducible.
+        recs.resize(count);
+        t_max.assign(count, infinity);
+        std::fill(hits.get(), hits.get() + count, false);
+        seed_random(seed, static_cast<uint64_t>(depth));
+        RTW_STAT_ADD(stat_path_rays, count);
+        world.hit_packet(rays.data(), count, 0.001, t_max.data(), recs.data(), hits.get());
+
+        // Counting sort of the hits by material kind; misses pick up the background and end.
+        int offsets[material_kind_count + 1] = {};
+        for (int a = 0; a < count; a++) {
+            if (hits[a]) {
+                recs[a].complete(rays[a]);
+                offsets[static_cast<int>(recs[a].mat_ptr->kind()) + 1]++;
+            } else {
+                paths[active[a]].radiance += paths[active[a]].throughput * background;
+            }
+        }
+        for (int k = 0; k < material_kind_count; k++)
+            offsets[k+1] += offsets[k];
+
+        order.resize(offsets[material_kind_count]);
+        for (int a = 0; a < count; a++) {
+            if (hits[a])
+                order[offsets[static_cast<int>(recs[a].mat_ptr->kind())]++] = a;
+        }
+
+        // Shade each material group in turn. The diffuse group, usually the largest, draws its
+        // sample pairs first and maps them to directions as a batch, so that their sines and
+        // cosines are taken a register at a time. Each path draws the values it would draw
+        // alone, and diffuse surfaces emit nothing.
+        next_active.clear();
+        next_rays.clear();
+        const int diffuse_count = offsets[static_cast<int>(material_kind::lambertian)];
+        sample_u.resize(diffuse_count);
+        sample_v.resize(diffuse_count);
+        directions.resize(diffuse_count);
+        for (int g = 0; g < diffuse_count; g++) {
+            auto& p = paths[active[order[g]]];
+            std::swap(thread_rng(), p.rng);
+            std::swap(thread_samples(), p.samples);
+            start_bounce(depth);
+            sample_2d(sample_u[g], sample_v[g]);
+            std::swap(thread_rng(), p.rng);
+            std::swap(thread_samples(), p.samples);
+        }
+        square_to_unit_vector(sample_u.data(), sample_v.data(), directions.data(), diffuse_count);
+
+        for (int g = 0; g < diffuse_count; g++) {
+            const auto a = order[g];
+            auto& p = paths[active[a]];
+            const auto& rec = recs[a];
+            const auto& mat = static_cast<const lambertian&>(*rec.mat_ptr);
+            const ray scattered(rec.p, rec.normal + directions[g], rays[a].time());
+            p.throughput = p.throughput * mat.albedo->lookup(rec.u, rec.v, rec.p, rec.footprint);
+
+            std::swap(thread_rng(), p.rng);
+            std::swap(thread_samples(), p.samples);
+            const bool alive = depth + 1 < rr_depth || russian_roulette(p.throughput);
+            std::swap(thread_rng(), p.rng);
+            std::swap(thread_samples(), p.samples);
+
+            if (alive) {
+                next_active.push_back(active[a]);
+                next_rays.push_back(scattered);
+            }
+        }
+
+        for (int g = diffuse_count; g < static_cast<int>(order.size()); g++) {
+            const auto a = order[g];
+            auto& p = paths[active[a]];
+            const auto& rec = recs[a];
+            std::swap(thread_rng(), p.rng);
+            std::swap(thread_samples(), p.samples);
+            start_bounce(depth);
+
+            ray scattered;
+            color attenuation;
+            p.radiance += p.throughput * material_emitted(*rec.mat_ptr, rec.u, rec.v, rec.p);
+
+            bool alive = material_scatter(*rec.mat_ptr, rays[a], rec, attenuation, scattered);
+            if (alive) {
+                p.throughput = p.throughput * attenuation;
+                alive = depth + 1 < rr_depth || russian_roulette(p.throughput);
+            }
+
+            std::swap(thread_rng(), p.rng);
+            std::swap(thread_samples(), p.samples);
+
+            if (alive) {
+                next_active.push_back(active[a]);
+                next_rays.push_back(scattered);
+            }
+        }
+
+        active.swap(next_active);
+        rays.swap(next_rays);
+    }
+}
+
+
+#endif
@@ -13,18 +13,23 @@
 
 #include "rtweekend.h"
 
-#include "aarect.h"
-#include "hittable_list.h"
+#include "hittable.h"
 
 
 class box: public hittable  {
+    // An axis-aligned box, intersected with one slab test instead of as six rectangles. The
+    // face that was hit shades exactly as the matching rectangle of the book's box would:
+    // outward normal, and u and v running along its two axes in order.
     public:
         box() {}
-        box(const point3& p0, const point3& p1, shared_ptr<material> ptr);
+        box(const point3& p0, const point3& p1, shared_ptr<material> ptr)
+            : box_min(p0), box_max(p1), mp(ptr) {}
 
-        virtual bool hit(const ray& r, double t0, double t1, hit_record& rec) const;
+        virtual bool hit(const ray& r, real t0, real t1, hit_record& rec) const;
+        virtual void surface(const ray& r, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t0, real t1) const;
 
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
             output_box = aabb(box_min, box_max);
             return true;
         }
@@ -32,29 +37,95 @@ class box: public hittable  {
     public:
         point3 box_min;
         point3 box_max;
-        hittable_list sides;
+        shared_ptr<material> mp;
+
+    private:
+        // The interval of r inside the box, with the axes of the entry and exit planes.
+        bool slabs(const ray& r, real& t_near, real& t_far, int& near_axis, int& far_axis) const;
+
+        // Where r meets the plane of a face. Faces are numbered 2*axis, plus one at box_max.
+        real face_t(const ray& r, int face) const {
+            const auto& plane = face & 1 ? box_max : box_min;
+            return (plane[face >> 1] - r.origin()[face >> 1]) / r.direction()[face >> 1];
+        }
 };
 
 
-box::box(const point3& p0, const point3& p1, shared_ptr<material> ptr) {
-    box_min = p0;
-    box_max = p1;
+bool box::slabs(
+    const ray& r, real& t_near, real& t_far, int& near_axis, int& far_axis
+) const {
+    const auto& inv_dir = r.inv_direction();
+    t_near = -infinity;
+    t_far = infinity;
+    near_axis = far_axis = 0;
+    for (int a = 0; a < 3; a++) {
+        const auto& near_plane = r.sign(a) ? box_max : box_min;
+        const auto& far_plane = r.sign(a) ? box_min : box_max;
+        auto t0 = (near_plane[a] - r.origin()[a]) * inv_dir[a];
+        auto t1 = (far_plane[a] - r.origin()[a]) * inv_dir[a];
+        if (t0 > t_near) {
+            t_near = t0;
+            near_axis = a;
+        }
+        if (t1 < t_far) {
+            t_far = t1;
+            far_axis = a;
+        }
+    }
+    return t_near <= t_far;
+}
+
+bool box::hit(const ray& r, real t0, real t1, hit_record& rec) const {
+    RTW_STAT(stat_primitive_tests);
+    real t_near, t_far;
+    int near_axis, far_axis;
+    if (!slabs(r, t_near, t_far, near_axis, far_axis))
+        return false;
 
-    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
-    sides.add(make_shared<flip_face>(
-        make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr)));
+    // Entering, the near plane is at the max bound where the ray runs negative; leaving, the
+    // far plane is there where it runs positive. Recomputing t from the plane alone gives the
+    // rectangle's own value.
+    auto face = 2*near_axis + r.sign(near_axis);
+    auto t = face_t(r, face);
+    if (t < t0 || t > t1) {
+        face = 2*far_axis + 1 - r.sign(far_axis);
+        t = face_t(r, face);
+        if (t < t0 || t > t1)
+            return false;
+    }
+
+    rec.t = t;
+    rec.part = face;
+    rec.object = this;
+    rec.pending = true;
+    return true;
+}
 
-    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr));
-    sides.add(make_shared<flip_face>(
-        make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr)));
+void box::surface(const ray& r, hit_record& rec) const {
+    const int axis = rec.part >> 1;
+    const int u_axis = axis == 0 ? 1 : 0;
+    const int v_axis = axis == 2 ? 1 : 2;
+    auto u = r.origin()[u_axis] + rec.t*r.direction()[u_axis];
+    auto v = r.origin()[v_axis] + rec.t*r.direction()[v_axis];
 
-    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr));
-    sides.add(make_shared<flip_face>(
-        make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr)));
+    rec.u = (u-box_min[u_axis])/(box_max[u_axis]-box_min[u_axis]);
+    rec.v = (v-box_min[v_axis])/(box_max[v_axis]-box_min[v_axis]);
+    const auto extent = box_max - box_min;
+    rec.set_footprint(r, sqrt(extent[u_axis]*extent[v_axis]));
+    vec3 outward_normal;
+    outward_normal[axis] = rec.part & 1 ? 1 : -1;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(rec.t);
 }
 
-bool box::hit(const ray& r, double t0, double t1, hit_record& rec) const {
-    return sides.hit(r, t0, t1, rec);
+bool box::occluded(const ray& r, real t0, real t1) const {
+    RTW_STAT(stat_primitive_tests);
+    real t_near, t_far;
+    int near_axis, far_axis;
+    if (!slabs(r, t_near, t_far, near_axis, far_axis))
+        return false;
+    return (t_near >= t0 && t_near <= t1) || (t_far >= t0 && t_far <= t1);
 }
 
 
@@ -11,26 +11,41 @@
 
 #include "rtweekend.h"
 
-#include <iostream>
-#include <iomanip>
-#include <math.h>
+#include "estimator.h"
 
 
-int main() {
-    int N = 1000000;
+class hemisphere_pdf : public pdf {
+    // Uniform over the directions with positive z.
+    public:
+        virtual real value(const vec3& direction) const {
+            return direction.z() > 0 ? 1/(2*pi) : 0;
+        }
 
-    auto sum = 0.0;
-    for (int i = 0; i < N; i++) {
-        auto r1 = random_double();
-        auto r2 = random_double();
-        auto x = cos(2*pi*r1)*2*sqrt(r2*(1-r2));
-        auto y = sin(2*pi*r1)*2*sqrt(r2*(1-r2));
-        auto z = 1 - r2;
+        virtual vec3 generate() const {
+            real r1, r2;
+            sample_2d(r1, r2);
+            auto z = 1 - r2;
+
+            real s, c;
+            sin_cos(2*pi*r1, s, c);
+            auto r = sqrt(fmax(real(0), 1 - z*z));
+            return vec3(c*r, s*r, z);
+        }
+};
 
-        sum += z*z*z / (1.0/(2.0*pi));
-    }
 
-    std::cout << std::fixed << std::setprecision(12);
-    std::cout << "PI/2 = " << pi/2 << '\n';
-    std::cout << "Estimate = " << sum/N << '\n';
+int main(int argc, char* argv[]) {
+    // The integral of cos^3 over the hemisphere, sampled uniformly.
+    estimator_options options(argc, argv, 10000000);
+    if (!options.ok())
+        return 1;
+
+    const hemisphere_pdf p;
+    report_header("PI/2", pi/2, options);
+    for (const auto& s : options.sequences()) {
+        const auto e = integrate(options.make_estimator(s.second), p, [](const vec3& d) {
+            return d.z()*d.z()*d.z();
+        });
+        report(s.first, e, pi/2);
+    }
 }
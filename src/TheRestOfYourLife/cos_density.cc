@@ -11,33 +11,22 @@
 
 #include "rtweekend.h"
 
-#include <iostream>
-#include <iomanip>
-#include <math.h>
-
-
-inline vec3 random_cosine_direction() {
-    auto r1 = random_double();
-    auto r2 = random_double();
-    auto z = sqrt(1-r2);
-    auto phi = 2*pi*r1;
-    auto x = cos(phi)*sqrt(r2);
-    auto y = sin(phi)*sqrt(r2);
-
-    return vec3(x, y, z);
-}
-
-
-int main() {
-    int N = 1000000;
-
-    auto sum = 0.0;
-    for (int i = 0; i < N; i++) {
-        auto v = random_cosine_direction();
-        sum += v.z()*v.z()*v.z() / (v.z()/(pi));
+#include "estimator.h"
+
+
+int main(int argc, char* argv[]) {
+    // The integral of cos^3 over the hemisphere, sampled by the cosine_pdf the renderer uses.
+    estimator_options options(argc, argv, 10000000);
+    if (!options.ok())
+        return 1;
+
+    const cosine_pdf p(vec3(0, 0, 1));
+    report_header("PI/2", pi/2, options);
+    for (const auto& s : options.sequences()) {
+        const auto e = integrate(options.make_estimator(s.second), p, [](const vec3& d) {
+            const auto z = fmax(real(0), d.z());
+            return z*z*z;
+        });
+        report(s.first, e, pi/2);
     }
-
-    std::cout << std::fixed << std::setprecision(12);
-    std::cout << "PI/2 = " << pi/2 << '\n';
-    std::cout << "Estimate = " << sum/N << '\n';
 }
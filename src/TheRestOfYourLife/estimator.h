@@ -0,0 +1,261 @@
+#ifndef ESTIMATOR_H
+#define ESTIMATOR_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "pdf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+
+struct estimate {
+    double value = 0;
+    double standard_error = 0;   // Of value, from the spread of the replicates' means
+    double variance = 0;         // Of a single sample of the integrand
+    uint64_t samples = 0;
+    double seconds = 0;
+
+    double samples_per_second() const { return seconds > 0 ? samples / seconds : 0; }
+};
+
+
+namespace estimator_detail {
+
+struct moments {
+    // The count, mean and sum of squared differences from the mean of some samples (Welford),
+    // merged in a fixed order so the result doesn't depend on the threads (Chan et al.).
+    uint64_t count = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void add(double x) {
+        count++;
+        const auto delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    void merge(const moments& other) {
+        if (other.count == 0)
+            return;
+        const auto total = count + other.count;
+        const auto delta = other.mean - mean;
+        mean += delta * other.count / total;
+        m2 += other.m2 + delta * delta * count / total * other.count;
+        count = total;
+    }
+};
+
+}  // namespace estimator_detail
+
+
+class estimator {
+    // Estimates an integral as the mean of an integrand over samples, on every thread. The
+    // samples are split into replicates: independent randomizations of the same sampling,
+    // each one a different scramble of a Sobol sequence, shuffle of strata, or run of random
+    // numbers. Within a replicate, sample i draws its values from the sample stream of index
+    // i, so a pdf's generate(), sample_1d() and sample_2d() all take their next dimension of
+    // it, and the estimate comes out the same for any number of threads.
+    //
+    // Stratified and Sobol samples aren't independent, so a sample's variance says nothing
+    // about the error of their mean; the spread of the replicates' means does, for every
+    // sampling alike.
+    public:
+        estimator(uint64_t samples, sample_sequence sequence, int replicates = 16)
+          : sequence(sequence), replicates(std::max(1, replicates))
+        {
+            // A stream's sample index is 32 bits.
+            const uint64_t most = 0xffffffffu;
+            per_replicate = std::max<uint64_t>(1, std::min(most, samples / this->replicates));
+        }
+
+        uint64_t samples() const { return per_replicate * replicates; }
+
+        // f() returns the integrand's value at a sample, over the density of that sample.
+        template <typename F>
+        estimate run(F f) const {
+            using estimator_detail::moments;
+            const auto start = std::chrono::steady_clock::now();
+
+            const auto chunks = (per_replicate + chunk_size - 1) / chunk_size;
+            const auto count = static_cast<uint32_t>(per_replicate);
+            const auto items = static_cast<int64_t>(chunks * replicates);
+            std::vector<moments> partial(static_cast<size_t>(items));
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int64_t item = 0; item < items; item++) {
+                const auto r = static_cast<uint64_t>(item) / chunks;
+                const auto c = static_cast<uint64_t>(item) % chunks;
+                const auto first = c * chunk_size;
+                const auto last = std::min(per_replicate, first + chunk_size);
+
+                seed_random(r, c);
+                auto& stream = thread_samples();
+                moments m;
+                for (auto i = first; i < last; i++) {
+                    stream.start(sequence, 0, 0, r, static_cast<uint32_t>(i), count);
+                    m.add(static_cast<double>(f()));
+                }
+                partial[static_cast<size_t>(item)] = m;
+            }
+
+            std::vector<moments> replicate(replicates);
+            for (int64_t item = 0; item < items; item++)
+                replicate[static_cast<size_t>(item / chunks)].merge(partial[item]);
+
+            estimate result;
+            double within = 0;
+            for (const auto& m : replicate) {
+                result.value += m.mean / replicates;
+                within += m.m2;
+            }
+            result.samples = samples();
+
+            const auto n = static_cast<double>(result.samples);
+            result.variance = n > replicates ? within / (n - replicates) : 0;
+            if (replicates > 1) {
+                double spread = 0;
+                for (const auto& m : replicate)
+                    spread += (m.mean - result.value) * (m.mean - result.value);
+                result.standard_error = std::sqrt(spread / (replicates * (replicates - 1.0)));
+            } else {
+                result.standard_error = std::sqrt(result.variance / n);
+            }
+
+            const auto stop = std::chrono::steady_clock::now();
+            result.seconds = std::chrono::duration<double>(stop - start).count();
+            return result;
+        }
+
+    private:
+        static const uint64_t chunk_size = 65536;   // Samples per work item
+
+        sample_sequence sequence;
+        int replicates;
+        uint64_t per_replicate;
+};
+
+
+template <typename F>
+estimate integrate(const estimator& e, const pdf& p, F g) {
+    // Estimates the integral of g(direction) over the sphere of directions, sampling from p.
+    return e.run([&p, &g]() -> real {
+        const auto direction = p.generate();
+        const auto density = p.value(direction);
+        return density > 0 ? g(direction) / density : 0;
+    });
+}
+
+
+class estimator_options {
+    // The command line shared by the Monte Carlo tools, which estimate with every sampling
+    // in turn unless given one:
+    //
+    //     pi [--samples N] [--sampler all|independent|stratified|sobol] [--replicates N]
+    //        [--threads N]
+    //
+    // The sample count may be written like 1e9.
+    public:
+        uint64_t samples;
+        std::string sampler = "all";
+        int replicates = 16;
+
+        estimator_options(int argc, char* argv[], uint64_t default_samples)
+          : samples(default_samples)
+        {
+            for (int a = 1; a < argc; ++a) {
+                std::string arg = argv[a];
+                if (arg == "--samples" && a + 1 < argc) {
+                    samples = static_cast<uint64_t>(std::max(1.0, std::atof(argv[++a])));
+                } else if (arg == "--sampler" && a + 1 < argc && known(argv[a + 1])) {
+                    sampler = argv[++a];
+                } else if (arg == "--replicates" && a + 1 < argc) {
+                    replicates = std::max(1, std::atoi(argv[++a]));
+                } else if (arg == "--threads" && a + 1 < argc) {
+                    omp_set_num_threads(std::max(1, std::atoi(argv[++a])));
+                } else {
+                    std::cerr << "usage: " << argv[0] << " [--samples N] [--sampler "
+                              << "all|independent|stratified|sobol] [--replicates N]"
+                              << " [--threads N]\n";
+                    valid = false;
+                    break;
+                }
+            }
+        }
+
+        bool ok() const { return valid; }
+
+        // The samplings to estimate with, and their names.
+        std::vector<std::pair<std::string, sample_sequence>> sequences() const {
+            std::vector<std::pair<std::string, sample_sequence>> all = {
+                { "independent", sample_sequence::independent },
+                { "stratified",  sample_sequence::stratified },
+                { "sobol",       sample_sequence::sobol },
+            };
+            if (sampler == "all")
+                return all;
+            all.erase(std::remove_if(all.begin(), all.end(),
+                [this](const std::pair<std::string, sample_sequence>& s) {
+                    return s.first != sampler;
+                }), all.end());
+            return all;
+        }
+
+        estimator make_estimator(sample_sequence sequence) const {
+            return estimator(samples, sequence, replicates);
+        }
+
+    private:
+        bool valid = true;
+
+        static bool known(const std::string& name) {
+            return name == "all" || name == "independent" || name == "stratified"
+                || name == "sobol";
+        }
+};
+
+
+inline void report(const std::string& name, const estimate& e, double exact) {
+    // One line of results on stdout. The efficiency is one over the time taken to reach unit
+    // variance: doubling it halves the time to a given error.
+    const auto efficiency = e.standard_error > 0
+        ? 1 / (e.standard_error * e.standard_error * e.seconds) : 0;
+    std::cout << std::left << std::setw(24) << name + " " << std::right << std::fixed
+              << std::setprecision(12) << e.value
+              << std::scientific << std::setprecision(2)
+              << "  error " << std::setw(9) << std::fabs(e.value - exact)
+              << "  std err " << e.standard_error
+              << "  variance " << e.variance
+              << std::fixed << std::setprecision(1)
+              << "  " << std::setw(7) << e.samples_per_second() / 1e6 << " Msamples/s"
+              << std::scientific << std::setprecision(2)
+              << "  efficiency " << efficiency << '\n';
+}
+
+
+inline void report_header(
+    const std::string& integral, double exact, const estimator_options& options
+) {
+    const auto samples = options.make_estimator(sample_sequence::independent).samples();
+    std::cout << integral << " = " << std::fixed << std::setprecision(12) << exact << ", "
+              << samples << " samples on " << omp_get_max_threads() << " threads\n";
+}
+
+
+#endif
@@ -14,11 +14,13 @@
 #include "rtweekend.h"
 
 #include "aabb.h"
+#include "affine.h"
 
 
+class hittable;
 class material;
 
-void get_sphere_uv(const point3& p, double& u, double& v) {
+void get_sphere_uv(const point3& p, real& u, real& v) {
     auto phi = atan2(p.z(), p.x());
     auto theta = asin(p.y());
     u = 1-(phi + pi) / (2*pi);
@@ -29,11 +31,22 @@ void get_sphere_uv(const point3& p, double& u, double& v) {
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
-    double t;
-    double u;
-    double v;
+    const material* mat_ptr;  // Owned by the hittable that was hit
+    real t;
+    real u;
+    real v;
+    real footprint;           // Width the ray covers at p in units of u and v, or zero
     bool front_face;
+    const hittable* object;   // The primitive that was hit, also for telling lights apart
+    uint32_t part;            // Which part of object, like the face of a box
+    bool pending;             // object's surface() has yet to fill in everything above but t
+
+    inline void complete(const ray& r);
+
+    // Sets footprint for a surface on which a unit of u or v spans about uv_size.
+    inline void set_footprint(const ray& r, real uv_size) {
+        footprint = uv_size > 0 ? r.footprint(t) / uv_size : 0;
+    }
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
@@ -44,10 +57,40 @@ struct hit_record {
 
 class hittable {
     public:
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const = 0;
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const = 0;
+
+        // A primitive's hit() may record only t and itself, and mark the record pending, when
+        // the rest costs more than the test. Candidates that a closer hit replaces then never
+        // pay for normals, UVs or materials: whoever takes the final hit calls complete(),
+        // which fills them in here, from the same ray hit() was given.
+        virtual void surface(const ray& r, hit_record& rec) const {}
+
+        // Whether anything lies along r between t_min and t_max. Unlike hit(), this may stop
+        // at the first intersection found and computes no surface attributes, which is all a
+        // shadow ray needs.
+        virtual bool occluded(const ray& r, real t_min, real t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
 
-        virtual double pdf_value(const vec3& o, const vec3& v) const {
+        // Intersects a batch of rays. Where ray i hits something closer than t_max[i], the hit
+        // goes to recs[i], t_max[i] shrinks to its distance and hits[i] is set; other entries
+        // are left alone, so calls on several hittables merge into the closest hit.
+        virtual void hit_packet(
+            const ray* rays, int count, real t_min, real* t_max, hit_record* recs, bool* hits
+        ) const {
+            hit_record temp_rec;
+            for (int i = 0; i < count; i++) {
+                if (hit(rays[i], t_min, t_max[i], temp_rec)) {
+                    recs[i] = temp_rec;
+                    t_max[i] = temp_rec.t;
+                    hits[i] = true;
+                }
+            }
+        }
+
+        virtual real pdf_value(const vec3& o, const vec3& v) const {
             return 0.0;
         }
 
@@ -57,146 +100,150 @@ class hittable {
 };
 
 
+inline void hit_record::complete(const ray& r) {
+    if (pending) {
+        pending = false;
+        object->surface(r, *this);
+    }
+}
+
+
 class flip_face : public hittable {
     public:
         flip_face(shared_ptr<hittable> p) : ptr(p) {}
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
             if (!ptr->hit(r, t_min, t_max, rec))
                 return false;
 
-            rec.front_face = !rec.front_face;
+            // A pending hit on ptr itself is finished by surface() if it turns out closest;
+            // one deeper inside ptr is finished now, since only ptr can be called back.
+            if (!rec.pending || rec.object != ptr.get()) {
+                rec.complete(r);
+                rec.front_face = !rec.front_face;
+            }
+
+            // The flipped surface is an object of its own, so it can be registered as a light.
+            rec.object = this;
             return true;
         }
 
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
-            return ptr->bounding_box(t0, t1, output_box);
+        virtual void surface(const ray& r, hit_record& rec) const {
+            ptr->surface(r, rec);
+            rec.front_face = !rec.front_face;
         }
 
-    public:
-        shared_ptr<hittable> ptr;
-};
+        virtual bool occluded(const ray& r, real t_min, real t_max) const {
+            return ptr->occluded(r, t_min, t_max);
+        }
 
+        virtual real pdf_value(const point3& o, const vec3& v) const {
+            return ptr->pdf_value(o, v);
+        }
 
-class translate : public hittable {
-    public:
-        translate(shared_ptr<hittable> p, const vec3& displacement)
-            : ptr(p), offset(displacement) {}
+        virtual vec3 random(const point3& o) const {
+            return ptr->random(o);
+        }
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
+            return ptr->bounding_box(t0, t1, output_box);
+        }
 
     public:
         shared_ptr<hittable> ptr;
-        vec3 offset;
 };
 
 
-bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    ray moved_r(r.origin() - offset, r.direction(), r.time());
-    if (!ptr->hit(moved_r, t_min, t_max, rec))
-        return false;
-
-    rec.p += offset;
-    rec.set_face_normal(moved_r, rec.normal);
-
-    return true;
-}
-
-
-bool translate::bounding_box(double t0, double t1, aabb& output_box) const {
-    if (!ptr->bounding_box(t0, t1, output_box))
-        return false;
+class instance : public hittable {
+    // A placement of a shared prototype, such as a BVH or a mesh, under an affine transform.
+    // However many instances there are, the prototype exists once. An instance of an instance
+    // fuses into one, so a chain like translate(rotate_y(box)) maps each ray only once.
+    public:
+        instance(shared_ptr<hittable> p, const affine& to_world)
+            : instance(p, to_world, to_world.inverse()) {}
 
-    output_box = aabb(
-        output_box.min() + offset,
-        output_box.max() + offset);
+        instance(shared_ptr<hittable> p, const affine& to_world, const affine& to_object);
 
-    return true;
-}
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const;
 
+        virtual bool occluded(const ray& r, real t_min, real t_max) const {
+            return ptr->occluded(object_ray(r), t_min, t_max);
+        }
 
-class rotate_y : public hittable {
-    public:
-        rotate_y(shared_ptr<hittable> p, double angle);
-
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const {
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
             output_box = bbox;
             return hasbox;
         }
 
     public:
-        shared_ptr<hittable> ptr;
-        double sin_theta;
-        double cos_theta;
+        shared_ptr<hittable> ptr;  // The prototype, never itself an instance
+        affine to_world;
+        affine to_object;
+        bool rigid;                // Normals come through unit length
         bool hasbox;
         aabb bbox;
-};
-
-
-rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
-    auto radians = degrees_to_radians(angle);
-    sin_theta = sin(radians);
-    cos_theta = cos(radians);
-    hasbox = ptr->bounding_box(0, 1, bbox);
-
-    point3 min( infinity,  infinity,  infinity);
-    point3 max(-infinity, -infinity, -infinity);
 
-    for (int i = 0; i < 2; i++) {
-        for (int j = 0; j < 2; j++) {
-            for (int k = 0; k < 2; k++) {
-                auto x = i*bbox.max().x() + (1-i)*bbox.min().x();
-                auto y = j*bbox.max().y() + (1-j)*bbox.min().y();
-                auto z = k*bbox.max().z() + (1-k)*bbox.min().z();
+    private:
+        real spread_scale;         // How much the map shrinks a footprint, on average
 
-                auto newx =  cos_theta*x + sin_theta*z;
-                auto newz = -sin_theta*x + cos_theta*z;
-
-                vec3 tester(newx, y, newz);
-
-                for (int c = 0; c < 3; c++) {
-                    min[c] = fmin(min[c], tester[c]);
-                    max[c] = fmax(max[c], tester[c]);
-                }
-            }
+        // r in the prototype's space. The direction isn't renormalized, so t is unchanged.
+        ray object_ray(const ray& r) const {
+            ray object_r(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+            object_r.spread = r.spread * spread_scale;
+            return object_r;
         }
-    }
-
-    bbox = aabb(min, max);
-}
+};
 
 
-bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    auto origin = r.origin();
-    auto direction = r.direction();
+instance::instance(shared_ptr<hittable> p, const affine& to_world, const affine& to_object)
+    : ptr(p), to_world(to_world), to_object(to_object)
+{
+    auto inner = std::dynamic_pointer_cast<instance>(p);
+    if (inner) {
+        ptr = inner->ptr;
+        this->to_world = to_world * inner->to_world;
+        this->to_object = inner->to_object * to_object;
+    }
 
-    origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
-    origin[2] = sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
+    rigid = this->to_world.is_rigid();
+    spread_scale = rigid ? 1 : cbrt(fabs(this->to_object.determinant()));
 
-    direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
-    direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
+    aabb object_box;
+    hasbox = ptr->bounding_box(0, 1, object_box);
+    if (hasbox)
+        bbox = this->to_world.box(object_box);
+}
 
-    ray rotated_r(origin, direction, r.time());
 
-    if (!ptr->hit(rotated_r, t_min, t_max, rec))
+bool instance::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    auto object_r = object_ray(r);
+    if (!ptr->hit(object_r, t_min, t_max, rec))
         return false;
+    rec.complete(object_r);
+
+    // The inverse transpose carries the normal over and keeps it on the side the ray came
+    // from, so front_face still holds.
+    rec.p = to_world.point(rec.p);
+    rec.normal = to_object.transposed_vector(rec.normal);
+    if (!rigid)
+        rec.normal = unit_vector(rec.normal);
+    return true;
+}
 
-    auto p = rec.p;
-    auto normal = rec.normal;
-
-    p[0] =  cos_theta*rec.p[0] + sin_theta*rec.p[2];
-    p[2] = -sin_theta*rec.p[0] + cos_theta*rec.p[2];
 
-    normal[0] =  cos_theta*rec.normal[0] + sin_theta*rec.normal[2];
-    normal[2] = -sin_theta*rec.normal[0] + cos_theta*rec.normal[2];
+class translate : public instance {
+    public:
+        translate(shared_ptr<hittable> p, const vec3& displacement)
+            : instance(p, affine::translation(displacement), affine::translation(-displacement))
+        {}
+};
 
-    rec.p = p;
-    rec.set_face_normal(rotated_r, normal);
 
-    return true;
-}
+class rotate_y : public instance {
+    public:
+        rotate_y(shared_ptr<hittable> p, real angle)
+            : instance(p, affine::rotation_y(angle), affine::rotation_y(-angle)) {}
+};
 
 
 #endif
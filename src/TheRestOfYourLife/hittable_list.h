@@ -15,6 +15,7 @@
 
 #include "hittable.h"
 
+#include <algorithm>
 #include <vector>
 
 
@@ -26,9 +27,17 @@ class hittable_list: public hittable  {
         void clear() { objects.clear(); }
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
-        virtual double pdf_value(const vec3 &o, const vec3 &v) const;
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const;
+
+        virtual void hit_packet(
+            const ray* rays, int count, real t_min, real* t_max, hit_record* recs, bool* hits
+        ) const {
+            for (const auto& object : objects)
+                object->hit_packet(rays, count, t_min, t_max, recs, hits);
+        }
+        virtual real pdf_value(const vec3 &o, const vec3 &v) const;
         virtual vec3 random(const vec3 &o) const;
 
     public:
@@ -36,7 +45,7 @@ class hittable_list: public hittable  {
 };
 
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     hit_record temp_rec;
     auto hit_anything = false;
     auto closest_so_far = t_max;
@@ -53,7 +62,16 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
 }
 
 
-bool hittable_list::bounding_box(double t0, double t1, aabb& output_box) const {
+bool hittable_list::occluded(const ray& r, real t_min, real t_max) const {
+    for (const auto& object : objects) {
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    }
+    return false;
+}
+
+
+bool hittable_list::bounding_box(real t0, real t1, aabb& output_box) const {
     if (objects.empty()) return false;
 
     aabb temp_box;
@@ -74,7 +92,7 @@ bool hittable_list::bounding_box(double t0, double t1, aabb& output_box) const {
 }
 
 
-double hittable_list::pdf_value(const point3& o, const vec3& v) const {
+real hittable_list::pdf_value(const point3& o, const vec3& v) const {
     auto weight = 1.0/objects.size();
     auto sum = 0.0;
 
@@ -87,7 +105,8 @@ double hittable_list::pdf_value(const point3& o, const vec3& v) const {
 
 vec3 hittable_list::random(const vec3 &o) const {
     auto int_size = static_cast<int>(objects.size());
-    return objects[random_int(0, int_size-1)]->random(o);
+    auto k = std::min(static_cast<int>(sample_1d() * int_size), int_size-1);
+    return objects[k]->random(o);
 }
 
 
@@ -11,27 +11,48 @@
 
 #include "rtweekend.h"
 
-#include <iostream>
-#include <iomanip>
-#include <math.h>
-#include <stdlib.h>
+#include "estimator.h"
 
+#include <vector>
 
-inline double pdf(double x) {
-    return  3*x*x/8;
-}
 
-int main() {
-    int inside_circle = 0;
-    int inside_circle_stratified = 0;
-    int N = 1;
+// Densities on [0,2] to sample x from, each with the inverse of its cumulative distribution.
+struct line_pdf {
+    const char* name;
+    real (*value)(real x);
+    real (*inverse)(real u);
+};
 
-    auto sum = 0.0;
-    for (int i = 0; i < N; i++) {
-        auto x = pow(random_double(0,8), 1./3.);
-        sum += x*x / pdf(x);
-    }
 
-    std::cout << std::fixed << std::setprecision(12);
-    std::cout << "I = " << sum/N << '\n';
+int main(int argc, char* argv[]) {
+    // The integral of x^2 over [0,2]. Sampling from a density proportional to x^2 weighs every
+    // sample to exactly 8/3, so its variance, and its error, are zero.
+    estimator_options options(argc, argv, 10000000);
+    if (!options.ok())
+        return 1;
+
+    const std::vector<line_pdf> pdfs = {
+        { "uniform",
+          [](real) -> real { return 0.5; },
+          [](real u) -> real { return 2*u; } },
+        { "linear",
+          [](real x) -> real { return x/2; },
+          [](real u) -> real { return 2*sqrt(u); } },
+        { "quadratic",
+          [](real x) -> real { return 3*x*x/8; },
+          [](real u) -> real { return cbrt(8*u); } },
+    };
+
+    const double exact = 8.0/3.0;
+    report_header("I", exact, options);
+    for (const auto& p : pdfs) {
+        for (const auto& s : options.sequences()) {
+            const auto e = options.make_estimator(s.second).run([&p] {
+                const auto x = p.inverse(sample_1d());
+                const auto density = p.value(x);
+                return density > 0 ? x*x / density : real(0);
+            });
+            report(std::string(p.name) + " " + s.first, e, exact);
+        }
+    }
 }
@@ -0,0 +1,80 @@
+#ifndef LIGHT_SAMPLER_H
+#define LIGHT_SAMPLER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "alias_table.h"
+#include "hittable.h"
+
+#include <unordered_map>
+#include <vector>
+
+
+// Weight of a sample drawn with density pdf_a against another strategy with density pdf_b,
+// by Veach's power heuristic with an exponent of two.
+inline real power_heuristic(real pdf_a, real pdf_b) {
+    auto a = pdf_a * pdf_a;
+    auto b = pdf_b * pdf_b;
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+
+class light_sampler {
+    // The emitters of a scene, for next-event estimation. A light is picked in constant time
+    // with probability proportional to its power, then a direction toward it is drawn with the
+    // light's own random(), so the cost of a light sample doesn't grow with the light count.
+    //
+    // Lights must be the same primitives (or flip_faces of them) that were added to the world,
+    // since a hit is matched to its light by hit_record::object, and must not be wrapped in a
+    // transform, since their pdf_value and random work in their own space.
+    public:
+        light_sampler() {}
+
+        void add(shared_ptr<hittable> light, real power) {
+            lights.push_back(light);
+            powers.push_back(power);
+            table = alias_table(powers);
+
+            index.clear();
+            for (size_t k = 0; k < lights.size(); k++)
+                index[lights[k].get()] = static_cast<int>(k);
+        }
+
+        bool empty() const { return table.empty(); }
+
+        // Picks a light for a shading point at o and returns a direction toward it, along with
+        // the light's pmf times the density of that direction.
+        vec3 sample(const point3& o, const hittable*& light, real& pdf) const {
+            auto k = table.sample(sample_1d());
+            light = lights[k].get();
+            auto direction = light->random(o);
+            pdf = table.pmf(k) * light->pdf_value(o, direction);
+            return direction;
+        }
+
+        // The density with which sample() produces the direction v from o toward light, which
+        // is zero unless light is one of these.
+        real pdf_value(const point3& o, const vec3& v, const hittable* light) const {
+            auto found = index.find(light);
+            if (found == index.end())
+                return 0;
+            return table.pmf(found->second) * light->pdf_value(o, v);
+        }
+
+    private:
+        std::vector<shared_ptr<hittable>> lights;
+        std::vector<real> powers;
+        alias_table table;
+        std::unordered_map<const hittable*, int> index;
+};
+
+
+#endif
@@ -12,15 +12,23 @@
 #include "rtweekend.h"
 
 #include "aarect.h"
+#include "adaptive_sampler.h"
 #include "box.h"
 #include "camera.h"
 #include "color.h"
+#include "denoiser.h"
+#include "framebuffer.h"
 #include "hittable_list.h"
+#include "image_output.h"
+#include "light_sampler.h"
 #include "material.h"
+#include "options.h"
+#include "progressive.h"
+#include "renderer.h"
 #include "sphere.h"
 
 #include <iostream>
-#include <omp.h>
+#include <string>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "external/stb_image_write.h"
@@ -30,23 +38,31 @@ color ray_color(
 	const ray& r,
 	const color& background,
 	const hittable& world,
-	shared_ptr<hittable> lights,
-	int depth
+	const hittable& lights,
+	int depth,
+	first_hit* aov = nullptr
 ) {
 	hit_record rec;
 
 	// If we've exceeded the ray bounce limit, no more light is gathered.
 	if (depth <= 0)
 		return color(0, 0, 0);
+	start_bounce(depth);
 
 	// If the ray hits nothing, return the background color.
+	RTW_STAT(stat_path_rays);
 	if (!world.hit(r, 0.001, infinity, rec))
 		return background;
+	rec.complete(r);
 
 	scatter_record srec;
-	color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+	color emitted = material_emitted(*rec.mat_ptr, r, rec, rec.u, rec.v, rec.p);
+	bool scatters = material_scatter(*rec.mat_ptr, r, rec, srec);
+	if (aov)
+		aov->record(rec.normal, rec.t * r.direction().length(),
+			scatters ? srec.attenuation : emitted);
 
-	if (!rec.mat_ptr->scatter(r, rec, srec))
+	if (!scatters)
 		return emitted;
 
 	if (srec.is_specular) {
@@ -54,19 +70,184 @@ color ray_color(
 			* ray_color(srec.specular_ray, background, world, lights, depth - 1);
 	}
 
-	auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-	mixture_pdf p(light_ptr, srec.pdf_ptr);
+	hittable_pdf light_pdf(lights, rec.p);
+	mixture_pdf p(&light_pdf, srec.pdf_ptr);
 	ray scattered = ray(rec.p, p.generate(), r.time());
 	auto pdf_val = p.value(scattered.direction());
 
 	return emitted
-		+ srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered)
+		+ srec.attenuation * material_scattering_pdf(*rec.mat_ptr, r, rec, scattered)
 		* ray_color(scattered, background, world, lights, depth - 1)
 		/ pdf_val;
 }
 
 
-hittable_list cornell_box(camera& cam, double aspect) {
+color ray_color_iterative(
+	ray r,
+	const color& background,
+	const hittable& world,
+	const hittable& lights,
+	int max_depth,
+	int rr_depth,
+	first_hit* aov = nullptr
+) {
+	// Same estimate as ray_color, but walks the path in a loop, carrying the product of the
+	// path weights so far, and plays Russian roulette from bounce rr_depth on.
+	color radiance(0, 0, 0);
+	color throughput(1, 1, 1);
+
+	for (int depth = 0; depth < max_depth; ++depth) {
+		hit_record rec;
+		start_bounce(depth);
+
+		RTW_STAT(stat_path_rays);
+		if (!world.hit(r, 0.001, infinity, rec)) {
+			radiance += throughput * background;
+			break;
+		}
+		rec.complete(r);
+
+		scatter_record srec;
+		auto emitted = material_emitted(*rec.mat_ptr, r, rec, rec.u, rec.v, rec.p);
+		radiance += throughput * emitted;
+
+		bool scatters = material_scatter(*rec.mat_ptr, r, rec, srec);
+		if (depth == 0 && aov)
+			aov->record(rec.normal, rec.t * r.direction().length(),
+				scatters ? srec.attenuation : emitted);
+		if (!scatters)
+			break;
+
+		if (srec.is_specular) {
+			throughput = throughput * srec.attenuation;
+			r = srec.specular_ray;
+		} else {
+			hittable_pdf light_pdf(lights, rec.p);
+			mixture_pdf p(&light_pdf, srec.pdf_ptr);
+			ray scattered = ray(rec.p, p.generate(), r.time());
+			auto pdf_val = p.value(scattered.direction());
+
+			throughput = throughput * srec.attenuation
+				* material_scattering_pdf(*rec.mat_ptr, r, rec, scattered) / pdf_val;
+			r = scattered;
+		}
+
+		if (depth + 1 >= rr_depth && !russian_roulette(throughput))
+			break;
+	}
+
+	return radiance;
+}
+
+
+color sample_light(
+	const ray& r,
+	const hit_record& rec,
+	const scatter_record& srec,
+	const hittable& world,
+	const light_sampler& lights
+) {
+	// One light sample for the diffuse hit rec, weighted for combination with the material's
+	// own sample. The emission at the sampled point is found first, so a shadow ray is only
+	// traced for light that would arrive; it stops just short of the light itself.
+	const hittable* light;
+	real light_pdf;
+	ray shadow(rec.p, lights.sample(rec.p, light, light_pdf), r.time());
+	hit_record light_rec;
+
+	if (!(light_pdf > 0) || !std::isfinite(light_pdf)
+		|| !light->hit(shadow, 0.001, infinity, light_rec))
+		return color(0, 0, 0);
+	light_rec.complete(shadow);
+
+	auto emitted = material_emitted(*light_rec.mat_ptr,
+		shadow, light_rec, light_rec.u, light_rec.v, light_rec.p);
+	if (!(emitted.x() > 0 || emitted.y() > 0 || emitted.z() > 0))
+		return color(0, 0, 0);
+
+	RTW_STAT(stat_shadow_rays);
+	if (world.occluded(shadow, 0.001, light_rec.t * (1 - 1e-4)))
+		return color(0, 0, 0);
+
+	auto weight = power_heuristic(light_pdf, srec.pdf_ptr->value(shadow.direction()));
+	return srec.attenuation * emitted * weight
+		* material_scattering_pdf(*rec.mat_ptr, r, rec, shadow) / light_pdf;
+}
+
+
+color ray_color_nee(
+	ray r,
+	const color& background,
+	const hittable& world,
+	const light_sampler& lights,
+	int max_depth,
+	int rr_depth,
+	first_hit* aov = nullptr
+) {
+	// Next-event estimation: at every diffuse bounce, besides continuing the path by sampling
+	// the material, trace a shadow ray toward a light picked from lights. Emission is counted
+	// both ways, each weighted by the power heuristic against the density of the other.
+	color radiance(0, 0, 0);
+	color throughput(1, 1, 1);
+	bool specular = true;  // Light found after a specular bounce could not have been sampled
+	real scatter_pdf = 0;  // Density of r, if it was sampled from a diffuse material
+	point3 origin;
+
+	for (int depth = 0; depth < max_depth; ++depth) {
+		hit_record rec;
+		start_bounce(depth);
+
+		RTW_STAT(stat_path_rays);
+		if (!world.hit(r, 0.001, infinity, rec)) {
+			radiance += throughput * background;
+			break;
+		}
+		rec.complete(r);
+
+		auto emitted = material_emitted(*rec.mat_ptr, r, rec, rec.u, rec.v, rec.p);
+		if (emitted.x() > 0 || emitted.y() > 0 || emitted.z() > 0) {
+			auto weight = specular ? 1
+				: power_heuristic(scatter_pdf, lights.pdf_value(origin, r.direction(), rec.object));
+			radiance += throughput * emitted * weight;
+		}
+
+		scatter_record srec;
+		bool scatters = material_scatter(*rec.mat_ptr, r, rec, srec);
+		if (depth == 0 && aov)
+			aov->record(rec.normal, rec.t * r.direction().length(),
+				scatters ? srec.attenuation : emitted);
+		if (!scatters)
+			break;
+
+		if (srec.is_specular) {
+			throughput = throughput * srec.attenuation;
+			r = srec.specular_ray;
+			specular = true;
+		} else {
+			if (!lights.empty())
+				radiance += throughput * sample_light(r, rec, srec, world, lights);
+
+			ray scattered = ray(rec.p, srec.pdf_ptr->generate(), r.time());
+			scatter_pdf = srec.pdf_ptr->value(scattered.direction());
+			if (!(scatter_pdf > 0))
+				break;
+
+			throughput = throughput * srec.attenuation
+				* material_scattering_pdf(*rec.mat_ptr, r, rec, scattered) / scatter_pdf;
+			origin = rec.p;
+			r = scattered;
+			specular = false;
+		}
+
+		if (depth + 1 >= rr_depth && !russian_roulette(throughput))
+			break;
+	}
+
+	return radiance;
+}
+
+
+hittable_list cornell_box(camera& cam, real aspect, light_sampler& lights) {
 	hittable_list world;
 
 	auto red = make_shared<lambertian>(make_shared<solid_color>(.65, .05, .05));
@@ -76,7 +257,10 @@ hittable_list cornell_box(camera& cam, double aspect) {
 
 	world.add(make_shared<flip_face>(make_shared<yz_rect>(0, 555, 0, 555, 555, green)));
 	world.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-	world.add(make_shared<flip_face>(make_shared<xz_rect>(213, 343, 227, 332, 554, light)));
+	auto ceiling_light =
+		make_shared<flip_face>(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+	world.add(ceiling_light);
+	lights.add(ceiling_light, 15.0 * (343 - 213) * (332 - 227));  // Radiance times area
 	world.add(make_shared<flip_face>(make_shared<xz_rect>(0, 555, 0, 555, 555, white)));
 	world.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
 	world.add(make_shared<flip_face>(make_shared<xy_rect>(0, 555, 0, 555, 555, white)));
@@ -104,51 +288,157 @@ hittable_list cornell_box(camera& cam, double aspect) {
 }
 
 
-int main() {
-	const auto aspect_ratio = 1.0 / 1.0;
-	const int image_width = 600;
-	const int image_height = static_cast<int>(image_width / aspect_ratio);
-	const int samples_per_pixel = 2000;
-	const int max_depth = 50;
-	const int n = 4;
-	const int buffer_size = image_height * image_width * n;
-	unsigned char* buffer = new unsigned char[buffer_size];
+int main(int argc, char* argv[]) {
+	render_options options;
+	options.image_width = 600;
+	options.samples_per_pixel = 2000;
+	options.max_depth = 50;
+	options.integrators = { "nee", "iterative", "recursive" };
+	options.integrator = "nee";
+	options.scenes = { "cornell_box" };
+	options.scene = "cornell_box";
+	options.output = "theRestOfYourLife.png";
+	options.takes_aovs = true;
+	if (!options.parse(argc, argv))
+		return 1;
+
+	const auto aspect_ratio = options.image_height > 0
+		? double(options.image_width) / options.image_height : 1.0 / 1.0;
+	const int image_width = options.image_width;
+	const int image_height = options.image_height > 0
+		? options.image_height : static_cast<int>(image_width / aspect_ratio);
+	const int samples_per_pixel = options.samples_per_pixel;
+	const int max_depth = options.max_depth;
+	enum { recursive, iterative, nee };
+	const int integrator = options.integrator == "recursive" ? recursive
+	                     : options.integrator == "iterative" ? iterative : nee;
+	const int rr_depth = options.rr_depth;
+	const bool adaptive = options.adaptive;
+	const bool progressive = options.progressive;
+	const int node = options.node;
+	const int node_count = options.node_count;
+	const bool denoise = options.denoise && node_count == 1;
+	const bool gather_features = denoise || (options.aovs && node_count == 1);
 
-	omp_lock_t m_lock;
-	omp_init_lock(&m_lock);
+	if (options.threads > 0)
+		omp_set_num_threads(options.threads);
+	active_sample_sequence() = options.sequence();
 
 	// std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
 
 	color background(0, 0, 0);
 
+	RTW_STAT_TIMER(scene_timer, stat_scene_build);
 	camera cam;
-	auto world = cornell_box(cam, aspect_ratio);
+	light_sampler emitters;
+	auto world = cornell_box(cam, aspect_ratio, emitters);
+	cam.set_image_width(image_width);
 
+	// The book's estimators also aim samples at the glass ball; next-event estimation samples
+	// only the emitters.
 	auto lights = make_shared<hittable_list>();
 	lights->add(make_shared<xz_rect>(213, 343, 227, 332, 554, shared_ptr<material>()));
 	lights->add(make_shared<sphere>(point3(190, 90, 190), 90, shared_ptr<material>()));
-	for (int j = image_height - 1; j >= 0; --j) {
-		std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-#pragma omp parallel for 
-		for (int i = 0; i < image_width; ++i) {
-			color pixel_color; 
-			for (int s = 0; s < samples_per_pixel; ++s) {
-				auto u = (i + random_double()) / (image_width - 1);
-				auto v = (j + random_double()) / (image_height - 1);
-				ray r = cam.get_ray(u, v);				
-				pixel_color += ray_color(r, background, world, lights, max_depth);				
-			}
-			omp_set_lock(&m_lock);
-			buffer[n * image_width * j + i * n + 0] = convert(pixel_color.x(), samples_per_pixel);
-			buffer[n * image_width * j + i * n + 1] = convert(pixel_color.y(), samples_per_pixel);
-			buffer[n * image_width * j + i * n + 2] = convert(pixel_color.z(), samples_per_pixel);
-			buffer[n * image_width * j + i * n + 3] = 255; 
-			omp_unset_lock(&m_lock);
+	RTW_STAT_STOP(scene_timer);
+
+	const auto share = node_samples(node, node_count, samples_per_pixel);
+	adaptive_sampler sampler(adaptive ? 32 : share.count, share.count, options.threshold);
+	framebuffer image(image_width, image_height);
+	feature_buffer features = gather_features
+		? feature_buffer(image_width, image_height) : feature_buffer();
+
+	auto trace = [&](const ray& r, first_hit* aov) -> color {
+		if (integrator == nee)
+			return ray_color_nee(r, background, world, emitters, max_depth, rr_depth, aov);
+		return integrator == iterative
+			? ray_color_iterative(r, background, world, *lights, max_depth, rr_depth, aov)
+			: ray_color(r, background, world, *lights, max_depth, aov);
+	};
+
+	auto sample = [&](int i, int j, int s) -> color {
+		start_sample(i, j, image_width, s);
+		real du, dv;
+		sample_2d(du, dv);
+		auto u = (i + du) / (image_width - 1);
+		auto v = (j + dv) / (image_height - 1);
+		ray r = cam.get_ray(u, v);
+		if (!gather_features)
+			return trace(r, nullptr);
+
+		first_hit hit;
+		auto pixel_color = trace(r, &hit);
+		features.add(i, j, pixel_color, hit);
+		return pixel_color;
+	};
+
+	auto write_file = [&](const std::string& path, const framebuffer& fb) {
+		if (!make_image_output(path, image_width, image_height)->finish(fb))
+			std::cerr << "\nCould not write " << path << '\n';
+	};
+
+	auto write_image = [&](const framebuffer& fb) {
+		RTW_STAT_TIMER(timer, stat_encode);
+		write_file(options.output, denoise ? denoiser().denoise(fb, features) : fb);
+	};
+
+	// Unless the render is progressive or denoised, tiles stream into the image as they finish,
+	// so only completing the file waits for the frame. A share of a distributed render is saved
+	// as raw sums and counts for rtw_merge instead.
+	std::unique_ptr<image_output> output;
+	if (node_count == 1 && !progressive && !denoise)
+		output = make_image_output(options.output, image_width, image_height);
+
+	auto write_output = [&](const framebuffer& fb) {
+		if (node_count == 1 && !output) {
+			write_image(fb);
+			return;
 		}
+		RTW_STAT_TIMER(timer, stat_encode);
+		if (output) {
+			if (!output->finish(fb))
+				std::cerr << "\nCould not write " << options.output << '\n';
+		} else if (!fb.write_checkpoint(options.output_with(".node" + std::to_string(node) + ".fb"))) {
+			std::cerr << "\nCould not write the sample buffer\n";
+		}
+	};
+
+	tile_renderer renderer(image_width, image_height, options.tile_size);
+	RTW_STAT_TIMER(render_timer, stat_render);
+	if (progressive && node_count == 1) {
+		// Rerunning after an interruption resumes from the checkpoint.
+		progressive_renderer passes(renderer, samples_per_pixel);
+		passes.checkpoint_every(
+			options.checkpoint_seconds, 0, options.output_with(".ckpt"), write_image);
+		passes.render(image, sample);
+		RTW_STAT_STOP(render_timer);
+	} else {
+		renderer.render([&](const tile& t) {
+			sampler.sample_tile(t, sample, image, share.first);
+			if (output)
+				output->write_tile(image, t);
+		});
+		RTW_STAT_STOP(render_timer);
+		write_output(image);
+	}
+
+	// The AOVs are linear floats, so they go in .exr files if the image does, else in .pfm.
+	if (options.aovs && node_count == 1) {
+		RTW_STAT_TIMER(timer, stat_encode);
+		const std::string extension = has_extension(options.output, ".exr") ? ".exr" : ".pfm";
+		write_file(options.output_with("_albedo" + extension), features.albedo_image());
+		write_file(options.output_with("_normal" + extension), features.normal_image());
+		write_file(options.output_with("_depth" + extension), features.depth_image());
+	}
+
+	if (adaptive && !progressive && node_count == 1) {
+		RTW_STAT_TIMER(timer, stat_encode);
+		auto heatmap = image.sample_heatmap_rgba8(share.count);
+		stbi_write_png(options.output_with("_samples.png").c_str(),
+			image_width, image_height, 4, heatmap.data(), image_width * 4);
+		std::cerr << "\nAverage samples per pixel: "
+			<< double(image.total_samples()) / (image_width * image_height);
 	}
 
-	stbi_write_png("theRestOfYourLife.png", image_width, image_height, n, buffer, image_width * n);
-	delete[] buffer;
-	omp_destroy_lock(&m_lock);
+	RTW_STAT_REPORT(std::cerr);
 	std::cerr << "\nDone.\n";
 }
@@ -16,9 +16,14 @@
 #include "pdf.h"
 #include "texture.h"
 
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
 
-double schlick(double cosine, double ref_idx) {
-    double r0 = (1-ref_idx) / (1+ref_idx);
+
+real schlick(real cosine, real ref_idx) {
+    real r0 = (1-ref_idx) / (1+ref_idx);
     r0 = r0*r0;
     return r0 + (1-r0)*pow((1 - cosine),5);
 }
@@ -29,14 +34,45 @@ struct scatter_record
     ray specular_ray;
     bool is_specular;
     color attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    const pdf* pdf_ptr;  // Lives in pdf_storage; null for specular scattering
+
+    scatter_record() : pdf_ptr(nullptr) {}
+    ~scatter_record() { reset_pdf(); }
+
+    scatter_record(const scatter_record&) = delete;
+    scatter_record& operator=(const scatter_record&) = delete;
+
+    // Builds the scattering PDF inside the record itself, so a bounce never allocates.
+    template <typename P, typename... Args>
+    void emplace_pdf(Args&&... args) {
+        static_assert(sizeof(P) <= sizeof(pdf_storage), "PDF does not fit in scatter_record");
+        static_assert(alignof(P) <= alignof(decltype(pdf_storage)), "PDF is over-aligned");
+        reset_pdf();
+        pdf_ptr = new (&pdf_storage) P(std::forward<Args>(args)...);
+    }
+
+    void reset_pdf() {
+        if (pdf_ptr)
+            pdf_ptr->~pdf();
+        pdf_ptr = nullptr;
+    }
+
+    private:
+        std::aligned_storage<128, alignof(std::max_align_t)>::type pdf_storage;
 };
 
 
+// The materials defined here, which shading dispatches on with a switch (see material_scatter
+// below). Materials defined elsewhere are other, and reached through their virtual functions.
+enum class material_kind { lambertian, metal, dielectric, diffuse_light, other };
+
+
 class material  {
     public:
+        material() : tag(material_kind::other) {}
+
         virtual color emitted(
-            const ray& r_in, const hit_record& rec, double u, double v, const point3& p
+            const ray& r_in, const hit_record& rec, real u, real v, const point3& p
         ) const {
             return color(0,0,0);
         }
@@ -47,37 +83,50 @@ class material  {
             return false;
         }
 
-        virtual double scattering_pdf(
+        virtual real scattering_pdf(
             const ray& r_in, const hit_record& rec, const ray& scattered
         ) const {
             return 0;
         }
+
+        material_kind kind() const { return tag; }
+
+    private:
+        // Only the final classes below may claim a kind, since material_scatter casts to them.
+        friend class dielectric;
+        friend class diffuse_light;
+        friend class lambertian;
+        friend class metal;
+
+        explicit material(material_kind k) : tag(k) {}
+
+        material_kind tag;
 };
 
 
-class dielectric : public material {
+class dielectric final : public material {
     public:
-        dielectric(double ri) : ref_idx(ri) {}
+        dielectric(real ri) : material(material_kind::dielectric), ref_idx(ri) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, scatter_record& srec
         ) const {
             srec.is_specular = true;
-            srec.pdf_ptr = nullptr;
+            srec.reset_pdf();
             srec.attenuation = color(1.0, 1.0, 1.0);
-            double etai_over_etat = (rec.front_face) ? (1.0 / ref_idx) : (ref_idx);
+            real etai_over_etat = (rec.front_face) ? (1.0 / ref_idx) : (ref_idx);
 
             vec3 unit_direction = unit_vector(r_in.direction());
-            double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+            real cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+            real sin_theta = sqrt(1.0 - cos_theta*cos_theta);
             if (etai_over_etat * sin_theta > 1.0 ) {
                 vec3 reflected = reflect(unit_direction, rec.normal);
                 srec.specular_ray = ray(rec.p, reflected, r_in.time());
                 return true;
             }
 
-            double reflect_prob = schlick(cos_theta, etai_over_etat);
-            if (random_double() < reflect_prob)
+            real reflect_prob = schlick(cos_theta, etai_over_etat);
+            if (sample_1d() < reflect_prob)
             {
                 vec3 reflected = reflect(unit_direction, rec.normal);
                 srec.specular_ray = ray(rec.p, reflected, r_in.time());
@@ -90,20 +139,21 @@ class dielectric : public material {
         }
 
     public:
-        double ref_idx;
+        real ref_idx;
 };
 
 
-class diffuse_light : public material {
+class diffuse_light final : public material {
     public:
-        diffuse_light(shared_ptr<texture> a) : emit(a) {}
+        diffuse_light(shared_ptr<texture> a)
+          : material(material_kind::diffuse_light), emit(a) {}
 
         virtual color emitted(
-            const ray& r_in, const hit_record& rec, double u, double v, const point3& p
+            const ray& r_in, const hit_record& rec, real u, real v, const point3& p
         ) const {
             if (!rec.front_face)
                 return color(0,0,0);
-            return emit->value(u, v, p);
+            return emit->lookup(u, v, p, 0);
         }
 
     public:
@@ -118,8 +168,8 @@ class isotropic : public material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const  {
-            scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            scattered = ray(rec.p, sample_unit_vector(), r_in.time());
+            attenuation = albedo->lookup(rec.u, rec.v, rec.p, rec.footprint);
             return true;
         }
 
@@ -128,20 +178,20 @@ class isotropic : public material {
 };
 
 
-class lambertian : public material {
+class lambertian final : public material {
     public:
-        lambertian(shared_ptr<texture> a) : albedo(a) {}
+        lambertian(shared_ptr<texture> a) : material(material_kind::lambertian), albedo(a) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, scatter_record& srec
         ) const {
             srec.is_specular = false;
-            srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
-            srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+            srec.attenuation = albedo->lookup(rec.u, rec.v, rec.p, rec.footprint);
+            srec.emplace_pdf<cosine_pdf>(rec.normal);
             return true;
         }
 
-        double scattering_pdf(
+        real scattering_pdf(
             const ray& r_in, const hit_record& rec, const ray& scattered
         ) const {
             auto cosine = dot(rec.normal, unit_vector(scattered.direction()));
@@ -153,26 +203,75 @@ class lambertian : public material {
 };
 
 
-class metal : public material {
+class metal final : public material {
     public:
-        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+        metal(const color& a, real f)
+          : material(material_kind::metal), albedo(a), fuzz(f < 1 ? f : 1) {}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, scatter_record& srec
         ) const {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
             srec.specular_ray =
-                ray(rec.p, reflected + fuzz*random_in_unit_sphere(), r_in.time());
+                ray(rec.p, reflected + fuzz*sample_in_unit_sphere(), r_in.time());
             srec.attenuation = albedo;
             srec.is_specular = true;
-            srec.pdf_ptr = nullptr;
+            srec.reset_pdf();
             return true;
         }
 
     public:
         color albedo;
-        double fuzz;
+        real fuzz;
 };
 
 
+// Shading switched on the material's kind. Each case calls its class's own function by name,
+// which the compiler can inline, so a bounce off one of the materials above makes no virtual
+// call; other materials go through the vtable.
+
+inline color material_emitted(
+    const material& m, const ray& r_in, const hit_record& rec, real u, real v, const point3& p
+) {
+    switch (m.kind()) {
+    case material_kind::diffuse_light:
+        return static_cast<const diffuse_light&>(m).diffuse_light::emitted(r_in, rec, u, v, p);
+    case material_kind::other:
+        return m.emitted(r_in, rec, u, v, p);
+    default:
+        return color(0,0,0);
+    }
+}
+
+inline bool material_scatter(
+    const material& m, const ray& r_in, const hit_record& rec, scatter_record& srec
+) {
+    switch (m.kind()) {
+    case material_kind::lambertian:
+        return static_cast<const lambertian&>(m).lambertian::scatter(r_in, rec, srec);
+    case material_kind::metal:
+        return static_cast<const metal&>(m).metal::scatter(r_in, rec, srec);
+    case material_kind::dielectric:
+        return static_cast<const dielectric&>(m).dielectric::scatter(r_in, rec, srec);
+    case material_kind::diffuse_light:
+        return false;
+    default:
+        return m.scatter(r_in, rec, srec);
+    }
+}
+
+inline real material_scattering_pdf(
+    const material& m, const ray& r_in, const hit_record& rec, const ray& scattered
+) {
+    switch (m.kind()) {
+    case material_kind::lambertian:
+        return static_cast<const lambertian&>(m).lambertian::scattering_pdf(r_in, rec, scattered);
+    case material_kind::other:
+        return m.scattering_pdf(r_in, rec, scattered);
+    default:
+        return 0;
+    }
+}
+
+
 #endif
@@ -13,40 +13,74 @@
 
 #include "rtweekend.h"
 
+#include "hittable.h"
 #include "onb.h"
 
 
-inline vec3 random_cosine_direction() {
-    auto r1 = random_double();
-    auto r2 = random_double();
+// The directions below for given uniform values r1 and r2, as drawn from a sample stream.
+
+inline vec3 cosine_direction(real r1, real r2) {
     auto z = sqrt(1-r2);
 
-    auto phi = 2*pi*r1;
-    auto x = cos(phi)*sqrt(r2);
-    auto y = sin(phi)*sqrt(r2);
+    real s, c;
+    sin_cos(2*pi*r1, s, c);
+    auto x = c*sqrt(r2);
+    auto y = s*sqrt(r2);
 
     return vec3(x, y, z);
 }
 
 
-inline vec3 random_to_sphere(double radius, double distance_squared) {
-    auto r1 = random_double();
-    auto r2 = random_double();
+inline vec3 to_sphere(real radius, real distance_squared, real r1, real r2) {
     auto z = 1 + r2*(sqrt(1-radius*radius/distance_squared) - 1);
 
-    auto phi = 2*pi*r1;
-    auto x = cos(phi)*sqrt(1-z*z);
-    auto y = sin(phi)*sqrt(1-z*z);
+    real s, c;
+    sin_cos(2*pi*r1, s, c);
+    auto x = c*sqrt(1-z*z);
+    auto y = s*sqrt(1-z*z);
 
     return vec3(x, y, z);
 }
 
 
+// cosine_direction for each of n pairs, with the sines and cosines taken as a batch.
+inline void cosine_direction(const real* r1, const real* r2, vec3* out, int n) {
+    const int chunk = 64;
+    real phi[chunk], s[chunk], c[chunk];
+
+    for (int first = 0; first < n; first += chunk) {
+        const int count = n - first < chunk ? n - first : chunk;
+        for (int k = 0; k < count; k++)
+            phi[k] = 2*pi*r1[first + k];
+        sin_cos(phi, s, c, count);
+
+        for (int k = 0; k < count; k++) {
+            const auto r = sqrt(r2[first + k]);
+            out[first + k] = vec3(c[k]*r, s[k]*r, sqrt(1-r2[first + k]));
+        }
+    }
+}
+
+
+inline vec3 random_cosine_direction() {
+    auto r1 = random_double();
+    auto r2 = random_double();
+    return cosine_direction(r1, r2);
+}
+
+
+inline vec3 random_to_sphere(real radius, real distance_squared) {
+    auto r1 = random_double();
+    auto r2 = random_double();
+    return to_sphere(radius, distance_squared, r1, r2);
+}
+
+
 class pdf  {
     public:
         virtual ~pdf() {}
 
-        virtual double value(const vec3& direction) const = 0;
+        virtual real value(const vec3& direction) const = 0;
         virtual vec3 generate() const = 0;
 };
 
@@ -55,13 +89,15 @@ class cosine_pdf : public pdf {
     public:
         cosine_pdf(const vec3& w) { uvw.build_from_w(w); }
 
-        virtual double value(const vec3& direction) const {
+        virtual real value(const vec3& direction) const {
             auto cosine = dot(unit_vector(direction), uvw.w());
             return (cosine <= 0) ? 0 : cosine/pi;
         }
 
         virtual vec3 generate() const  {
-            return uvw.local(random_cosine_direction());
+            real r1, r2;
+            sample_2d(r1, r2);
+            return uvw.local(cosine_direction(r1, r2));
         }
 
     public:
@@ -70,10 +106,11 @@ class cosine_pdf : public pdf {
 
 
 class hittable_pdf : public pdf {
+    // Refers to the hittable without owning it, so it can live on the stack for a bounce.
     public:
-        hittable_pdf(shared_ptr<hittable> p, const point3& origin) : ptr(p), o(origin) {}
+        hittable_pdf(const hittable& p, const point3& origin) : ptr(&p), o(origin) {}
 
-        virtual double value(const vec3& direction) const {
+        virtual real value(const vec3& direction) const {
             return ptr->pdf_value(o, direction);
         }
 
@@ -82,31 +119,32 @@ class hittable_pdf : public pdf {
         }
 
     public:
+        const hittable* ptr;
         point3 o;
-        shared_ptr<hittable> ptr;
 };
 
 
 class mixture_pdf : public pdf {
+    // Mixes two PDFs owned by the caller, which must outlive the mixture.
     public:
-        mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
+        mixture_pdf(const pdf* p0, const pdf* p1) {
             p[0] = p0;
             p[1] = p1;
         }
 
-        virtual double value(const vec3& direction) const {
+        virtual real value(const vec3& direction) const {
             return 0.5 * p[0]->value(direction) + 0.5 *p[1]->value(direction);
         }
 
         virtual vec3 generate() const {
-            if (random_double() < 0.5)
+            if (sample_1d() < 0.5)
                 return p[0]->generate();
             else
                 return p[1]->generate();
         }
 
     public:
-        shared_ptr<pdf> p[2];
+        const pdf* p[2];
 };
 
 
@@ -11,37 +11,24 @@
 
 #include "rtweekend.h"
 
-#include <iostream>
-#include <iomanip>
-#include <math.h>
-#include <stdlib.h>
-
-
-int main() {
-    int inside_circle = 0;
-    int inside_circle_stratified = 0;
-    int sqrt_N = 10000;
-
-    for (int i = 0; i < sqrt_N; i++) {
-        for (int j = 0; j < sqrt_N; j++) {
-            auto x = random_double(-1,1);
-            auto y = random_double(-1,1);
-
-            if (x*x + y*y < 1)
-                inside_circle++;
-
-            x = 2*((i + random_double()) / sqrt_N) - 1;
-            y = 2*((j + random_double()) / sqrt_N) - 1;
-
-            if (x*x + y*y < 1)
-                inside_circle_stratified++;
-        }
+#include "estimator.h"
+
+
+int main(int argc, char* argv[]) {
+    // The fraction of points in the square [-1,1]^2 that fall in the unit circle, times four.
+    estimator_options options(argc, argv, 100000000);
+    if (!options.ok())
+        return 1;
+
+    report_header("pi", pi, options);
+    for (const auto& s : options.sequences()) {
+        const auto e = options.make_estimator(s.second).run([] {
+            real u, v;
+            sample_2d(u, v);
+            const auto x = 2*u - 1;
+            const auto y = 2*v - 1;
+            return x*x + y*y < 1 ? real(4) : real(0);
+        });
+        report(s.first, e, pi);
     }
-
-    auto N = static_cast<double>(sqrt_N) * sqrt_N;
-    std::cout << std::fixed << std::setprecision(12);
-    std::cout << "Regular    Estimate of Pi = "
-        << 4 * double(inside_circle) / (sqrt_N*sqrt_N) << '\n';
-    std::cout << "Stratified Estimate of Pi = "
-        << 4 * double(inside_circle_stratified) / (sqrt_N*sqrt_N) << '\n';
 }
@@ -20,20 +20,22 @@
 class sphere: public hittable  {
     public:
         sphere() {}
-        sphere(point3 cen, double r, shared_ptr<material> m)
+        sphere(point3 cen, real r, shared_ptr<material> m)
             : center(cen), radius(r), mat_ptr(m) {};
-        virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
-        virtual bool bounding_box(double t0, double t1, aabb& output_box) const;
-        virtual double pdf_value(const point3& o, const vec3& v) const;
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual void surface(const ray& r, hit_record& rec) const;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const;
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const;
+        virtual real pdf_value(const point3& o, const vec3& v) const;
         virtual vec3 random(const point3& o) const;
 
     public:
         point3 center;
-        double radius;
+        real radius;
         shared_ptr<material> mat_ptr;
 };
 
-double sphere::pdf_value(const point3& o, const vec3& v) const {
+real sphere::pdf_value(const point3& o, const vec3& v) const {
     hit_record rec;
     if (!this->hit(ray(o, v), 0.001, infinity, rec))
         return 0;
@@ -49,18 +51,21 @@ vec3 sphere::random(const point3& o) const {
      auto distance_squared = direction.length_squared();
      onb uvw;
      uvw.build_from_w(direction);
-     return uvw.local(random_to_sphere(radius, distance_squared));
+     real r1, r2;
+     sample_2d(r1, r2);
+     return uvw.local(to_sphere(radius, distance_squared, r1, r2));
 }
 
 
-bool sphere::bounding_box(double t0, double t1, aabb& output_box) const {
+bool sphere::bounding_box(real t0, real t1, aabb& output_box) const {
     output_box = aabb(
         center - vec3(radius, radius, radius),
         center + vec3(radius, radius, radius));
     return true;
 }
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    RTW_STAT(stat_primitive_tests);
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -74,22 +79,16 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
         auto temp = (-half_b - root)/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            rec.object = this;
+            rec.pending = true;
             return true;
         }
 
         temp = (-half_b + root)/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
+            rec.object = this;
+            rec.pending = true;
             return true;
         }
     }
@@ -97,4 +96,36 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     return false;
 }
 
+
+void sphere::surface(const ray& r, hit_record& rec) const {
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(r, outward_normal);
+    get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
+    // u runs around the equator, 2 pi r, and v from pole to pole, pi r; this is their mean.
+    rec.set_footprint(r, sqrt(2.0) * pi * radius);
+    rec.mat_ptr = mat_ptr.get();
+}
+
+
+bool sphere::occluded(const ray& r, real t_min, real t_max) const {
+    RTW_STAT(stat_primitive_tests);
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant <= 0)
+        return false;
+
+    auto root = sqrt(discriminant);
+    auto temp = (-half_b - root)/a;
+    if (temp < t_max && temp > t_min)
+        return true;
+
+    temp = (-half_b + root)/a;
+    return temp < t_max && temp > t_min;
+}
+
 #endif
@@ -11,25 +11,35 @@
 
 #include "rtweekend.h"
 
-#include <iostream>
-#include <iomanip>
-#include <math.h>
-#include <stdlib.h>
+#include "estimator.h"
 
 
-inline double pdf(const vec3& p) {
-    return  1.0 / (4.0*pi);
-}
+class sphere_pdf : public pdf {
+    // Uniform over all directions.
+    public:
+        virtual real value(const vec3&) const {
+            return 1/(4*pi);
+        }
+
+        virtual vec3 generate() const {
+            return sample_unit_vector();
+        }
+};
+
 
+int main(int argc, char* argv[]) {
+    // The integral of cos^2 over the sphere of directions, sampled uniformly.
+    estimator_options options(argc, argv, 10000000);
+    if (!options.ok())
+        return 1;
 
-int main() {
-    int N = 1000000;
-    auto sum = 0.0;
-    for (int i = 0; i < N; i++) {
-        vec3 d = random_unit_vector();
-        auto cosine_squared = d.z()*d.z();
-        sum += cosine_squared / pdf(d);
+    const sphere_pdf p;
+    const double exact = 4*pi/3;
+    report_header("I", exact, options);
+    for (const auto& s : options.sequences()) {
+        const auto e = integrate(options.make_estimator(s.second), p, [](const vec3& d) {
+            return d.z()*d.z();
+        });
+        report(s.first, e, exact);
     }
-    std::cout << std::fixed << std::setprecision(12);
-    std::cout << "I = " << sum/N << '\n';
 }
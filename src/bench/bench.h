@@ -0,0 +1,131 @@
+#ifndef BENCH_H
+#define BENCH_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+
+// Benchmarks pass a checksum of their results through here, so the compiler can't drop the work.
+inline void bench_keep(double checksum) {
+    static volatile double sink = 0;
+    sink = sink + checksum;
+}
+
+
+class bench_suite {
+    // Runs named benchmarks and prints one JSON object per line on stdout, after a first line
+    // describing the build. Timings go to stdout only; progress and scene loading messages
+    // stay on stderr, so the output can be piped straight into a regression tracker.
+    //
+    // Each benchmark is calibrated to take at least min_time seconds per trial, then timed over
+    // several trials; the median trial is reported, with the fastest and slowest for scale.
+    // All inputs come from fixed random seeds, so two runs of one build do the same work.
+    //
+    //     rtw_bench [--filter SUBSTRING] [--trials N] [--min-time SECONDS]
+    public:
+        bench_suite(const char* suite, int argc, char* argv[]) : suite(suite) {
+            for (int a = 1; a < argc; ++a) {
+                std::string arg = argv[a];
+                if (arg == "--filter" && a + 1 < argc) {
+                    filter = argv[++a];
+                } else if (arg == "--trials" && a + 1 < argc) {
+                    trials = std::max(1, std::atoi(argv[++a]));
+                } else if (arg == "--min-time" && a + 1 < argc) {
+                    min_time = std::max(0.0, std::atof(argv[++a]));
+                } else {
+                    std::cerr << "usage: " << argv[0]
+                              << " [--filter SUBSTRING] [--trials N] [--min-time SECONDS]\n";
+                    valid = false;
+                }
+            }
+
+            if (valid) {
+                std::cout << "{\"suite\":\"" << suite << "\""
+                          << ",\"real\":\"" << (sizeof(real) == 4 ? "float" : "double") << "\""
+#ifdef RTW_SIMD_VEC3
+                          << ",\"simd_vec3\":true"
+#else
+                          << ",\"simd_vec3\":false"
+#endif
+                          << ",\"threads\":" << omp_get_max_threads()
+                          << ",\"trials\":" << trials
+                          << ",\"min_time\":" << min_time << "}\n";
+            }
+        }
+
+        bool ok() const { return valid; }
+
+        bool selected(const std::string& name) const {
+            return filter.empty() || name.find(filter) != std::string::npos;
+        }
+
+        // Times body(n), which must do n repetitions of the benchmarked operation and return
+        // how many units of work (hits, lookups, rays) those repetitions did in total.
+        template <typename F>
+        void run(const std::string& name, const char* unit, F body) const {
+            if (!selected(name))
+                return;
+
+            std::cerr << "Running " << name << "...\n";
+
+            // Grow the repetition count until one trial is long enough to time reliably.
+            int64_t reps = 1;
+            double work = 0;
+            for (;;) {
+                const auto seconds = time_once(body, reps, work);
+                if (seconds >= min_time || reps >= (int64_t(1) << 40))
+                    break;
+                const auto scale = seconds > 0 ? 1.5 * min_time / seconds : 100.0;
+                reps = std::max(reps + 1, static_cast<int64_t>(reps * std::min(scale, 100.0)));
+            }
+
+            std::vector<double> rates;
+            for (int t = 0; t < trials; t++) {
+                const auto seconds = time_once(body, reps, work);
+                rates.push_back(seconds > 0 ? work / seconds : 0);
+            }
+            std::sort(rates.begin(), rates.end());
+
+            const auto median = rates[rates.size() / 2];
+            std::cout << "{\"name\":\"" << name << "\""
+                      << ",\"unit\":\"" << unit << "\""
+                      << ",\"work\":" << static_cast<long long>(work)
+                      << ",\"per_second\":" << median
+                      << ",\"ns_per_unit\":" << (median > 0 ? 1e9 / median : 0)
+                      << ",\"min_per_second\":" << rates.front()
+                      << ",\"max_per_second\":" << rates.back() << "}\n" << std::flush;
+        }
+
+    private:
+        std::string suite;
+        std::string filter;
+        int trials = 5;
+        double min_time = 0.25;
+        bool valid = true;
+
+        template <typename F>
+        static double time_once(F& body, int64_t reps, double& work) {
+            const auto start = std::chrono::steady_clock::now();
+            work = static_cast<double>(body(reps));
+            const auto stop = std::chrono::steady_clock::now();
+            return std::chrono::duration<double>(stop - start).count();
+        }
+};
+
+
+#endif
@@ -0,0 +1,478 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Benchmarks the renderer of The Next Week: the intersection routines, BVHs and textures one at
+// a time, and then whole path-traced frames of the predefined scenes in rays per second. It also
+// prints the shape of each BVH builder's tree over one set of primitives. The
+// PDFs of The Rest of Your Life are built on a different hittable, so they live in
+// rtw_bench_pdf.
+
+#include "rtweekend.h"
+
+#include "aarect.h"
+#include "bench.h"
+#include "box.h"
+#include "bvh.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "perlin.h"
+#include "primitive_pool.h"
+#include "ray_color.h"
+#include "renderer.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "texture.h"
+#include "texture_cache.h"
+#include "triangle_mesh.h"
+
+#include <vector>
+#include <omp.h>
+
+#ifndef RTW_BENCH_IMAGE
+#define RTW_BENCH_IMAGE "earthmap.jpg"
+#endif
+
+
+const int input_count = 1024;  // Inputs per repetition of a micro benchmark
+
+
+std::vector<ray> rays_at_box(const point3& eye_center, real eye_radius, const aabb& target) {
+    // Rays from points around eye_center toward random points of the target box.
+    std::vector<ray> rays;
+    for (int k = 0; k < input_count; k++) {
+        auto from = eye_center + eye_radius * random_unit_vector();
+        auto to = target.min() + (target.max() - target.min()) * vec3::random();
+        rays.push_back(ray(from, to - from));
+    }
+    return rays;
+}
+
+
+template <typename H>
+void bench_hits(const bench_suite& suite, const std::string& name, const H& object,
+                const std::vector<ray>& rays) {
+    suite.run(name, "ray", [&](int64_t reps) {
+        double checksum = 0;
+        hit_record rec;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& r : rays) {
+                if (object.hit(r, 0.001, infinity, rec))
+                    checksum += rec.t;
+            }
+        }
+        bench_keep(checksum);
+        return reps * static_cast<int64_t>(rays.size());
+    });
+}
+
+
+template <typename H>
+void bench_occluded(const bench_suite& suite, const std::string& name, const H& object,
+                    const std::vector<ray>& rays) {
+    suite.run(name, "ray", [&](int64_t reps) {
+        int64_t blocked = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& r : rays)
+                blocked += object.occluded(r, 0.001, infinity);
+        }
+        bench_keep(static_cast<double>(blocked));
+        return reps * static_cast<int64_t>(rays.size());
+    });
+}
+
+
+void print_bvh_stats(const bench_suite& suite, const std::string& name, const bvh_stats& stats) {
+    // Not a timing: the shape of one builder's tree under the SAH cost model, on a line of its
+    // own so builders can be compared over the same primitives.
+    if (!suite.selected(name))
+        return;
+    std::cout << "{\"name\":\"" << name << "\""
+              << ",\"nodes\":" << stats.nodes
+              << ",\"leaves\":" << stats.leaves
+              << ",\"depth\":" << stats.max_depth
+              << ",\"sah_cost\":" << stats.sah_cost << "}\n" << std::flush;
+}
+
+
+class counting_hittable : public hittable {
+    // Passes every ray through to a scene and counts it, per thread.
+    public:
+        counting_hittable(const hittable& scene)
+          : scene(scene), counts(omp_get_max_threads()) {}
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+            counts[omp_get_thread_num()].rays++;
+            return scene.hit(r, t_min, t_max, rec);
+        }
+
+        virtual bool bounding_box(real t0, real t1, aabb& output_box) const {
+            return scene.bounding_box(t0, t1, output_box);
+        }
+
+        int64_t take_count() const {
+            int64_t total = 0;
+            for (auto& c : counts) {
+                total += c.rays;
+                c.rays = 0;
+            }
+            return total;
+        }
+
+    private:
+        struct counter {
+            int64_t rays = 0;
+            char padding[56];  // One cache line per thread
+        };
+
+        const hittable& scene;
+        mutable std::vector<counter> counts;
+};
+
+
+struct scene_setup {
+    const char* name;
+    hittable_list (*build)();
+    point3 lookfrom;
+    point3 lookat;
+    real vfov;
+    color background;
+};
+
+
+void bench_scene(const bench_suite& suite, const scene_setup& setup) {
+    const std::string name = std::string("render_") + setup.name;
+    if (!suite.selected(name))
+        return;
+
+    const int image_width = 64;
+    const int image_height = 64;
+    const int samples_per_pixel = 4;
+    const int max_depth = 30;
+    const int rr_depth = 5;
+
+    seed_random(0, 0);
+    auto world = setup.build();
+    counting_hittable counted(world);
+    camera cam(setup.lookfrom, setup.lookat, vec3(0, 1, 0), setup.vfov, 1.0, 0.0, 10.0, 0.0, 1.0);
+    cam.set_image_width(image_width);
+    tile_renderer renderer(image_width, image_height);
+
+    suite.run(name, "ray", [&](int64_t reps) {
+        counted.take_count();
+        for (int64_t rep = 0; rep < reps; rep++) {
+            framebuffer image(image_width, image_height);
+            renderer.render([&](const tile& t) {
+                for (int j = t.y0; j < t.y1; ++j) {
+                    for (int i = t.x0; i < t.x1; ++i) {
+                        color pixel_color;
+                        for (int s = 0; s < samples_per_pixel; ++s) {
+                            start_sample(i, j, image_width, s);
+                            real du, dv;
+                            sample_2d(du, dv);
+                            auto u = (i + du) / (image_width - 1);
+                            auto v = (j + dv) / (image_height - 1);
+                            pixel_color += ray_color_iterative(
+                                cam.get_ray(u, v), setup.background, counted, max_depth, rr_depth);
+                        }
+                        image.add(i, j, pixel_color, samples_per_pixel);
+                    }
+                }
+            });
+            bench_keep(image.sum(image_width / 2, image_height / 2).x());
+        }
+        return counted.take_count();
+    });
+}
+
+
+int main(int argc, char* argv[]) {
+    bench_suite suite("rtw_bench", argc, argv);
+    if (!suite.ok())
+        return 1;
+
+    // Intersections
+
+    seed_random(0, 0);
+    const aabb unit_box(point3(-1, -1, -1), point3(1, 1, 1));
+    const aabb target(point3(-1.25, -1.25, -1.25), point3(1.25, 1.25, 1.25));
+    const auto rays = rays_at_box(point3(0, 0, 0), 4, target);
+
+    bench_hits(suite, "sphere_hit", sphere(point3(0, 0, 0), 1, nullptr), rays);
+    bench_hits(suite, "xy_rect_hit", xy_rect(-1, 1, -1, 1, 0, nullptr), rays);
+    bench_hits(suite, "xz_rect_hit", xz_rect(-1, 1, -1, 1, 0, nullptr), rays);
+    bench_hits(suite, "yz_rect_hit", yz_rect(-1, 1, -1, 1, 0, nullptr), rays);
+    bench_hits(suite, "box_hit", box(point3(-1, -1, -1), point3(1, 1, 1), nullptr), rays);
+
+    auto corner_box = make_shared<box>(point3(-1, -1, -1), point3(0, 0, 0), nullptr);
+    bench_hits(suite, "translate_rotate_y_box_hit",
+        translate(make_shared<rotate_y>(corner_box, 30), vec3(0.5, 0.5, 0.5)), rays);
+
+    suite.run("aabb_hit", "ray", [&](int64_t reps) {
+        int64_t hits = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& r : rays)
+                hits += unit_box.hit(r, 0.001, infinity);
+        }
+        bench_keep(static_cast<double>(hits));
+        return reps * static_cast<int64_t>(rays.size());
+    });
+
+    // Acceleration structures, over the spheres of random_scene
+
+    seed_random(0, 0);
+    auto spheres = random_scene();
+    aabb spheres_box;
+    spheres.bounding_box(0, 1, spheres_box);
+    const auto scene_rays = rays_at_box(point3(13, 2, 3), 1, spheres_box);
+
+    // The trees each builder makes over 2000 random spheres and 400 random boxes
+
+    seed_random(0, 0);
+    hittable_list scattered;
+    for (int k = 0; k < 2400; k++) {
+        auto center = point3::random(-10, 10);
+        if (k % 6 == 5) {
+            auto half = vec3::random(0.1, 0.5);
+            scattered.add(make_shared<box>(center - half, center + half, nullptr));
+        } else {
+            scattered.add(make_shared<sphere>(center, random_double(0.1, 0.5), nullptr));
+        }
+    }
+    print_bvh_stats(suite, "bvh_node_stats", compute_bvh_stats(bvh_node(scattered, 0, 1)));
+    print_bvh_stats(suite, "flat_bvh_median_stats",
+        flat_bvh(scattered, 0, 1, bvh_build_options(bvh_split::median)).stats());
+    print_bvh_stats(suite, "flat_bvh_sah_stats", flat_bvh(scattered, 0, 1).stats());
+
+    bench_hits(suite, "bvh_node_hit", bvh_node(spheres, 0, 1), scene_rays);
+    bench_hits(suite, "flat_bvh_hit", flat_bvh(spheres, 0, 1), scene_rays);
+    bench_hits(suite, "bvh4_hit", bvh4(spheres, 0, 1), scene_rays);
+    bench_hits(suite, "bvh8_hit", bvh8(spheres, 0, 1), scene_rays);
+    bench_occluded(suite, "flat_bvh_occluded", flat_bvh(spheres, 0, 1), scene_rays);
+    bench_occluded(suite, "bvh4_occluded", bvh4(spheres, 0, 1), scene_rays);
+
+    // A thousand spheres, as sphere objects under a bvh4 and as one pool
+
+    seed_random(0, 0);
+    hittable_list sphere_objects;
+    primitive_pool pool;
+    for (int k = 0; k < 1000; k++) {
+        auto center = point3::random(-10, 10);
+        auto radius = random_double(0.2, 0.6);
+        sphere_objects.add(make_shared<sphere>(center, radius, nullptr));
+        pool.add_sphere(center, radius, nullptr);
+    }
+    pool.build(0, 1);
+    aabb pool_box;
+    pool.bounding_box(0, 1, pool_box);
+    const auto pool_rays = rays_at_box(point3(0, 0, 30), 1, pool_box);
+
+    bench_hits(suite, "sphere_objects_hit", bvh4(sphere_objects, 0, 1), pool_rays);
+    bench_hits(suite, "sphere_pool_hit", pool, pool_rays);
+    bench_occluded(suite, "sphere_objects_occluded", bvh4(sphere_objects, 0, 1), pool_rays);
+    bench_occluded(suite, "sphere_pool_occluded", pool, pool_rays);
+
+    // A mesh of 73,728 triangles
+
+    const triangle_mesh torus(torus_mesh(2, 0.8, 384, 96), nullptr);
+    aabb torus_box;
+    torus.bounding_box(0, 1, torus_box);
+    const auto torus_rays = rays_at_box(point3(0, 3, 8), 1, torus_box);
+
+    bench_hits(suite, "triangle_mesh_hit", torus, torus_rays);
+    bench_occluded(suite, "triangle_mesh_occluded", torus, torus_rays);
+
+    // Textures
+
+    seed_random(0, 0);
+    std::vector<point3> points;
+    for (int k = 0; k < input_count; k++)
+        points.push_back(point3::random(0, 10));
+
+    perlin noise;
+    suite.run("perlin_turb", "lookup", [&](int64_t reps) {
+        double checksum = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& p : points)
+                checksum += noise.turb(p);
+        }
+        bench_keep(checksum);
+        return reps * static_cast<int64_t>(points.size());
+    });
+
+    const baked_turbulence baked(noise, aabb(point3(0, 0, 0), point3(10, 10, 10)), 128);
+    suite.run("perlin_turb_baked", "lookup", [&](int64_t reps) {
+        double checksum = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& p : points)
+                checksum += baked.value(p);
+        }
+        bench_keep(checksum);
+        return reps * static_cast<int64_t>(points.size());
+    });
+
+    image_texture image(RTW_BENCH_IMAGE);
+    suite.run("image_texture_value", "lookup", [&](int64_t reps) {
+        double checksum = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& p : points)
+                checksum += image.value(p.x() / 10, p.y() / 10, p).y();
+        }
+        bench_keep(checksum);
+        return reps * static_cast<int64_t>(points.size());
+    });
+
+    // A footprint of about six texels, which blends two mip levels.
+    const auto footprint = 6.0 / image.width();
+    suite.run("image_texture_filtered", "lookup", [&](int64_t reps) {
+        double checksum = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& p : points)
+                checksum += image.value(p.x() / 10, p.y() / 10, p, footprint).y();
+        }
+        bench_keep(checksum);
+        return reps * static_cast<int64_t>(points.size());
+    });
+
+    // The same image through a texture cache, which adds the residency check to each lookup.
+    texture_cache cache;
+    auto cached = cache.get(RTW_BENCH_IMAGE);
+    suite.run("texture_cache_value", "lookup", [&](int64_t reps) {
+        double checksum = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& p : points)
+                checksum += cached->value(p.x() / 10, p.y() / 10, p).y();
+        }
+        bench_keep(checksum);
+        return reps * static_cast<int64_t>(points.size());
+    });
+
+    // Materials: a bounce off each of a mix of lambertian, metal and dielectric surfaces, through
+    // the vtable and through the switch on the material's kind.
+
+    std::vector<shared_ptr<material>> surfaces;
+    for (int k = 0; k < input_count; k++) {
+        if (k % 3 == 0)
+            surfaces.push_back(make_shared<lambertian>(make_shared<solid_color>(0.5, 0.5, 0.5)));
+        else if (k % 3 == 1)
+            surfaces.push_back(make_shared<metal>(color(0.7, 0.6, 0.5), 0.1));
+        else
+            surfaces.push_back(make_shared<dielectric>(1.5));
+    }
+    const ray incoming(point3(0, 1, -1), vec3(0, -1, 1));
+    hit_record bounce = {};
+    bounce.normal = vec3(0, 1, 0);
+    bounce.front_face = true;
+
+    seed_random(0, 0);
+    suite.run("material_virtual_scatter", "bounce", [&](int64_t reps) {
+        double checksum = 0;
+        color attenuation;
+        ray scattered;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& m : surfaces) {
+                if (m->scatter(incoming, bounce, attenuation, scattered))
+                    checksum += attenuation.x() + scattered.direction().y();
+            }
+        }
+        bench_keep(checksum);
+        return reps * static_cast<int64_t>(surfaces.size());
+    });
+
+    suite.run("material_scatter", "bounce", [&](int64_t reps) {
+        double checksum = 0;
+        color attenuation;
+        ray scattered;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (const auto& m : surfaces) {
+                if (material_scatter(*m, incoming, bounce, attenuation, scattered))
+                    checksum += attenuation.x() + scattered.direction().y();
+            }
+        }
+        bench_keep(checksum);
+        return reps * static_cast<int64_t>(surfaces.size());
+    });
+
+    // Sample sequences, drawing 2D values for four bounces of each sample
+
+    const struct {
+        const char* name;
+        sample_sequence sequence;
+    } sequences[] = {
+        { "sample_independent", sample_sequence::independent },
+        { "sample_sobol", sample_sequence::sobol },
+        { "sample_blue_noise", sample_sequence::blue_noise },
+    };
+    for (const auto& entry : sequences) {
+        active_sample_sequence() = entry.sequence;
+        suite.run(entry.name, "value", [&](int64_t reps) {
+            double checksum = 0;
+            real u, v;
+            for (int64_t rep = 0; rep < reps; rep++) {
+                start_sample(static_cast<int>(rep & 63), 0, 64, static_cast<int>(rep >> 6));
+                for (int depth = 0; depth < 4; depth++) {
+                    start_bounce(depth);
+                    sample_2d(u, v);
+                    checksum += u + v;
+                }
+            }
+            bench_keep(checksum);
+            return reps * 8;
+        });
+    }
+    active_sample_sequence() = sample_sequence::independent;
+
+    // Sample maps, one direction at a time and as a batch
+    std::vector<real> map_u(input_count), map_v(input_count);
+    std::vector<vec3> map_out(input_count);
+    for (int k = 0; k < input_count; k++) {
+        map_u[k] = random_double();
+        map_v[k] = random_double();
+    }
+
+    suite.run("unit_vector_scalar", "direction", [&](int64_t reps) {
+        double checksum = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            for (int k = 0; k < input_count; k++) {
+                const auto d = square_to_unit_vector(map_u[k], map_v[k]);
+                checksum += d.x() + d.y() + d.z();
+            }
+        }
+        bench_keep(checksum);
+        return reps * input_count;
+    });
+
+    suite.run("unit_vector_batch", "direction", [&](int64_t reps) {
+        double checksum = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            square_to_unit_vector(map_u.data(), map_v.data(), map_out.data(), input_count);
+            checksum += map_out[rep % input_count].x();
+        }
+        bench_keep(checksum);
+        return reps * input_count;
+    });
+
+    // Whole frames
+
+    const scene_setup scenes[] = {
+        { "random_scene", random_scene, point3(13, 2, 3), point3(0, 0, 0), 20,
+          color(0.70, 0.80, 1.00) },
+        { "random_motion", random_motion, point3(13, 2, 3), point3(0, 0, 0), 20,
+          color(0.70, 0.80, 1.00) },
+        { "cornell_box", cornell_box, point3(278, 278, -800), point3(278, 278, 0), 40,
+          color(0, 0, 0) },
+        { "final_scene", final_scene, point3(478, 278, -600), point3(278, 278, 0), 40,
+          color(0, 0, 0) },
+        { "instances", instances, point3(13, 2, 3), point3(0, 0, 0), 20,
+          color(0.70, 0.80, 1.00) },
+    };
+    for (const auto& setup : scenes)
+        bench_scene(suite, setup);
+}
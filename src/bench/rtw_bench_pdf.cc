@@ -0,0 +1,110 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Benchmarks the generate/value pairs of The Rest of Your Life's PDFs, each as one sampled
+// direction followed by the density of that direction, the way the renderer uses them. Built
+// on that book's hittables; the rest of the suite is in rtw_bench.
+
+#include "rtweekend.h"
+
+#include "aarect.h"
+#include "bench.h"
+#include "hittable_list.h"
+#include "light_sampler.h"
+#include "pdf.h"
+#include "sphere.h"
+
+#include <vector>
+
+
+const int input_count = 1024;  // Inputs per repetition of a benchmark
+
+
+template <typename F>
+void bench_pdf(
+    const bench_suite& suite, const std::string& name, const std::vector<point3>& origins,
+    F sample_and_weigh
+) {
+    // sample_and_weigh(o) sets up a PDF at o, generates a direction and returns its density.
+    suite.run(name, "sample", [&](int64_t reps) {
+        double checksum = 0;
+        for (int64_t rep = 0; rep < reps; rep++) {
+            seed_random(0, static_cast<uint64_t>(rep));
+            for (const auto& o : origins)
+                checksum += sample_and_weigh(o);
+        }
+        bench_keep(checksum);
+        return reps * static_cast<int64_t>(origins.size());
+    });
+}
+
+
+int main(int argc, char* argv[]) {
+    bench_suite suite("rtw_bench_pdf", argc, argv);
+    if (!suite.ok())
+        return 1;
+
+    // Shading points on the floor of the Cornell box, lit by its ceiling light and glass ball.
+    seed_random(0, 0);
+    std::vector<point3> origins;
+    for (int k = 0; k < input_count; k++)
+        origins.push_back(point3(random_double(0, 555), 0, random_double(0, 555)));
+
+    const vec3 normal(0, 1, 0);
+    const xz_rect light(213, 343, 227, 332, 554, nullptr);
+    const sphere ball(point3(190, 90, 190), 90, nullptr);
+    hittable_list lights;
+    lights.add(make_shared<xz_rect>(213, 343, 227, 332, 554, nullptr));
+    lights.add(make_shared<sphere>(point3(190, 90, 190), 90, nullptr));
+
+    bench_pdf(suite, "cosine_pdf", origins, [&](const point3&) {
+        cosine_pdf p(normal);
+        return p.value(p.generate());
+    });
+
+    bench_pdf(suite, "hittable_pdf_xz_rect", origins, [&](const point3& o) {
+        hittable_pdf p(light, o);
+        return p.value(p.generate());
+    });
+
+    bench_pdf(suite, "hittable_pdf_sphere", origins, [&](const point3& o) {
+        hittable_pdf p(ball, o);
+        return p.value(p.generate());
+    });
+
+    bench_pdf(suite, "hittable_pdf_list", origins, [&](const point3& o) {
+        hittable_pdf p(lights, o);
+        return p.value(p.generate());
+    });
+
+    bench_pdf(suite, "mixture_pdf", origins, [&](const point3& o) {
+        cosine_pdf surface(normal);
+        hittable_pdf toward_lights(lights, o);
+        mixture_pdf p(&surface, &toward_lights);
+        return p.value(p.generate());
+    });
+
+    // A ceiling of 64 small lights of mixed power, as next-event estimation picks from them.
+    light_sampler ceiling;
+    for (int a = 0; a < 8; a++) {
+        for (int b = 0; b < 8; b++) {
+            auto x = 20 + 65 * a;
+            auto z = 20 + 65 * b;
+            ceiling.add(make_shared<xz_rect>(x, x + 40, z, z + 40, 554, nullptr),
+                        random_double(1, 10));
+        }
+    }
+
+    bench_pdf(suite, "light_sampler_64", origins, [&](const point3& o) {
+        const hittable* light;
+        real pdf;
+        auto direction = ceiling.sample(o, light, pdf);
+        return pdf + ceiling.pdf_value(o, direction, light);
+    });
+}
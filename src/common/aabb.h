@@ -22,21 +22,24 @@ class aabb {
         point3 min() const {return _min; }
         point3 max() const {return _max; }
 
-        bool hit(const ray& r, double tmin, double tmax) const {
+        const point3& bound(int sign) const { return sign ? _max : _min; }
+
+        // Slab test using the ray's cached reciprocal direction: the sign bits pick the near
+        // and far planes directly, and a NaN from 0*inf in one slab leaves the interval alone.
+        bool hit(const ray& r, real tmin, real tmax) const {
+            const auto& inv_dir = r.inv_direction();
             for (int a = 0; a < 3; a++) {
-                auto t0 = fmin((_min[a] - r.origin()[a]) / r.direction()[a],
-                               (_max[a] - r.origin()[a]) / r.direction()[a]);
-                auto t1 = fmax((_min[a] - r.origin()[a]) / r.direction()[a],
-                               (_max[a] - r.origin()[a]) / r.direction()[a]);
-                tmin = fmax(t0, tmin);
-                tmax = fmin(t1, tmax);
+                auto t0 = (bound(r.sign(a))[a] - r.origin()[a]) * inv_dir[a];
+                auto t1 = (bound(1 - r.sign(a))[a] - r.origin()[a]) * inv_dir[a];
+                tmin = t0 > tmin ? t0 : tmin;
+                tmax = t1 < tmax ? t1 : tmax;
                 if (tmax <= tmin)
                     return false;
             }
             return true;
         }
 
-        double area() const {
+        real area() const {
             auto a = _max.x() - _min.x();
             auto b = _max.y() - _min.y();
             auto c = _max.z() - _min.z();
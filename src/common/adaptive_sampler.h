@@ -0,0 +1,131 @@
+#ifndef ADAPTIVE_SAMPLER_H
+#define ADAPTIVE_SAMPLER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "framebuffer.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <vector>
+
+
+class adaptive_sampler {
+    // Samples the pixels of a tile in rounds and stops each one once the estimated error of its
+    // displayed value is below a threshold, or it reaches max_samples. The error is the standard
+    // error of the mean luminance, carried through the gamma-2 display curve, so dark pixels are
+    // not held to an absolute standard they can never meet, nor bright ones let off too early.
+    //
+    // A pixel only stops when its whole 3x3 neighborhood has converged. Paths that rarely find
+    // a light leave many pixels with no hits at all after the first round, and so a variance of
+    // zero; judged alone they would stop at once and come out too dark.
+    //
+    // With min_samples equal to max_samples this is a plain fixed-count sampler.
+    public:
+        adaptive_sampler(int min_samples, int max_samples, real threshold, int round_size = 16)
+          : min_samples(std::min(min_samples, max_samples)), max_samples(max_samples),
+            threshold(threshold), round_size(std::max(1, round_size))
+        {}
+
+        // Calls sample(i, j, s) for s = first_sample, first_sample + 1, ... at every pixel (i, j)
+        // of the tile, and adds the results to the image.
+        template <typename F>
+        void sample_tile(const tile& t, F sample, framebuffer& image, int first_sample = 0) const {
+            const int width = t.x1 - t.x0;
+            const int height = t.y1 - t.y0;
+            std::vector<pixel_state> pixels(width * height);
+            std::vector<bool> converged(pixels.size());
+
+            int target = min_samples;
+            while (true) {
+                bool any_active = false;
+                for (int y = 0; y < height; y++) {
+                    for (int x = 0; x < width; x++) {
+                        auto& p = pixels[y * width + x];
+                        if (p.done)
+                            continue;
+                        for (; p.n < target; p.n++)
+                            p.add(sample(t.x0 + x, t.y0 + y, first_sample + p.n));
+                        p.done = p.n >= max_samples;
+                        any_active = any_active || !p.done;
+                    }
+                }
+
+                if (!any_active)
+                    break;
+
+                for (size_t k = 0; k < pixels.size(); k++)
+                    converged[k] = pixels[k].done || error(pixels[k]) <= threshold;
+
+                // A pixel whose neighbor picks up noise later on starts sampling again.
+                for (int y = 0; y < height; y++) {
+                    for (int x = 0; x < width; x++) {
+                        auto& p = pixels[y * width + x];
+                        p.done = p.n >= max_samples
+                              || neighborhood_converged(converged, width, height, x, y);
+                    }
+                }
+
+                target = std::min(max_samples, target + round_size);
+            }
+
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    const auto& p = pixels[y * width + x];
+                    image.add(t.x0 + x, t.y0 + y, p.sum, p.n);
+                }
+            }
+        }
+
+    private:
+        struct pixel_state {
+            color sum;
+            real mean = 0;  // Running mean and sum of squared deviations of the luminance
+            real m2 = 0;
+            int n = 0;
+            bool done = false;
+
+            void add(const color& c) {
+                sum += c;
+                const real luminance = 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+                const real delta = luminance - mean;
+                mean += delta / (n + 1);
+                m2 += delta * (luminance - mean);
+            }
+        };
+
+        int min_samples;
+        int max_samples;
+        real threshold;
+        int round_size;
+
+        static real error(const pixel_state& p) {
+            if (p.n < 2)
+                return infinity;
+            const auto standard_error = sqrt(p.m2 / (p.n - 1) / p.n);
+            return standard_error / (2 * sqrt(std::max<real>(p.mean, 1e-4)));
+        }
+
+        static bool neighborhood_converged(
+            const std::vector<bool>& converged, int width, int height, int x, int y
+        ) {
+            for (int ny = std::max(0, y-1); ny <= std::min(height-1, y+1); ny++) {
+                for (int nx = std::max(0, x-1); nx <= std::min(width-1, x+1); nx++) {
+                    if (!converged[ny * width + nx])
+                        return false;
+                }
+            }
+            return true;
+        }
+};
+
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+
+class affine {
+    // An affine map of 3D space as the top three rows of a 4x4 matrix: a linear part in the
+    // first three columns and a translation in the fourth. a * b applies b first.
+    public:
+        affine() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+        static affine translation(const vec3& offset) {
+            affine t;
+            for (int i = 0; i < 3; i++)
+                t.m[i][3] = offset[i];
+            return t;
+        }
+
+        static affine scaling(const vec3& factors) {
+            affine s;
+            for (int i = 0; i < 3; i++)
+                s.m[i][i] = factors[i];
+            return s;
+        }
+
+        // Counterclockwise rotation by angle degrees about axis, looking down the axis.
+        static affine rotation(const vec3& axis, real angle) {
+            auto radians = degrees_to_radians(angle);
+            auto c = cos(radians);
+            auto s = sin(radians);
+            auto a = unit_vector(axis);
+
+            affine r;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++)
+                    r.m[i][j] = (1 - c) * a[i] * a[j] + (i == j ? c : 0);
+            }
+            r.m[0][1] -= s * a[2];  r.m[1][0] += s * a[2];
+            r.m[0][2] += s * a[1];  r.m[2][0] -= s * a[1];
+            r.m[1][2] -= s * a[0];  r.m[2][1] += s * a[0];
+            return r;
+        }
+
+        // Rotation about the y axis built from one sine and cosine, so that with the opposite
+        // angle it is an exact inverse.
+        static affine rotation_y(real angle) {
+            auto radians = degrees_to_radians(angle);
+            affine r;
+            r.m[0][0] = r.m[2][2] = cos(radians);
+            r.m[0][2] = sin(radians);
+            r.m[2][0] = -r.m[0][2];
+            return r;
+        }
+
+        affine operator*(const affine& b) const {
+            affine product;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    product.m[i][j] = m[i][0]*b.m[0][j] + m[i][1]*b.m[1][j] + m[i][2]*b.m[2][j]
+                                    + (j == 3 ? m[i][3] : 0);
+                }
+            }
+            return product;
+        }
+
+        // Of the linear part: the factor by which the map scales volumes.
+        real determinant() const {
+            return m[0][0]*cofactor(0, 0) + m[0][1]*cofactor(0, 1) + m[0][2]*cofactor(0, 2);
+        }
+
+        affine inverse() const {
+            // The linear part inverts by its cofactors; the translation then undoes m's.
+            affine inv;
+            auto det = determinant();
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++)
+                    inv.m[i][j] = cofactor(j, i) / det;
+            }
+            for (int i = 0; i < 3; i++)
+                inv.m[i][3] = -(inv.m[i][0]*m[0][3] + inv.m[i][1]*m[1][3] + inv.m[i][2]*m[2][3]);
+            return inv;
+        }
+
+        // Whether the linear part is a rotation or reflection, leaving lengths alone, up to
+        // rounding.
+        bool is_rigid() const {
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    auto d = m[0][i]*m[0][j] + m[1][i]*m[1][j] + m[2][i]*m[2][j];
+                    if (fabs(d - (i == j ? 1 : 0)) > 1e-6)
+                        return false;
+                }
+            }
+            return true;
+        }
+
+        point3 point(const point3& p) const {
+            return point3(
+                m[0][0]*p[0] + m[0][1]*p[1] + m[0][2]*p[2] + m[0][3],
+                m[1][0]*p[0] + m[1][1]*p[1] + m[1][2]*p[2] + m[1][3],
+                m[2][0]*p[0] + m[2][1]*p[1] + m[2][2]*p[2] + m[2][3]);
+        }
+
+        vec3 vector(const vec3& v) const {
+            return vec3(
+                m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+        }
+
+        // Multiplies by the transpose of the linear part. Called on the inverse of a map, this
+        // carries normals through the map itself; the result is not unit length.
+        vec3 transposed_vector(const vec3& v) const {
+            return vec3(
+                m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+        }
+
+        // The tightest box around the image of box (Arvo's method: each output interval is the
+        // translation plus, per input axis, the smaller and larger products with that slab).
+        aabb box(const aabb& box) const {
+            point3 lo, hi;
+            for (int i = 0; i < 3; i++) {
+                lo[i] = hi[i] = m[i][3];
+                for (int j = 0; j < 3; j++) {
+                    auto a = m[i][j] * box.min()[j];
+                    auto b = m[i][j] * box.max()[j];
+                    lo[i] += fmin(a, b);
+                    hi[i] += fmax(a, b);
+                }
+            }
+            return aabb(lo, hi);
+        }
+
+    public:
+        real m[3][4];
+
+    private:
+        real cofactor(int i, int j) const {
+            int i1 = (i + 1) % 3, i2 = (i + 2) % 3, j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            return m[i1][j1]*m[i2][j2] - m[i1][j2]*m[i2][j1];
+        }
+};
+
+
+#endif
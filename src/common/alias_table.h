@@ -0,0 +1,88 @@
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <vector>
+
+
+class alias_table {
+    // Draws an index with probability proportional to its weight in constant time, however
+    // many weights there are (Walker's alias method, built with Vose's algorithm). Every bin
+    // holds its own index with probability threshold and an alias for the rest.
+    public:
+        alias_table() {}
+
+        alias_table(const std::vector<real>& weights) {
+            const auto n = static_cast<int>(weights.size());
+            double total = 0;
+            for (auto w : weights)
+                total += std::max(w, real(0));
+            if (n == 0 || total <= 0)
+                return;
+
+            bins.resize(n);
+            std::vector<double> scaled(n);
+            std::vector<int> small, large;
+            for (int i = 0; i < n; i++) {
+                bins[i].pmf = static_cast<real>(std::max(weights[i], real(0)) / total);
+                scaled[i] = std::max(weights[i], real(0)) * n / total;
+                (scaled[i] < 1 ? small : large).push_back(i);
+            }
+
+            // Fill each underfull bin from an overfull one, which then may become underfull.
+            while (!small.empty() && !large.empty()) {
+                auto s = small.back();
+                auto l = large.back();
+                small.pop_back();
+
+                bins[s].threshold = static_cast<real>(scaled[s]);
+                bins[s].alias = l;
+                scaled[l] -= 1 - scaled[s];
+                if (scaled[l] < 1) {
+                    large.pop_back();
+                    small.push_back(l);
+                }
+            }
+
+            // What is left is full up to rounding error.
+            for (auto i : small)
+                bins[i] = bin{1, i, bins[i].pmf};
+            for (auto i : large)
+                bins[i] = bin{1, i, bins[i].pmf};
+        }
+
+        bool empty() const { return bins.empty(); }
+        int size() const { return static_cast<int>(bins.size()); }
+
+        // Maps u in [0,1) to an index.
+        int sample(real u) const {
+            auto scaled = u * bins.size();
+            auto i = std::min(static_cast<int>(scaled), size() - 1);
+            return scaled - i < bins[i].threshold ? i : bins[i].alias;
+        }
+
+        // The probability that sample() returns i.
+        real pmf(int i) const { return bins[i].pmf; }
+
+    private:
+        struct bin {
+            real threshold;
+            int alias;
+            real pmf;
+        };
+
+        std::vector<bin> bins;
+};
+
+
+#endif
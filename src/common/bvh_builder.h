@@ -0,0 +1,433 @@
+#ifndef BVH_BUILDER_H
+#define BVH_BUILDER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <omp.h>
+
+
+struct flat_bvh_node {
+    // One node of a flattened BVH, stored in depth-first order so that the first child of an
+    // interior node always sits right after it. Bounds are single precision, rounded outward.
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t offset;  // Interior: index of the second child. Leaf: first primitive index.
+    uint16_t count;   // Number of primitives in a leaf, or 0 for an interior node
+    uint8_t axis;     // Split axis of an interior node
+    uint8_t pad;
+
+    bool is_leaf() const { return count > 0; }
+
+    bool hit(const ray& r, real t_min, real t_max) const {
+        const auto& origin = r.orig;
+        const auto& inv_dir = r.inv_direction();
+        for (int a = 0; a < 3; a++) {
+            const float* near_plane = r.sign(a) ? bounds_max : bounds_min;
+            const float* far_plane = r.sign(a) ? bounds_min : bounds_max;
+            auto t0 = (near_plane[a] - origin[a]) * inv_dir[a];
+            auto t1 = (far_plane[a] - origin[a]) * inv_dir[a];
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max <= t_min)
+                return false;
+        }
+        return true;
+    }
+};
+
+static_assert(sizeof(flat_bvh_node) == 32, "flat_bvh_node should fill half a cache line");
+
+
+enum class bvh_split {
+    median,  // Median of the centroids along their longest axis
+    sah      // Binned surface area heuristic along the longest centroid axis
+};
+
+
+struct bvh_build_options {
+    bvh_build_options(bvh_split split = bvh_split::sah, int max_leaf_size = 4)
+      : split(split), max_leaf_size(max_leaf_size), parallel(true), print_stats(false)
+    {}
+
+    bvh_split split;
+    int max_leaf_size;  // Ranges at or below this size may become leaves
+    bool parallel;      // Build subtrees as OpenMP tasks; the tree is identical either way
+    bool print_stats;   // Print a bvh_stats summary to std::cerr after each build
+};
+
+
+// SAH cost model: one unit per node visit and one per primitive test, weighted by the
+// probability (surface area relative to the root) that a random ray reaches the node.
+const double bvh_traversal_cost = 1.0;
+const double bvh_intersection_cost = 1.0;
+
+
+struct bvh_stats {
+    bvh_stats() : nodes(0), leaves(0), max_depth(0), sah_cost(0) {}
+
+    int nodes;        // Interior and leaf nodes
+    int leaves;
+    int max_depth;    // Root is depth 1
+    double sah_cost;  // Expected cost of a ray through the tree under the SAH model
+};
+
+
+inline std::ostream& operator<<(std::ostream& out, const bvh_stats& stats) {
+    return out << stats.nodes << " nodes, " << stats.leaves << " leaves, depth "
+               << stats.max_depth << ", SAH cost " << stats.sah_cost;
+}
+
+
+inline double node_area(const flat_bvh_node& node) {
+    auto a = double(node.bounds_max[0]) - node.bounds_min[0];
+    auto b = double(node.bounds_max[1]) - node.bounds_min[1];
+    auto c = double(node.bounds_max[2]) - node.bounds_min[2];
+    return 2*(a*b + b*c + c*a);
+}
+
+
+inline bvh_stats compute_bvh_stats(const std::vector<flat_bvh_node>& nodes) {
+    bvh_stats stats;
+    if (nodes.empty())
+        return stats;
+
+    const auto root_area = node_area(nodes[0]);
+
+    // Depth-first walk, carrying each node's depth with it.
+    std::vector<std::pair<uint32_t, int>> stack(1, std::make_pair(0u, 1));
+    while (!stack.empty()) {
+        auto index = stack.back().first;
+        auto depth = stack.back().second;
+        stack.pop_back();
+
+        const auto& node = nodes[index];
+        auto probability = root_area > 0 ? node_area(node) / root_area : 1.0;
+
+        stats.nodes++;
+        stats.max_depth = std::max(stats.max_depth, depth);
+
+        if (node.is_leaf()) {
+            stats.leaves++;
+            stats.sah_cost += probability * node.count * bvh_intersection_cost;
+        } else {
+            stats.sah_cost += probability * bvh_traversal_cost;
+            stack.push_back(std::make_pair(index + 1, depth + 1));
+            stack.push_back(std::make_pair(node.offset, depth + 1));
+        }
+    }
+
+    return stats;
+}
+
+
+class bvh_builder {
+    // Builds a flattened BVH over a set of primitive bounding boxes. The result is the node
+    // array plus the order in which leaves reference the primitives. Given a kind for each
+    // primitive, no leaf mixes kinds: a range that would become one is split by kind instead.
+    public:
+        bvh_builder(const std::vector<aabb>& boxes, const bvh_build_options& options)
+          : boxes(boxes), options(options), kinds(nullptr)
+        {}
+
+        bvh_builder(
+            const std::vector<aabb>& boxes, const bvh_build_options& options,
+            const std::vector<uint8_t>& kinds)
+          : boxes(boxes), options(options), kinds(&kinds)
+        {}
+
+        void build(std::vector<flat_bvh_node>& out_nodes, std::vector<uint32_t>& out_order) {
+            nodes.clear();
+            order.resize(boxes.size());
+            centroids.resize(boxes.size());
+
+            for (size_t i = 0; i < boxes.size(); i++) {
+                order[i] = static_cast<uint32_t>(i);
+                centroids[i] = 0.5 * (boxes[i].min() + boxes[i].max());
+            }
+
+            auto size = static_cast<uint32_t>(boxes.size());
+
+            if (size >= parallel_grain && options.parallel) {
+                #pragma omp parallel
+                #pragma omp single
+                build_recursive(nodes, 0, size, 0);
+            } else if (size > 0) {
+                build_recursive(nodes, 0, size, 0);
+            }
+
+            if (options.print_stats)
+                std::cerr << "BVH (" << boxes.size() << " primitives): "
+                          << compute_bvh_stats(nodes) << '\n';
+
+            out_nodes.swap(nodes);
+            out_order.swap(order);
+        }
+
+    private:
+        static const int max_depth = 64;  // Matches the traversal stack size
+        static const int sah_bins = 16;
+        static const uint32_t parallel_grain = 4096;  // Smallest range built as its own task
+
+        const std::vector<aabb>& boxes;
+        bvh_build_options options;
+        const std::vector<uint8_t>* kinds;
+        std::vector<point3> centroids;
+        std::vector<flat_bvh_node> nodes;
+        std::vector<uint32_t> order;
+
+        uint32_t build_recursive(
+            std::vector<flat_bvh_node>& out, uint32_t begin, uint32_t end, int depth
+        ) {
+            // Appends the subtree over order[begin,end) to out and returns its root index.
+            // Interior node offsets are relative to the start of out; leaf offsets index
+            // the shared order array directly.
+            auto node_index = static_cast<uint32_t>(out.size());
+            out.push_back(flat_bvh_node());
+
+            point3 bounds_min( infinity,  infinity,  infinity);
+            point3 bounds_max(-infinity, -infinity, -infinity);
+            point3 centroid_min = bounds_min;
+            point3 centroid_max = bounds_max;
+
+            for (auto i = begin; i < end; i++) {
+                const auto& box = boxes[order[i]];
+                const auto& c = centroids[order[i]];
+                for (int a = 0; a < 3; a++) {
+                    bounds_min[a] = fmin(bounds_min[a], box.min()[a]);
+                    bounds_max[a] = fmax(bounds_max[a], box.max()[a]);
+                    centroid_min[a] = fmin(centroid_min[a], c[a]);
+                    centroid_max[a] = fmax(centroid_max[a], c[a]);
+                }
+            }
+
+            set_bounds(out[node_index], bounds_min, bounds_max);
+
+            auto count = end - begin;
+            auto axis = aabb(centroid_min, centroid_max).longest_axis();
+            auto max_leaf_size = static_cast<uint32_t>(options.max_leaf_size);
+
+            const auto one_kind = single_kind(begin, end);
+            if (count == 1 || (depth >= max_depth - 1 && one_kind)) {
+                make_leaf(out[node_index], begin, count);
+                return node_index;
+            }
+
+            uint32_t mid = begin;
+            auto found_split = false;
+
+            if (!one_kind && (count <= max_leaf_size || depth >= max_depth - 1)) {
+                // Split by kind; this adds at most one level per kind past max_depth.
+                mid = partition_kinds(begin, end);
+                found_split = true;
+            } else if (options.split == bvh_split::sah) {
+                auto area = aabb(bounds_min, bounds_max).area();
+                bool leaf_is_cheaper;
+                found_split = sah_partition(
+                    begin, end, axis, centroid_min, centroid_max, area, mid, leaf_is_cheaper);
+
+                if (leaf_is_cheaper && count <= max_leaf_size && one_kind) {
+                    make_leaf(out[node_index], begin, count);
+                    return node_index;
+                }
+            }
+
+            if (!found_split) {
+                if (count <= max_leaf_size) {
+                    make_leaf(out[node_index], begin, count);
+                    return node_index;
+                }
+
+                // Median split along the longest axis of the centroids.
+                mid = begin + count/2;
+                std::nth_element(
+                    order.begin() + begin, order.begin() + mid, order.begin() + end,
+                    [&](uint32_t a, uint32_t b) {
+                        return centroids[a][axis] < centroids[b][axis];
+                    });
+            }
+
+            out[node_index].axis = static_cast<uint8_t>(axis);
+
+            if (options.parallel && count >= parallel_grain) {
+                // Build the two halves concurrently into private arrays, then splice them in
+                // depth-first order. Both tasks touch disjoint ranges of order.
+                std::vector<flat_bvh_node> left_nodes, right_nodes;
+
+                #pragma omp task shared(left_nodes)
+                build_recursive(left_nodes, begin, mid, depth + 1);
+
+                build_recursive(right_nodes, mid, end, depth + 1);
+
+                #pragma omp taskwait
+
+                append_subtree(out, left_nodes);
+                auto second = append_subtree(out, right_nodes);
+                out[node_index].offset = second;
+            } else {
+                build_recursive(out, begin, mid, depth + 1);
+                auto second = build_recursive(out, mid, end, depth + 1);
+                out[node_index].offset = second;  // out may have been reallocated
+            }
+
+            return node_index;
+        }
+
+        bool single_kind(uint32_t begin, uint32_t end) const {
+            if (!kinds)
+                return true;
+            const auto kind = (*kinds)[order[begin]];
+            for (auto i = begin + 1; i < end; i++) {
+                if ((*kinds)[order[i]] != kind)
+                    return false;
+            }
+            return true;
+        }
+
+        // Moves the primitives of the first one's kind to the front of the range, keeping
+        // their order, and returns where the rest begin.
+        uint32_t partition_kinds(uint32_t begin, uint32_t end) {
+            const auto kind = (*kinds)[order[begin]];
+            auto rest = std::stable_partition(
+                order.begin() + begin, order.begin() + end,
+                [&](uint32_t i) { return (*kinds)[i] == kind; });
+            return static_cast<uint32_t>(rest - order.begin());
+        }
+
+        static uint32_t append_subtree(
+            std::vector<flat_bvh_node>& out, const std::vector<flat_bvh_node>& subtree
+        ) {
+            auto base = static_cast<uint32_t>(out.size());
+            for (auto node : subtree) {
+                if (!node.is_leaf())
+                    node.offset += base;
+                out.push_back(node);
+            }
+            return base;
+        }
+
+        bool sah_partition(
+            uint32_t begin, uint32_t end, int axis,
+            const point3& centroid_min, const point3& centroid_max, double area,
+            uint32_t& mid, bool& leaf_is_cheaper
+        ) {
+            // Bins the centroids along the split axis, evaluates the SAH cost of splitting
+            // after each bin, and partitions the range at the cheapest split. Returns false if
+            // the centroids are too tightly clustered to bin.
+            leaf_is_cheaper = false;
+
+            auto low = centroid_min[axis];
+            auto extent = centroid_max[axis] - low;
+            if (!(extent > 0) || !(area > 0))
+                return false;
+
+            struct bin {
+                bin() : count(0),
+                    lo( infinity,  infinity,  infinity),
+                    hi(-infinity, -infinity, -infinity)
+                {}
+
+                void grow(const aabb& box) {
+                    for (int a = 0; a < 3; a++) {
+                        lo[a] = fmin(lo[a], box.min()[a]);
+                        hi[a] = fmax(hi[a], box.max()[a]);
+                    }
+                }
+
+                void grow(const bin& other) {
+                    count += other.count;
+                    if (other.count > 0)
+                        grow(aabb(other.lo, other.hi));
+                }
+
+                double area() const { return count > 0 ? aabb(lo, hi).area() : 0.0; }
+
+                uint32_t count;
+                point3 lo, hi;
+            };
+
+            auto bin_of = [&](uint32_t index) {
+                auto b = static_cast<int>(sah_bins * (centroids[index][axis] - low) / extent);
+                return std::min(b, sah_bins - 1);
+            };
+
+            bin bins[sah_bins];
+            for (auto i = begin; i < end; i++) {
+                auto& b = bins[bin_of(order[i])];
+                b.count++;
+                b.grow(boxes[order[i]]);
+            }
+
+            // Sweep from the right to get the cost contribution of every right-hand side.
+            double right_cost[sah_bins];
+            bin right;
+            for (int b = sah_bins - 1; b > 0; b--) {
+                right.grow(bins[b]);
+                right_cost[b] = right.count * right.area();
+            }
+
+            auto best_cost = infinity;
+            auto best_bin = -1;
+            bin left;
+            for (int b = 0; b < sah_bins - 1; b++) {
+                left.grow(bins[b]);
+                if (left.count == 0 || left.count == end - begin)
+                    continue;
+
+                auto weighted_count = left.count*left.area() + right_cost[b+1];
+                auto cost = bvh_traversal_cost + bvh_intersection_cost * weighted_count / area;
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_bin = b;
+                }
+            }
+
+            if (best_bin < 0)
+                return false;
+
+            leaf_is_cheaper = (end - begin) * bvh_intersection_cost <= best_cost;
+
+            auto split = std::partition(
+                order.begin() + begin, order.begin() + end,
+                [&](uint32_t index) { return bin_of(index) <= best_bin; });
+            mid = static_cast<uint32_t>(split - order.begin());
+
+            return true;
+        }
+
+        static void make_leaf(flat_bvh_node& node, uint32_t begin, uint32_t count) {
+            if (count > 0xffff)
+                std::cerr << "BVH leaf holds more primitives than a node can reference.\n";
+
+            node.offset = begin;
+            node.count = static_cast<uint16_t>(std::min<uint32_t>(count, 0xffff));
+        }
+
+        static void set_bounds(flat_bvh_node& node, const point3& lo, const point3& hi) {
+            // Round outward so the float box always contains the double precision one.
+            for (int a = 0; a < 3; a++) {
+                auto fmin_a = static_cast<float>(lo[a]);
+                auto fmax_a = static_cast<float>(hi[a]);
+                if (fmin_a > lo[a]) fmin_a = std::nextafter(fmin_a, -INFINITY);
+                if (fmax_a < hi[a]) fmax_a = std::nextafter(fmax_a,  INFINITY);
+                node.bounds_min[a] = fmin_a;
+                node.bounds_max[a] = fmax_a;
+            }
+        }
+};
+
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef BVH_WIDE_H
+#define BVH_WIDE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh_builder.h"
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define RTW_HAVE_SSE 1
+    #include <immintrin.h>
+#endif
+
+
+template <int W>
+struct wide_bvh_node {
+    // A BVH node with up to W children whose boxes are stored one axis at a time (structure of
+    // arrays), so one SIMD register holds the same bound of every child.
+    float lo[3][W];
+    float hi[3][W];
+    uint32_t child[W];   // Interior child: node index. Leaf child: first primitive.
+    uint32_t count[W];   // Leaf child: primitive count. Interior child: 0.
+    uint32_t num_children;
+};
+
+
+struct wide_ray {
+    // A ray prepared for wide slab tests: single precision origin and reciprocal direction,
+    // and for each axis whether the near plane is the box maximum.
+    wide_ray() {}
+
+    wide_ray(const ray& r) {
+        for (int a = 0; a < 3; a++) {
+            o[a] = static_cast<float>(r.orig[a]);
+            inv[a] = static_cast<float>(r.inv_direction()[a]);
+            negative[a] = r.sign(a) != 0;
+        }
+    }
+
+    float o[3];
+    float inv[3];
+    bool negative[3];
+};
+
+
+// Widens the far distance by 2*gamma(3) (see PBRT, "Robust Ray-Bounds Intersections") so
+// float rounding can't make the slab test miss a box the ray actually grazes.
+const float wide_slab_robust_scale = 1.0f + 2.0f * (3.0f * 5.96046448e-08f);
+
+
+template <int W>
+inline int slab_test(
+    const wide_bvh_node<W>& node, const wide_ray& r, float t_min, float t_max, float* t_near
+) {
+    // Portable version; a fixed-length loop the compiler can vectorize on its own.
+    int mask = 0;
+    for (int c = 0; c < W; c++) {
+        auto near_t = t_min;
+        auto far_t = t_max;
+        for (int a = 0; a < 3; a++) {
+            auto n = ((r.negative[a] ? node.hi[a][c] : node.lo[a][c]) - r.o[a]) * r.inv[a];
+            auto f = ((r.negative[a] ? node.lo[a][c] : node.hi[a][c]) - r.o[a]) * r.inv[a];
+            near_t = n > near_t ? n : near_t;  // NaN leaves the running value untouched
+            far_t = f < far_t ? f : far_t;
+        }
+        t_near[c] = near_t;
+        mask |= (near_t <= far_t * wide_slab_robust_scale) << c;
+    }
+    return mask & ((1 << node.num_children) - 1);
+}
+
+
+#ifdef RTW_HAVE_SSE
+
+template <>
+inline int slab_test<4>(
+    const wide_bvh_node<4>& node, const wide_ray& r, float t_min, float t_max, float* t_near
+) {
+    auto near_t = _mm_set1_ps(t_min);
+    auto far_t = _mm_set1_ps(t_max);
+
+    for (int a = 0; a < 3; a++) {
+        auto o = _mm_set1_ps(r.o[a]);
+        auto inv = _mm_set1_ps(r.inv[a]);
+        auto near_plane = _mm_loadu_ps(r.negative[a] ? node.hi[a] : node.lo[a]);
+        auto far_plane = _mm_loadu_ps(r.negative[a] ? node.lo[a] : node.hi[a]);
+
+        // With a NaN operand, min/max return the second one, which is the running value.
+        near_t = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_plane, o), inv), near_t);
+        far_t = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_plane, o), inv), far_t);
+    }
+
+    far_t = _mm_mul_ps(far_t, _mm_set1_ps(wide_slab_robust_scale));
+    _mm_storeu_ps(t_near, near_t);
+
+    auto mask = _mm_movemask_ps(_mm_cmple_ps(near_t, far_t));
+    return mask & ((1 << node.num_children) - 1);
+}
+
+#endif
+
+
+#ifdef __AVX__
+
+template <>
+inline int slab_test<8>(
+    const wide_bvh_node<8>& node, const wide_ray& r, float t_min, float t_max, float* t_near
+) {
+    auto near_t = _mm256_set1_ps(t_min);
+    auto far_t = _mm256_set1_ps(t_max);
+
+    for (int a = 0; a < 3; a++) {
+        auto o = _mm256_set1_ps(r.o[a]);
+        auto inv = _mm256_set1_ps(r.inv[a]);
+        auto near_plane = _mm256_loadu_ps(r.negative[a] ? node.hi[a] : node.lo[a]);
+        auto far_plane = _mm256_loadu_ps(r.negative[a] ? node.lo[a] : node.hi[a]);
+
+        near_t = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(near_plane, o), inv), near_t);
+        far_t = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(far_plane, o), inv), far_t);
+    }
+
+    far_t = _mm256_mul_ps(far_t, _mm256_set1_ps(wide_slab_robust_scale));
+    _mm256_storeu_ps(t_near, near_t);
+
+    auto mask = _mm256_movemask_ps(_mm256_cmp_ps(near_t, far_t, _CMP_LE_OQ));
+    return mask & ((1 << node.num_children) - 1);
+}
+
+#endif
+
+
+// The same test against a node's bounds at a time between two keys: the node as it is at the
+// first key, moved a fraction s of the way to the same node at the second. For primitives that
+// move linearly, bounds interpolated this way always contain them.
+template <int W>
+inline int slab_test(
+    const wide_bvh_node<W>& key0, const wide_bvh_node<W>& key1, float s, const wide_ray& r,
+    float t_min, float t_max, float* t_near
+) {
+    int mask = 0;
+    for (int c = 0; c < W; c++) {
+        auto near_t = t_min;
+        auto far_t = t_max;
+        for (int a = 0; a < 3; a++) {
+            auto lo = key0.lo[a][c] + s * (key1.lo[a][c] - key0.lo[a][c]);
+            auto hi = key0.hi[a][c] + s * (key1.hi[a][c] - key0.hi[a][c]);
+            auto n = ((r.negative[a] ? hi : lo) - r.o[a]) * r.inv[a];
+            auto f = ((r.negative[a] ? lo : hi) - r.o[a]) * r.inv[a];
+            near_t = n > near_t ? n : near_t;
+            far_t = f < far_t ? f : far_t;
+        }
+        t_near[c] = near_t;
+        mask |= (near_t <= far_t * wide_slab_robust_scale) << c;
+    }
+    return mask & ((1 << key0.num_children) - 1);
+}
+
+
+#ifdef RTW_HAVE_SSE
+
+template <>
+inline int slab_test<4>(
+    const wide_bvh_node<4>& key0, const wide_bvh_node<4>& key1, float s, const wide_ray& r,
+    float t_min, float t_max, float* t_near
+) {
+    auto near_t = _mm_set1_ps(t_min);
+    auto far_t = _mm_set1_ps(t_max);
+    auto fraction = _mm_set1_ps(s);
+
+    for (int a = 0; a < 3; a++) {
+        auto o = _mm_set1_ps(r.o[a]);
+        auto inv = _mm_set1_ps(r.inv[a]);
+        auto lo0 = _mm_loadu_ps(key0.lo[a]);
+        auto hi0 = _mm_loadu_ps(key0.hi[a]);
+        auto lo1 = _mm_loadu_ps(key1.lo[a]);
+        auto hi1 = _mm_loadu_ps(key1.hi[a]);
+        auto lo = _mm_add_ps(lo0, _mm_mul_ps(fraction, _mm_sub_ps(lo1, lo0)));
+        auto hi = _mm_add_ps(hi0, _mm_mul_ps(fraction, _mm_sub_ps(hi1, hi0)));
+        auto near_plane = r.negative[a] ? hi : lo;
+        auto far_plane = r.negative[a] ? lo : hi;
+
+        near_t = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(near_plane, o), inv), near_t);
+        far_t = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(far_plane, o), inv), far_t);
+    }
+
+    far_t = _mm_mul_ps(far_t, _mm_set1_ps(wide_slab_robust_scale));
+    _mm_storeu_ps(t_near, near_t);
+
+    auto mask = _mm_movemask_ps(_mm_cmple_ps(near_t, far_t));
+    return mask & ((1 << key0.num_children) - 1);
+}
+
+#endif
+
+
+template <int W>
+class wide_bvh_collapser {
+    // Turns a binary flat BVH into a W-wide one by repeatedly opening the largest interior
+    // child of each node until it has W children. Leaf ranges are carried over unchanged.
+    public:
+        wide_bvh_collapser(const std::vector<flat_bvh_node>& binary) : binary(binary) {}
+
+        void collapse(std::vector<wide_bvh_node<W>>& out) {
+            out.clear();
+            if (!binary.empty())
+                collapse_node(out, 0);
+        }
+
+    private:
+        const std::vector<flat_bvh_node>& binary;
+
+        uint32_t collapse_node(std::vector<wide_bvh_node<W>>& out, uint32_t root) {
+            uint32_t children[W];
+            int n = 0;
+
+            if (binary[root].is_leaf()) {
+                children[n++] = root;
+            } else {
+                children[n++] = root + 1;
+                children[n++] = binary[root].offset;
+            }
+
+            while (n < W) {
+                int widest = -1;
+                double widest_area = 0;
+                for (int c = 0; c < n; c++) {
+                    const auto& child = binary[children[c]];
+                    if (child.is_leaf())
+                        continue;
+                    if (widest < 0 || node_area(child) > widest_area) {
+                        widest = c;
+                        widest_area = node_area(child);
+                    }
+                }
+
+                if (widest < 0)
+                    break;
+
+                auto opened = children[widest];
+                children[widest] = opened + 1;
+                children[n++] = binary[opened].offset;
+            }
+
+            auto index = static_cast<uint32_t>(out.size());
+            out.push_back(wide_bvh_node<W>());
+            init_empty(out[index]);
+            out[index].num_children = n;
+
+            for (int c = 0; c < n; c++) {
+                const auto& child = binary[children[c]];
+                for (int a = 0; a < 3; a++) {
+                    out[index].lo[a][c] = child.bounds_min[a];
+                    out[index].hi[a][c] = child.bounds_max[a];
+                }
+
+                if (child.is_leaf()) {
+                    out[index].child[c] = child.offset;
+                    out[index].count[c] = child.count;
+                } else {
+                    auto grandchild = collapse_node(out, children[c]);
+                    out[index].child[c] = grandchild;  // out may have been reallocated
+                    out[index].count[c] = 0;
+                }
+            }
+
+            return index;
+        }
+
+        static void init_empty(wide_bvh_node<W>& node) {
+            for (int c = 0; c < W; c++) {
+                for (int a = 0; a < 3; a++) {
+                    node.lo[a][c] = 0;
+                    node.hi[a][c] = 0;
+                }
+                node.child[c] = 0;
+                node.count[c] = 0;
+            }
+        }
+};
+
+
+#endif
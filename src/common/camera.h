@@ -22,12 +22,12 @@ class camera {
             point3 lookfrom,
             point3 lookat,
             vec3   vup,
-            double vfov, // vertical field-of-view in degrees
-            double aspect_ratio,
-            double aperture,
-            double focus_dist,
-            double t0 = 0,
-            double t1 = 0
+            real vfov, // vertical field-of-view in degrees
+            real aspect_ratio,
+            real aperture,
+            real focus_dist,
+            real t0 = 0,
+            real t1 = 0
         ) {
             auto theta = degrees_to_radians(vfov);
             auto h = tan(theta/2);
@@ -46,16 +46,28 @@ class camera {
             lens_radius = aperture / 2;
             time0 = t0;
             time1 = t1;
+            pixel_spread = 0;
         }
 
-        ray get_ray(double s, double t) const {
-            vec3 rd = lens_radius * random_in_unit_disk();
+        // Gives the rays footprints one pixel wide, across image_width pixels, so that
+        // textures can filter what a pixel covers.
+        void set_image_width(int image_width) {
+            pixel_spread = horizontal.length() / image_width;
+        }
+
+        ray get_ray(real s, real t) const {
+            // The lens and the time draw the sample's dimensions after the pixel jitter.
+            RTW_STAT(stat_camera_rays);
+            vec3 rd = lens_radius * sample_unit_disk();
             vec3 offset = u * rd.x() + v * rd.y();
-            return ray(
+            ray r(
                 origin + offset,
                 lower_left_corner + s*horizontal + t*vertical - origin - offset,
-                random_double(time0, time1)
+                time0 + (time1 - time0) * sample_1d()
             );
+            // The direction reaches the focus plane at t = 1, where a pixel is this wide.
+            r.spread = pixel_spread;
+            return r;
         }
 
     private:
@@ -64,8 +76,9 @@ class camera {
         vec3 horizontal;
         vec3 vertical;
         vec3 u, v, w;
-        double lens_radius;
-        double time0, time1;  // shutter open/close times
+        real lens_radius;
+        real time0, time1;  // shutter open/close times
+        real pixel_spread;
 };
 
 #endif
@@ -38,7 +38,17 @@ void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
         << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
 }
 
-unsigned char convert(double color, int samples_per_pixel) {
+bool russian_roulette(color& throughput) {
+    // Ends a path with a probability that grows as its throughput shrinks, and scales the
+    // throughput of surviving paths up to match, so the estimate stays unbiased.
+    auto p = fmin(fmax(throughput.x(), fmax(throughput.y(), throughput.z())), 0.95);
+    if (sample_1d() >= p)
+        return false;
+    throughput /= p;
+    return true;
+}
+
+unsigned char convert(real color, int samples_per_pixel) {
     if (color != color)
         color = 0.0;
     color = 256 * clamp(sqrt(color / samples_per_pixel), 0.0, 0.999);
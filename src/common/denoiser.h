@@ -0,0 +1,330 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+struct first_hit {
+    // What a camera ray found at its first surface: the arbitrary output variables (AOVs) an
+    // integrator reports beside the radiance. A ray that hits nothing leaves them all zero.
+    color albedo = color(0, 0, 0);   // Attenuation of the scatter, or emission, within [0,1]
+    vec3 normal = vec3(0, 0, 0);     // Shading normal, facing the ray
+    real depth = 0;                  // Distance along the ray
+
+    void record(const vec3& n, real distance, const color& reflectance) {
+        albedo = color(clamp(reflectance.x(), 0, 1), clamp(reflectance.y(), 0, 1),
+                       clamp(reflectance.z(), 0, 1));
+        normal = n;
+        depth = distance;
+    }
+};
+
+
+class feature_buffer {
+    // Per-pixel averages of the first hits of a pixel's samples, and the first two moments of
+    // the samples' luminance, which tell the denoiser how noisy every pixel still is. Like a
+    // framebuffer, each pixel is written by one worker at a time.
+    public:
+        feature_buffer() : image_width(0), image_height(0) {}
+
+        feature_buffer(int width, int height)
+          : image_width(width), image_height(height),
+            pixels(static_cast<size_t>(width) * height)
+        {}
+
+        int width() const  { return image_width; }
+        int height() const { return image_height; }
+
+        void add(int i, int j, const color& radiance, const first_hit& hit) {
+            auto& p = pixels[pixel_index(i, j)];
+            const auto l = luminance(radiance);
+            for (int a = 0; a < 3; a++) {
+                p.albedo[a] += static_cast<float>(hit.albedo[a]);
+                p.normal[a] += static_cast<float>(hit.normal[a]);
+            }
+            p.depth += static_cast<float>(hit.depth);
+            p.moments[0] += l;
+            p.moments[1] += l * l;
+            p.count++;
+        }
+
+        color albedo(int i, int j) const {
+            const auto& p = pixels[pixel_index(i, j)];
+            return color(p.albedo[0], p.albedo[1], p.albedo[2]) / std::max(p.count, 1u);
+        }
+
+        // The average normal, rescaled to unit length, or zero where every sample missed.
+        vec3 normal(int i, int j) const {
+            const auto& p = pixels[pixel_index(i, j)];
+            const vec3 sum(p.normal[0], p.normal[1], p.normal[2]);
+            const auto length = sum.length();
+            return length > 0 ? sum / length : vec3(0, 0, 0);
+        }
+
+        real depth(int i, int j) const {
+            const auto& p = pixels[pixel_index(i, j)];
+            return p.depth / std::max(p.count, 1u);
+        }
+
+        uint32_t samples(int i, int j) const { return pixels[pixel_index(i, j)].count; }
+
+        // The variance of the pixel's mean luminance, or a negative value with too few samples
+        // to estimate it.
+        real luminance_variance(int i, int j) const {
+            const auto& p = pixels[pixel_index(i, j)];
+            if (p.count < 2)
+                return -1;
+            const double n = p.count;
+            const double mean = p.moments[0] / n;
+            return static_cast<real>(std::max(0.0, (p.moments[1] / n - mean*mean) / (n - 1)));
+        }
+
+        // The AOVs as images, for any image_output: the normal's components, and the depth in
+        // every channel, are stored as they are, so they belong in .pfm or .exr files.
+        framebuffer albedo_image() const {
+            return to_image([this](int i, int j) { return albedo(i, j); });
+        }
+
+        framebuffer normal_image() const {
+            return to_image([this](int i, int j) { return normal(i, j); });
+        }
+
+        framebuffer depth_image() const {
+            return to_image([this](int i, int j) { return depth(i, j) * color(1, 1, 1); });
+        }
+
+        static real luminance(const color& c) {
+            return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+        }
+
+    private:
+        struct pixel {
+            float albedo[3] = {0, 0, 0};
+            float normal[3] = {0, 0, 0};
+            float depth = 0;
+            double moments[2] = {0, 0};
+            uint32_t count = 0;
+        };
+
+        int image_width, image_height;
+        std::vector<pixel> pixels;
+
+        size_t pixel_index(int i, int j) const {
+            return static_cast<size_t>(j) * image_width + i;
+        }
+
+        template <typename F>
+        framebuffer to_image(F value) const {
+            framebuffer image(image_width, image_height);
+            for (int j = 0; j < image_height; j++) {
+                for (int i = 0; i < image_width; i++)
+                    image.add(i, j, value(i, j), 1);
+            }
+            return image;
+        }
+};
+
+
+class denoiser {
+    // An edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the luminance
+    // weights of spatiotemporal variance-guided filtering (Schied et al. 2017), for stills.
+    //
+    // The radiance is first divided by the albedo, so texture and material edges survive and
+    // only the lighting is blurred. Every pass then averages each pixel with 5x5 neighbors
+    // spaced one, two, four and then eight pixels apart, weighted by a B3 spline and by how
+    // alike the two pixels' normals, depths, albedos and lighting are. The lighting term allows
+    // for the pixel's own noise: differences within a few standard deviations of its luminance
+    // are taken for noise and averaged away, while larger ones are kept as edges. Each pass
+    // also carries the variance through, so later, wider passes blur less of what is left.
+    public:
+        int passes = 4;
+        real sigma_luminance = 2;   // Noise standard deviations over which lighting is an edge
+        real sigma_normal = 128;    // Exponent on the cosine between normals
+        real sigma_depth = 1;       // Multiple of the depth gradient over which depth is an edge
+        real sigma_albedo = 0.1;
+
+        // Returns the denoised image: one sample per pixel, of the filtered mean.
+        framebuffer denoise(const framebuffer& image, const feature_buffer& features) const;
+
+    private:
+        struct texel {
+            color lighting;   // Radiance over albedo
+            color albedo;     // The albedo divided out, with no zero channels
+            color guide;      // The AOVs' albedo
+            vec3 normal;
+            real depth;
+            real gradient;    // Largest change in depth to a neighboring pixel
+            real variance;    // Of the luminance of lighting
+        };
+
+        real weight(const texel& p, const texel& q, real p_deviation, int offset) const;
+};
+
+
+framebuffer denoiser::denoise(const framebuffer& image, const feature_buffer& features) const {
+    const int width = image.width();
+    const int height = image.height();
+    auto index = [width](int i, int j) { return static_cast<size_t>(j) * width + i; };
+
+    std::vector<texel> texels(static_cast<size_t>(width) * height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            auto& t = texels[index(i, j)];
+            const auto mean = image.sum(i, j) / std::max(image.samples(i, j), 1u);
+            t.guide = features.albedo(i, j);
+            for (int a = 0; a < 3; a++) {
+                t.albedo[a] = t.guide[a] > real(0.001) ? t.guide[a] : 1;
+                t.lighting[a] = mean[a] / t.albedo[a];
+            }
+            t.normal = features.normal(i, j);
+            t.depth = features.depth(i, j);
+
+            const auto l = feature_buffer::luminance(t.albedo);
+            t.variance = features.luminance_variance(i, j) / (l * l);
+        }
+    }
+
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            auto& t = texels[index(i, j)];
+            t.gradient = 0;
+            const int neighbors[4][2] = { {i-1, j}, {i+1, j}, {i, j-1}, {i, j+1} };
+            for (const auto& n : neighbors) {
+                if (n[0] < 0 || n[0] >= width || n[1] < 0 || n[1] >= height)
+                    continue;
+                const real change = fabs(texels[index(n[0], n[1])].depth - t.depth);
+                t.gradient = std::max(t.gradient, change);
+            }
+        }
+    }
+
+    // Pixels with a single sample borrow the spread of the lighting around them.
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            auto& t = texels[index(i, j)];
+            if (t.variance >= 0)
+                continue;
+            real sum = 0, sum_squares = 0;
+            int n = 0;
+            for (int y = std::max(0, j-1); y <= std::min(height-1, j+1); y++) {
+                for (int x = std::max(0, i-1); x <= std::min(width-1, i+1); x++) {
+                    const auto l = feature_buffer::luminance(texels[index(x, y)].lighting);
+                    sum += l;
+                    sum_squares += l * l;
+                    n++;
+                }
+            }
+            t.variance = std::max(real(0), sum_squares / n - (sum / n) * (sum / n));
+        }
+    }
+
+    const real kernel[5] = { 1.0/16, 1.0/4, 3.0/8, 1.0/4, 1.0/16 };
+    std::vector<texel> filtered(texels.size());
+    std::vector<real> deviations(texels.size());
+
+    for (int pass = 0; pass < passes; pass++) {
+        const int step = 1 << pass;
+
+        // The luminance weights use a 3x3 blur of the variance, steadier than any one pixel's.
+        #pragma omp parallel for
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                real sum = 0, total = 0;
+                for (int y = std::max(0, j-1); y <= std::min(height-1, j+1); y++) {
+                    for (int x = std::max(0, i-1); x <= std::min(width-1, i+1); x++) {
+                        const real w = (x == i ? 2 : 1) * (y == j ? 2 : 1);
+                        sum += w * texels[index(x, y)].variance;
+                        total += w;
+                    }
+                }
+                deviations[index(i, j)] = sqrt(sum / total);
+            }
+        }
+
+        #pragma omp parallel for
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                const auto& p = texels[index(i, j)];
+                color sum(0, 0, 0);
+                real total = 0, variance = 0;
+
+                for (int dy = -2; dy <= 2; dy++) {
+                    const int y = j + dy * step;
+                    if (y < 0 || y >= height)
+                        continue;
+                    for (int dx = -2; dx <= 2; dx++) {
+                        const int x = i + dx * step;
+                        if (x < 0 || x >= width)
+                            continue;
+                        const auto& q = texels[index(x, y)];
+                        const auto offset = step * (std::abs(dx) + std::abs(dy));
+                        const auto w = kernel[dx+2] * kernel[dy+2]
+                                     * weight(p, q, deviations[index(i, j)], offset);
+                        sum += w * q.lighting;
+                        variance += w * w * q.variance;
+                        total += w;
+                    }
+                }
+
+                auto& f = filtered[index(i, j)];
+                f = p;
+                f.lighting = sum / total;
+                f.variance = variance / (total * total);
+            }
+        }
+
+        texels.swap(filtered);
+    }
+
+    framebuffer result(width, height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            const auto& t = texels[index(i, j)];
+            result.add(i, j, t.lighting * t.albedo, 1);
+        }
+    }
+    return result;
+}
+
+
+real denoiser::weight(const texel& p, const texel& q, real p_deviation, int offset) const {
+    // Pixels are alike when both miss, or both hit with similar normals; depths within the
+    // surface's slope over the distance between them, or within a small fraction of the
+    // depth; similar albedos; and lighting within the noise.
+    const bool p_hit = p.normal.length_squared() > 0;
+    const bool q_hit = q.normal.length_squared() > 0;
+    if (p_hit != q_hit)
+        return 0;
+
+    const auto cosine = fmax(real(0), dot(p.normal, q.normal));
+    const auto w_normal = p_hit ? std::pow(cosine, sigma_normal) : 1;
+
+    const auto depth_scale = sigma_depth * p.gradient * offset + real(0.005) * p.depth;
+    const auto w_depth = fabs(p.depth - q.depth) / (depth_scale + real(1e-6));
+
+    const auto albedo_difference = p.guide - q.guide;
+    const auto w_albedo = albedo_difference.length_squared() / (sigma_albedo * sigma_albedo);
+
+    const auto lighting_difference = fabs(feature_buffer::luminance(p.lighting)
+                                        - feature_buffer::luminance(q.lighting));
+    const auto w_lighting = lighting_difference / (sigma_luminance * p_deviation + real(1e-6));
+
+    return w_normal * std::exp(-(w_depth + w_albedo + w_lighting));
+}
+
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "color.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+class framebuffer {
+    // Linear, unclamped sums of radiance samples, with the number of samples behind each
+    // pixel. Every pixel is written by exactly one worker at a time, so no locking is needed.
+    // Pixel (0,0) is the lower-left corner of the image, matching the camera's (u,v).
+    public:
+        framebuffer() : image_width(0), image_height(0) {}
+
+        framebuffer(int width, int height)
+          : image_width(width), image_height(height),
+            sums(3 * static_cast<size_t>(width) * height, 0.0f),
+            counts(static_cast<size_t>(width) * height, 0)
+        {}
+
+        int width() const  { return image_width; }
+        int height() const { return image_height; }
+
+        void add(int i, int j, const color& sum, int samples) {
+            auto index = pixel_index(i, j);
+            sums[3*index + 0] += static_cast<float>(sum.x());
+            sums[3*index + 1] += static_cast<float>(sum.y());
+            sums[3*index + 2] += static_cast<float>(sum.z());
+            counts[index] += samples;
+        }
+
+        color sum(int i, int j) const {
+            auto index = pixel_index(i, j);
+            return color(sums[3*index + 0], sums[3*index + 1], sums[3*index + 2]);
+        }
+
+        uint32_t samples(int i, int j) const { return counts[pixel_index(i, j)]; }
+
+        // Returns gamma-corrected 8-bit RGBA rows, top row first, ready for stbi_write_png.
+        std::vector<unsigned char> to_rgba8() const {
+            std::vector<unsigned char> pixels(4 * counts.size());
+            auto out = pixels.begin();
+
+            for (int j = image_height - 1; j >= 0; --j) {
+                for (int i = 0; i < image_width; ++i) {
+                    auto index = pixel_index(i, j);
+                    auto n = counts[index] > 0 ? static_cast<int>(counts[index]) : 1;
+                    *out++ = convert(sums[3*index + 0], n);
+                    *out++ = convert(sums[3*index + 1], n);
+                    *out++ = convert(sums[3*index + 2], n);
+                    *out++ = 255;
+                }
+            }
+
+            return pixels;
+        }
+
+        // Returns the sample count of each pixel as an RGBA8 heat map, top row first: black
+        // for no samples, then blue, red and finally white at max_samples.
+        std::vector<unsigned char> sample_heatmap_rgba8(uint32_t max_samples) const {
+            std::vector<unsigned char> pixels(4 * counts.size());
+            auto out = pixels.begin();
+            const auto scale = max_samples > 0 ? 1.0 / max_samples : 0.0;
+
+            for (int j = image_height - 1; j >= 0; --j) {
+                for (int i = 0; i < image_width; ++i) {
+                    auto t = clamp(counts[pixel_index(i, j)] * scale, 0, 1);
+                    auto blue = t < 1.0/3 ? 3*t : (t < 2.0/3 ? 2 - 3*t : 3*t - 2);
+                    *out++ = static_cast<unsigned char>(255 * clamp(3*t - 1, 0, 1));
+                    *out++ = static_cast<unsigned char>(255 * clamp(3*t - 2, 0, 1));
+                    *out++ = static_cast<unsigned char>(255 * clamp(blue, 0, 1));
+                    *out++ = 255;
+                }
+            }
+
+            return pixels;
+        }
+
+        // Total number of samples taken over the whole image.
+        uint64_t total_samples() const {
+            uint64_t total = 0;
+            for (auto n : counts)
+                total += n;
+            return total;
+        }
+
+        // The fewest samples behind any one pixel.
+        uint32_t min_samples() const {
+            uint32_t fewest = counts.empty() ? 0 : counts[0];
+            for (auto n : counts)
+                fewest = n < fewest ? n : fewest;
+            return fewest;
+        }
+
+        // Adds the samples of another image of the same size. Returns false if the sizes differ.
+        bool merge(const framebuffer& other) {
+            if (other.image_width != image_width || other.image_height != image_height)
+                return false;
+            for (size_t k = 0; k < sums.size(); k++)
+                sums[k] += other.sums[k];
+            for (size_t k = 0; k < counts.size(); k++)
+                counts[k] += other.counts[k];
+            return true;
+        }
+
+        // Checkpoints hold the raw sums and counts in native byte order, behind a small header.
+        // The file is written under a temporary name and renamed into place, so an interrupted
+        // write never clobbers the previous checkpoint.
+        bool write_checkpoint(const std::string& path) const {
+            const auto temporary = path + ".tmp";
+            auto file = std::fopen(temporary.c_str(), "wb");
+            if (!file)
+                return false;
+
+            const int32_t size[2] = { image_width, image_height };
+            bool ok = std::fwrite(checkpoint_magic(), 1, 8, file) == 8
+                   && std::fwrite(size, sizeof size, 1, file) == 1
+                   && std::fwrite(counts.data(), sizeof(uint32_t), counts.size(), file)
+                      == counts.size()
+                   && std::fwrite(sums.data(), sizeof(float), sums.size(), file) == sums.size();
+            ok = std::fclose(file) == 0 && ok;
+
+            const bool written = ok;
+            ok = written && std::rename(temporary.c_str(), path.c_str()) == 0;
+#ifdef _WIN32
+            // Windows won't rename over an existing file, so there the old checkpoint goes
+            // first, only once the new one is complete.
+            if (written && !ok) {
+                std::remove(path.c_str());
+                ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+            }
+#endif
+            if (!ok)
+                std::remove(temporary.c_str());
+            return ok;
+        }
+
+        // Replaces this image with a checkpoint. Returns false, leaving the image untouched, if
+        // the file is missing, is not a checkpoint, or is not the size its header says.
+        bool read_checkpoint(const std::string& path) {
+            auto file = std::fopen(path.c_str(), "rb");
+            if (!file)
+                return false;
+
+            char magic[8];
+            int32_t size[2];
+            bool ok = std::fread(magic, 1, 8, file) == 8
+                   && std::memcmp(magic, checkpoint_magic(), 8) == 0
+                   && std::fread(size, sizeof size, 1, file) == 1
+                   && size[0] >= 0 && size[1] >= 0;
+
+            // Check the header against the file before allocating what it asks for.
+            if (ok) {
+                const auto pixels = static_cast<uint64_t>(size[0]) * size[1];
+                const auto expected = 8 + sizeof size
+                                    + pixels * (sizeof(uint32_t) + 3 * sizeof(float));
+                const auto header_end = std::ftell(file);
+                ok = std::fseek(file, 0, SEEK_END) == 0
+                  && static_cast<uint64_t>(std::ftell(file)) == expected
+                  && std::fseek(file, header_end, SEEK_SET) == 0;
+            }
+
+            framebuffer loaded;
+            if (ok) {
+                loaded = framebuffer(size[0], size[1]);
+                auto& c = loaded.counts;
+                auto& s = loaded.sums;
+                ok = std::fread(c.data(), sizeof(uint32_t), c.size(), file) == c.size()
+                  && std::fread(s.data(), sizeof(float), s.size(), file) == s.size();
+            }
+            std::fclose(file);
+
+            if (ok)
+                *this = std::move(loaded);
+            return ok;
+        }
+
+    private:
+        int image_width, image_height;
+        std::vector<float> sums;
+        std::vector<uint32_t> counts;
+
+        static const char* checkpoint_magic() { return "RTWFB01"; }  // 8 bytes with the NUL
+
+        size_t pixel_index(int i, int j) const {
+            return static_cast<size_t>(j) * image_width + i;
+        }
+};
+
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef IMAGE_OUTPUT_H
+#define IMAGE_OUTPUT_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "framebuffer.h"
+#include "tile.h"
+#include "external/stb_image_write.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+class image_output {
+    // Where the pixels of a framebuffer end up. Workers may hand over each tile with
+    // write_tile() as soon as its pixels are final, in any order and concurrently, so that it
+    // is encoded while the rest of the frame renders; finish() encodes whatever wasn't handed
+    // over and completes the file. An output is used for one image.
+    public:
+        image_output(int width, int height) : width(width), height(height), written(0) {}
+        virtual ~image_output() {}
+
+        void write_tile(const framebuffer& image, const tile& t) {
+            encode_tile(image, t);
+            written += size_t(t.x1 - t.x0) * (t.y1 - t.y0);
+        }
+
+        // Returns false if the file couldn't be written.
+        bool finish(const framebuffer& image) {
+            if (written != size_t(width) * height) {
+                tile all = { 0, 0, width, height };
+                encode_tile(image, all);
+            }
+            return complete(image);
+        }
+
+    protected:
+        int width, height;
+
+        virtual void encode_tile(const framebuffer& image, const tile& t) = 0;
+        virtual bool complete(const framebuffer& image) = 0;
+
+        // The average of a pixel's samples, with NaNs zeroed as convert() does.
+        static color average(const framebuffer& image, int i, int j) {
+            auto n = image.samples(i, j) > 0 ? image.samples(i, j) : 1;
+            auto c = image.sum(i, j) / n;
+            for (int a = 0; a < 3; a++) {
+                if (c[a] != c[a])
+                    c[a] = 0;
+            }
+            return c;
+        }
+
+    private:
+        std::atomic<size_t> written;  // Pixels handed over by write_tile
+};
+
+
+class png_output : public image_output {
+    // Tiles are tone mapped into 8-bit rows as they finish; the compression, which needs the
+    // whole image, is left for finish().
+    public:
+        png_output(const std::string& path, int width, int height)
+          : image_output(width, height), path(path), pixels(4 * size_t(width) * height) {}
+
+    protected:
+        virtual void encode_tile(const framebuffer& image, const tile& t) {
+            for (int j = t.y0; j < t.y1; j++) {
+                auto out = &pixels[4 * (size_t(height - 1 - j) * width + t.x0)];
+                for (int i = t.x0; i < t.x1; i++) {
+                    auto n = image.samples(i, j) > 0 ? static_cast<int>(image.samples(i, j)) : 1;
+                    auto sum = image.sum(i, j);
+                    *out++ = convert(sum.x(), n);
+                    *out++ = convert(sum.y(), n);
+                    *out++ = convert(sum.z(), n);
+                    *out++ = 255;
+                }
+            }
+        }
+
+        virtual bool complete(const framebuffer& image) {
+            return stbi_write_png(path.c_str(), width, height, 4, pixels.data(), width * 4) != 0;
+        }
+
+    private:
+        std::string path;
+        std::vector<unsigned char> pixels;
+};
+
+
+class raster_output : public image_output {
+    // Formats whose pixels sit at fixed offsets in the file, which get each tile's rows
+    // written in place as soon as the tile is handed over.
+    public:
+        raster_output(const std::string& path, int width, int height)
+          : image_output(width, height), file(std::fopen(path.c_str(), "wb")), ok(file != nullptr)
+        {}
+
+        ~raster_output() {
+            if (file)
+                std::fclose(file);
+        }
+
+    protected:
+        std::FILE* file;
+        std::mutex lock;
+        bool ok;
+
+        void put(long offset, const std::vector<unsigned char>& bytes) {
+            std::lock_guard<std::mutex> guard(lock);
+            ok = ok && std::fseek(file, offset, SEEK_SET) == 0
+                    && std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        }
+
+        virtual bool complete(const framebuffer& image) {
+            if (file) {
+                ok = std::fclose(file) == 0 && ok;
+                file = nullptr;
+            }
+            return ok;
+        }
+
+        static void append(std::vector<unsigned char>& bytes, const std::string& text) {
+            bytes.insert(bytes.end(), text.begin(), text.end());
+        }
+
+        static void append_le32(std::vector<unsigned char>& bytes, uint32_t value) {
+            for (int b = 0; b < 4; b++)
+                bytes.push_back(static_cast<unsigned char>(value >> (8*b)));
+        }
+
+        static void append_float_le(std::vector<unsigned char>& bytes, float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof bits);
+            append_le32(bytes, bits);
+        }
+};
+
+
+class ppm_output : public raster_output {
+    // Binary PPM (P6): gamma-corrected 8-bit RGB, top row first.
+    public:
+        ppm_output(const std::string& path, int width, int height)
+          : raster_output(path, width, height)
+        {
+            std::vector<unsigned char> header;
+            append(header, "P6\n" + std::to_string(width) + ' ' + std::to_string(height)
+                           + "\n255\n");
+            header_size = static_cast<long>(header.size());
+            if (ok)
+                put(0, header);
+        }
+
+    protected:
+        virtual void encode_tile(const framebuffer& image, const tile& t) {
+            std::vector<unsigned char> row;
+            for (int j = t.y0; j < t.y1; j++) {
+                row.clear();
+                for (int i = t.x0; i < t.x1; i++) {
+                    auto n = image.samples(i, j) > 0 ? static_cast<int>(image.samples(i, j)) : 1;
+                    auto sum = image.sum(i, j);
+                    row.push_back(convert(sum.x(), n));
+                    row.push_back(convert(sum.y(), n));
+                    row.push_back(convert(sum.z(), n));
+                }
+                put(header_size + 3 * (long(height - 1 - j) * width + t.x0), row);
+            }
+        }
+
+    private:
+        long header_size;
+};
+
+
+class pfm_output : public raster_output {
+    // Portable float map: linear 32-bit RGB, bottom row first, little-endian (which the
+    // negative scale in the header declares).
+    public:
+        pfm_output(const std::string& path, int width, int height)
+          : raster_output(path, width, height)
+        {
+            std::vector<unsigned char> header;
+            append(header, "PF\n" + std::to_string(width) + ' ' + std::to_string(height)
+                           + "\n-1.0\n");
+            header_size = static_cast<long>(header.size());
+            if (ok)
+                put(0, header);
+        }
+
+    protected:
+        virtual void encode_tile(const framebuffer& image, const tile& t) {
+            std::vector<unsigned char> row;
+            for (int j = t.y0; j < t.y1; j++) {
+                row.clear();
+                for (int i = t.x0; i < t.x1; i++) {
+                    auto c = average(image, i, j);
+                    for (int a = 0; a < 3; a++)
+                        append_float_le(row, static_cast<float>(c[a]));
+                }
+                put(header_size + 12 * (long(j) * width + t.x0), row);
+            }
+        }
+
+    private:
+        long header_size;
+};
+
+
+class exr_output : public raster_output {
+    // OpenEXR with linear 32-bit float R, G and B, uncompressed, one scanline per block. With
+    // no compression every block has the same size, so the offset table and block headers
+    // are written up front and tiles fill in the channel spans of their rows.
+    public:
+        exr_output(const std::string& path, int width, int height)
+          : raster_output(path, width, height)
+        {
+            std::vector<unsigned char> header;
+            append_le32(header, 20000630);  // Magic number
+            append_le32(header, 2);         // Version 2, single-part scanline image
+
+            std::vector<unsigned char> channels;
+            for (auto name : { "B", "G", "R" }) {  // Channels go in alphabetical order
+                append(channels, name);
+                channels.push_back(0);
+                append_le32(channels, 2);  // FLOAT
+                append_le32(channels, 0);  // pLinear and reserved bytes
+                append_le32(channels, 1);  // xSampling
+                append_le32(channels, 1);  // ySampling
+            }
+            channels.push_back(0);
+            attribute(header, "channels", "chlist", channels);
+
+            attribute(header, "compression", "compression", { 0 });
+
+            std::vector<unsigned char> window;
+            for (auto v : { 0, 0, width - 1, height - 1 })
+                append_le32(window, static_cast<uint32_t>(v));
+            attribute(header, "dataWindow", "box2i", window);
+            attribute(header, "displayWindow", "box2i", window);
+
+            attribute(header, "lineOrder", "lineOrder", { 0 });  // Increasing y
+
+            std::vector<unsigned char> one, center;
+            append_float_le(one, 1);
+            append_float_le(center, 0);
+            append_float_le(center, 0);
+            attribute(header, "pixelAspectRatio", "float", one);
+            attribute(header, "screenWindowCenter", "v2f", center);
+            attribute(header, "screenWindowWidth", "float", one);
+            header.push_back(0);
+
+            // The offset table, then each block's y and byte count.
+            table_end = static_cast<long>(header.size()) + 8L * height;
+            for (int y = 0; y < height; y++) {
+                uint64_t offset = block_offset(y);
+                append_le32(header, static_cast<uint32_t>(offset));
+                append_le32(header, static_cast<uint32_t>(offset >> 32));
+            }
+            if (ok)
+                put(0, header);
+
+            for (int y = 0; y < height && ok; y++) {
+                std::vector<unsigned char> block_header;
+                append_le32(block_header, static_cast<uint32_t>(y));
+                append_le32(block_header, static_cast<uint32_t>(12 * width));
+                put(block_offset(y), block_header);
+            }
+        }
+
+    protected:
+        virtual void encode_tile(const framebuffer& image, const tile& t) {
+            std::vector<color> row;
+            std::vector<unsigned char> span;
+            for (int j = t.y0; j < t.y1; j++) {
+                row.clear();
+                for (int i = t.x0; i < t.x1; i++)
+                    row.push_back(average(image, i, j));
+
+                const auto y = height - 1 - j;  // EXR rows run top to bottom
+                for (int channel = 0; channel < 3; channel++) {
+                    span.clear();
+                    for (const auto& c : row)
+                        append_float_le(span, static_cast<float>(c[2 - channel]));
+                    put(block_offset(y) + 8 + 4 * (long(channel) * width + t.x0), span);
+                }
+            }
+        }
+
+    private:
+        long table_end;
+
+        long block_offset(int y) const {
+            return table_end + long(y) * (8 + 12L * width);
+        }
+
+        static void attribute(
+            std::vector<unsigned char>& header, const std::string& name, const std::string& type,
+            const std::vector<unsigned char>& value
+        ) {
+            append(header, name);
+            header.push_back(0);
+            append(header, type);
+            header.push_back(0);
+            append_le32(header, static_cast<uint32_t>(value.size()));
+            header.insert(header.end(), value.begin(), value.end());
+        }
+};
+
+
+inline bool has_extension(const std::string& path, const std::string& extension) {
+    return path.size() >= extension.size()
+        && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+
+// An output for path in the format its extension names: .exr and .pfm hold linear floats,
+// .ppm gamma-corrected bytes, and anything else is written as PNG.
+inline std::unique_ptr<image_output> make_image_output(
+    const std::string& path, int width, int height
+) {
+    if (has_extension(path, ".exr"))
+        return std::unique_ptr<image_output>(new exr_output(path, width, height));
+    if (has_extension(path, ".pfm"))
+        return std::unique_ptr<image_output>(new pfm_output(path, width, height));
+    if (has_extension(path, ".ppm"))
+        return std::unique_ptr<image_output>(new ppm_output(path, width, height));
+    return std::unique_ptr<image_output>(new png_output(path, width, height));
+}
+
+
+#endif
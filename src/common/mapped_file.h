@@ -0,0 +1,129 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+    #define RTW_HAVE_MMAP 1
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+class mapped_file {
+    // A whole file mapped read-only into memory. Pages are read in when first touched, and
+    // every process that maps the same file shares one copy of them in the page cache. Where
+    // there is no mapping, the file is read into memory instead. Replacing the file by renaming
+    // another over it leaves existing mappings of the old one intact.
+    public:
+        // Null, if the file can't be opened or is empty.
+        static shared_ptr<const mapped_file> open(const std::string& path) {
+            shared_ptr<mapped_file> file(new mapped_file);
+            return file->map(path) ? file : nullptr;
+        }
+
+        ~mapped_file() {
+#if defined(_WIN32)
+            if (first)
+                UnmapViewOfFile(first);
+            if (mapping)
+                CloseHandle(mapping);
+#elif defined(RTW_HAVE_MMAP)
+            if (first)
+                munmap(const_cast<unsigned char*>(first), length);
+#endif
+        }
+
+        const unsigned char* data() const { return first; }
+        size_t size() const               { return length; }
+
+    private:
+        const unsigned char* first = nullptr;
+        size_t length = 0;
+#if defined(_WIN32)
+        HANDLE mapping = nullptr;
+#endif
+        std::vector<unsigned char> copy;  // The contents, where they couldn't be mapped
+
+        mapped_file() {}
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        bool map(const std::string& path) {
+#if defined(_WIN32)
+            auto handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (handle == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER file_size;
+            if (GetFileSizeEx(handle, &file_size) && file_size.QuadPart > 0) {
+                mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping) {
+                    first = static_cast<const unsigned char*>(
+                        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                    length = static_cast<size_t>(file_size.QuadPart);
+                }
+            }
+            CloseHandle(handle);
+            return first != nullptr;
+#elif defined(RTW_HAVE_MMAP)
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat info;
+            if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                auto address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ,
+                                    MAP_SHARED, fd, 0);
+                if (address != MAP_FAILED) {
+                    first = static_cast<const unsigned char*>(address);
+                    length = static_cast<size_t>(info.st_size);
+                }
+            }
+            close(fd);  // The mapping stays valid without the descriptor
+            return first != nullptr;
+#else
+            auto file = std::fopen(path.c_str(), "rb");
+            if (!file)
+                return false;
+            std::fseek(file, 0, SEEK_END);
+            auto size = std::ftell(file);
+            std::fseek(file, 0, SEEK_SET);
+            if (size > 0) {
+                copy.resize(static_cast<size_t>(size));
+                if (std::fread(copy.data(), 1, copy.size(), file) == copy.size()) {
+                    first = copy.data();
+                    length = copy.size();
+                }
+            }
+            std::fclose(file);
+            return first != nullptr;
+#endif
+        }
+};
+
+
+#endif
@@ -0,0 +1,418 @@
+#ifndef MESH_IO_H
+#define MESH_IO_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Readers for Wavefront OBJ and Stanford PLY triangle meshes. Both stream the file once into
+// flat vertex and index arrays, with no per-face or per-vertex objects along the way.
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+struct mesh_data {
+    // An indexed triangle mesh. Normals and texture coordinates are either empty or hold one
+    // entry per vertex.
+    std::vector<float> positions;  // x, y, z per vertex
+    std::vector<float> normals;    // x, y, z per vertex
+    std::vector<float> uvs;        // u, v per vertex
+    std::vector<uint32_t> indices; // Three vertices per triangle, counterclockwise
+
+    size_t vertex_count() const { return positions.size() / 3; }
+    size_t triangle_count() const { return indices.size() / 3; }
+};
+
+
+namespace mesh_io_detail {
+
+    struct obj_corner {
+        // One v/vt/vn reference of an OBJ face, as zero-based indices, -1 where absent.
+        long p, t, n;
+
+        bool operator==(const obj_corner& other) const {
+            return p == other.p && t == other.t && n == other.n;
+        }
+    };
+
+    struct obj_corner_hash {
+        size_t operator()(const obj_corner& c) const {
+            return std::hash<long>()(c.p) ^ (std::hash<long>()(c.t) * 31)
+                 ^ (std::hash<long>()(c.n) * 1009);
+        }
+    };
+
+    // Parses an OBJ index, which counts from 1, or back from the end if negative.
+    inline bool obj_index(const char*& s, size_t count, long& out) {
+        char* end;
+        long i = std::strtol(s, &end, 10);
+        if (end == s)
+            return false;
+        s = end;
+        out = i > 0 ? i - 1 : static_cast<long>(count) + i;
+        return out >= 0 && out < static_cast<long>(count);
+    }
+
+    inline const char* skip_space(const char* s) {
+        while (*s == ' ' || *s == '\t')
+            s++;
+        return s;
+    }
+
+    // Appends the first n numbers of s to out, zero for any that are missing.
+    inline void read_floats(const char* s, int n, std::vector<float>& out) {
+        for (int a = 0; a < n; a++) {
+            char* end;
+            out.push_back(std::strtof(s, &end));
+            s = end;
+        }
+    }
+
+    enum ply_type { ply_int8, ply_uint8, ply_int16, ply_uint16, ply_int32, ply_uint32,
+                    ply_float32, ply_float64, ply_invalid };
+
+    inline ply_type ply_type_named(const std::string& name) {
+        if (name == "char"   || name == "int8")    return ply_int8;
+        if (name == "uchar"  || name == "uint8")   return ply_uint8;
+        if (name == "short"  || name == "int16")   return ply_int16;
+        if (name == "ushort" || name == "uint16")  return ply_uint16;
+        if (name == "int"    || name == "int32")   return ply_int32;
+        if (name == "uint"   || name == "uint32")  return ply_uint32;
+        if (name == "float"  || name == "float32") return ply_float32;
+        if (name == "double" || name == "float64") return ply_float64;
+        return ply_invalid;
+    }
+
+    struct ply_property {
+        std::string name;
+        ply_type type;
+        ply_type count_type;  // ply_invalid unless this is a list
+    };
+
+    struct ply_element {
+        std::string name;
+        size_t count;
+        std::vector<ply_property> properties;
+    };
+
+    class ply_reader {
+        // Reads one value at a time in the file's format, ASCII or binary of either byte order.
+        public:
+            ply_reader(std::istream& in, bool ascii, bool swap)
+              : in(in), ascii(ascii), swap(swap) {}
+
+            double read(ply_type type) {
+                if (ascii) {
+                    double value = 0;
+                    in >> value;
+                    return value;
+                }
+
+                static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+                unsigned char bytes[8];
+                in.read(reinterpret_cast<char*>(bytes), sizes[type]);
+                if (swap) {
+                    for (int a = 0, b = sizes[type] - 1; a < b; a++, b--)
+                        std::swap(bytes[a], bytes[b]);
+                }
+
+                switch (type) {
+                    case ply_int8:    return as<int8_t>(bytes);
+                    case ply_uint8:   return as<uint8_t>(bytes);
+                    case ply_int16:   return as<int16_t>(bytes);
+                    case ply_uint16:  return as<uint16_t>(bytes);
+                    case ply_int32:   return as<int32_t>(bytes);
+                    case ply_uint32:  return as<uint32_t>(bytes);
+                    case ply_float32: return as<float>(bytes);
+                    default:          return as<double>(bytes);
+                }
+            }
+
+            bool ok() const { return !in.fail(); }
+
+        private:
+            std::istream& in;
+            bool ascii;
+            bool swap;
+
+            template <typename T>
+            static double as(const unsigned char* bytes) {
+                T value;
+                std::memcpy(&value, bytes, sizeof(T));
+                return static_cast<double>(value);
+            }
+    };
+
+    // Where a vertex property goes in a record of position, normal and uv, or -1 if nowhere.
+    inline int ply_vertex_slot(const std::string& name) {
+        static const char* names[] = { "x", "y", "z", "nx", "ny", "nz", "u", "v" };
+        for (int k = 0; k < 8; k++) {
+            if (name == names[k])
+                return k;
+        }
+        if (name == "s" || name == "texture_u" || name == "texture_s")
+            return 6;
+        if (name == "t" || name == "texture_v" || name == "texture_t")
+            return 7;
+        return -1;
+    }
+
+    inline bool host_is_little_endian() {
+        const uint16_t probe = 1;
+        unsigned char first;
+        std::memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+
+}
+
+
+// Reads the v, vt, vn and f lines of an OBJ file; polygons are split into triangle fans and
+// everything else (groups, materials, smoothing) is ignored. A vertex is made for each distinct
+// v/vt/vn combination the faces use. Prints why and returns false if the file can't be read.
+inline bool load_obj(const std::string& path, mesh_data& mesh) {
+    using namespace mesh_io_detail;
+
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Could not read mesh file " << path << '\n';
+        return false;
+    }
+
+    std::vector<float> positions, normals, uvs;
+    std::unordered_map<obj_corner, uint32_t, obj_corner_hash> vertices;
+    std::vector<uint32_t> face;
+    bool any_uvs = false, any_normals = false;
+
+    mesh = mesh_data();
+
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        const char* s = skip_space(line.c_str());
+
+        if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+            read_floats(s + 1, 3, positions);
+        } else if (s[0] == 'v' && s[1] == 'n') {
+            read_floats(s + 2, 3, normals);
+        } else if (s[0] == 'v' && s[1] == 't') {
+            read_floats(s + 2, 2, uvs);
+        } else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+            face.clear();
+            s = skip_space(s + 1);
+            while (*s && *s != '\r' && *s != '#') {
+                obj_corner c = { -1, -1, -1 };
+                bool valid = obj_index(s, positions.size() / 3, c.p);
+                if (valid && *s == '/') {
+                    s++;
+                    if (*s != '/')
+                        valid = obj_index(s, uvs.size() / 2, c.t);
+                    if (valid && *s == '/') {
+                        s++;
+                        valid = obj_index(s, normals.size() / 3, c.n);
+                    }
+                }
+                if (!valid) {
+                    std::cerr << path << ':' << number << ": bad face index\n";
+                    return false;
+                }
+
+                auto inserted = vertices.insert(
+                    std::make_pair(c, static_cast<uint32_t>(vertices.size())));
+                if (inserted.second) {
+                    mesh.positions.insert(mesh.positions.end(),
+                        positions.begin() + 3*c.p, positions.begin() + 3*c.p + 3);
+                    if (c.t >= 0)
+                        any_uvs = true;
+                    if (c.n >= 0)
+                        any_normals = true;
+                    for (int a = 0; a < 2; a++)
+                        mesh.uvs.push_back(c.t >= 0 ? uvs[2*c.t + a] : 0.0f);
+                    for (int a = 0; a < 3; a++)
+                        mesh.normals.push_back(c.n >= 0 ? normals[3*c.n + a] : 0.0f);
+                }
+                face.push_back(inserted.first->second);
+                s = skip_space(s);
+            }
+
+            for (size_t k = 2; k < face.size(); k++) {
+                mesh.indices.push_back(face[0]);
+                mesh.indices.push_back(face[k-1]);
+                mesh.indices.push_back(face[k]);
+            }
+        }
+    }
+
+    // Attributes only some vertices referenced can't be interpolated; drop them.
+    if (!any_uvs)
+        mesh.uvs.clear();
+    if (!any_normals)
+        mesh.normals.clear();
+
+    return true;
+}
+
+
+// Reads the vertex and face elements of a PLY file in any of its three formats. Vertices may
+// carry nx/ny/nz normals and u/v (or s/t) texture coordinates; faces are split into triangle
+// fans. Prints why and returns false if the file can't be read.
+inline bool load_ply(const std::string& path, mesh_data& mesh) {
+    using namespace mesh_io_detail;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Could not read mesh file " << path << '\n';
+        return false;
+    }
+
+    std::string line, word;
+    std::getline(file, line);
+    if (line.compare(0, 3, "ply") != 0) {
+        std::cerr << path << ": not a PLY file\n";
+        return false;
+    }
+
+    bool ascii = false, big_endian = false;
+    std::vector<ply_element> elements;
+
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        std::istringstream fields(line);
+        fields >> word;
+        if (word == "end_header")
+            break;
+
+        if (word == "format") {
+            fields >> word;
+            ascii = word == "ascii";
+            big_endian = word == "binary_big_endian";
+            if (!ascii && !big_endian && word != "binary_little_endian") {
+                std::cerr << path << ": unknown PLY format " << word << '\n';
+                return false;
+            }
+        } else if (word == "element") {
+            ply_element element;
+            fields >> element.name >> element.count;
+            elements.push_back(element);
+        } else if (word == "property" && !elements.empty()) {
+            ply_property property;
+            std::string type, count_type;
+            fields >> type;
+            property.count_type = ply_invalid;
+            if (type == "list") {
+                fields >> count_type >> type;
+                property.count_type = ply_type_named(count_type);
+            }
+            property.type = ply_type_named(type);
+            fields >> property.name;
+            if (property.type == ply_invalid
+                || (!count_type.empty() && property.count_type == ply_invalid)) {
+                std::cerr << path << ": unknown PLY type in \"" << line << "\"\n";
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        }
+    }
+
+    mesh = mesh_data();
+    ply_reader reader(file, ascii, big_endian == host_is_little_endian());
+    std::vector<uint32_t> face;
+
+    for (const auto& element : elements) {
+        const bool is_vertex = element.name == "vertex";
+        const bool is_face = element.name == "face";
+
+        std::vector<int> slots;
+        bool has_normals = false, has_uvs = false;
+        for (const auto& property : element.properties) {
+            auto slot = is_vertex ? ply_vertex_slot(property.name) : -1;
+            has_normals = has_normals || (slot >= 3 && slot < 6);
+            has_uvs = has_uvs || slot >= 6;
+            slots.push_back(slot);
+        }
+
+        for (size_t item = 0; item < element.count; item++) {
+            float values[8] = {};
+            for (size_t k = 0; k < element.properties.size(); k++) {
+                const auto& property = element.properties[k];
+
+                if (property.count_type == ply_invalid) {
+                    auto value = reader.read(property.type);
+                    if (slots[k] >= 0)
+                        values[slots[k]] = static_cast<float>(value);
+                    continue;
+                }
+
+                auto count = static_cast<size_t>(reader.read(property.count_type));
+                face.clear();
+                for (size_t i = 0; i < count; i++)
+                    face.push_back(static_cast<uint32_t>(reader.read(property.type)));
+
+                if (is_face && (property.name == "vertex_indices"
+                                || property.name == "vertex_index")) {
+                    for (size_t i = 2; i < face.size(); i++) {
+                        mesh.indices.push_back(face[0]);
+                        mesh.indices.push_back(face[i-1]);
+                        mesh.indices.push_back(face[i]);
+                    }
+                }
+            }
+
+            if (is_vertex) {
+                mesh.positions.insert(mesh.positions.end(), values, values + 3);
+                if (has_normals)
+                    mesh.normals.insert(mesh.normals.end(), values + 3, values + 6);
+                if (has_uvs)
+                    mesh.uvs.insert(mesh.uvs.end(), values + 6, values + 8);
+            }
+
+            if (!reader.ok()) {
+                std::cerr << path << ": ends inside its " << element.name << " element\n";
+                return false;
+            }
+        }
+    }
+
+    for (auto index : mesh.indices) {
+        if (index >= mesh.vertex_count()) {
+            std::cerr << path << ": face index " << index << " is out of range\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Reads an OBJ or PLY file, chosen by its extension.
+inline bool load_mesh(const std::string& path, mesh_data& mesh) {
+    auto dot = path.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+    for (auto& c : extension)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+    if (extension == "obj")
+        return load_obj(path, mesh);
+    if (extension == "ply")
+        return load_ply(path, mesh);
+
+    std::cerr << "Unknown mesh format " << path << " (expected .obj or .ply)\n";
+    return false;
+}
+
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+class render_options {
+    // Render settings that can be changed without a rebuild. Each program fills in its own
+    // defaults, then parse() overrides them from the command line,
+    //
+    //     --spp 256 --width=800 --scene cornell_box
+    //
+    // or from a config file named with --config, holding one "name = value" per line, with
+    // '#' starting a comment at the start of a line or after a space. Each line splits at its
+    // first '=', and the value is the rest of the line without its surrounding spaces, as
+    // --name=value would give it. Later settings win, so flags after --config override the file.
+    public:
+        int image_width = 0;
+        int image_height = 0;        // 0 derives the height from the width and aspect ratio
+        int samples_per_pixel = 0;   // The most any pixel gets
+        int max_depth = 0;
+        int rr_depth = 5;            // Bounces before Russian roulette may end a path
+        std::string integrator = "iterative";
+        std::string sampler = "sobol";  // Sequence of the sample values; see sample_sequence
+        bool adaptive = true;        // false takes samples_per_pixel samples in every pixel
+        double threshold = 0.01;     // Error at which an adaptive pixel stops
+        bool progressive = false;    // Render in passes, checkpointing as it goes
+        bool preview = false;        // Render in passes until told to stop, taking camera
+                                     // commands from the standard input
+        double checkpoint_seconds = 60;
+        int node = 0;                // This machine's share of the samples, out of node_count;
+        int node_count = 1;          // shares always render in one pass
+        int threads = 0;             // 0 uses every hardware thread
+        int tile_size = 16;
+        std::string scene;
+        std::string model;           // OBJ or PLY file, for programs with takes_model set
+        std::string scene_file;      // Scene description rendered instead of scene, if set
+        bool scene_cache = true;     // Reuse the scene built from scene_file last time
+        double texture_budget = 0;   // Megabytes of decoded textures, 0 for no limit
+        bool aovs = false;           // Also write first-hit albedo, normal and depth images
+        bool denoise = false;        // Filter the image, guided by those, before writing it
+        std::string output;
+
+        std::vector<std::string> scenes;      // Names --scene accepts, if the program has any
+        std::vector<std::string> integrators = { "iterative", "recursive" };
+        bool takes_model = false;             // Whether --model is accepted
+        bool takes_textures = false;          // Whether --texture-budget is accepted
+        bool takes_scene_file = false;        // Whether --scene-file and --scene-cache are
+        bool takes_aovs = false;              // Whether --aovs and --denoise are
+        bool takes_preview = false;           // Whether --preview is
+
+        // Returns false, after printing why, if the program should exit instead of rendering.
+        bool parse(int argc, char* argv[]) {
+            for (int a = 1; a < argc; ++a) {
+                std::string arg = argv[a];
+
+                if (arg == "--help" || arg == "-h") {
+                    usage(argv[0]);
+                    return false;
+                }
+
+                if (arg.compare(0, 2, "--") != 0) {
+                    std::cerr << "Unexpected argument " << arg << '\n';
+                    usage(argv[0]);
+                    return false;
+                }
+
+                std::string name = arg.substr(2), value;
+                auto equals = name.find('=');
+                if (equals != std::string::npos) {
+                    value = name.substr(equals + 1);
+                    name.resize(equals);
+                } else if (a + 1 < argc) {
+                    value = argv[++a];
+                } else {
+                    std::cerr << "Missing value for " << arg << '\n';
+                    return false;
+                }
+
+                if (!(name == "config" ? read_file(value) : set(name, value)))
+                    return false;
+            }
+
+            return validate();
+        }
+
+        // The output path with its extension replaced, for the files written next to the image.
+        std::string output_with(const std::string& suffix) const {
+            auto dot = output.find_last_of('.');
+            auto slash = output.find_last_of("/\\");
+            if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+                return output + suffix;
+            return output.substr(0, dot) + suffix;
+        }
+
+        // The sequence --sampler names, for active_sample_sequence().
+        sample_sequence sequence() const {
+            if (sampler == "independent")
+                return sample_sequence::independent;
+            return sampler == "blue-noise" ? sample_sequence::blue_noise : sample_sequence::sobol;
+        }
+
+        // Index of the chosen scene in scenes.
+        int scene_index() const {
+            for (size_t k = 0; k < scenes.size(); k++) {
+                if (scenes[k] == scene)
+                    return static_cast<int>(k);
+            }
+            return 0;
+        }
+
+        void usage(const char* program) const {
+            std::cerr << std::boolalpha
+                << "usage: " << program << " [--name value | --name=value]...\n"
+                << "  --config FILE        read \"name = value\" lines from FILE\n"
+                << "  --width N            image width (" << image_width << ")\n"
+                << "  --height N           image height (from the aspect ratio)\n"
+                << "  --spp N              most samples per pixel (" << samples_per_pixel << ")\n"
+                << "  --depth N            most bounces per path (" << max_depth << ")\n"
+                << "  --rr-depth N         bounces before Russian roulette (" << rr_depth << ")\n"
+                << "  --integrator NAME    " << join(integrators) << " (" << integrator << ")\n"
+                << "  --sampler NAME       " << join(samplers()) << " (" << sampler << ")\n"
+                << "  --adaptive BOOL      stop converged pixels early (" << adaptive << ")\n"
+                << "  --threshold X        error at which adaptive pixels stop (" << threshold
+                << ")\n"
+                << "  --progressive BOOL   render in passes and checkpoint (" << progressive
+                << ")\n"
+                << "  --checkpoint-seconds X  time between checkpoints (" << checkpoint_seconds
+                << ")\n"
+                << "  --node N             this machine's share of the samples (" << node << ")\n"
+                << "  --node-count N       machines sharing the render (" << node_count << ")\n"
+                << "  --threads N          worker threads, 0 for all (" << threads << ")\n"
+                << "  --tile N             tile size in pixels (" << tile_size << ")\n";
+            if (!scenes.empty())
+                std::cerr << "  --scene NAME         " << join(scenes) << " (" << scene << ")\n";
+            if (takes_model)
+                std::cerr << "  --model PATH         OBJ or PLY mesh for the mesh scenes\n";
+            if (takes_scene_file) {
+                std::cerr << "  --scene-file PATH    scene description to render instead\n"
+                          << "  --scene-cache BOOL   keep the built scene in PATH.cache ("
+                          << scene_cache << ")\n";
+            }
+            if (takes_textures) {
+                std::cerr << "  --texture-budget MB  decoded textures kept, 0 for all ("
+                          << texture_budget << ")\n";
+            }
+            if (takes_preview) {
+                std::cerr << "  --preview BOOL       keep rendering and take camera commands ("
+                          << preview << ")\n";
+            }
+            if (takes_aovs) {
+                std::cerr << "  --aovs BOOL          write albedo, normal and depth images ("
+                          << aovs << ")\n"
+                          << "  --denoise BOOL       denoise the image before writing it ("
+                          << denoise << ")\n";
+            }
+            std::cerr << "  --output PATH        .png, .ppm, .pfm or .exr to write (" << output
+                      << ")\n";
+        }
+
+    private:
+        bool set(const std::string& name, const std::string& value) {
+            if (name == "width")              return to_int(name, value, image_width, 1);
+            if (name == "height")             return to_int(name, value, image_height, 1);
+            if (name == "spp")                return to_int(name, value, samples_per_pixel, 1);
+            if (name == "depth")              return to_int(name, value, max_depth, 1);
+            if (name == "rr-depth")           return to_int(name, value, rr_depth, 0);
+            if (name == "adaptive")           return to_bool(name, value, adaptive);
+            if (name == "threshold")          return to_double(name, value, threshold);
+            if (name == "progressive")        return to_bool(name, value, progressive);
+            if (name == "checkpoint-seconds") return to_double(name, value, checkpoint_seconds);
+            if (name == "node")               return to_int(name, value, node, 0);
+            if (name == "node-count")         return to_int(name, value, node_count, 1);
+            if (name == "threads")            return to_int(name, value, threads, 0);
+            if (name == "tile")               return to_int(name, value, tile_size, 1);
+            if (name == "output")             { output = value; return true; }
+            if (name == "integrator")
+                return to_choice(name, value, integrators, integrator);
+            if (name == "sampler")
+                return to_choice(name, value, samplers(), sampler);
+            if (name == "scene" && !scenes.empty())
+                return to_choice(name, value, scenes, scene);
+            if (name == "model" && takes_model) { model = value; return true; }
+            if (name == "scene-file" && takes_scene_file) { scene_file = value; return true; }
+            if (name == "scene-cache" && takes_scene_file)
+                return to_bool(name, value, scene_cache);
+            if (name == "texture-budget" && takes_textures)
+                return to_double(name, value, texture_budget);
+            if (name == "preview" && takes_preview) return to_bool(name, value, preview);
+            if (name == "aovs" && takes_aovs) return to_bool(name, value, aovs);
+            if (name == "denoise" && takes_aovs) return to_bool(name, value, denoise);
+
+            std::cerr << "Unknown option --" << name << '\n';
+            return false;
+        }
+
+        bool read_file(const std::string& path) {
+            std::ifstream file(path);
+            if (!file) {
+                std::cerr << "Could not read config file " << path << '\n';
+                return false;
+            }
+
+            std::string line;
+            for (int number = 1; std::getline(file, line); ++number) {
+                line = trim(line.substr(0, comment_start(line)));
+                if (line.empty())
+                    continue;
+
+                const auto equals = line.find('=');
+                const auto name = trim(line.substr(0, equals));
+                if (equals == std::string::npos || name.empty()
+                    || name.find_first_of(" \t") != std::string::npos) {
+                    std::cerr << path << ':' << number << ": expected \"name = value\"\n";
+                    return false;
+                }
+                if (!set(name, trim(line.substr(equals + 1))))
+                    return false;
+            }
+
+            return true;
+        }
+
+        bool validate() const {
+            if (node >= node_count) {
+                std::cerr << "--node must be less than --node-count\n";
+                return false;
+            }
+            if (preview && node_count > 1) {
+                std::cerr << "--preview renders on one machine, not --node-count " << node_count
+                          << '\n';
+                return false;
+            }
+            return true;
+        }
+
+        // Where a config line's comment begins: a '#' first on the line or after white space,
+        // so values like "#ff8800" or "take#2.png" keep theirs.
+        static size_t comment_start(const std::string& line) {
+            for (size_t k = 0; k < line.size(); k++) {
+                if (line[k] == '#' && (k == 0 || line[k-1] == ' ' || line[k-1] == '\t'))
+                    return k;
+            }
+            return std::string::npos;
+        }
+
+        static std::string trim(const std::string& text) {
+            const auto first = text.find_first_not_of(" \t\r");
+            if (first == std::string::npos)
+                return "";
+            return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+        }
+
+        static bool to_int(const std::string& name, const std::string& value, int& out, int min) {
+            char* end;
+            long parsed = std::strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || parsed < min || parsed > 1 << 30) {
+                std::cerr << "--" << name << " needs a whole number of at least " << min
+                          << ", not " << value << '\n';
+                return false;
+            }
+            out = static_cast<int>(parsed);
+            return true;
+        }
+
+        static bool to_double(const std::string& name, const std::string& value, double& out) {
+            char* end;
+            double parsed = std::strtod(value.c_str(), &end);
+            if (value.empty() || *end != '\0' || !(parsed >= 0)) {
+                std::cerr << "--" << name << " needs a non-negative number, not " << value << '\n';
+                return false;
+            }
+            out = parsed;
+            return true;
+        }
+
+        static bool to_bool(const std::string& name, const std::string& value, bool& out) {
+            if (value == "true" || value == "on" || value == "1") {
+                out = true;
+            } else if (value == "false" || value == "off" || value == "0") {
+                out = false;
+            } else {
+                std::cerr << "--" << name << " needs true or false, not " << value << '\n';
+                return false;
+            }
+            return true;
+        }
+
+        static bool to_choice(
+            const std::string& name, const std::string& value,
+            const std::vector<std::string>& choices, std::string& out
+        ) {
+            for (const auto& choice : choices) {
+                if (choice == value) {
+                    out = value;
+                    return true;
+                }
+            }
+            std::cerr << "--" << name << " needs one of " << join(choices) << ", not " << value
+                      << '\n';
+            return false;
+        }
+
+        static std::vector<std::string> samplers() {
+            return { "sobol", "blue-noise", "independent" };
+        }
+
+        static std::string join(const std::vector<std::string>& names) {
+            std::string joined;
+            for (const auto& name : names)
+                joined += (joined.empty() ? "" : ", ") + name;
+            return joined;
+        }
+};
+
+
+#endif
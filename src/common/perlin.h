@@ -13,58 +13,59 @@
 
 #include "rtweekend.h"
 
+#include "aabb.h"
+
+#include <algorithm>
+#include <vector>
 
 
 class perlin {
+    // Gradient noise on a lattice with a period of 256. The gradients are stored as three
+    // arrays, one per component, and turb() runs each step across a batch of octaves at once:
+    // the lattice cells, the corner dots and the interpolation are plain loops over octaves
+    // that the compiler can vectorize, and only the gradient gathers stay scalar.
     public:
         perlin() {
-            ranvec = new vec3[point_count];
             for (int i = 0; i < point_count; ++i) {
-                ranvec[i] = unit_vector(vec3::random(-1,1));
+                auto g = unit_vector(vec3::random(-1,1));
+                for (int a = 0; a < 3; a++)
+                    gradient[a][i] = g[a];
             }
 
-            perm_x = perlin_generate_perm();
-            perm_y = perlin_generate_perm();
-            perm_z = perlin_generate_perm();
-        }
-
-        ~perlin() {
-            delete[] ranvec;
-            delete[] perm_x;
-            delete[] perm_y;
-            delete[] perm_z;
+            for (int a = 0; a < 3; a++)
+                perlin_generate_perm(perm[a]);
         }
 
-        double noise(const point3& p) const {
-            auto u = p.x() - floor(p.x());
-            auto v = p.y() - floor(p.y());
-            auto w = p.z() - floor(p.z());
-            auto i = static_cast<int>(floor(p.x()));
-            auto j = static_cast<int>(floor(p.y()));
-            auto k = static_cast<int>(floor(p.z()));
-            vec3 c[2][2][2];
-
-            for (int di=0; di < 2; di++)
-                for (int dj=0; dj < 2; dj++)
-                    for (int dk=0; dk < 2; dk++)
-                        c[di][dj][dk] = ranvec[
-                            perm_x[(i+di) & 255] ^
-                            perm_y[(j+dj) & 255] ^
-                            perm_z[(k+dk) & 255]
-                        ];
-
-            return perlin_interp(c, u, v, w);
+        real noise(const point3& p) const {
+            real x[3*batch];
+            for (int a = 0; a < 3; a++)
+                x[a*batch] = p[a];
+            real result;
+            noise_batch(x, 1, &result);
+            return result;
         }
 
-        double turb(const point3& p, int depth=7) const {
-            auto accum = 0.0;
-            auto temp_p = p;
-            auto weight = 1.0;
-
-            for (int i = 0; i < depth; i++) {
-                accum += weight * noise(temp_p);
-                weight *= 0.5;
-                temp_p *= 2;
+        real turb(const point3& p, int depth=7) const {
+            real accum = 0;
+            real scale = 1;
+            real weight = 1;
+
+            for (int first = 0; first < depth; first += batch) {
+                const int remaining = depth - first;
+                const int count = remaining < batch ? remaining : batch;
+                real x[3*batch];
+                for (int o = 0; o < count; o++) {
+                    for (int a = 0; a < 3; a++)
+                        x[a*batch + o] = scale * p[a];
+                    scale *= 2;
+                }
+
+                real octave[batch];
+                noise_batch(x, count, octave);
+                for (int o = 0; o < count; o++) {
+                    accum += weight * octave[o];
+                    weight *= 0.5;
+                }
             }
 
             return fabs(accum);
@@ -72,20 +73,65 @@ class perlin {
 
     private:
         static const int point_count = 256;
-        vec3* ranvec;
-        int* perm_x;
-        int* perm_y;
-        int* perm_z;
+        static const int batch = 8;  // Octaves evaluated together
+
+        real gradient[3][point_count];
+        int perm[3][point_count];
+
+        // Noise at count points, given as x[axis*batch + point], into result[point].
+        void noise_batch(const real* x, int count, real* result) const {
+            int cell[3][batch];
+            real frac[3][batch];
+            for (int a = 0; a < 3; a++) {
+                for (int o = 0; o < count; o++) {
+                    // floor, as truncation corrected for negatives, which vectorizes.
+                    auto c = static_cast<int>(x[a*batch + o]);
+                    c -= x[a*batch + o] < c;
+                    cell[a][o] = c;
+                    frac[a][o] = x[a*batch + o] - c;
+                }
+            }
+
+            // The dot of each corner's gradient with the offset from that corner, corner index
+            // 4*di + 2*dj + dk.
+            real dots[8][batch];
+            for (int o = 0; o < count; o++) {
+                const auto u = frac[0][o], v = frac[1][o], w = frac[2][o];
+                for (int di = 0; di < 2; di++) {
+                    const auto hx = perm[0][(cell[0][o] + di) & 255];
+                    for (int dj = 0; dj < 2; dj++) {
+                        const auto hxy = hx ^ perm[1][(cell[1][o] + dj) & 255];
+                        for (int dk = 0; dk < 2; dk++) {
+                            const auto h = hxy ^ perm[2][(cell[2][o] + dk) & 255];
+                            dots[4*di + 2*dj + dk][o] = gradient[0][h]*(u - di)
+                                + gradient[1][h]*(v - dj) + gradient[2][h]*(w - dk);
+                        }
+                    }
+                }
+            }
 
-        static int* perlin_generate_perm() {
-            auto p = new int[point_count];
+            // Hermite-smoothed trilinear interpolation of the corner dots.
+            for (int o = 0; o < count; o++) {
+                const auto u = frac[0][o], v = frac[1][o], w = frac[2][o];
+                const auto uu = u*u*(3-2*u);
+                const auto vv = v*v*(3-2*v);
+                const auto ww = w*w*(3-2*w);
+
+                const auto d00 = dots[0][o] + ww*(dots[1][o] - dots[0][o]);
+                const auto d01 = dots[2][o] + ww*(dots[3][o] - dots[2][o]);
+                const auto d10 = dots[4][o] + ww*(dots[5][o] - dots[4][o]);
+                const auto d11 = dots[6][o] + ww*(dots[7][o] - dots[6][o]);
+                const auto d0 = d00 + vv*(d01 - d00);
+                const auto d1 = d10 + vv*(d11 - d10);
+                result[o] = d0 + uu*(d1 - d0);
+            }
+        }
 
+        static void perlin_generate_perm(int* p) {
             for (int i = 0; i < point_count; i++)
                 p[i] = i;
 
             permute(p, point_count);
-
-            return p;
         }
 
         static void permute(int* p, int n) {
@@ -96,23 +142,80 @@ class perlin {
                 p[target] = tmp;
             }
         }
+};
+
+
+class baked_turbulence {
+    // perlin::turb sampled once on a grid over a box, for lookups that interpolate eight
+    // samples instead of evaluating every octave. Octaves finer than the grid spacing are
+    // averaged away, so the grid should resolve the finest detail the renders show.
+    public:
+        baked_turbulence() : count{0, 0, 0} {}
+
+        // Samples turb(p, depth) at resolution points along the longest side of region and
+        // proportionally fewer, at least two, along the others.
+        baked_turbulence(const perlin& noise, const aabb& region, int resolution, int depth = 7)
+          : origin(region.min())
+        {
+            const auto extent = region.max() - region.min();
+            const auto longest = std::max(extent.x(), std::max(extent.y(), extent.z()));
+            const auto spacing = longest / (resolution - 1);
+            for (int a = 0; a < 3; a++) {
+                count[a] = std::max(2, static_cast<int>(ceil(extent[a] / spacing)) + 1);
+                scale[a] = 1 / spacing;
+            }
 
-        inline static double perlin_interp(vec3 c[2][2][2], double u, double v, double w) {
-            auto uu = u*u*(3-2*u);
-            auto vv = v*v*(3-2*v);
-            auto ww = w*w*(3-2*w);
-            auto accum = 0.0;
-
-            for (int i=0; i < 2; i++)
-                for (int j=0; j < 2; j++)
-                    for (int k=0; k < 2; k++) {
-                        vec3 weight_v(u-i, v-j, w-k);
-                        accum += (i*uu + (1-i)*(1-uu))*
-                            (j*vv + (1-j)*(1-vv))*
-                            (k*ww + (1-k)*(1-ww))*dot(c[i][j][k], weight_v);
+            samples.resize(size_t(count[0]) * count[1] * count[2]);
+            #pragma omp parallel for
+            for (int k = 0; k < count[2]; k++) {
+                for (int j = 0; j < count[1]; j++) {
+                    for (int i = 0; i < count[0]; i++) {
+                        auto p = origin + spacing * vec3(i, j, k);
+                        samples[index(i, j, k)] = static_cast<float>(noise.turb(p, depth));
                     }
+                }
+            }
+        }
+
+        bool contains(const point3& p) const {
+            for (int a = 0; a < 3; a++) {
+                auto x = (p[a] - origin[a]) * scale[a];
+                if (!(x >= 0 && x <= count[a] - 1))
+                    return false;
+            }
+            return true;
+        }
+
+        // Interpolates the grid at p, which must be inside it.
+        real value(const point3& p) const {
+            int cell[3];
+            real frac[3];
+            for (int a = 0; a < 3; a++) {
+                auto x = (p[a] - origin[a]) * scale[a];
+                cell[a] = std::min(static_cast<int>(x), count[a] - 2);
+                frac[a] = x - cell[a];
+            }
+
+            const auto base = index(cell[0], cell[1], cell[2]);
+            const size_t dj = count[0], dk = size_t(count[0]) * count[1];
+            auto lerp = [](real a, real b, real t) { return a + t*(b - a); };
+            auto row = [&](size_t at) {
+                return lerp(samples[at], samples[at + 1], frac[0]);
+            };
+            return lerp(lerp(row(base), row(base + dj), frac[1]),
+                        lerp(row(base + dk), row(base + dk + dj), frac[1]), frac[2]);
+        }
+
+        size_t bytes() const { return sizeof(float) * samples.size(); }
+
+    private:
+        point3 origin;
+        vec3 scale;   // Grid steps per unit along each axis
+        int count[3];
+        std::vector<float> samples;
 
-            return accum;
+        size_t index(int i, int j, int k) const {
+            return (size_t(k) * count[1] + j) * count[0] + i;
         }
 };
 
@@ -0,0 +1,254 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+
+namespace preview_detail {
+
+inline bool read(std::istream& in, vec3& v) {
+    double x, y, z;
+    if (!(in >> x >> y >> z))
+        return false;
+    v = vec3(x, y, z);
+    return true;
+}
+
+
+inline bool read(std::istream& in, real& value) {
+    double x;
+    if (!(in >> x))
+        return false;
+    value = static_cast<real>(x);
+    return true;
+}
+
+}  // namespace preview_detail
+
+
+struct camera_view {
+    // The settings a camera is built from, changed by preview commands: lines of one or more
+    // settings, in the words of a scene file's camera line,
+    //
+    //     lookfrom 278 278 -600 vfov 30
+    //
+    // with each of lookfrom, lookat and vup followed by three numbers, and each of vfov,
+    // aperture and focus by one.
+    point3 lookfrom;
+    point3 lookat;
+    vec3 vup;
+    real vfov;
+    real aperture;
+    real focus;
+
+    camera make_camera(real aspect_ratio, real time0, real time1) const {
+        return camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, focus, time0, time1);
+    }
+
+    // Applies the settings of a command line. Returns false, changing nothing, if the line
+    // is not a list of settings.
+    bool apply(const std::string& line, std::string& error) {
+        using preview_detail::read;
+        camera_view changed = *this;
+        std::istringstream fields(line);
+        std::string key;
+        while (fields >> key) {
+            bool ok = key == "lookfrom" ? read(fields, changed.lookfrom)
+                    : key == "lookat"   ? read(fields, changed.lookat)
+                    : key == "vup"      ? read(fields, changed.vup)
+                    : key == "vfov"     ? read(fields, changed.vfov)
+                    : key == "aperture" ? read(fields, changed.aperture)
+                    : key == "focus"    ? read(fields, changed.focus)
+                    : false;
+            if (!ok) {
+                error = "expected camera settings, not \"" + line + '"';
+                return false;
+            }
+        }
+        *this = changed;
+        return true;
+    }
+
+    // The view as one command, or a scene file's camera line without its first word.
+    std::string describe() const {
+        std::ostringstream out;
+        out << "lookfrom " << lookfrom << " lookat " << lookat << " vup " << vup
+            << " vfov " << vfov << " aperture " << aperture << " focus " << focus;
+        return out.str();
+    }
+};
+
+
+class command_reader {
+    // Reads lines from a stream on a thread of its own, so a render can look for commands
+    // between tiles without ever blocking on input. The thread is detached and shares the
+    // lines it reads with the reader, since it may be waiting on a read that never returns.
+    public:
+        command_reader(std::istream& in) : queue(std::make_shared<shared_queue>()) {
+            auto q = queue;
+            std::thread([q, &in] {
+                std::string line;
+                while (std::getline(in, line)) {
+                    std::lock_guard<std::mutex> guard(q->lock);
+                    q->lines.push_back(line);
+                    q->waiting++;
+                    q->ready.notify_one();
+                }
+                std::lock_guard<std::mutex> guard(q->lock);
+                q->closed = true;
+                q->ready.notify_one();
+            }).detach();
+        }
+
+        // Whether a line is waiting; cheap enough to ask once per tile.
+        bool pending() const { return queue->waiting.load() > 0; }
+
+        // Takes the next line if one is waiting.
+        bool poll(std::string& line) {
+            std::lock_guard<std::mutex> guard(queue->lock);
+            return take(line);
+        }
+
+        // Takes the next line, waiting for one. Returns false once the stream has ended.
+        bool wait(std::string& line) {
+            std::unique_lock<std::mutex> guard(queue->lock);
+            auto& q = *queue;
+            q.ready.wait(guard, [&q] { return !q.lines.empty() || q.closed; });
+            return take(line);
+        }
+
+    private:
+        struct shared_queue {
+            std::mutex lock;
+            std::condition_variable ready;
+            std::deque<std::string> lines;
+            bool closed = false;
+            std::atomic<int> waiting{0};
+        };
+
+        std::shared_ptr<shared_queue> queue;
+
+        bool take(std::string& line) {
+            if (queue->lines.empty())
+                return false;
+            line = queue->lines.front();
+            queue->lines.pop_front();
+            queue->waiting--;
+            return true;
+        }
+};
+
+
+class preview_renderer {
+    // Renders like progressive_renderer, in passes from one sample per pixel up, and writes
+    // the image after every pass, while reading camera commands (see camera_view) from a
+    // stream. A command restarts only the image: the scene and its BVHs stay as they are,
+    // and the pass under way stops at its next tile. "quit" ends the preview, as does the
+    // end of the stream once the image has all its samples.
+    public:
+        preview_renderer(
+            const tile_renderer& tiles, int samples_per_pixel, int max_pass_samples = 16)
+          : tiles(tiles), samples_per_pixel(samples_per_pixel),
+            max_pass_samples(std::max(1, max_pass_samples))
+        {}
+
+        // set_view(view) rebuilds the camera sample(i, j, s) traces through; write(image)
+        // shows the image so far.
+        template <typename F>
+        void render(
+            framebuffer& image, camera_view view, std::istream& in,
+            std::function<void(const camera_view&)> set_view, F sample,
+            std::function<void(const framebuffer&)> write
+        ) const {
+            command_reader commands(in);
+            std::cerr << "Preview: " << view.describe() << '\n';
+
+            while (true) {
+                // Take the commands waiting, or, once the image is finished, wait for one.
+                std::string line, error;
+                const bool finished = static_cast<int>(image.min_samples()) >= samples_per_pixel;
+                bool got = finished ? commands.wait(line) : commands.poll(line);
+                if (finished && !got)
+                    return;
+
+                bool changed = false;
+                for (; got; got = commands.poll(line)) {
+                    std::string word;
+                    std::istringstream(line) >> word;
+                    if (word.empty())
+                        continue;
+                    if (word == "quit")
+                        return;
+                    if (view.apply(line, error))
+                        changed = true;
+                    else
+                        std::cerr << '\n' << error << '\n';
+                }
+                if (changed) {
+                    set_view(view);
+                    image = framebuffer(image.width(), image.height());
+                    std::cerr << "\nPreview: " << view.describe() << '\n';
+                }
+
+                const int done = static_cast<int>(image.min_samples());
+                if (done >= samples_per_pixel)
+                    continue;
+
+                // Pixels carry on from their own counts, so a pass cut short by a command
+                // that changes nothing is simply finished by the next one.
+                const int target = std::min(samples_per_pixel, done + std::min(
+                    std::max(1, done), max_pass_samples));
+                tiles.render([&](const tile& t) {
+                    if (commands.pending())
+                        return;
+                    for (int j = t.y0; j < t.y1; ++j) {
+                        for (int i = t.x0; i < t.x1; ++i) {
+                            color pixel_color;
+                            int s = static_cast<int>(image.samples(i, j));
+                            const int first = s;
+                            for (; s < target; ++s)
+                                pixel_color += sample(i, j, s);
+                            image.add(i, j, pixel_color, s - first);
+                        }
+                    }
+                });
+
+                if (!commands.pending()) {
+                    std::cerr << "\rPreview pass done: " << target << " samples per pixel\n";
+                    write(image);
+                }
+            }
+        }
+
+    private:
+        const tile_renderer& tiles;
+        int samples_per_pixel;
+        int max_pass_samples;
+};
+
+
+#endif
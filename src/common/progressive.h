@@ -0,0 +1,130 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "framebuffer.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+
+
+class progressive_renderer {
+    // Renders in whole-image passes until every pixel has samples_per_pixel samples. The
+    // sample count per pass doubles from 1 up to max_pass_samples, so a usable preview comes
+    // early and later passes stay short enough to checkpoint often.
+    //
+    // Each pixel continues its own sample sequence from however many samples it already has,
+    // so a render resumed from a checkpoint takes exactly the samples the interrupted one
+    // would have taken next.
+    public:
+        progressive_renderer(
+            const tile_renderer& tiles, int samples_per_pixel, int max_pass_samples = 64)
+          : tiles(tiles), samples_per_pixel(samples_per_pixel),
+            max_pass_samples(std::max(1, max_pass_samples))
+        {}
+
+        // After any pass that ends at least `seconds` after the last checkpoint, or `passes`
+        // passes after it, saves the image to checkpoint_path and calls write_image. Zero
+        // disables that trigger. The finished image is always saved.
+        void checkpoint_every(
+            double seconds, int passes, const std::string& checkpoint_path,
+            std::function<void(const framebuffer&)> write_image
+        ) {
+            checkpoint_seconds = seconds;
+            checkpoint_passes = passes;
+            path = checkpoint_path;
+            write = write_image;
+        }
+
+        // Picks up from the checkpoint if one of the image's size exists, then renders the
+        // remaining passes. sample(i, j, s) returns sample s of pixel (i, j).
+        template <typename F>
+        void render(framebuffer& image, F sample) const {
+            if (!path.empty()) {
+                framebuffer saved;
+                if (saved.read_checkpoint(path)
+                    && saved.width() == image.width() && saved.height() == image.height()) {
+                    image = std::move(saved);
+                    std::cerr << "Resuming from " << path << " at "
+                              << image.min_samples() << " samples per pixel\n";
+                }
+            }
+
+            auto last_checkpoint = std::chrono::steady_clock::now();
+            int passes_since_checkpoint = 0;
+            int done = static_cast<int>(image.min_samples());
+
+            if (done >= samples_per_pixel)  // Resumed from a finished checkpoint
+                save(image);
+
+            while (done < samples_per_pixel) {
+                const int target = next_target(done);
+
+                tiles.render([&](const tile& t) {
+                    for (int j = t.y0; j < t.y1; ++j) {
+                        for (int i = t.x0; i < t.x1; ++i) {
+                            color pixel_color;
+                            int s = static_cast<int>(image.samples(i, j));
+                            const int first = s;
+                            for (; s < target; ++s)
+                                pixel_color += sample(i, j, s);
+                            image.add(i, j, pixel_color, s - first);
+                        }
+                    }
+                });
+
+                done = target;
+                std::cerr << "\rPass done: " << done << " samples per pixel\n";
+
+                const auto now = std::chrono::steady_clock::now();
+                const auto elapsed = std::chrono::duration<double>(now - last_checkpoint).count();
+                ++passes_since_checkpoint;
+
+                if (done >= samples_per_pixel
+                    || (checkpoint_seconds > 0 && elapsed >= checkpoint_seconds)
+                    || (checkpoint_passes > 0 && passes_since_checkpoint >= checkpoint_passes)) {
+                    save(image);
+                    last_checkpoint = now;
+                    passes_since_checkpoint = 0;
+                }
+            }
+        }
+
+    private:
+        const tile_renderer& tiles;
+        int samples_per_pixel;
+        int max_pass_samples;
+
+        double checkpoint_seconds = 0;
+        int checkpoint_passes = 0;
+        std::string path;
+        std::function<void(const framebuffer&)> write;
+
+        int next_target(int done) const {
+            const int pass = std::max(1, std::min(done, max_pass_samples));
+            return std::min(samples_per_pixel, done + pass);
+        }
+
+        void save(const framebuffer& image) const {
+            if (!path.empty() && !image.write_checkpoint(path))
+                std::cerr << "\nCould not write checkpoint " << path << '\n';
+            if (write)
+                write(image);
+        }
+};
+
+
+#endif
@@ -19,25 +19,56 @@ class ray
     public:
         ray() {}
         ray(const point3& origin, const vec3& direction)
-            : orig(origin), dir(direction), tm(0)
-        {}
+            : orig(origin), dir(direction), tm(0), spread(0)
+        {
+            cache_inverse();
+        }
 
-        ray(const point3& origin, const vec3& direction, double time)
-            : orig(origin), dir(direction), tm(time)
-        {}
+        ray(const point3& origin, const vec3& direction, real time)
+            : orig(origin), dir(direction), tm(time), spread(0)
+        {
+            cache_inverse();
+        }
 
         point3 origin() const  { return orig; }
         vec3 direction() const { return dir; }
-        double time() const    { return tm; }
+        real time() const    { return tm; }
+
+        // 1/direction and, per axis, whether it is negative; computed once for slab tests.
+        const vec3& inv_direction() const { return inv_dir; }
+        int sign(int axis) const          { return signs[axis]; }
 
-        point3 at(double t) const {
+        point3 at(real t) const {
             return orig + t*dir;
         }
 
+        // Width of the pixel's footprint at t, for rays that stand for one; zero otherwise.
+        real footprint(real t) const {
+            return spread * t;
+        }
+
+        // The same ray starting elsewhere, keeping the cached inverse direction.
+        ray with_origin(const point3& origin) const {
+            ray moved(*this);
+            moved.orig = origin;
+            return moved;
+        }
+
     public:
         point3 orig;
         vec3 dir;
-        double tm;
+        real tm;
+        real spread;  // Footprint width per unit of t
+
+    private:
+        vec3 inv_dir;
+        int signs[3];
+
+        void cache_inverse() {
+            inv_dir = vec3(1/dir.x(), 1/dir.y(), 1/dir.z());
+            for (int a = 0; a < 3; a++)
+                signs[a] = inv_dir[a] < 0;
+        }
 };
 
 #endif
@@ -0,0 +1,145 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "tile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <omp.h>
+
+
+struct sample_range {
+    int first;  // Index of the first sample of every pixel
+    int count;
+};
+
+
+inline sample_range node_samples(int node, int node_count, int samples_per_pixel) {
+    // Splits the samples of every pixel into node_count disjoint, contiguous ranges and returns
+    // the one for node. Since each sample seeds its own random stream, the merged output of all
+    // the nodes holds exactly the samples a single machine would have taken.
+    sample_range range;
+    range.first = static_cast<int>(static_cast<int64_t>(samples_per_pixel) * node / node_count);
+    range.count = static_cast<int>(static_cast<int64_t>(samples_per_pixel) * (node+1) / node_count)
+                - range.first;
+    return range;
+}
+
+
+class tile_queue {
+    // A contiguous range of tile indices owned by one worker. The owner pops from the front,
+    // while idle workers steal from the back, so the two only meet on the very last tile.
+    public:
+        tile_queue() : front(0), back(0) {}
+
+        void assign(int first, int last) {
+            front = first;
+            back = last;
+        }
+
+        bool pop(int& index) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (front >= back)
+                return false;
+            index = front++;
+            return true;
+        }
+
+        bool steal(int& index) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (front >= back)
+                return false;
+            index = --back;
+            return true;
+        }
+
+    private:
+        std::mutex lock;
+        int front, back;
+        char padding[64];  // Keep neighboring queues off each other's cache lines
+};
+
+
+class tile_renderer {
+    public:
+        tile_renderer(int width, int height, int tile_size = 16)
+          : image_width(width), image_height(height), tile_size(tile_size)
+        {
+            tiles_x = (image_width + tile_size - 1) / tile_size;
+            tiles_y = (image_height + tile_size - 1) / tile_size;
+        }
+
+        int tile_count() const { return tiles_x * tiles_y; }
+
+        tile get_tile(int index) const {
+            tile t;
+            t.x0 = (index % tiles_x) * tile_size;
+            t.y0 = (index / tiles_x) * tile_size;
+            t.x1 = std::min(t.x0 + tile_size, image_width);
+            t.y1 = std::min(t.y0 + tile_size, image_height);
+            return t;
+        }
+
+        // Calls render_tile(const tile&) once for every tile of the image. Each worker thread
+        // starts on its own contiguous band of tiles and steals from the others once its band
+        // runs dry, so a frame finishes when the last tile does instead of at a barrier per row.
+        template <typename F>
+        void render(F render_tile) const {
+            const int workers = std::max(1, omp_get_max_threads());
+            const int count = tile_count();
+
+            std::vector<tile_queue> queues(workers);
+            for (int w = 0; w < workers; w++)
+                queues[w].assign(count * w / workers, count * (w+1) / workers);
+
+            std::atomic<int> remaining(count);
+
+            #pragma omp parallel num_threads(workers)
+            {
+                const int self = omp_get_thread_num();
+                int index;
+
+                while (next_tile(queues, self, index)) {
+                    render_tile(get_tile(index));
+
+                    int left = --remaining;
+                    #pragma omp critical (tile_progress)
+                    std::cerr << "\rTiles remaining: " << left << ' ' << std::flush;
+                }
+            }
+        }
+
+    private:
+        int image_width, image_height;
+        int tile_size;
+        int tiles_x, tiles_y;
+
+        static bool next_tile(std::vector<tile_queue>& queues, int self, int& index) {
+            if (queues[self].pop(index))
+                return true;
+
+            const int workers = static_cast<int>(queues.size());
+            for (int offset = 1; offset < workers; offset++) {
+                if (queues[(self + offset) % workers].steal(index))
+                    return true;
+            }
+
+            return false;
+        }
+};
+
+
+#endif
@@ -10,6 +10,7 @@
 //==============================================================================================
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
@@ -21,28 +22,92 @@ using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
+// Scalar Type
+
+// Configure with -DRTW_USE_FLOAT=ON to trace in single precision, which halves the size of
+// vectors, rays and hit records.
+#ifdef RTW_USE_FLOAT
+typedef float real;
+#else
+typedef double real;
+#endif
+
 // Constants
 
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = static_cast<real>(3.1415926535897932385);
 
 // Utility Functions
 
-inline double degrees_to_radians(double degrees) {
-    return degrees * pi / 180.0;
+inline real degrees_to_radians(real degrees) {
+    return degrees * pi / 180;
 }
 
-inline double clamp(double x, double min, double max) {
+inline real clamp(real x, real min, real max) {
     if (x < min) return min;
     if (x > max) return max;
     return x;
 }
 
-inline double random_double() {
-    return rand() / (RAND_MAX + 1.0);
+// Random Number Generation
+
+class pcg32 {
+    // PCG-XSH-RR generator (see https://www.pcg-random.org). Each render thread owns its own
+    // instance, so drawing random numbers never touches shared state.
+    public:
+        pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+        pcg32(uint64_t initstate, uint64_t initseq) { seed(initstate, initseq); }
+
+        void seed(uint64_t initstate, uint64_t initseq) {
+            state = 0u;
+            inc = (initseq << 1u) | 1u;
+            next();
+            state += initstate;
+            next();
+        }
+
+        uint32_t next() {
+            uint64_t oldstate = state;
+            state = oldstate * 6364136223846793005ULL + inc;
+            auto xorshifted = static_cast<uint32_t>(((oldstate >> 18u) ^ oldstate) >> 27u);
+            auto rot = static_cast<uint32_t>(oldstate >> 59u);
+            return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+        }
+
+    private:
+        uint64_t state;
+        uint64_t inc;
+};
+
+inline uint64_t mix64(uint64_t x) {
+    // SplitMix64 finalizer; turns structured indices into well-spread seeds.
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline pcg32& thread_rng() {
+    thread_local pcg32 generator;
+    return generator;
+}
+
+inline void seed_random(uint64_t pixel, uint64_t sample) {
+    // Restart this thread's generator on a sequence determined only by the pixel and sample
+    // index, so a render comes out bit-identical no matter how work is spread over threads.
+    thread_rng().seed(mix64(sample ^ mix64(pixel)), pixel);
+}
+
+inline real random_double() {
+    // Returns a random real in [0,1).
+#ifdef RTW_USE_FLOAT
+    return (thread_rng().next() >> 8) * (1.0f / 16777216.0f);  // 4294967295/2^32 rounds to 1
+#else
+    return thread_rng().next() / 4294967296.0;
+#endif
 }
 
-inline double random_double(double min, double max) {
+inline real random_double(real min, real max) {
     // Returns a random real in [min,max).
     return min + (max-min)*random_double();
 }
@@ -55,6 +120,8 @@ inline int random_int(int min, int max) {
 // Common Headers
 
 #include "ray.h"
+#include "sampler.h"
+#include "stats.h"
 #include "vec3.h"
 
 
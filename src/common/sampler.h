@@ -0,0 +1,403 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "vec3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+enum class sample_sequence {
+    independent,  // random_double() for every value
+    sobol,        // Owen-scrambled Sobol points, scrambled differently in every pixel
+    blue_noise,   // The same Sobol points everywhere, shifted by a blue-noise mask per pixel
+    stratified    // Jittered strata of a known number of samples, shuffled for each dimension
+};
+
+
+namespace sampler_detail {
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    // Laine and Karras's hash flips each bit depending only on the bits below it; run on the
+    // reversed bits, every digit depends only on the digits above it, which makes it a nested
+    // uniform (Owen) scramble (Burley, "Practical Hash-based Owen Scrambling").
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+
+// The first two dimensions of the Sobol sequence, as 32-bit fractions. Any power-of-two run
+// of points starting at a multiple of its length stratifies the unit square.
+inline uint32_t sobol_0(uint32_t index) {
+    return reverse_bits(index);
+}
+
+
+inline uint32_t sobol_1(uint32_t index) {
+    uint32_t x = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1)
+            x ^= v;
+    }
+    return x;
+}
+
+
+// Kensler's hashed permutation of [0, length), one for every seed ("Correlated Multi-Jittered
+// Sampling"): the hash is a bijection on the bits of length - 1, walked until it lands inside.
+inline uint32_t permute(uint32_t i, uint32_t length, uint32_t seed) {
+    uint32_t w = length - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;             i *= 0xe170893du;
+        i ^= seed >> 16;       i ^= (i & w) >> 4;
+        i ^= seed >> 8;        i *= 0x0929eb3fu;
+        i ^= seed >> 23;       i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;   i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;    i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;     i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;     i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= length);
+    return static_cast<uint32_t>((static_cast<uint64_t>(i) + seed) % length);
+}
+
+
+inline real to_unit(uint32_t x) {
+#ifdef RTW_USE_FLOAT
+    return (x >> 8) * (1.0f / 16777216.0f);
+#else
+    return x / 4294967296.0;
+#endif
+}
+
+
+// The point at a fraction of the way across one of a number of strata of [0,1), kept below 1
+// where a float can't tell the last strata apart.
+inline real in_stratum(uint32_t stratum, real fraction, uint32_t strata) {
+    const auto u = static_cast<real>((stratum + static_cast<double>(fraction)) / strata);
+    return std::min(u, std::nextafter(real(1), real(0)));
+}
+
+
+class blue_noise_mask {
+    // A 64x64 tile whose pixels rank 0 to 4095, so that the pixels below any rank make a
+    // blue-noise dither pattern when the tile repeats. It is made once, in a few milliseconds,
+    // with Ulichney's void-and-cluster method: a Gaussian energy marks where points crowd, and
+    // points are ranked by repeatedly taking the tightest cluster or filling the largest void.
+    public:
+        static const int size = 64;
+
+        blue_noise_mask();
+
+        // The pixel's rank as a 32-bit fraction, at the middle of its 1/4096 of the range.
+        uint32_t value(int x, int y) const {
+            return values[(y & (size - 1)) * size + (x & (size - 1))];
+        }
+
+    private:
+        std::vector<uint32_t> values;
+};
+
+
+blue_noise_mask::blue_noise_mask() : values(size * size) {
+    const int n = size * size;
+    const double sigma = 1.5;
+
+    std::vector<double> kernel(n);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            const int dx = std::min(x, size - x), dy = std::min(y, size - y);
+            kernel[y*size + x] = std::exp(-(dx*dx + dy*dy) / (2 * sigma * sigma));
+        }
+    }
+
+    std::vector<double> energy(n, 0);
+    std::vector<char> on(n, 0);
+
+    auto set = [&](int p, bool value) {
+        on[p] = value;
+        const double sign = value ? 1 : -1;
+        const int px = p % size, py = p / size;
+        for (int y = 0; y < size; y++) {
+            const auto* row = &kernel[((y - py) & (size - 1)) * size];
+            for (int x = 0; x < size; x++)
+                energy[y*size + x] += sign * row[(x - px) & (size - 1)];
+        }
+    };
+
+    auto tightest_cluster = [&]() {
+        int best = -1;
+        for (int p = 0; p < n; p++) {
+            if (on[p] && (best < 0 || energy[p] > energy[best]))
+                best = p;
+        }
+        return best;
+    };
+
+    auto largest_void = [&]() {
+        int best = -1;
+        for (int p = 0; p < n; p++) {
+            if (!on[p] && (best < 0 || energy[p] < energy[best]))
+                best = p;
+        }
+        return best;
+    };
+
+    // A tenth of the pixels at random, evened out by moving the tightest cluster's point to
+    // the largest void until the two are the same pixel.
+    pcg32 rng(0x626c7565ULL, 0x6e6f697365ULL);
+    int ones = 0;
+    while (ones < n / 10) {
+        const int p = static_cast<int>(rng.next() % n);
+        if (!on[p]) {
+            set(p, true);
+            ones++;
+        }
+    }
+
+    for (int moves = 0; moves < n; moves++) {
+        const int cluster = tightest_cluster();
+        set(cluster, false);
+        const int gap = largest_void();
+        set(gap, true);
+        if (gap == cluster)
+            break;
+    }
+
+    // Rank that pattern's points down from its size, then fill the rest of the tile up.
+    const auto pattern = on;
+    const auto pattern_energy = energy;
+    std::vector<int> rank(n);
+    for (int r = ones; r-- > 0;) {
+        const int cluster = tightest_cluster();
+        set(cluster, false);
+        rank[cluster] = r;
+    }
+
+    on = pattern;
+    energy = pattern_energy;
+    for (int r = ones; r < n; r++) {
+        const int gap = largest_void();
+        set(gap, true);
+        rank[gap] = r;
+    }
+
+    const int shift = 32 - 12;  // n is 2^12
+    for (int p = 0; p < n; p++)
+        values[p] = (static_cast<uint32_t>(rank[p]) << shift) | (1u << (shift - 1));
+}
+
+
+inline const blue_noise_mask& blue_noise() {
+    static const blue_noise_mask mask;
+    return mask;
+}
+
+}  // namespace sampler_detail
+
+
+class sample_stream {
+    // The values one sample of a pixel draws, taken dimension by dimension. The camera draws
+    // the first few, and each bounce starts its own run of dimensions, so that the values a
+    // bounce uses line up across the samples of a pixel even when paths draw different
+    // numbers of values. Every dimension, or pair of dimensions, is a separately shuffled and
+    // scrambled copy of the first Sobol dimensions (Burley's padding), so any number of them
+    // stays well distributed without a table of direction numbers.
+    //
+    // Stratified streams need the number of samples, count: every dimension then splits
+    // [0,1) into count strata, and every pair of dimensions the square into the largest
+    // square grid of at most count cells, each sample taking its own stratum and a random
+    // point in it. Samples past the grid's cells draw independent values.
+    public:
+        void start(
+            sample_sequence kind, int x, int y, uint64_t pixel, uint32_t sample,
+            uint32_t count = 0
+        ) {
+            sequence = kind == sample_sequence::stratified && count == 0
+                ? sample_sequence::independent : kind;
+            this->x = x;
+            this->y = y;
+            pixel_seed = kind == sample_sequence::sobol || kind == sample_sequence::stratified
+                ? mix64(pixel) : 0;
+            index = sample;
+            bounce = 0;
+            dimension = 0;
+            strata = count;
+            grid_side = static_cast<uint32_t>(std::sqrt(static_cast<double>(count)));
+        }
+
+        void start_bounce(int depth) {
+            bounce = static_cast<uint32_t>(depth) + 1;
+            dimension = 0;
+        }
+
+        real get_1d() {
+            using namespace sampler_detail;
+            if (sequence == sample_sequence::independent)
+                return random_double();
+
+            const auto seed = next_seed();
+            if (sequence == sample_sequence::stratified) {
+                const auto stratum = permute(index, strata, static_cast<uint32_t>(seed));
+                return in_stratum(stratum, jitter(seed, 0), strata);
+            }
+
+            const auto shuffled = owen_scramble(index, static_cast<uint32_t>(seed));
+            const auto u = owen_scramble(sobol_0(shuffled), static_cast<uint32_t>(seed >> 32));
+            return to_unit(u + shift(seed, 0));
+        }
+
+        void get_2d(real& u, real& v) {
+            using namespace sampler_detail;
+            if (sequence == sample_sequence::independent) {
+                u = random_double();
+                v = random_double();
+                return;
+            }
+
+            const auto seed = next_seed();
+            if (sequence == sample_sequence::stratified) {
+                const auto cells = grid_side * grid_side;
+                const auto stratum = permute(index, strata, static_cast<uint32_t>(seed));
+                if (stratum >= cells) {
+                    u = jitter(seed, 0);
+                    v = jitter(seed, 1);
+                    return;
+                }
+                u = in_stratum(stratum % grid_side, jitter(seed, 0), grid_side);
+                v = in_stratum(stratum / grid_side, jitter(seed, 1), grid_side);
+                return;
+            }
+
+            const auto scramble = mix64(seed);
+            const auto shuffled = owen_scramble(index, static_cast<uint32_t>(seed));
+            const auto a = owen_scramble(sobol_0(shuffled), static_cast<uint32_t>(seed >> 32));
+            const auto b = owen_scramble(sobol_1(shuffled), static_cast<uint32_t>(scramble));
+            u = to_unit(a + shift(seed, 0));
+            v = to_unit(b + shift(seed, 1));
+        }
+
+    private:
+        sample_sequence sequence = sample_sequence::independent;
+        int x = 0, y = 0;
+        uint64_t pixel_seed = 0;  // 0 for blue noise, which scrambles every pixel alike
+        uint32_t index = 0;       // The sample's number within its pixel
+        uint32_t bounce = 0;      // 0 for the camera
+        uint32_t dimension = 0;   // Values drawn so far in this bounce
+        uint32_t strata = 0;      // Samples sharing a stratified stream
+        uint32_t grid_side = 0;   // Strata along each side of a stratified square
+
+        uint64_t next_seed() {
+            const auto id = (static_cast<uint64_t>(bounce) << 32) | dimension++;
+            return mix64(pixel_seed ^ mix64(id));
+        }
+
+        // A uniform value of its own for every sample, dimension and axis.
+        real jitter(uint64_t seed, int axis) const {
+            const auto hash = mix64(seed ^ (static_cast<uint64_t>(index) << 1 | axis));
+            return sampler_detail::to_unit(static_cast<uint32_t>(hash >> 32));
+        }
+
+        // A Cranley-Patterson rotation by the blue-noise mask, read at an offset that differs
+        // for every dimension, so neighboring pixels' errors are spread apart.
+        uint32_t shift(uint64_t seed, int axis) const {
+            if (sequence != sample_sequence::blue_noise)
+                return 0;
+            const auto offset = mix64(seed) >> (32 + 12*axis);
+            const auto dx = static_cast<int>(offset & 63), dy = static_cast<int>(offset >> 6 & 63);
+            return sampler_detail::blue_noise().value(x + dx, y + dy);
+        }
+};
+
+
+// The sequence start_sample() gives every sample, set once before rendering.
+inline sample_sequence& active_sample_sequence() {
+    static sample_sequence sequence = sample_sequence::independent;
+    return sequence;
+}
+
+
+inline sample_stream& thread_samples() {
+    thread_local sample_stream stream;
+    return stream;
+}
+
+
+inline void start_sample(int i, int j, int image_width, int s) {
+    // Seeds this thread's random numbers for sample s of pixel (i, j), as seed_random() does,
+    // and starts its sample stream at the first dimension.
+    const auto pixel = static_cast<uint64_t>(j) * image_width + i;
+    seed_random(pixel, s);
+    thread_samples().start(active_sample_sequence(), i, j, pixel, static_cast<uint32_t>(s));
+}
+
+
+inline void start_bounce(int depth) {
+    thread_samples().start_bounce(depth);
+}
+
+
+inline real sample_1d() {
+    return thread_samples().get_1d();
+}
+
+
+inline void sample_2d(real& u, real& v) {
+    thread_samples().get_2d(u, v);
+}
+
+
+inline vec3 sample_unit_disk() {
+    real u, v;
+    sample_2d(u, v);
+    return square_to_unit_disk(u, v);
+}
+
+
+inline vec3 sample_unit_vector() {
+    real u, v;
+    sample_2d(u, v);
+    return square_to_unit_vector(u, v);
+}
+
+
+inline vec3 sample_in_unit_sphere() {
+    real u, v;
+    sample_2d(u, v);
+    return cube_to_unit_ball(u, v, sample_1d());
+}
+
+
+#endif
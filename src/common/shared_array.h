@@ -0,0 +1,58 @@
+#ifndef SHARED_ARRAY_H
+#define SHARED_ARRAY_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include <vector>
+
+
+template <typename T>
+class shared_array {
+    // A read-only array that keeps its storage alive without owning it alone: either a vector
+    // handed over at construction, or memory that something else holds, such as a mapped file.
+    // Copies and slices share the same elements, so a mesh or BVH can use a run of a larger
+    // array in place. Element access is a plain pointer lookup.
+    public:
+        shared_array() : first(nullptr), count(0) {}
+
+        shared_array(std::vector<T> values) {
+            auto vector = make_shared<std::vector<T>>(std::move(values));
+            first = vector->data();
+            count = vector->size();
+            owner = vector;
+        }
+
+        shared_array(const T* data, size_t size, shared_ptr<const void> owner)
+          : first(data), count(size), owner(owner) {}
+
+        // Elements offset through offset + size - 1, sharing this array's storage.
+        shared_array slice(size_t offset, size_t size) const {
+            return shared_array(first + offset, size, owner);
+        }
+
+        const T& operator[](size_t i) const { return first[i]; }
+
+        const T* data() const  { return first; }
+        size_t size() const    { return count; }
+        bool empty() const     { return count == 0; }
+        const T* begin() const { return first; }
+        const T* end() const   { return first + count; }
+
+        std::vector<T> to_vector() const { return std::vector<T>(begin(), end()); }
+
+    private:
+        const T* first;
+        size_t count;
+        shared_ptr<const void> owner;
+};
+
+
+#endif
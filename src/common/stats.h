@@ -0,0 +1,191 @@
+#ifndef STATS_H
+#define STATS_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Render statistics, compiled in by configuring with -DRTW_STATS=ON. The hot paths count events
+// with RTW_STAT and RTW_STAT_ADD into a block of counters owned by the calling thread, so
+// counting takes no locks and shares no cache lines; the blocks are only summed for the report.
+// Without RTW_STATS every macro here expands to nothing and none of this code is built.
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+
+enum stat_counter {
+    stat_camera_rays,      // Rays generated by the camera
+    stat_path_rays,        // Path segments traced, camera rays included
+    stat_shadow_rays,      // Visibility rays toward sampled lights
+    stat_bvh_nodes,        // BVH nodes visited, once per ray tested against a node
+    stat_primitive_tests,  // Ray-primitive intersection tests
+    stat_medium_lookups,   // Densities looked up while tracking through media
+    stat_counter_count
+};
+
+enum stat_phase {
+    stat_scene_build,      // Includes the BVH builds done while building the scene
+    stat_bvh_build,
+    stat_render,
+    stat_encode,
+    stat_phase_count
+};
+
+
+#ifdef RTW_STATS
+
+#define RTW_STAT(counter)           (++stat_counters()[counter])
+#define RTW_STAT_ADD(counter, n)    (stat_counters()[counter] += (n))
+#define RTW_STAT_TIMER(name, phase) stat_timer name(phase)
+#define RTW_STAT_STOP(name)         name.stop()
+#define RTW_STAT_REPORT(out)        stat_report(out)
+
+
+class stat_registry {
+    // Owns every thread's counter block. Blocks are never freed, since OpenMP keeps its threads
+    // for the life of the program and the report may come after a thread is done counting.
+    public:
+        struct block {
+            int64_t count[stat_counter_count] = {};
+            char padding[64];  // Keeps the next block off this one's cache line
+        };
+
+        static stat_registry& get() {
+            static stat_registry registry;
+            return registry;
+        }
+
+        block* add_block() {
+            std::lock_guard<std::mutex> guard(lock);
+            blocks.push_back(new block);
+            return blocks.back();
+        }
+
+        void add_time(stat_phase phase, double seconds) {
+            std::lock_guard<std::mutex> guard(lock);
+            phase_seconds[phase] += seconds;
+        }
+
+        int64_t total(stat_counter counter) {
+            std::lock_guard<std::mutex> guard(lock);
+            int64_t sum = 0;
+            for (auto b : blocks)
+                sum += b->count[counter];
+            return sum;
+        }
+
+        double seconds(stat_phase phase) {
+            std::lock_guard<std::mutex> guard(lock);
+            return phase_seconds[phase];
+        }
+
+    private:
+        std::mutex lock;
+        std::vector<block*> blocks;
+        double phase_seconds[stat_phase_count] = {};
+};
+
+
+inline int64_t* stat_counters() {
+    thread_local stat_registry::block* local = nullptr;
+    if (!local)
+        local = stat_registry::get().add_block();
+    return local->count;
+}
+
+
+inline int stat_popcount(uint32_t mask) {
+    // Rays of a packet mask, for counting the node visits of packet traversals.
+    int count = 0;
+    for (; mask; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+
+class stat_timer {
+    // Adds the wall time from construction to stop() or destruction to a phase. Timers of a
+    // phase nested in one of the same phase on this thread, like those of recursive BVH
+    // builds, add nothing, so no time is counted twice.
+    public:
+        stat_timer(stat_phase phase)
+          : phase(phase), outermost(depth()[phase]++ == 0),
+            start(std::chrono::steady_clock::now()) {}
+
+        ~stat_timer() { stop(); }
+
+        void stop() {
+            if (stopped)
+                return;
+            stopped = true;
+            depth()[phase]--;
+            if (outermost) {
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                stat_registry::get().add_time(phase, elapsed.count());
+            }
+        }
+
+    private:
+        stat_phase phase;
+        bool outermost;
+        bool stopped = false;
+        std::chrono::steady_clock::time_point start;
+
+        static int* depth() {
+            thread_local int nesting[stat_phase_count] = {};
+            return nesting;
+        }
+};
+
+
+void stat_report(std::ostream& out) {
+    auto& stats = stat_registry::get();
+
+    const auto camera_rays = stats.total(stat_camera_rays);
+    const auto path_rays = stats.total(stat_path_rays);
+    const auto shadow_rays = stats.total(stat_shadow_rays);
+    const auto rays = path_rays + shadow_rays;
+    const auto render_seconds = stats.seconds(stat_render);
+
+    auto per = [](double n, double d) { return d > 0 ? n / d : 0.0; };
+
+    out << std::fixed << std::setprecision(3)
+        << "\nRender statistics\n"
+        << "  Scene build          " << stats.seconds(stat_scene_build) << " s\n"
+        << "    of which BVH build " << stats.seconds(stat_bvh_build) << " s\n"
+        << "  Render               " << render_seconds << " s\n"
+        << "  Encode               " << stats.seconds(stat_encode) << " s\n"
+        << "  Camera rays          " << camera_rays << '\n'
+        << "  Bounce rays          " << path_rays - camera_rays << '\n'
+        << "  Shadow rays          " << shadow_rays << '\n'
+        << "  Total rays           " << rays << '\n'
+        << "  Mrays/s              " << per(rays * 1e-6, render_seconds) << '\n'
+        << "  BVH nodes per ray    " << per(stats.total(stat_bvh_nodes), rays) << '\n'
+        << "  Primitive tests/ray  " << per(stats.total(stat_primitive_tests), rays) << '\n'
+        << "  Medium lookups/ray   " << per(stats.total(stat_medium_lookups), rays) << '\n'
+        << "  Average path length  " << per(path_rays, camera_rays) << '\n';
+    out.unsetf(std::ios::floatfield);
+    out << std::setprecision(6);
+}
+
+#else
+
+#define RTW_STAT(counter)           ((void)0)
+#define RTW_STAT_ADD(counter, n)    ((void)0)
+#define RTW_STAT_TIMER(name, phase) ((void)0)
+#define RTW_STAT_STOP(name)         ((void)0)
+#define RTW_STAT_REPORT(out)        ((void)0)
+
+#endif
+
+
+#endif
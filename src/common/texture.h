@@ -16,24 +16,45 @@
 #include "perlin.h"
 #include "rtw_stb_image.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <vector>
 
 
 class texture  {
     public:
-        virtual color value(double u, double v, const vec3& p) const = 0;
+        virtual color value(real u, real v, const vec3& p) const = 0;
+
+        // The texture averaged over a footprint this wide in u and v around (u,v). Textures
+        // that can't prefilter take a point sample.
+        virtual color value(real u, real v, const vec3& p, real footprint) const {
+            return value(u, v, p);
+        }
+
+        // The same as value(), but a solid color, the commonest texture, costs no virtual call.
+        color lookup(real u, real v, const vec3& p, real footprint) const {
+            return solid ? solid_value : value(u, v, p, footprint);
+        }
+
+    protected:
+        bool solid = false;
+        color solid_value;
 };
 
 
 class solid_color : public texture {
     public:
-        solid_color() {}
-        solid_color(color c) : color_value(c) {}
+        solid_color() { solid = true; }
+        solid_color(color c) : color_value(c) {
+            solid = true;
+            solid_value = c;
+        }
 
-        solid_color(double red, double green, double blue)
+        solid_color(real red, real green, real blue)
           : solid_color(color(red,green,blue)) {}
 
-        virtual color value(double u, double v, const vec3& p) const {
+        virtual color value(real u, real v, const vec3& p) const {
             return color_value;
         }
 
@@ -47,12 +68,16 @@ class checker_texture : public texture {
         checker_texture() {}
         checker_texture(shared_ptr<texture> t0, shared_ptr<texture> t1): even(t0), odd(t1) {}
 
-        virtual color value(double u, double v, const vec3& p) const {
+        virtual color value(real u, real v, const vec3& p) const {
+            return value(u, v, p, 0);
+        }
+
+        virtual color value(real u, real v, const vec3& p, real footprint) const {
             auto sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
             if (sines < 0)
-                return odd->value(u, v, p);
+                return odd->lookup(u, v, p, footprint);
             else
-                return even->value(u, v, p);
+                return even->lookup(u, v, p, footprint);
         }
 
     public:
@@ -64,71 +89,229 @@ class checker_texture : public texture {
 class noise_texture : public texture {
     public:
         noise_texture() {}
-        noise_texture(double sc) : scale(sc) {}
+        noise_texture(real sc) : scale(sc) {}
 
-        virtual color value(double u, double v, const vec3& p) const {
+        virtual color value(real u, real v, const vec3& p) const {
             // return color(1,1,1)*0.5*(1 + noise.turb(scale * p));
             // return color(1,1,1)*noise.turb(scale * p);
-            return color(1,1,1)*0.5*(1 + sin(scale*p.z() + 10*noise.turb(p)));
+            auto turbulence = baked.contains(p) ? baked.value(p) : noise.turb(p);
+            return color(1,1,1)*0.5*(1 + sin(scale*p.z() + 10*turbulence));
+        }
+
+        // Samples the turbulence over region once, at resolution points along its longest
+        // side, so that lookups inside it interpolate instead of summing octaves.
+        void bake(const aabb& region, int resolution) {
+            baked = baked_turbulence(noise, region, resolution);
         }
 
     public:
         perlin noise;
-        double scale;
+        real scale;
+        baked_turbulence baked;
 };
 
 
-class image_texture : public texture {
+class mip_image {
+    // An image and its mip chain, each level half the size of the one before and box filtered
+    // from it, down to a single texel. Texels are converted to RGBA8 once and stored in 8x8
+    // tiles, so the four texels of a bilinear lookup (and most neighbouring lookups) share a
+    // tile instead of spanning scanlines. Lookups filter bilinearly within a level and, given
+    // a footprint, blend the two levels whose texels are nearest its size.
     public:
         const static int bytes_per_pixel = 3;
 
-        image_texture()
-          : data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
+        mip_image(const unsigned char* data, int width, int height) : texel_scale(0) {
+            build_levels(data, width, height);
+        }
 
-        image_texture(const char* filename) {
+        // Decodes an image file, or prints why not and returns null.
+        static shared_ptr<mip_image> load(const char* filename) {
             auto components_per_pixel = bytes_per_pixel;
+            int width, height;
 
-            data = stbi_load(
+            auto data = stbi_load(
                 filename, &width, &height, &components_per_pixel, components_per_pixel);
 
             if (!data) {
                 std::cerr << "ERROR: Could not load texture image file '" << filename << "'.\n";
-                width = height = 0;
+                return nullptr;
             }
 
-            bytes_per_scanline = bytes_per_pixel * width;
-        }
-
-        ~image_texture() {
-            delete data;
+            auto image = make_shared<mip_image>(data, width, height);
+            stbi_image_free(data);
+            return image;
         }
 
-        virtual color value(double u, double v, const vec3& p) const {
-            // If we have no texture data, then return solid cyan as a debugging aid.
-            if (data == nullptr)
-                return color(0,1,1);
-
+        // The image around (u,v), averaged over a footprint this wide in u and v.
+        color lookup(real u, real v, real footprint) const {
             // Clamp input texture coordinates to [0,1] x [1,0]
             u = clamp(u, 0.0, 1.0);
             v = 1.0 - clamp(v, 0.0, 1.0);  // Flip V to image coordinates
 
-            auto i = static_cast<int>(u * width);
-            auto j = static_cast<int>(v * height);
+            // The level whose texels are as wide as the footprint, fractionally.
+            const auto texels = footprint * texel_scale;
+            if (texels <= 1)
+                return bilinear(levels[0], u, v);
+
+            const auto lod = std::log2(texels);
+            const auto last = static_cast<int>(levels.size()) - 1;
+            const auto level = static_cast<int>(lod);
+            if (level >= last)
+                return bilinear(levels[last], u, v);
+
+            const auto blend = lod - level;
+            return (1-blend)*bilinear(levels[level], u, v)
+                 + blend*bilinear(levels[level+1], u, v);
+        }
+
+        int width() const  { return levels[0].width; }
+        int height() const { return levels[0].height; }
+
+        // Memory held by all the levels.
+        size_t bytes() const {
+            size_t total = 0;
+            for (const auto& level : levels)
+                total += sizeof(uint32_t) * level.texels.size();
+            return total;
+        }
+
+    private:
+        static const int tile_bits = 3;
+        static const int tile_size = 1 << tile_bits;
+        static const int tile_mask = tile_size - 1;
+
+        struct mip_level {
+            int width, height;
+            int tiles_across;
+            std::vector<uint32_t> texels;  // RGBA8, tile by tile, each tile in scanline order
+
+            mip_level(int w, int h)
+              : width(w), height(h), tiles_across((w + tile_mask) >> tile_bits),
+                texels(size_t(tiles_across) * ((h + tile_mask) >> tile_bits) * tile_size
+                       * tile_size) {}
+
+            uint32_t& at(int i, int j) {
+                return texels[index(i, j)];
+            }
+
+            uint32_t at(int i, int j) const {
+                return texels[index(i, j)];
+            }
+
+            size_t index(int i, int j) const {
+                auto tile = size_t(j >> tile_bits) * tiles_across + (i >> tile_bits);
+                return (tile << (2*tile_bits)) + ((j & tile_mask) << tile_bits) + (i & tile_mask);
+            }
+        };
+
+        std::vector<mip_level> levels;
+        real texel_scale;  // Texels per unit of u or v, on average, at level 0
+
+        static uint32_t pack(int r, int g, int b) {
+            return uint32_t(r) | uint32_t(g) << 8 | uint32_t(b) << 16 | 0xff000000u;
+        }
+
+        static int channel(uint32_t texel, int c) {
+            return (texel >> (8*c)) & 0xff;
+        }
 
-            // Clamp integer mapping, since actual coordinates should be less than 1.0
-            if (i >= width)  i = width-1;
-            if (j >= height) j = height-1;
+        void build_levels(const unsigned char* data, int width, int height) {
+            levels.emplace_back(width, height);
+            for (int j = 0; j < height; j++) {
+                for (int i = 0; i < width; i++) {
+                    auto pixel = data + (size_t(j)*width + i) * bytes_per_pixel;
+                    levels[0].at(i, j) = pack(pixel[0], pixel[1], pixel[2]);
+                }
+            }
 
-            const auto color_scale = 1.0 / 255.0;
-            auto pixel = data + j*bytes_per_scanline + i*bytes_per_pixel;
+            // Each texel of the next level averages the 2x2 block above it; an odd last row
+            // or column is repeated.
+            while (width > 1 || height > 1) {
+                const int next_width = width > 1 ? width / 2 : 1;
+                const int next_height = height > 1 ? height / 2 : 1;
+                mip_level next(next_width, next_height);
+                const auto& above = levels.back();
+
+                for (int j = 0; j < next_height; j++) {
+                    const int j0 = 2*j, j1 = std::min(2*j + 1, height - 1);
+                    for (int i = 0; i < next_width; i++) {
+                        const int i0 = 2*i, i1 = std::min(2*i + 1, width - 1);
+                        uint32_t block[4] = {
+                            above.at(i0, j0), above.at(i1, j0), above.at(i0, j1), above.at(i1, j1)
+                        };
+                        int sum[3] = {2, 2, 2};
+                        for (auto texel : block) {
+                            for (int c = 0; c < 3; c++)
+                                sum[c] += channel(texel, c);
+                        }
+                        next.at(i, j) = pack(sum[0] / 4, sum[1] / 4, sum[2] / 4);
+                    }
+                }
+
+                levels.push_back(std::move(next));
+                width = next_width;
+                height = next_height;
+            }
 
-            return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
+            texel_scale = sqrt(real(levels[0].width) * levels[0].height);
         }
 
+        // Interpolates the four texels around (u,v), on texel centers, with the edges clamped.
+        static color bilinear(const mip_level& level, real u, real v) {
+            const auto x = u * level.width - 0.5;
+            const auto y = v * level.height - 0.5;
+            // Both are at least -0.5, so truncating after the shift by one floors them.
+            const auto i = static_cast<int>(x + 1) - 1;
+            const auto j = static_cast<int>(y + 1) - 1;
+            const auto fx = x - i;
+            const auto fy = y - j;
+
+            const int i0 = std::max(i, 0), i1 = std::min(i + 1, level.width - 1);
+            const int j0 = std::max(j, 0), j1 = std::min(j + 1, level.height - 1);
+            const auto t00 = level.at(i0, j0);
+            const auto t10 = level.at(i1, j0);
+            const auto t01 = level.at(i0, j1);
+            const auto t11 = level.at(i1, j1);
+
+            // The weights fold in the scale from bytes.
+            const auto w11 = fx * fy / 255.0;
+            const auto w01 = (1-fx) * fy / 255.0;
+            const auto w10 = fx * (1-fy) / 255.0;
+            const auto w00 = (1-fx) * (1-fy) / 255.0;
+            color result;
+            for (int c = 0; c < 3; c++) {
+                result[c] = w00*channel(t00, c) + w10*channel(t10, c) + w01*channel(t01, c)
+                          + w11*channel(t11, c);
+            }
+            return result;
+        }
+};
+
+
+class image_texture : public texture {
+    public:
+        image_texture() {}
+
+        image_texture(const char* filename) : image(mip_image::load(filename)) {}
+
+        image_texture(shared_ptr<const mip_image> image) : image(image) {}
+
+        virtual color value(real u, real v, const vec3& p) const {
+            return value(u, v, p, 0);
+        }
+
+        virtual color value(real u, real v, const vec3& p, real footprint) const {
+            // If we have no texture data, then return solid cyan as a debugging aid.
+            if (!image)
+                return color(0,1,1);
+            return image->lookup(u, v, footprint);
+        }
+
+        int width() const  { return image ? image->width() : 0; }
+        int height() const { return image ? image->height() : 0; }
+
     private:
-        unsigned char *data;
-        int width, height;
-        int bytes_per_scanline;
+        shared_ptr<const mip_image> image;
 };
 
 
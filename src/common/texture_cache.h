@@ -0,0 +1,187 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "texture.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+
+class texture_cache {
+    // Image textures shared by path and decoded on first lookup rather than at scene load.
+    // Every texture of a path shares one decoded mip_image. With a budget, decoding one more
+    // image first evicts the least recently used others until the resident images fit; an
+    // evicted image is decoded again the next time it is looked up.
+    //
+    // A lookup of a resident image takes no lock, only a count of the lookups in progress, which
+    // eviction waits out before freeing an image. Recency is only as fine as the decodes, which
+    // is all eviction needs: textures looked up since the last decode are all equally recent.
+    // The cache must outlive the textures it hands out.
+    public:
+        texture_cache(size_t budget_bytes = 0) : budget(budget_bytes) {}
+
+        // The one cache the scenes load through.
+        static texture_cache& global() {
+            static texture_cache cache;
+            return cache;
+        }
+
+        // The most memory decoded images may hold, or 0 for no limit. A single image larger
+        // than the budget still loads, alone.
+        void set_budget(size_t budget_bytes) {
+            std::lock_guard<std::mutex> guard(lock);
+            budget = budget_bytes;
+        }
+
+        // The texture for the image at path, which is the same texture every time.
+        shared_ptr<texture> get(const std::string& path);
+
+        // Only exact once lookups have stopped.
+        size_t resident_bytes() const { return resident; }
+        int decodes() const           { return decode_count; }
+        int evictions() const         { return eviction_count; }
+
+    private:
+        struct entry {
+            std::string path;
+            std::atomic<const mip_image*> image{nullptr};  // Null until decoded and once evicted
+            std::atomic<int> readers{0};                   // Lookups that may be using image
+            std::atomic<uint64_t> last_use{0};
+            shared_ptr<const mip_image> owned;
+            size_t bytes = 0;
+            bool failed = false;  // Decoding failed, and won't be tried again
+            shared_ptr<texture> handle;
+        };
+
+        class cached_texture : public texture {
+            public:
+                cached_texture(texture_cache* cache, entry* e) : cache(cache), e(e) {}
+
+                virtual color value(real u, real v, const vec3& p) const {
+                    return value(u, v, p, 0);
+                }
+
+                virtual color value(real u, real v, const vec3& p, real footprint) const {
+                    cache->touch(*e);
+                    while (true) {
+                        e->readers++;
+                        auto image = e->image.load();
+                        if (image) {
+                            auto result = image->lookup(u, v, footprint);
+                            e->readers--;
+                            return result;
+                        }
+                        e->readers--;
+
+                        // Solid cyan, as for an image_texture, if there is no image.
+                        if (!cache->decode(*e))
+                            return color(0,1,1);
+                    }
+                }
+
+            private:
+                texture_cache* cache;
+                entry* e;
+        };
+
+        std::mutex lock;
+        std::unordered_map<std::string, std::unique_ptr<entry>> entries;
+        size_t budget;
+        size_t resident = 0;
+        int decode_count = 0;
+        int eviction_count = 0;
+        std::atomic<uint64_t> clock{0};  // Advances with each decode
+
+        void touch(entry& e) {
+            const auto now = clock.load(std::memory_order_relaxed);
+            if (e.last_use.load(std::memory_order_relaxed) != now)
+                e.last_use.store(now, std::memory_order_relaxed);
+        }
+
+        bool decode(entry& e);
+        void evict(entry& e);
+};
+
+
+shared_ptr<texture> texture_cache::get(const std::string& path) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto& slot = entries[path];
+    if (!slot) {
+        slot.reset(new entry);
+        slot->path = path;
+        slot->handle = make_shared<cached_texture>(this, slot.get());
+    }
+    return slot->handle;
+}
+
+
+bool texture_cache::decode(entry& e) {
+    // Decodes one image at a time; lookups of resident images go on meanwhile.
+    std::lock_guard<std::mutex> guard(lock);
+    if (e.image.load())
+        return true;
+    if (e.failed)
+        return false;
+
+    auto decoded = mip_image::load(e.path.c_str());
+    if (!decoded) {
+        e.failed = true;
+        return false;
+    }
+    e.bytes = decoded->bytes();
+
+    while (budget > 0 && resident + e.bytes > budget) {
+        entry* oldest = nullptr;
+        for (auto& slot : entries) {
+            auto& other = *slot.second;
+            if (&other != &e && other.owned && (!oldest || other.last_use < oldest->last_use))
+                oldest = &other;
+        }
+        if (!oldest)
+            break;
+        evict(*oldest);
+    }
+
+    e.owned = decoded;
+    e.image.store(decoded.get());
+    resident += e.bytes;
+    decode_count++;
+    e.last_use = ++clock;
+    return true;
+}
+
+
+void texture_cache::evict(entry& e) {
+    // A lookup counts itself before it loads the pointer, so once the pointer is cleared and
+    // the count drops to zero, nobody can still be reading the image.
+    e.image.store(nullptr);
+    while (e.readers.load() > 0)
+        std::this_thread::yield();
+
+    e.owned.reset();
+    resident -= e.bytes;
+    eviction_count++;
+}
+
+
+// Shares and lazily decodes the image at path through the global texture cache.
+inline shared_ptr<texture> load_texture(const std::string& path) {
+    return texture_cache::global().get(path);
+}
+
+
+#endif
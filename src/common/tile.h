@@ -0,0 +1,20 @@
+#ifndef TILE_H
+#define TILE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+
+struct tile {
+    // A rectangle of pixels, the unit of work the renderers hand out and write.
+    int x0, y0;  // Lower corner, inclusive
+    int x1, y1;  // Upper corner, exclusive
+};
+
+
+#endif
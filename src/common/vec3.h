@@ -11,47 +11,71 @@
 // along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==============================================================================================
 
+#include "vec3_simd.h"
+
 #include <cmath>
 #include <iostream>
 
+#if defined(__SSE2__) || defined(_M_X64)
+    #define RTW_VEC3_HAVE_SSE 1
+    #include <immintrin.h>
+#endif
+
 using std::sqrt;
 
 class vec3 {
     public:
         vec3() : e{0,0,0} {}
-        vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+        vec3(real e0, real e1, real e2) : e{e0, e1, e2} {}
+
+#ifdef RTW_SIMD_VEC3
+        explicit vec3(const vec3_lanes& v) { v.store(e); }
+        vec3_lanes lanes() const { return vec3_lanes::load(e); }
+#endif
 
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
+        real x() const { return e[0]; }
+        real y() const { return e[1]; }
+        real z() const { return e[2]; }
 
+#ifdef RTW_SIMD_VEC3
+        vec3 operator-() const { return vec3(lanes().negated()); }
+#else
         vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        double operator[](int i) const { return e[i]; }
-        double& operator[](int i) { return e[i]; }
+#endif
+        real operator[](int i) const { return e[i]; }
+        real& operator[](int i) { return e[i]; }
 
         vec3& operator+=(const vec3 &v) {
+#ifdef RTW_SIMD_VEC3
+            (lanes() + v.lanes()).store(e);
+#else
             e[0] += v.e[0];
             e[1] += v.e[1];
             e[2] += v.e[2];
+#endif
             return *this;
         }
 
-        vec3& operator*=(const double t) {
+        vec3& operator*=(const real t) {
+#ifdef RTW_SIMD_VEC3
+            (lanes() * vec3_lanes::splat(t)).store(e);
+#else
             e[0] *= t;
             e[1] *= t;
             e[2] *= t;
+#endif
             return *this;
         }
 
-        vec3& operator/=(const double t) {
+        vec3& operator/=(const real t) {
             return *this *= 1/t;
         }
 
-        double length() const {
+        real length() const {
             return sqrt(length_squared());
         }
 
-        double length_squared() const {
+        real length_squared() const {
             return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
         }
 
@@ -79,12 +103,12 @@ class vec3 {
             return vec3(random_double(), random_double(), random_double());
         }
 
-        inline static vec3 random(double min, double max) {
+        inline static vec3 random(real min, real max) {
             return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
         }
 
     public:
-        double e[3];
+        RTW_VEC3_ALIGN real e[RTW_VEC3_LANES];
 };
 
 
@@ -99,6 +123,26 @@ inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
+#ifdef RTW_SIMD_VEC3
+
+inline vec3 operator+(const vec3 &u, const vec3 &v) {
+    return vec3(u.lanes() + v.lanes());
+}
+
+inline vec3 operator-(const vec3 &u, const vec3 &v) {
+    return vec3(u.lanes() - v.lanes());
+}
+
+inline vec3 operator*(const vec3 &u, const vec3 &v) {
+    return vec3(u.lanes() * v.lanes());
+}
+
+inline vec3 operator*(real t, const vec3 &v) {
+    return vec3(vec3_lanes::splat(t) * v.lanes());
+}
+
+#else
+
 inline vec3 operator+(const vec3 &u, const vec3 &v) {
     return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
@@ -111,57 +155,262 @@ inline vec3 operator*(const vec3 &u, const vec3 &v) {
     return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3 &v) {
+inline vec3 operator*(real t, const vec3 &v) {
     return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &v, double t) {
+#endif
+
+inline vec3 operator*(const vec3 &v, real t) {
     return t * v;
 }
 
-inline vec3 operator/(vec3 v, double t) {
+inline vec3 operator/(vec3 v, real t) {
     return (1/t) * v;
 }
 
-inline double dot(const vec3 &u, const vec3 &v) {
+inline real dot(const vec3 &u, const vec3 &v) {
+#ifdef RTW_SIMD_VEC3
+    const vec3 p(u.lanes() * v.lanes());
+    return p.e[0] + p.e[1] + p.e[2];
+#else
     return u.e[0] * v.e[0]
          + u.e[1] * v.e[1]
          + u.e[2] * v.e[2];
+#endif
 }
 
 inline vec3 cross(const vec3 &u, const vec3 &v) {
+#ifdef RTW_VEC3_SSE
+    auto a = u.lanes(), b = v.lanes();
+    return vec3((a * b.yzx() - a.yzx() * b).yzx());
+#else
     return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
                 u.e[2] * v.e[0] - u.e[0] * v.e[2],
                 u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+#endif
 }
 
 inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
-vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() >= 1) continue;
-        return p;
+// Sine and Cosine
+
+// Taylor coefficients past the first term, of sin(y)/y - 1 and cos(y) - 1 in powers of y^2.
+const real sin_terms[] = {
+    real(-1.0/6), real(1.0/120), real(-1.0/5040), real(1.0/362880), real(-1.0/39916800),
+    real(1.0/6227020800)
+};
+const real cos_terms[] = {
+    real(-1.0/2), real(1.0/24), real(-1.0/720), real(1.0/40320), real(-1.0/3628800),
+    real(1.0/479001600), real(-1.0/87178291200)
+};
+const int sin_term_count = 6, cos_term_count = 7;
+
+// Adding and then subtracting 1.5 * 2^(mantissa bits) rounds a value to the nearest integer,
+// ties to even, as the SIMD conversions do, without a call into the math library.
+#ifdef RTW_USE_FLOAT
+const real round_shift = 12582912.0f;
+#else
+const real round_shift = 6755399441055744.0;
+#endif
+
+inline void sin_cos(real x, real& s, real& c) {
+    // Both at once and without branches: x is reduced to [-pi/4, pi/4] around its nearest
+    // multiple of pi/2, where the polynomials hold to a few ulps, and the quadrant then swaps
+    // and negates them. Meant for angles within a few turns of zero, as samplers make.
+    const auto j = (x * static_cast<real>(0.63661977236758134308) + round_shift) - round_shift;
+    const auto q = static_cast<int>(j);
+    const auto y = x - j * (pi/2);
+    const auto y2 = y * y;
+
+    auto sin_sum = sin_terms[sin_term_count - 1];
+    for (int t = sin_term_count - 2; t >= 0; t--)
+        sin_sum = sin_terms[t] + y2 * sin_sum;
+    auto cos_sum = cos_terms[cos_term_count - 1];
+    for (int t = cos_term_count - 2; t >= 0; t--)
+        cos_sum = cos_terms[t] + y2 * cos_sum;
+    const auto sy = y + y*y2*sin_sum;
+    const auto cy = 1 + y2*cos_sum;
+
+    const auto sv = (q & 1) ? cy : sy;
+    const auto cv = (q & 1) ? sy : cy;
+    s = (q & 2) ? -sv : sv;
+    c = ((q + 1) & 2) ? -cv : cv;
+}
+
+void sin_cos(const real* x, real* s, real* c, int n) {
+    // The same arithmetic, in the same order, a register of angles at a time, so every lane
+    // comes out bit for bit as the scalar version does.
+    int k = 0;
+#if defined(RTW_VEC3_HAVE_SSE) && defined(RTW_USE_FLOAT)
+    for (; k + 4 <= n; k += 4) {
+        const auto xv = _mm_loadu_ps(x + k);
+        const auto j = _mm_cvtps_epi32(_mm_mul_ps(xv, _mm_set1_ps(0.63661977236758134308f)));
+        const auto y = _mm_sub_ps(xv, _mm_mul_ps(_mm_cvtepi32_ps(j), _mm_set1_ps(pi/2)));
+        const auto y2 = _mm_mul_ps(y, y);
+        auto horner = [&](const real* terms, int count) {
+            auto sum = _mm_set1_ps(terms[count - 1]);
+            for (int t = count - 2; t >= 0; t--)
+                sum = _mm_add_ps(_mm_set1_ps(terms[t]), _mm_mul_ps(y2, sum));
+            return sum;
+        };
+        const auto sin_sum = horner(sin_terms, sin_term_count);
+        const auto cos_sum = horner(cos_terms, cos_term_count);
+        const auto sy = _mm_add_ps(y, _mm_mul_ps(_mm_mul_ps(y, y2), sin_sum));
+        const auto cy = _mm_add_ps(_mm_set1_ps(1), _mm_mul_ps(y2, cos_sum));
+
+        const auto one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+        const auto odd = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, one), one));
+        const auto sv = _mm_or_ps(_mm_and_ps(odd, cy), _mm_andnot_ps(odd, sy));
+        const auto cv = _mm_or_ps(_mm_and_ps(odd, sy), _mm_andnot_ps(odd, cy));
+        const auto s_sign = _mm_slli_epi32(_mm_and_si128(j, two), 30);
+        const auto c_sign = _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(j, one), two), 30);
+        _mm_storeu_ps(s + k, _mm_xor_ps(sv, _mm_castsi128_ps(s_sign)));
+        _mm_storeu_ps(c + k, _mm_xor_ps(cv, _mm_castsi128_ps(c_sign)));
+    }
+#elif defined(RTW_VEC3_HAVE_SSE)
+    for (; k + 2 <= n; k += 2) {
+        const auto xv = _mm_loadu_pd(x + k);
+        const auto j32 = _mm_cvtpd_epi32(_mm_mul_pd(xv, _mm_set1_pd(0.63661977236758134308)));
+        const auto y = _mm_sub_pd(xv, _mm_mul_pd(_mm_cvtepi32_pd(j32), _mm_set1_pd(pi/2)));
+        const auto y2 = _mm_mul_pd(y, y);
+        auto horner = [&](const real* terms, int count) {
+            auto sum = _mm_set1_pd(terms[count - 1]);
+            for (int t = count - 2; t >= 0; t--)
+                sum = _mm_add_pd(_mm_set1_pd(terms[t]), _mm_mul_pd(y2, sum));
+            return sum;
+        };
+        const auto sin_sum = horner(sin_terms, sin_term_count);
+        const auto cos_sum = horner(cos_terms, cos_term_count);
+        const auto sy = _mm_add_pd(y, _mm_mul_pd(_mm_mul_pd(y, y2), sin_sum));
+        const auto cy = _mm_add_pd(_mm_set1_pd(1), _mm_mul_pd(y2, cos_sum));
+
+        // Each lane's quadrant, repeated in both halves of its 64 bits.
+        const auto j = _mm_shuffle_epi32(j32, _MM_SHUFFLE(1, 1, 0, 0));
+        const auto one = _mm_set1_epi32(1), two = _mm_set_epi32(0, 2, 0, 2);
+        const auto odd = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(j, one), one));
+        const auto sv = _mm_or_pd(_mm_and_pd(odd, cy), _mm_andnot_pd(odd, sy));
+        const auto cv = _mm_or_pd(_mm_and_pd(odd, sy), _mm_andnot_pd(odd, cy));
+        const auto s_sign = _mm_slli_epi64(_mm_and_si128(j, two), 62);
+        const auto c_sign = _mm_slli_epi64(_mm_and_si128(_mm_add_epi32(j, one), two), 62);
+        _mm_storeu_pd(s + k, _mm_xor_pd(sv, _mm_castsi128_pd(s_sign)));
+        _mm_storeu_pd(c + k, _mm_xor_pd(cv, _mm_castsi128_pd(c_sign)));
     }
+#endif
+    for (; k < n; k++)
+        sin_cos(x[k], s[k], c[k]);
+}
+
+// Sampling
+//
+// Maps from uniform values in [0,1) to the shapes the random functions sample, with no
+// rejection loops or branches, so that each takes a fixed count of values and keeps the
+// stratification of values from a sample sequence. The batch forms fill out[0, n).
+
+vec3 square_to_unit_disk(real u, real v) {
+    // Shirley and Chiu's concentric map, which takes nested squares to nested rings.
+    const auto a = 2*u - 1;
+    const auto b = 2*v - 1;
+    const bool wide = a*a > b*b;
+    const auto r = wide ? a : b;
+    const auto ratio = r == 0 ? 0 : (wide ? b : a) / r;
+    const auto phi = wide ? (pi/4) * ratio : pi/2 - (pi/4) * ratio;
+
+    real s, c;
+    sin_cos(phi, s, c);
+    return vec3(r*c, r*s, 0);
+}
+
+vec3 square_to_unit_vector(real u, real v) {
+    const auto z = 1 - 2*v;
+    const auto r = sqrt(fmax(real(0), 1 - z*z));
+
+    real s, c;
+    sin_cos(2*pi*u, s, c);
+    return vec3(r*c, r*s, z);
+}
+
+vec3 cube_to_unit_ball(real u, real v, real w) {
+    return std::cbrt(w) * square_to_unit_vector(u, v);
+}
+
+void square_to_unit_vector(const real* u, const real* v, vec3* out, int n) {
+    const int chunk = 64;
+    real angle[chunk], s[chunk], c[chunk];
+
+    for (int first = 0; first < n; first += chunk) {
+        const int count = n - first < chunk ? n - first : chunk;
+        for (int k = 0; k < count; k++)
+            angle[k] = 2*pi*u[first + k];
+        sin_cos(angle, s, c, count);
+
+        for (int k = 0; k < count; k++) {
+            const auto z = 1 - 2*v[first + k];
+            const auto r = sqrt(fmax(real(0), 1 - z*z));
+            out[first + k] = vec3(r*c[k], r*s[k], z);
+        }
+    }
+}
+
+vec3 random_in_unit_disk() {
+    const auto u = random_double();
+    return square_to_unit_disk(u, random_double());
 }
 
 vec3 random_unit_vector() {
-    auto a = random_double(0, 2*pi);
-    auto z = random_double(-1, 1);
-    auto r = sqrt(1 - z*z);
-    return vec3(r*cos(a), r*sin(a), z);
+    const auto u = random_double();
+    return square_to_unit_vector(u, random_double());
 }
 
 vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = vec3::random(-1,1);
-        if (p.length_squared() >= 1) continue;
-        return p;
+    const auto u = random_double();
+    const auto v = random_double();
+    return cube_to_unit_ball(u, v, random_double());
+}
+
+void random_in_unit_disk(vec3* out, int n) {
+    const int chunk = 64;
+    real r[chunk], phi[chunk], s[chunk], c[chunk];
+
+    for (int first = 0; first < n; first += chunk) {
+        const int count = n - first < chunk ? n - first : chunk;
+        for (int k = 0; k < count; k++) {
+            const auto a = 2*random_double() - 1;
+            const auto b = 2*random_double() - 1;
+            const bool wide = a*a > b*b;
+            r[k] = wide ? a : b;
+            const auto ratio = r[k] == 0 ? 0 : (wide ? b : a) / r[k];
+            phi[k] = wide ? (pi/4) * ratio : pi/2 - (pi/4) * ratio;
+        }
+        sin_cos(phi, s, c, count);
+
+        for (int k = 0; k < count; k++)
+            out[first + k] = vec3(r[k]*c[k], r[k]*s[k], 0);
     }
 }
 
+void random_unit_vector(vec3* out, int n) {
+    const int chunk = 64;
+    real u[chunk], v[chunk];
+
+    for (int first = 0; first < n; first += chunk) {
+        const int count = n - first < chunk ? n - first : chunk;
+        for (int k = 0; k < count; k++) {
+            u[k] = random_double();
+            v[k] = random_double();
+        }
+        square_to_unit_vector(u, v, out + first, count);
+    }
+}
+
+void random_in_unit_sphere(vec3* out, int n) {
+    random_unit_vector(out, n);
+    for (int k = 0; k < n; k++)
+        out[k] = std::cbrt(random_double()) * out[k];
+}
+
 vec3 random_in_hemisphere(const vec3& normal) {
     vec3 in_unit_sphere = random_in_unit_sphere();
     if (dot(in_unit_sphere, normal) > 0.0) // In the same hemisphere as the normal
@@ -174,7 +423,7 @@ vec3 reflect(const vec3& v, const vec3& n) {
     return v - 2*dot(v,n)*n;
 }
 
-vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
+vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
     auto cos_theta = fmin(dot(-uv, n), 1.0);
     vec3 r_out_parallel =  etai_over_etat * (uv + cos_theta*n);
     vec3 r_out_perp = -sqrt(1.0 - r_out_parallel.length_squared()) * n;
@@ -0,0 +1,166 @@
+#ifndef VEC3_SIMD_H
+#define VEC3_SIMD_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Configure with -DRTW_SIMD_VEC3=ON to pad vec3 to four lanes, aligned to 16 bytes, and do its
+// arithmetic with whole-register SSE, AVX or NEON instructions. The fourth lane is padding and
+// is never read back. Without a matching instruction set a plain four-lane loop is used.
+//
+// 32-byte alignment would suit AVX doubles better, but C++11 allocators only promise 16 bytes,
+// so the AVX path uses unaligned loads instead.
+
+#ifdef RTW_SIMD_VEC3
+
+#if defined(RTW_USE_FLOAT) && (defined(__SSE__) || defined(_M_X64))
+    #define RTW_VEC3_SSE 1
+    #include <immintrin.h>
+#elif !defined(RTW_USE_FLOAT) && defined(__AVX__)
+    #define RTW_VEC3_AVX 1
+    #include <immintrin.h>
+#elif !defined(RTW_USE_FLOAT) && (defined(__SSE2__) || defined(_M_X64))
+    #define RTW_VEC3_SSE2 1
+    #include <immintrin.h>
+#elif defined(RTW_USE_FLOAT) && defined(__ARM_NEON)
+    #define RTW_VEC3_NEON 1
+    #include <arm_neon.h>
+#elif !defined(RTW_USE_FLOAT) && defined(__ARM_NEON) && defined(__aarch64__)
+    #define RTW_VEC3_NEON64 1
+    #include <arm_neon.h>
+#endif
+
+#define RTW_VEC3_LANES 4
+#define RTW_VEC3_ALIGN alignas(16)
+
+
+struct vec3_lanes {
+    // The four lanes of a vec3 held in registers. Loads and stores go through the vec3's own
+    // array; once inlined, the compiler keeps chains of operations in registers.
+
+#if defined(RTW_VEC3_SSE)
+
+    __m128 v;
+
+    static vec3_lanes load(const real* p) { return vec3_lanes{_mm_load_ps(p)}; }
+    static vec3_lanes splat(real t)       { return vec3_lanes{_mm_set1_ps(t)}; }
+    void store(real* p) const             { _mm_store_ps(p, v); }
+
+    friend vec3_lanes operator+(vec3_lanes a, vec3_lanes b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend vec3_lanes operator-(vec3_lanes a, vec3_lanes b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend vec3_lanes operator*(vec3_lanes a, vec3_lanes b) { return {_mm_mul_ps(a.v, b.v)}; }
+
+    // Flips the sign bits, as scalar negation does, so zeros change sign too.
+    vec3_lanes negated() const { return {_mm_xor_ps(v, _mm_set1_ps(-0.0f))}; }
+
+    // Rotates (x,y,z,w) to (y,z,x,w), the shuffle cross products are built from.
+    vec3_lanes yzx() const { return {_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1))}; }
+
+#elif defined(RTW_VEC3_AVX)
+
+    __m256d v;
+
+    static vec3_lanes load(const real* p) { return vec3_lanes{_mm256_loadu_pd(p)}; }
+    static vec3_lanes splat(real t)       { return vec3_lanes{_mm256_set1_pd(t)}; }
+    void store(real* p) const             { _mm256_storeu_pd(p, v); }
+
+    friend vec3_lanes operator+(vec3_lanes a, vec3_lanes b) { return {_mm256_add_pd(a.v, b.v)}; }
+    friend vec3_lanes operator-(vec3_lanes a, vec3_lanes b) { return {_mm256_sub_pd(a.v, b.v)}; }
+    friend vec3_lanes operator*(vec3_lanes a, vec3_lanes b) { return {_mm256_mul_pd(a.v, b.v)}; }
+
+    vec3_lanes negated() const { return {_mm256_xor_pd(v, _mm256_set1_pd(-0.0))}; }
+
+#elif defined(RTW_VEC3_SSE2)
+
+    __m128d lo, hi;
+
+    static vec3_lanes load(const real* p) { return vec3_lanes{_mm_load_pd(p), _mm_load_pd(p+2)}; }
+    static vec3_lanes splat(real t)       { return vec3_lanes{_mm_set1_pd(t), _mm_set1_pd(t)}; }
+    void store(real* p) const             { _mm_store_pd(p, lo); _mm_store_pd(p+2, hi); }
+
+    friend vec3_lanes operator+(vec3_lanes a, vec3_lanes b) {
+        return {_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)};
+    }
+    friend vec3_lanes operator-(vec3_lanes a, vec3_lanes b) {
+        return {_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)};
+    }
+    friend vec3_lanes operator*(vec3_lanes a, vec3_lanes b) {
+        return {_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)};
+    }
+
+    vec3_lanes negated() const {
+        const auto sign = _mm_set1_pd(-0.0);
+        return {_mm_xor_pd(lo, sign), _mm_xor_pd(hi, sign)};
+    }
+
+#elif defined(RTW_VEC3_NEON)
+
+    float32x4_t v;
+
+    static vec3_lanes load(const real* p) { return vec3_lanes{vld1q_f32(p)}; }
+    static vec3_lanes splat(real t)       { return vec3_lanes{vdupq_n_f32(t)}; }
+    void store(real* p) const             { vst1q_f32(p, v); }
+
+    friend vec3_lanes operator+(vec3_lanes a, vec3_lanes b) { return {vaddq_f32(a.v, b.v)}; }
+    friend vec3_lanes operator-(vec3_lanes a, vec3_lanes b) { return {vsubq_f32(a.v, b.v)}; }
+    friend vec3_lanes operator*(vec3_lanes a, vec3_lanes b) { return {vmulq_f32(a.v, b.v)}; }
+
+    vec3_lanes negated() const { return {vnegq_f32(v)}; }
+
+#elif defined(RTW_VEC3_NEON64)
+
+    float64x2_t lo, hi;
+
+    static vec3_lanes load(const real* p) { return vec3_lanes{vld1q_f64(p), vld1q_f64(p+2)}; }
+    static vec3_lanes splat(real t)       { return vec3_lanes{vdupq_n_f64(t), vdupq_n_f64(t)}; }
+    void store(real* p) const             { vst1q_f64(p, lo); vst1q_f64(p+2, hi); }
+
+    friend vec3_lanes operator+(vec3_lanes a, vec3_lanes b) {
+        return {vaddq_f64(a.lo, b.lo), vaddq_f64(a.hi, b.hi)};
+    }
+    friend vec3_lanes operator-(vec3_lanes a, vec3_lanes b) {
+        return {vsubq_f64(a.lo, b.lo), vsubq_f64(a.hi, b.hi)};
+    }
+    friend vec3_lanes operator*(vec3_lanes a, vec3_lanes b) {
+        return {vmulq_f64(a.lo, b.lo), vmulq_f64(a.hi, b.hi)};
+    }
+
+    vec3_lanes negated() const { return {vnegq_f64(lo), vnegq_f64(hi)}; }
+
+#else
+
+    real v[4];
+
+    static vec3_lanes load(const real* p) { return vec3_lanes{{p[0], p[1], p[2], p[3]}}; }
+    static vec3_lanes splat(real t)       { return vec3_lanes{{t, t, t, t}}; }
+    void store(real* p) const             { for (int i = 0; i < 4; i++) p[i] = v[i]; }
+
+    friend vec3_lanes operator+(vec3_lanes a, vec3_lanes b) {
+        return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+    }
+    friend vec3_lanes operator-(vec3_lanes a, vec3_lanes b) {
+        return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+    }
+    friend vec3_lanes operator*(vec3_lanes a, vec3_lanes b) {
+        return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+    }
+
+    vec3_lanes negated() const { return {{-v[0], -v[1], -v[2], -v[3]}}; }
+
+#endif
+};
+
+#else
+
+#define RTW_VEC3_LANES 3
+#define RTW_VEC3_ALIGN
+
+#endif
+
+
+#endif
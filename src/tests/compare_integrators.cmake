@@ -0,0 +1,26 @@
+#---------------------------------------------------------------------------------------------------
+# Renders a scene with theNextWeek's iterative and wavefront integrators and fails unless the two
+# images are identical, as they are for scenes without media. Run by ctest:
+#
+#   cmake -DRENDERER=<theNextWeek> -DSCENE=<name> -DSAMPLER=<name> -DOUTPUT_DIR=<dir>
+#         -P compare_integrators.cmake
+#---------------------------------------------------------------------------------------------------
+
+foreach ( integrator iterative wavefront )
+  set ( image "${OUTPUT_DIR}/${SCENE}_${SAMPLER}_${integrator}.pfm" )
+  execute_process (
+    COMMAND "${RENDERER}" --scene ${SCENE} --sampler ${SAMPLER} --integrator ${integrator}
+            --width 64 --spp 8 --adaptive false --output "${image}"
+    RESULT_VARIABLE result
+    ERROR_QUIET
+  )
+  if ( NOT result EQUAL 0 )
+    message ( FATAL_ERROR "${integrator} render of ${SCENE} failed: ${result}" )
+  endif()
+  file ( SHA256 "${image}" hash_${integrator} )
+endforeach()
+
+if ( NOT hash_iterative STREQUAL hash_wavefront )
+  message ( FATAL_ERROR
+    "wavefront and iterative renders of ${SCENE} with --sampler ${SAMPLER} differ" )
+endif()
@@ -0,0 +1,71 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Sums the sample buffers written by the nodes of a distributed render, or by progressive
+// checkpoints, and writes the result. An output name ending in .png, .ppm, .pfm or .exr gets the
+// image in that format; any other name gets another sample buffer, so merges can be done in
+// stages.
+//
+//     rtw_merge final.png test.node0.fb test.node1.fb ...
+
+#include "rtweekend.h"
+
+#include "framebuffer.h"
+#include "image_output.h"
+
+#include <iostream>
+#include <string>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "external/stb_image_write.h"
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0]
+            << " <output.png | .ppm | .pfm | .exr | .fb> <input.fb>...\n";
+        return 1;
+    }
+
+    const std::string output = argv[1];
+    framebuffer total;
+
+    for (int a = 2; a < argc; ++a) {
+        framebuffer part;
+        if (!part.read_checkpoint(argv[a])) {
+            std::cerr << "Could not read sample buffer " << argv[a] << '\n';
+            return 1;
+        }
+
+        if (a == 2) {
+            total = std::move(part);
+        } else if (!total.merge(part)) {
+            std::cerr << argv[a] << " is " << part.width() << 'x' << part.height()
+                << ", not " << total.width() << 'x' << total.height() << '\n';
+            return 1;
+        }
+    }
+
+    bool written;
+    if (has_extension(output, ".png") || has_extension(output, ".ppm")
+        || has_extension(output, ".pfm") || has_extension(output, ".exr")) {
+        written = make_image_output(output, total.width(), total.height())->finish(total);
+    } else {
+        written = total.write_checkpoint(output);
+    }
+
+    if (!written) {
+        std::cerr << "Could not write " << output << '\n';
+        return 1;
+    }
+
+    std::cerr << "Merged " << argc - 2 << " buffers, "
+        << double(total.total_samples()) / (double(total.width()) * total.height())
+        << " samples per pixel on average.\n";
+}